@@ -58,9 +58,21 @@
 /* Define to 1 if you have the <syslog.h> header file. */
 #cmakedefine HAVE_SYSLOG_H 1
 
+/* Define to 1 if you have the <sys/epoll.h> header file. */
+#cmakedefine HAVE_SYS_EPOLL_H 1
+
 /* Define to 1 if you have the <sys/ioctl.h> header file. */
 #cmakedefine HAVE_SYS_IOCTL_H 1
 
+/* Define to 1 if you have the <sys/sendfile.h> header file. */
+#cmakedefine HAVE_SYS_SENDFILE_H 1
+
+/* Define to 1 if you have the `recvmmsg' function. */
+#cmakedefine HAVE_RECVMMSG 1
+
+/* Define to 1 if you have the `sendmmsg' function. */
+#cmakedefine HAVE_SENDMMSG 1
+
 /* Define to 1 if you have the <sys/socket.h> header file. */
 #cmakedefine HAVE_SYS_SOCKET_H 1
 
@@ -164,6 +176,26 @@
 #define UPNP_HAVE_WEBSERVER ENABLE_WEBSERVER
 #endif
 
+#cmakedefine ENABLE_EPOLL 1
+#if defined(ENABLE_EPOLL) && defined(HAVE_SYS_EPOLL_H)
+#define UPNP_ENABLE_EPOLL 1
+#endif
+
+#cmakedefine ENABLE_SENDFILE 1
+#if defined(ENABLE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+#define UPNP_ENABLE_SENDFILE 1
+#endif
+
+#cmakedefine ENABLE_SENDMMSG 1
+#if defined(ENABLE_SENDMMSG) && defined(HAVE_SENDMMSG)
+#define UPNP_ENABLE_SENDMMSG 1
+#endif
+
+#cmakedefine ENABLE_RECVMMSG 1
+#if defined(ENABLE_RECVMMSG) && defined(HAVE_RECVMMSG)
+#define UPNP_ENABLE_RECVMMSG 1
+#endif
+
 #ifdef UPNP_USE_MSVCPP
 typedef unsigned long off_t
 #define strdup _strdup
@@ -20,7 +20,9 @@ check_include_files("strings.h" HAVE_STRINGS_H)
 check_include_files("string.h" HAVE_STRING_H)
 check_include_files("string.h" HAVE_STRNDUP)
 check_include_files("syslog.h" HAVE_SYSLOG_H)
+check_include_files("sys/epoll.h" HAVE_SYS_EPOLL_H)
 check_include_files("sys/ioctl.h" HAVE_SYS_IOCTL_H)
+check_include_files("sys/sendfile.h" HAVE_SYS_SENDFILE_H)
 check_include_files("sys/socket.h" HAVE_SYS_SOCKET_H)
 check_include_files("winsock2.h" HAVE_WIN_SOCKET_H)
 check_include_files("sys/stat.h" HAVE_SYS_STAT_H)
@@ -34,4 +36,8 @@ check_function_exists("fseeko;ftello" HAVE_FSEEKO)
 check_function_exists("strndup" HAVE_STRNDUP)
 check_function_exists("strnlen" HAVE_STRNLEN)
 check_function_exists("vprintf" HAVE_VPRINTF)
-check_function_exists("_doprnt" HAVE_DOPRNT)
\ No newline at end of file
+check_function_exists("_doprnt" HAVE_DOPRNT)
+set(CMAKE_REQUIRED_DEFINITIONS -D_GNU_SOURCE)
+check_symbol_exists(sendmmsg "sys/socket.h" HAVE_SENDMMSG)
+check_symbol_exists(recvmmsg "sys/socket.h" HAVE_RECVMMSG)
+unset(CMAKE_REQUIRED_DEFINITIONS)
\ No newline at end of file
@@ -15,3 +15,7 @@ option(ENABLE_OPT_SSDP "optionnal SSDP headers support" ON)
 option(ENABLE_SSDP "SSDP part" ON)
 option(ENABLE_TOOLS "helper APIs in upnptools.h" ON)
 option(ENABLE_WEBSERVER "integrated web server" ON)
+option(ENABLE_EPOLL "use epoll for the miniserver event loop when available" ON)
+option(ENABLE_SENDFILE "use sendfile for web server file responses when available" ON)
+option(ENABLE_SENDMMSG "use sendmmsg to send batches of SSDP packets when available" ON)
+option(ENABLE_RECVMMSG "use recvmmsg to read batches of SSDP packets when available" ON)
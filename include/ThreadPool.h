@@ -102,6 +102,18 @@ typedef enum priority {
 /*! default priority used by TPJobInit */
 #define DEFAULT_PRIORITY MED_PRIORITY
 
+/*! Job scheduling strategy of a thread pool. */
+typedef enum scheduler {
+	/*! All the jobs are kept in three shared priority queues protected by
+	 * the pool mutex. */
+	SHARED_QUEUE_SCHEDULER,
+	/*! Every worker owns lock free priority queues, idle workers steal
+	 * from the others and a single idle worker is woken per job. Only
+	 * available when the library is built with C11 atomics, otherwise
+	 * the shared queue scheduler is used. */
+	WORK_STEALING_SCHEDULER
+} SchedulerType;
+
 /*! default minimum used by TPAttrInit */
 #define DEFAULT_MIN_THREADS 1
 
@@ -126,6 +138,9 @@ typedef enum priority {
 /*! default max jobs used TPAttrInit */
 #define DEFAULT_MAX_JOBS_TOTAL 100
 
+/*! default scheduler used by TPAttrInit */
+#define DEFAULT_SCHEDULER SHARED_QUEUE_SCHEDULER
+
 /*!
  * \brief Statistics.
  *
@@ -165,6 +180,8 @@ typedef struct THREADPOOLATTR {
 	int starvationTime;
 	/*! scheduling policy to use. */
 	PolicyType schedPolicy;
+	/*! job scheduling strategy, fixed when the pool is initialized. */
+	SchedulerType scheduler;
 } ThreadPoolAttr;
 
 /*! Internal ThreadPool Job. */
@@ -248,6 +265,9 @@ EXPORT_SPEC typedef struct THREADPOOL {
 	ThreadPoolAttr attr;
 	/*! statistics */
 	ThreadPoolStats stats;
+	/*! state of the work stealing scheduler, NULL with the shared queue
+	 * scheduler. */
+	struct ws_scheduler *ws;
 } ThreadPool;
 
 /*!
@@ -277,6 +297,7 @@ EXPORT_SPEC int ThreadPoolInit(
 	 * than this number,and if less than the maximum number of workers are
 	 * running then a new thread is started to help out with efficiency.
 	 * \li \c schedPolicy - scheduling policy to try and set (OS dependent).
+	 * \li \c scheduler - job scheduling strategy.
 	 */
 	ThreadPoolAttr *attr);
 
@@ -488,6 +509,21 @@ EXPORT_SPEC int TPAttrSetSchedPolicy(
 	/*! must be a valid policy type. */
 	PolicyType schedPolicy);
 
+/*!
+ * \brief Sets the job scheduling strategy for the thread pool attributes.
+ *
+ * The work stealing scheduler needs a finite maxThreads and maxJobsTotal,
+ * the shared queue scheduler is used otherwise. The strategy of a running
+ * pool is not changed by ThreadPoolSetAttr().
+ *
+ * \return Always returns 0.
+ */
+EXPORT_SPEC int TPAttrSetScheduler(
+	/*! must be valid thread pool attributes. */
+	ThreadPoolAttr *attr,
+	/*! scheduling strategy. */
+	SchedulerType scheduler);
+
 /*!
  * \brief Sets the maximum number jobs that can be qeued totally.
  *
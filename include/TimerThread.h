@@ -58,17 +58,30 @@ typedef enum timeoutType {
 /*!
  * A timer thread similar to the one in the Upnp SDK that allows
  * the scheduling of a job to run at a specified time in the future.
- *
  * Because the timer thread uses the thread pool there is no 
  * gurantee of timing, only approximate timing.
  *
+ * Pending events are kept in a binary min-heap ordered by their deadline on
+ * the monotonic clock, with a hash index by event id, so scheduling and
+ * removal are O(log n) and wall clock changes do not shift the events.
  * Uses ThreadPool, Mutex, Condition, Thread.
  */
 EXPORT_SPEC typedef struct TIMERTHREAD {
 	ithread_mutex_t mutex;
 	ithread_cond_t condition;
 	int lastEventId;
-	LinkedList eventQ;
+	/*! Min-heap of the pending events, the next event is heap[0]. */
+	struct TIMEREVENT **heap;
+	/*! Number of events in the heap. */
+	size_t heapSize;
+	/*! Allocated size of the heap. */
+	size_t heapCapacity;
+	/*! Hash buckets indexing the pending events by id. */
+	struct TIMEREVENT **index;
+	/*! Number of buckets in the index, a power of two. */
+	size_t indexSize;
+	/*! Nonzero if condition is bound to the monotonic clock. */
+	int monotonicCond;
 	int shutdown;
 	FreeList freeEvents;
 	ThreadPool *tp;
@@ -76,16 +89,19 @@ EXPORT_SPEC typedef struct TIMERTHREAD {
 
 /*!
  * Struct to contain information for a timer event.
- *
  * Internal to the TimerThread.
  */
 typedef struct TIMEREVENT {
 	ThreadPoolJob job;
-	/*! [in] Absolute time for event in seconds since Jan 1, 1970. */
-	time_t eventTime;
+	/*! [in] Time of the event in milliseconds on the monotonic clock. */
+	long long eventTime;
 	/*! [in] Long term or short term job. */
 	Duration persistent;
 	int id;
+	/*! Position of the event in the heap. */
+	size_t heapPos;
+	/*! Next event in the same index bucket. */
+	struct TIMEREVENT *indexNext;
 } TimerEvent;
 
 /*!
@@ -123,6 +139,24 @@ EXPORT_SPEC int TimerThreadSchedule(
 	/*! [in] Id of timer event. (out, can be null). */
 	int *id);
 
+/*!
+ * \brief Schedules an event to run after a delay in milliseconds.
+ * \return 0 on success, nonzero on failure, EOUTOFMEM if not enough memory
+ * 	to schedule job.
+ */
+EXPORT_SPEC int TimerThreadScheduleMs(
+	/*! [in] Valid timer thread pointer. */
+	TimerThread *timer,
+	/*! [in] Delay of the event in milliseconds from the current time,
+	 * zero or negative to run it as soon as possible. */
+	long timeoutMs,
+	/*! [in] Valid Thread pool job with following fields. */
+	ThreadPoolJob *job,
+	/*! [in] . */
+	Duration duration,
+	/*! [in] Id of timer event. (out, can be null). */
+	int *id);
+
 /*!
  * \brief Removes an event from the timer Q.
  *
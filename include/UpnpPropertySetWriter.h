@@ -0,0 +1,106 @@
+#ifndef UPNPPROPERTYSETWRITER_H
+#define UPNPPROPERTYSETWRITER_H
+
+
+/*!
+ * \defgroup UpnpPropertySetWriter The UpnpPropertySetWriter Class
+ *
+ * \brief Writes the property set of an event directly as text, without
+ * building a DOM document.
+ *
+ * The writer keeps its buffer across events: clear it and add the variables
+ * of the next event, then send it with \b UpnpNotifyPropertySet or
+ * \b UpnpAcceptSubscriptionPropertySet.
+ *
+ * @{
+ *
+ * \file
+ *
+ * \brief UpnpPropertySetWriter object declaration.
+ */
+
+
+#include "UpnpGlobal.h" /* for EXPORT_SPEC */
+
+#include <stdlib.h> /* for size_t */
+
+#ifdef __cplusplus
+extern "C" {
+#endif /* __cplusplus */
+
+/*!
+ * \brief Type of the property set writers.
+ */
+typedef struct s_UpnpPropertySetWriter UpnpPropertySetWriter;
+
+
+/*!
+ * \brief Constructor, the property set has no variable.
+ *
+ * \return A pointer to a new writer, or NULL if out of memory.
+ */
+EXPORT_SPEC UpnpPropertySetWriter *UpnpPropertySetWriter_new(void);
+
+
+/*!
+ * \brief Destructor.
+ */
+EXPORT_SPEC void UpnpPropertySetWriter_delete(
+	/*! [in] The \em \b this pointer. */
+	UpnpPropertySetWriter *p);
+
+
+/*!
+ * \brief Removes all the variables, keeping the memory for the next ones.
+ */
+EXPORT_SPEC void UpnpPropertySetWriter_clear(
+	/*! [in] The \em \b this pointer. */
+	UpnpPropertySetWriter *p);
+
+
+/*!
+ * \brief Adds a state variable to the property set.
+ *
+ * The characters of the value that are special in XML are escaped; the name
+ * is written as is.
+ *
+ * \return UPNP_E_SUCCESS, UPNP_E_INVALID_PARAM if a parameter is NULL, or
+ * 	UPNP_E_OUTOF_MEMORY.
+ */
+EXPORT_SPEC int UpnpPropertySetWriter_add(
+	/*! [in] The \em \b this pointer. */
+	UpnpPropertySetWriter *p,
+	/*! [in] The name of the variable. */
+	const char *VarName,
+	/*! [in] The value of the variable. */
+	const char *Value);
+
+
+/*!
+ * \brief Returns the property set.
+ *
+ * \return The property set, a complete XML document.
+ */
+EXPORT_SPEC const char *UpnpPropertySetWriter_get_String(
+	/*! [in] The \em \b this pointer. */
+	const UpnpPropertySetWriter *p);
+
+
+/*!
+ * \brief Returns the length of the property set.
+ *
+ * \return The length of the property set.
+ */
+EXPORT_SPEC size_t UpnpPropertySetWriter_get_Length(
+	/*! [in] The \em \b this pointer. */
+	const UpnpPropertySetWriter *p);
+
+#ifdef __cplusplus
+}
+#endif /* __cplusplus */
+
+
+/* @} UpnpPropertySetWriter The UpnpPropertySetWriter API */
+
+
+#endif /* UPNPPROPERTYSETWRITER_H */
@@ -0,0 +1,210 @@
+#ifndef UPNP_AUTOCONFIG_H
+#define UPNP_AUTOCONFIG_H
+
+/* Define to 1 if you have the <stddef.h> header file. */
+#define HAVE_STDDEF_H 1
+
+/* Define to 1 if you have the <arpa/inet.h> header file. */
+#define HAVE_ARPA_INET_H 1
+
+/* Define to 1 if you have the <dlfcn.h> header file. */
+#define HAVE_DLFCN_H 1
+
+/* Define to 1 if you don't have `vprintf' but do have `_doprnt.' */
+/* #undef HAVE_DOPRNT */
+
+/* Define to 1 if you have the <fcntl.h> header file. */
+#define HAVE_FCNTL_H 1
+
+/* Define to 1 if fseeko (and presumably ftello) exists and is declared. */
+#define HAVE_FSEEKO 1
+
+/* Define to 1 if you have the <inttypes.h> header file. */
+#define HAVE_INTTYPES_H 1
+
+/* Define to 1 if you have the <limits.h> header file. */
+#define HAVE_LIMITS_H 1
+
+/* Define to 1 if you have the <memory.h> header file. */
+#define HAVE_MEMORY_H 1
+
+/* Define to 1 if you have the <netdb.h> header file. */
+#define HAVE_NETDB_H 1
+
+/* Define to 1 if you have the <netinet/in.h> header file. */
+#define HAVE_NETINET_IN_H 1
+
+/* Define if you have POSIX threads libraries and header files. */
+#define HAVE_PTHREAD 1
+
+/* Define to 1 if you have the <stdint.h> header file. */
+#define HAVE_STDINT_H 1
+
+/* Define to 1 if you have the <stdlib.h> header file. */
+#define HAVE_STDLIB_H 1
+
+/* Define to 1 if you have the <strings.h> header file. */
+#define HAVE_STRINGS_H 1
+
+/* Define to 1 if you have the <string.h> header file. */
+#define HAVE_STRING_H 1
+
+/* Defines if strndup is available on your system */
+#define HAVE_STRNDUP 1
+
+/* Defines if strnlen is available on your system */
+#define HAVE_STRNLEN 1
+
+/* Define to 1 if you have the <syslog.h> header file. */
+#define HAVE_SYSLOG_H 1
+
+/* Define to 1 if you have the <sys/epoll.h> header file. */
+#define HAVE_SYS_EPOLL_H 1
+
+/* Define to 1 if you have the <sys/ioctl.h> header file. */
+#define HAVE_SYS_IOCTL_H 1
+
+/* Define to 1 if you have the <sys/sendfile.h> header file. */
+#define HAVE_SYS_SENDFILE_H 1
+
+/* Define to 1 if you have the `recvmmsg' function. */
+#define HAVE_RECVMMSG 1
+
+/* Define to 1 if you have the `sendmmsg' function. */
+#define HAVE_SENDMMSG 1
+
+/* Define to 1 if you have the <sys/socket.h> header file. */
+#define HAVE_SYS_SOCKET_H 1
+
+/* Define to 1 if you have the <w32api/winsock2.h> header file. */
+/* #undef HAVE_WIN_SOCKET_H */
+
+/* Define to 1 if you have the <sys/stat.h> header file. */
+#define HAVE_SYS_STAT_H 1
+
+/* Define to 1 if you have the <sys/time.h> header file. */
+#define HAVE_SYS_TIME_H 1
+
+/* Define to 1 if you have the <sys/types.h> header file. */
+#define HAVE_SYS_TYPES_H 1
+
+/* Define to 1 if you have the <unistd.h> header file. */
+#define HAVE_UNISTD_H 1
+
+/* Define to 1 if you have the `vprintf' function. */
+/* #undef HAVE_VPRINTF */
+
+/* Define to 1 if you have the <ws2tcpip.h> header file. */
+/* #undef HAVE_WS2TCPIP_H */
+
+/* #undef ENABLE_STATIC */
+#ifndef ENABLE_STATIC
+	#define LIBUPNP_EXPORTS 1 // shared lib export
+#else
+	#define UPNP_STATIC_LIB 1 // static lib
+#endif
+
+/* #undef ENABLE_DEBUG */
+#ifdef ENABLE_DEBUG
+	#define UPNP_HAVE_DEBUG ENABLE_DEBUG
+#endif
+
+/* #undef ENABLE_OPENSSL */
+#ifdef ENABLE_OPENSSL
+	#define UPNP_ENABLE_OPEN_SSL ENABLE_OPENSSL
+#endif
+
+/* #undef ENABLE_BLOCKING_TCP */
+#ifdef ENABLE_BLOCKING_TCP
+#define UPNP_ENABLE_BLOCKING_TCP_CONNECTIONS ENABLE_BLOCKING_TCP
+#endif
+
+// default false
+/* #undef ENABLE_IPV6 */
+#ifdef ENABLE_IPV6
+#define UPNP_ENABLE_IPV6 ENABLE_IPV6
+#endif
+
+// default false
+/* #undef ENABLE_POST_WRITE */
+#ifdef ENABLE_POST_WRITE
+#define UPNP_ENABLE_POST_WRITE ENABLE_POST_WRITE
+#endif
+
+/* #undef ENABLE_UNSPECIFIED_SERVER */
+#ifdef ENABLE_UNSPECIFIED_SERVER
+	#define UPNP_ENABLE_UNSPECIFIED_SERVER ENABLE_UNSPECIFIED_SERVER
+#endif
+
+#define ENABLE_CLIENT 1
+#ifdef ENABLE_CLIENT
+#define UPNP_HAVE_CLIENT 1
+#endif
+
+#define ENABLE_DEVICE 1
+#ifdef ENABLE_DEVICE
+#define UPNP_HAVE_DEVICE ENABLE_DEVICE
+#endif
+
+#define ENABLE_GENA 1
+#ifdef ENABLE_GENA
+#define UPNP_HAVE_GENA ENABLE_GENA
+#endif
+
+#define ENABLE_OPT_SSDP 1
+#ifdef ENABLE_OPT_SSDP
+#define UPNP_HAVE_OPTSSDP 1
+#endif
+
+#define ENABLE_SOAP 1
+#ifdef ENABLE_SOAP
+#define UPNP_HAVE_SOAP ENABLE_SOAP
+#endif
+
+#define ENABLE_SSDP 1
+#ifdef ENABLE_SSDP
+#define UPNP_HAVE_SSDP ENABLE_SSDP
+#endif
+
+#define ENABLE_TOOLS 1
+#ifdef ENABLE_TOOLS
+#define UPNP_HAVE_TOOLS 1
+#endif
+
+#define ENABLE_WEBSERVER
+#ifdef ENABLE_WEBSERVER
+#define UPNP_HAVE_WEBSERVER ENABLE_WEBSERVER
+#endif
+
+#define ENABLE_EPOLL 1
+#if defined(ENABLE_EPOLL) && defined(HAVE_SYS_EPOLL_H)
+#define UPNP_ENABLE_EPOLL 1
+#endif
+
+#define ENABLE_SENDFILE 1
+#if defined(ENABLE_SENDFILE) && defined(HAVE_SYS_SENDFILE_H)
+#define UPNP_ENABLE_SENDFILE 1
+#endif
+
+#define ENABLE_SENDMMSG 1
+#if defined(ENABLE_SENDMMSG) && defined(HAVE_SENDMMSG)
+#define UPNP_ENABLE_SENDMMSG 1
+#endif
+
+#define ENABLE_RECVMMSG 1
+#if defined(ENABLE_RECVMMSG) && defined(HAVE_RECVMMSG)
+#define UPNP_ENABLE_RECVMMSG 1
+#endif
+
+#ifdef UPNP_USE_MSVCPP
+typedef unsigned long off_t
+#define strdup _strdup
+#endif
+
+
+
+/* Do not use pthread_rwlock_t */
+#define UPNP_USE_RWLOCK 1
+
+#endif // UPNP_AUTOCONFIG_H
+
@@ -45,6 +45,7 @@
 #include "upnpconfig.h"
 #include "UpnpGlobal.h"
 #include "UpnpInet.h"
+#include "UpnpPropertySetWriter.h"
 
 /*
  * \todo Document the exact reason of these include files and solve this
@@ -790,6 +791,58 @@ struct Upnp_Subscription_Request {
 
 };
 
+/** Returned by {\bf UpnpGetSubscriptionStats}, the latencies are in
+ *  milliseconds.  */
+
+struct Upnp_Subscription_Stats {
+	/** The number of events accepted by the control point. */
+	unsigned long Delivered;
+
+	/** The number of events that could not be delivered. */
+	unsigned long Failed;
+
+	/** The number of failures since the last accepted event. */
+	int ConsecutiveFailures;
+
+	/** The number of events waiting to be sent, including the one
+	 *  being sent. */
+	int QueuedEvents;
+
+	/** The latency of the last accepted event. */
+	long LastLatency;
+
+	/** The average latency of the accepted events. */
+	long AverageLatency;
+
+	/** The maximum latency of the accepted events. */
+	long MaxLatency;
+
+	/** The time before the next attempt while the events to the
+	 *  control point of the subscription are suspended after failures,
+	 *  0 otherwise. */
+	long RetryIn;
+
+};
+
+/** Returned by {\bf UpnpGetConnectionPoolStats}, the counters of the
+ *  connections kept open to the control points between two events.  */
+
+struct Upnp_Connection_Pool_Stats {
+	/** The number of connections opened to control points. */
+	unsigned long Connects;
+
+	/** The number of events sent on a pooled connection. */
+	unsigned long Reuses;
+
+	/** The number of pooled connections found closed by the control
+	 *  point when taken. */
+	unsigned long Stale;
+
+	/** The number of idle connections closed by the pool. */
+	unsigned long Evictions;
+
+};
+
 struct File_Info {
 	/** The length of the file. A length less than 0 indicates the size
 	*  is unknown, and data will be sent until 0 bytes are returned from
@@ -1827,6 +1880,36 @@ EXPORT_SPEC int UpnpAcceptSubscriptionExt(
 	/*! [in] The subscription ID of the newly registered control point. */
 	Upnp_SID SubsId);
 
+/*!
+ * \brief Similar to \b UpnpAcceptSubscriptionExt() except that it takes a
+ * property set written with an \b UpnpPropertySetWriter, which avoids
+ * building and printing a DOM document.
+ *
+ * \return An integer representing one of the following:
+ *     \li \c UPNP_E_SUCCESS: The operation completed successfully.
+ *     \li \c UPNP_E_INVALID_HANDLE: The handle is not a valid device 
+ *             handle.
+ *     \li \c UPNP_E_INVALID_SERVICE: The \b DevId/\b ServId 
+ *             pair refers to an invalid service.
+ *     \li \c UPNP_E_INVALID_SID: The specified subscription ID is not 
+ *             valid.
+ *     \li \c UPNP_E_INVALID_PARAM: Either \b DevID, \b ServID, 
+ *             \b PropSet or \b SubsId is not a valid pointer.
+ *     \li \c UPNP_E_OUTOF_MEMORY: Insufficient resources exist to 
+ *             complete this operation.
+ */
+EXPORT_SPEC int UpnpAcceptSubscriptionPropertySet(
+	/*! [in] The handle of the device. */
+	UpnpDevice_Handle Hnd,
+	/*! [in] The device ID of the subdevice of the service generating the event. */
+	const char *DevID,
+	/*! [in] The unique service identifier of the service generating the event. */
+	const char *ServID,
+	/*! [in] The property set. */
+	const UpnpPropertySetWriter *PropSet,
+	/*! [in] The subscription ID of the newly registered control point. */
+	const Upnp_SID SubsId);
+
 /*!
  * \brief Sends out an event change notification to all control points
  * subscribed to a particular service.
@@ -1836,6 +1919,11 @@ EXPORT_SPEC int UpnpAcceptSubscriptionExt(
  * This function may be called during a callback function to send out a
  * notification.
  *
+ * Once state variables of the service are kept by the SDK (see
+ * \b UpnpSetStateVariables), the values are stored as with
+ * \b UpnpSetStateVariables, and only the variables whose value changed are
+ * sent.
+ *
  * \return An integer representing one of the following:
  *     \li \c UPNP_E_SUCCESS: The operation completed successfully.
  *     \li \c UPNP_E_INVALID_HANDLE: The handle is not a valid device 
@@ -1895,6 +1983,286 @@ EXPORT_SPEC int UpnpNotifyExt(
 	 * Plug and Play Device Architecture specification. */
 	IXML_Document *PropSet);
 
+/*!
+ * \brief Sets the file where the SDK saves the subscriptions to the device,
+ * so that they survive a restart of the device.
+ *
+ * The subscriptions are saved when the device is unregistered, or with
+ * \b UpnpSaveSubscriptions, and restored when it is registered again. The
+ * control points then keep receiving events without subscribing again. The
+ * events that were not sent yet are lost, the control points see a gap in the
+ * event keys. An IPv6 device saves its subscriptions in the file named with
+ * ".ipv6" appended.
+ *
+ * \return An integer representing one of the following:
+ *     \li \c UPNP_E_SUCCESS: The operation completed successfully.
+ *     \li \c UPNP_E_OUTOF_MEMORY: Insufficient resources exist to 
+ *             complete this operation.
+ */
+EXPORT_SPEC int UpnpSetSubscriptionSnapshot(
+	/*! [in] The name of the file, \c NULL to disable the snapshot. */
+	const char *FileName);
+
+/*!
+ * \brief Saves the subscriptions to a device in the file set with
+ * \b UpnpSetSubscriptionSnapshot, for instance periodically in case the
+ * device would not be unregistered.
+ *
+ * \return An integer representing one of the following:
+ *     \li \c UPNP_E_SUCCESS: The operation completed successfully.
+ *     \li \c UPNP_E_INVALID_HANDLE: The handle is not a valid device 
+ *             handle.
+ *     \li \c UPNP_E_INVALID_PARAM: No snapshot file is set.
+ *     \li \c UPNP_E_FILE_WRITE_ERROR: The file could not be written.
+ *     \li \c UPNP_E_OUTOF_MEMORY: Insufficient resources exist to 
+ *             complete this operation.
+ */
+EXPORT_SPEC int UpnpSaveSubscriptions(
+	/*! [in] The handle of the device. */
+	UpnpDevice_Handle Hnd);
+
+/*!
+ * \brief Moderates the events of a state variable of a service.
+ *
+ * The events of the variable sent with \b UpnpNotify or
+ * \b UpnpSetStateVariables are limited to one every \b MinimumIntervalMs
+ * milliseconds: a newer value is held back and the latest one is sent when
+ * the delay is elapsed. The \b maximumRate of an SCPD is in seconds, it
+ * is multiplied by 1000 to be passed here. A numeric value is not sent either unless it differs
+ * by at least \b MinimumDelta from the value last sent. The variables that
+ * are not moderated in an event are sent at once. \b UpnpNotifyExt and
+ * \b UpnpNotifyPropertySet are not moderated: they send the variable at once
+ * and drop the value held back, if any.
+ *
+ * Moderation can also be read from an SCPD with
+ * \b UpnpLoadStateVariableModeration. The values set with this function
+ * take precedence.
+ *
+ * \return An integer representing one of the following:
+ *     \li \c UPNP_E_SUCCESS: The operation completed successfully.
+ *     \li \c UPNP_E_INVALID_HANDLE: The handle is not a valid device 
+ *             handle.
+ *     \li \c UPNP_E_INVALID_SERVICE: The \b DevId/\b ServId 
+ *             pair refers to an invalid service.
+ *     \li \c UPNP_E_INVALID_PARAM: Either \b DevID, \b ServID or
+ *             \b VarName is not a valid pointer, or \b MinimumIntervalMs or
+ *             \b MinimumDelta is negative.
+ *     \li \c UPNP_E_OUTOF_MEMORY: Insufficient resources exist to 
+ *             complete this operation.
+ */
+EXPORT_SPEC int UpnpSetStateVariableModeration(
+	/*! [in] The handle of the device. */
+	UpnpDevice_Handle Hnd,
+	/*! [in] The device ID of the subdevice of the service. */
+	const char *DevID,
+	/*! [in] The unique service identifier of the service. */
+	const char *ServID,
+	/*! [in] The name of the variable. */
+	const char *VarName,
+	/*! [in] The minimum number of milliseconds between two events of the
+	 * variable, 0 for no limit. */
+	int MinimumIntervalMs,
+	/*! [in] The minimum change of a numeric value, 0 for any change. */
+	double MinimumDelta);
+
+/*!
+ * \brief Moderates the events of the state variables of a service as
+ * declared in its SCPD.
+ *
+ * The optional \b maximumRate (in seconds) and \b minimumDelta elements of
+ * the state variables of \b Scpd set the moderation of the variables, as
+ * \b UpnpSetStateVariableModeration does. The values set with
+ * \b UpnpSetStateVariableModeration take precedence. The SDK does not fetch
+ * the SCPD itself: the application passes the document it serves, after
+ * the device is registered.
+ *
+ * \return An integer representing one of the following:
+ *     \li \c UPNP_E_SUCCESS: The operation completed successfully.
+ *     \li \c UPNP_E_INVALID_HANDLE: The handle is not a valid device 
+ *             handle.
+ *     \li \c UPNP_E_INVALID_SERVICE: The \b DevId/\b ServId 
+ *             pair refers to an invalid service.
+ *     \li \c UPNP_E_INVALID_PARAM: Either \b DevID, \b ServID or
+ *             \b Scpd is not a valid pointer.
+ *     \li \c UPNP_E_OUTOF_MEMORY: Insufficient resources exist to 
+ *             complete this operation.
+ */
+EXPORT_SPEC int UpnpLoadStateVariableModeration(
+	/*! [in] The handle of the device. */
+	UpnpDevice_Handle Hnd,
+	/*! [in] The device ID of the subdevice of the service. */
+	const char *DevID,
+	/*! [in] The unique service identifier of the service. */
+	const char *ServID,
+	/*! [in] The SCPD of the service. */
+	IXML_Document *Scpd);
+
+/*!
+ * \brief Reads the delivery counters of a subscription to a service of a
+ * device.
+ *
+ * After a few consecutive failures to deliver events to a control point,
+ * counted over all its subscriptions, the SDK stops sending events to the
+ * control point and retries later, with a delay doubled at each new
+ * failure. The events wait in the queues of the subscriptions meanwhile.
+ *
+ * \return An integer representing one of the following:
+ *     \li \c UPNP_E_SUCCESS: The operation completed successfully.
+ *     \li \c UPNP_E_INVALID_HANDLE: The handle is not a valid device 
+ *             handle.
+ *     \li \c UPNP_E_INVALID_SERVICE: The \b DevId/\b ServId 
+ *             pair refers to an invalid service.
+ *     \li \c UPNP_E_INVALID_SID: The specified subscription ID is not 
+ *             valid.
+ *     \li \c UPNP_E_INVALID_PARAM: Either \b DevID, \b ServID,
+ *             \b SubsId or \b Stats is not a valid pointer.
+ */
+EXPORT_SPEC int UpnpGetSubscriptionStats(
+	/*! [in] The handle of the device. */
+	UpnpDevice_Handle Hnd,
+	/*! [in] The device ID of the subdevice of the service. */
+	const char *DevID,
+	/*! [in] The unique service identifier of the service. */
+	const char *ServID,
+	/*! [in] The subscription ID. */
+	const Upnp_SID SubsId,
+	/*! [out] The counters of the subscription. */
+	struct Upnp_Subscription_Stats *Stats);
+
+/*!
+ * \brief Reads the counters of the pool of connections the events are sent
+ * on, shared by all the devices.
+ *
+ * \return An integer representing one of the following:
+ *     \li \c UPNP_E_SUCCESS: The operation completed successfully.
+ *     \li \c UPNP_E_INVALID_PARAM: \b Stats is not a valid pointer.
+ */
+EXPORT_SPEC int UpnpGetConnectionPoolStats(
+	/*! [out] The counters of the connection pool. */
+	struct Upnp_Connection_Pool_Stats *Stats);
+
+/*!
+ * \brief Similar to \b UpnpNotifyExt() except that it takes a property set
+ * written with an \b UpnpPropertySetWriter, which avoids building and
+ * printing a DOM document at each event. The writer can be cleared and
+ * reused as soon as the function returns.
+ *
+ * \return An integer representing one of the following:
+ *     \li \c UPNP_E_SUCCESS: The operation completed successfully.
+ *     \li \c UPNP_E_INVALID_HANDLE: The handle is not a valid device 
+ *             handle.
+ *     \li \c UPNP_E_INVALID_SERVICE: The \b DevId/\b ServId 
+ *             pair refers to an invalid service.
+ *     \li \c UPNP_E_INVALID_PARAM: Either \b DevID, \b ServID or
+ *             \b PropSet is not a valid pointer.
+ *     \li \c UPNP_E_OUTOF_MEMORY: Insufficient resources exist to 
+ *             complete this operation.
+ */
+EXPORT_SPEC int UpnpNotifyPropertySet(
+	/*! [in] The handle to the device sending the event. */
+	UpnpDevice_Handle Hnd,
+	/*! [in] The device ID of the subdevice of the service generating the event. */
+	const char *DevID,
+	/*! [in] The unique identifier of the service generating the event. */
+	const char *ServID,
+	/*! [in] The property set. */
+	const UpnpPropertySetWriter *PropSet);
+
+/*!
+ * \brief Sets evented state variables of a service, kept by the SDK.
+ *
+ * The variables whose value changed are sent to all the subscribed control
+ * points in one event, as \b UpnpNotify does. Once a service has state
+ * variables, the SDK also sends the initial event of the new subscriptions
+ * to the service from the values it keeps: the
+ * \c UPNP_EVENT_SUBSCRIPTION_REQUEST callback is no longer called for the
+ * service. The initial event is built once and shared by the subscriptions
+ * until a value changes. Values are sent as given, they must be escaped like
+ * the values given to \b UpnpNotify.
+ *
+ * \b UpnpNotify updates the kept values too. \b UpnpNotifyExt and
+ * \b UpnpNotifyPropertySet do not: mixing them with this function is not
+ * supported, as new subscriptions would get the values they did not store.
+ *
+ * \return An integer representing one of the following:
+ *     \li \c UPNP_E_SUCCESS: The operation completed successfully.
+ *     \li \c UPNP_E_INVALID_HANDLE: The handle is not a valid device 
+ *             handle.
+ *     \li \c UPNP_E_INVALID_SERVICE: The \b DevId/\b ServId 
+ *             pair refers to an invalid service.
+ *     \li \c UPNP_E_INVALID_PARAM: Either \b VarName, \b NewVal, 
+ *              \b DevID, or \b ServID is not a valid pointer or 
+ *              \b cVariables is less than zero.
+ *     \li \c UPNP_E_OUTOF_MEMORY: Insufficient resources exist to 
+ *             complete this operation. Some of the values may have been
+ *             stored, no event was sent for them.
+ */
+EXPORT_SPEC int UpnpSetStateVariables(
+	/*! [in] The handle to the device sending the event. */
+	UpnpDevice_Handle,
+	/*! [in] The device ID of the subdevice of the service generating the event. */
+	const char *DevID,
+	/*! [in] The unique identifier of the service generating the event. */
+	const char *ServID,
+	/*! [in] Pointer to an array of variable names. */
+	const char **VarName,
+	/*! [in] Pointer to an array of values for those variables. */
+	const char **NewVal,
+	/*! [in] The count of variables. */
+	int cVariables);
+
+/*!
+ * \brief Sets a string state variable, see \b UpnpSetStateVariables.
+ *
+ * \return The same values as \b UpnpSetStateVariables.
+ */
+EXPORT_SPEC int UpnpSetStateVariable(
+	/*! [in] The handle to the device sending the event. */
+	UpnpDevice_Handle,
+	/*! [in] The device ID of the subdevice of the service generating the event. */
+	const char *DevID,
+	/*! [in] The unique identifier of the service generating the event. */
+	const char *ServID,
+	/*! [in] The name of the variable. */
+	const char *VarName,
+	/*! [in] The new value. */
+	const char *NewVal);
+
+/*!
+ * \brief Sets an integer state variable, see \b UpnpSetStateVariables.
+ *
+ * \return The same values as \b UpnpSetStateVariables.
+ */
+EXPORT_SPEC int UpnpSetStateVariableInt(
+	/*! [in] The handle to the device sending the event. */
+	UpnpDevice_Handle,
+	/*! [in] The device ID of the subdevice of the service generating the event. */
+	const char *DevID,
+	/*! [in] The unique identifier of the service generating the event. */
+	const char *ServID,
+	/*! [in] The name of the variable. */
+	const char *VarName,
+	/*! [in] The new value. */
+	long NewVal);
+
+/*!
+ * \brief Sets a boolean state variable, sent as 0 or 1, see
+ * \b UpnpSetStateVariables.
+ *
+ * \return The same values as \b UpnpSetStateVariables.
+ */
+EXPORT_SPEC int UpnpSetStateVariableBool(
+	/*! [in] The handle to the device sending the event. */
+	UpnpDevice_Handle,
+	/*! [in] The device ID of the subdevice of the service generating the event. */
+	const char *DevID,
+	/*! [in] The unique identifier of the service generating the event. */
+	const char *ServID,
+	/*! [in] The name of the variable. */
+	const char *VarName,
+	/*! [in] The new value, any non-zero value is true. */
+	int NewVal);
+
 /*!
  * \brief Renews a subscription that is about to expire.
  *
@@ -2034,6 +2402,27 @@ EXPORT_SPEC int UpnpSetMaxSubscriptionTimeOut(
 	/*! The maximum subscription time-out to be accepted. */
 	int MaxSubscriptionTimeOut);
 
+/*!
+ * \brief Enables the coalescing of the events queued for a subscription.
+ *
+ * At most \c MAX_SUBSCRIPTION_QUEUED_EVENTS events are queued for a
+ * subscription whose control point is slow. By default, a new event arriving
+ * on a full queue discards the oldest one not being sent. With coalescing, the
+ * events waiting to be sent and the new one are merged into one event holding
+ * the last value of each state variable, so no change of value is lost.
+ * Property sets given to UpnpNotifyExt() are merged only if they parse.
+ *
+ * \return An integer representing one of the following:
+ *     \li \c UPNP_E_SUCCESS: The operation completed successfully.
+ *     \li \c UPNP_E_INVALID_HANDLE: The handle is not a valid device 
+ *             handle.
+ */
+EXPORT_SPEC int UpnpSetEventCoalescing(
+	/*! The handle of the device. */
+	UpnpDevice_Handle Hnd,
+	/*! Non-zero to merge the queued events, zero to discard them. */
+	int Enable);
+
 /*!
  * \brief Registers a control point to receive event notifications from another
  * device.
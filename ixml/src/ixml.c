@@ -328,7 +328,7 @@ DOMString ixmlPrintDocument(IXML_Document *doc) {
 	ixml_membuf_append_str(buf, "<?xml version=\"1.0\"?>\r\n");
 	ixmlPrintDomTree(rootNode, buf);
 
-	return buf->buf;
+	return ixml_membuf_detach(buf);
 }
 
 DOMString ixmlPrintNode(IXML_Node *node) {
@@ -342,7 +342,7 @@ DOMString ixmlPrintNode(IXML_Node *node) {
 	ixml_membuf_init(buf);
 	ixmlPrintDomTree(node, buf);
 
-	return buf->buf;
+	return ixml_membuf_detach(buf);
 }
 
 DOMString ixmlDocumenttoString(IXML_Document *doc) {
@@ -358,7 +358,7 @@ DOMString ixmlDocumenttoString(IXML_Document *doc) {
 	ixml_membuf_append_str(buf, "<?xml version=\"1.0\"?>\r\n");
 	ixmlDomTreetoString(rootNode, buf);
 
-	return buf->buf;
+	return ixml_membuf_detach(buf);
 }
 
 DOMString ixmlNodetoString(IXML_Node *node) {
@@ -372,7 +372,7 @@ DOMString ixmlNodetoString(IXML_Node *node) {
 	ixml_membuf_init(buf);
 	ixmlDomTreetoString(node, buf);
 
-	return buf->buf;
+	return ixml_membuf_detach(buf);
 }
 
 void ixmlRelaxParser(char errorChar) {
@@ -57,7 +57,6 @@ static int ixml_membuf_set_size(
 	INOUT ixml_membuf *m,
 	/*! [in] The new lenght. */
 	IN size_t new_length) {
-	size_t diff;
 	size_t alloc_len;
 	char *temp_buf;
 
@@ -68,15 +67,26 @@ static int ixml_membuf_set_size(
 			/* have enough mem; done */
 			return 0;
 		}
+		if (m->buf == NULL && new_length < IXML_MEMBUF_INLINE_SIZE) {
+			/* short contents fit in the embedded storage */
+			m->buf = m->inline_buf;
+			m->capacity = IXML_MEMBUF_INLINE_SIZE - (size_t) 1;
+			return 0;
+		}
 
-		diff = new_length - m->length;
-		alloc_len = MAXVAL(m->size_inc, diff) + m->capacity;
+		/* grow geometrically, so that appends are amortized O(1). */
+		alloc_len = m->capacity + MAXVAL(m->size_inc, m->capacity);
+		if (alloc_len < m->capacity || alloc_len < new_length) {
+			alloc_len = new_length;
+		}
 	} else {
 		/* decrease length */
 		assert(new_length <= m->length);
 
-		/* if diff is 0..m->size_inc, don't free */
-		if ((m->capacity - new_length) <= m->size_inc) {
+		/* keep the memory unless most of it is unused. */
+		if (m->buf == m->inline_buf ||
+		    (m->capacity - new_length) <= m->size_inc ||
+		    new_length >= m->capacity / 4) {
 			return 0;
 		}
 		alloc_len = new_length + m->size_inc;
@@ -84,14 +94,23 @@ static int ixml_membuf_set_size(
 
 	assert(alloc_len >= new_length);
 
-	temp_buf = realloc(m->buf, alloc_len + (size_t) 1);
-	if (temp_buf == NULL) {
-		/* try smaller size */
-		alloc_len = new_length;
-		temp_buf = realloc(m->buf, alloc_len + (size_t) 1);
+	if (m->buf == m->inline_buf) {
+		/* move out of the embedded storage */
+		temp_buf = malloc(alloc_len + (size_t) 1);
 		if (temp_buf == NULL) {
 			return IXML_INSUFFICIENT_MEMORY;
 		}
+		memcpy(temp_buf, m->inline_buf, m->length + (size_t) 1);
+	} else {
+		temp_buf = realloc(m->buf, alloc_len + (size_t) 1);
+		if (temp_buf == NULL) {
+			/* try smaller size */
+			alloc_len = new_length;
+			temp_buf = realloc(m->buf, alloc_len + (size_t) 1);
+			if (temp_buf == NULL) {
+				return IXML_INSUFFICIENT_MEMORY;
+			}
+		}
 	}
 	/* save */
 	m->buf = temp_buf;
@@ -114,10 +133,30 @@ void ixml_membuf_destroy(ixml_membuf *m) {
 		return;
 	}
 
-	free(m->buf);
+	if (m->buf != m->inline_buf) {
+		free(m->buf);
+	}
 	ixml_membuf_init(m);
 }
 
+char *ixml_membuf_detach(ixml_membuf *m) {
+	char *buf;
+
+	assert(m != NULL);
+
+	if (m->buf == m->inline_buf) {
+		buf = malloc(m->length + (size_t) 1);
+		if (buf != NULL) {
+			memcpy(buf, m->inline_buf, m->length + (size_t) 1);
+		}
+	} else {
+		buf = m->buf;
+	}
+	ixml_membuf_init(m);
+
+	return buf;
+}
+
 int ixml_membuf_assign(
 	ixml_membuf *m,
 	const void *buf,
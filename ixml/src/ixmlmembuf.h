@@ -49,14 +49,26 @@
 
 #define MEMBUF_DEF_SIZE_INC 20u
 
+/*!
+ * \brief Size of the storage embedded in ixml_membuf, used for short
+ * contents (e.g. parser tokens) before any heap allocation is made.
+ */
+#define IXML_MEMBUF_INLINE_SIZE 64u
+
 /*!
  * \brief The ixml_membuf type.
+ *
+ * The buffer grows geometrically. Contents shorter than
+ * IXML_MEMBUF_INLINE_SIZE live in \b inline_buf, so an ixml_membuf must not
+ * be copied by value once written to. \b buf is NULL until the first write.
  */
 typedef struct {
 	char *buf;
 	size_t length;
 	size_t capacity;
+	/*! Minimum increase of the capacity. */
 	size_t size_inc;
+	char inline_buf[IXML_MEMBUF_INLINE_SIZE];
 } ixml_membuf;
 
 /*!
@@ -76,6 +88,19 @@ void ixml_membuf_destroy(
 	/*! [in,out] The memory buffer to clear. */
 	ixml_membuf *m);
 
+/*!
+ * \brief Takes the contents of the ixml_membuf as a heap allocated string.
+ *
+ * The ixml_membuf is reinitialized and the caller owns the returned string,
+ * to be released with free().
+ *
+ * \return The string, or NULL if the buffer is empty and was never written
+ * to, or on memory allocation failure.
+ */
+char *ixml_membuf_detach(
+	/*! [in,out] The memory buffer to detach the contents from. */
+	ixml_membuf *m);
+
 /*!
  * \brief Copies the contents o a buffer to the designated ixml_membuf.
  *
@@ -35,6 +35,15 @@
  */
 #include "ThreadPool.h"
 
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && \
+	!defined(__STDC_NO_ATOMICS__)
+	/*! The work stealing scheduler relies on C11 atomics. */
+	#define TP_WORK_STEALING 1
+	#include <stdatomic.h>
+	#include <limits.h>
+	#include <stddef.h>
+#endif
+
 /*!
  * \brief Returns the difference in milliseconds between two timeval structures.
  *
@@ -402,6 +411,688 @@ static void SetSeed(void) {
 #endif
 }
 
+#ifdef TP_WORK_STEALING
+/*!
+ * \name Work stealing scheduler
+ *
+ * Every worker owns one bounded lock free queue per priority. A worker
+ * adding a job queues it locally, other threads use the pool queues. A
+ * worker looks for a job in its own queue, then in the pool queue, then in
+ * the queues of the other workers, for each priority in turn. The queues
+ * are multi consumer FIFO rings, so stealing keeps the order of the jobs
+ * of a priority. Idle workers sleep on their own condition variable and
+ * exactly one of them is woken per added job.
+ *
+ * @{
+ */
+
+/*! State of a worker slot. */
+enum {
+	/*! No thread uses the slot. */
+	WS_FREE,
+	/*! The worker runs or looks for jobs. */
+	WS_RUNNING,
+	/*! The worker waits on its condition variable. */
+	WS_SLEEPING,
+	/*! The worker has been chosen to run a new job. */
+	WS_WAKING
+};
+
+/*! Id of a free slot. */
+#define WS_NO_JOB (-1)
+/*! Id of a slot whose job was taken by ThreadPoolRemove(). */
+#define WS_REMOVED_JOB (-2)
+
+/*! One slot of a job queue. */
+typedef struct {
+	/*! Position of the slot in the sequence of pushes and pops. */
+	atomic_size_t seq;
+	/*! Queued job, published by seq. */
+	_Atomic(ThreadPoolJob *) job;
+	/*! Id of the queued job, WS_NO_JOB once popped. Whoever changes it
+	 * first, WSQueuePop() or WSQueueRemove(), owns the job. */
+	atomic_int id;
+	/*! Time the job was queued in milliseconds, read by the aging check. */
+	atomic_llong queued;
+} WSCell;
+
+/*! Bounded multi producer, multi consumer FIFO queue of jobs. */
+typedef struct {
+	/*! Slots, the size is a power of two. */
+	WSCell *cells;
+	/*! Size of cells minus one. */
+	size_t mask;
+	/*! Next position to pop. */
+	atomic_size_t head;
+	/*! Next position to push. */
+	atomic_size_t tail;
+	/*! Number of removed jobs whose slots are still in use, shared by the
+	 * queues of the scheduler. */
+	atomic_int *removedJobs;
+} WSQueue;
+
+/*! A worker slot of the work stealing scheduler. */
+typedef struct {
+	/*! Owning thread pool. */
+	ThreadPool *tp;
+	/*! Jobs added by the worker, indexed by ThreadPriority. */
+	WSQueue queues[HIGH_PRIORITY + 1];
+	/*! Protects the sleep of the worker. */
+	ithread_mutex_t mutex;
+	/*! Signaled to wake the worker up. */
+	ithread_cond_t cond;
+	/*! WS_FREE, WS_RUNNING, WS_SLEEPING or WS_WAKING. */
+	atomic_int state;
+} WSWorker;
+
+struct ws_scheduler {
+	/*! Worker slots, one per possible thread. */
+	WSWorker *workers;
+	/*! Number of worker slots, maxThreads at initialization. */
+	int numWorkers;
+	/*! Jobs added by threads outside the pool, indexed by ThreadPriority. */
+	WSQueue queues[HIGH_PRIORITY + 1];
+	/*! Number of queued jobs, bounded by maxJobsTotal. */
+	atomic_int queuedJobs;
+	/*! Number of jobs taken by ThreadPoolRemove() whose slots WSQueuePop()
+	 * has not skipped yet. They count against maxJobsTotal too. */
+	atomic_int removedJobs;
+	/*! Number of queued jobs per priority. */
+	atomic_int currentJobs[HIGH_PRIORITY + 1];
+	/*! Number of workers running a job. */
+	atomic_int busyThreads;
+	/*! Number of started workers, tp->totalThreads without the lock. */
+	atomic_int threads;
+	/*! Next job id. */
+	atomic_int nextJobId;
+	/*! Set when the pool shuts down. */
+	atomic_int shutdown;
+	/*! Set while tp->persistentJob waits for a worker. */
+	atomic_int persistentPending;
+	/*! Rotates the first slot examined by WSWakeOne(). */
+	atomic_uint nextWake;
+	/*! Statistics: jobs started per priority. */
+	atomic_int totalJobs[HIGH_PRIORITY + 1];
+	/*! Statistics: milliseconds spent queued per priority. */
+	atomic_llong totalWait[HIGH_PRIORITY + 1];
+};
+
+/*! Worker slot of the current thread, NULL outside work stealing pools. */
+static _Thread_local WSWorker *wsCurrentWorker = NULL;
+
+/*!
+ * \brief Returns a timeval in milliseconds.
+ *
+ * \internal
+ */
+static long long WSMillis(
+	/*! . */
+	const struct timeval *tv) {
+	return (long long) tv->tv_sec * 1000 + tv->tv_usec / 1000;
+}
+
+/*!
+ * \brief Maps a job priority to a queue index.
+ *
+ * \internal
+ */
+static int WSQueueIndex(
+	/*! . */
+	ThreadPriority priority) {
+	switch (priority) {
+		case HIGH_PRIORITY:
+		case MED_PRIORITY:
+			return (int) priority;
+		default:
+			return LOW_PRIORITY;
+	}
+}
+
+/*!
+ * \brief Allocates the slots of a queue.
+ *
+ * \internal
+ *
+ * \return 0 on success, EOUTOFMEM on failure.
+ */
+static int WSQueueInit(
+	/*! . */
+	WSQueue *q,
+	/*! Number of slots, a power of two. */
+	size_t capacity,
+	/*! Counter of the removed jobs of the scheduler. */
+	atomic_int *removedJobs) {
+	size_t i;
+
+	q->cells = (WSCell *) malloc(capacity * sizeof(WSCell));
+	if (q->cells == NULL) {
+		return EOUTOFMEM;
+	}
+	for (i = 0; i < capacity; i++) {
+		atomic_init(&q->cells[i].seq, i);
+		atomic_init(&q->cells[i].job, NULL);
+		atomic_init(&q->cells[i].id, WS_NO_JOB);
+		atomic_init(&q->cells[i].queued, 0);
+	}
+	q->mask = capacity - 1;
+	atomic_init(&q->head, 0);
+	atomic_init(&q->tail, 0);
+	q->removedJobs = removedJobs;
+
+	return 0;
+}
+
+/*!
+ * \brief Adds a job at the tail of a queue.
+ *
+ * \internal
+ *
+ * \return 1 on success, 0 if the queue is full.
+ */
+static int WSQueuePush(
+	/*! . */
+	WSQueue *q,
+	/*! . */
+	ThreadPoolJob *job) {
+	WSCell *cell;
+	size_t pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+	size_t seq;
+
+	while (1) {
+		cell = &q->cells[pos & q->mask];
+		seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+		if (seq == pos) {
+			if (atomic_compare_exchange_weak_explicit(&q->tail, &pos,
+				pos + 1, memory_order_relaxed,
+				memory_order_relaxed)) {
+				break;
+			}
+		} else if ((ptrdiff_t) (seq - pos) < 0) {
+			return 0;
+		} else {
+			pos = atomic_load_explicit(&q->tail, memory_order_relaxed);
+		}
+	}
+	atomic_store_explicit(&cell->job, job, memory_order_relaxed);
+	atomic_store_explicit(&cell->id, job->jobId, memory_order_release);
+	atomic_store_explicit(&cell->queued, WSMillis(&job->requestTime),
+	                      memory_order_relaxed);
+	atomic_store_explicit(&cell->seq, pos + 1, memory_order_release);
+
+	return 1;
+}
+
+/*!
+ * \brief Removes the job at the head of a queue. The slots emptied by
+ * WSQueueRemove() are skipped.
+ *
+ * \internal
+ *
+ * \return The job or NULL if the queue is empty.
+ */
+static ThreadPoolJob *WSQueuePop(
+	/*! . */
+	WSQueue *q) {
+	WSCell *cell;
+	ThreadPoolJob *job;
+	size_t pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+	size_t seq;
+	int id;
+
+	while (1) {
+		cell = &q->cells[pos & q->mask];
+		seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+		if (seq == pos + 1) {
+			if (!atomic_compare_exchange_weak_explicit(&q->head,
+				&pos, pos + 1, memory_order_relaxed,
+				memory_order_relaxed)) {
+				continue;
+			}
+			job = atomic_load_explicit(&cell->job,
+			                           memory_order_relaxed);
+			id = atomic_exchange(&cell->id, WS_NO_JOB);
+			atomic_store_explicit(&cell->seq, pos + q->mask + 1,
+			                      memory_order_release);
+			if (id != WS_REMOVED_JOB) {
+				return job;
+			}
+			atomic_fetch_sub(q->removedJobs, 1);
+			pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+		} else if ((ptrdiff_t) (seq - (pos + 1)) < 0) {
+			return NULL;
+		} else {
+			pos = atomic_load_explicit(&q->head, memory_order_relaxed);
+		}
+	}
+}
+
+/*!
+ * \brief Takes a queued job out of a queue. Its slot stays in the queue
+ * until WSQueuePop() skips it.
+ *
+ * \internal
+ *
+ * \return The job or NULL if the queue does not hold it.
+ */
+static ThreadPoolJob *WSQueueRemove(
+	/*! . */
+	WSQueue *q,
+	/*! Id of the job. */
+	int jobId) {
+	WSCell *cell;
+	ThreadPoolJob *job;
+	size_t pos = atomic_load(&q->head);
+	size_t tail = atomic_load(&q->tail);
+	int expected;
+
+	for (; pos != tail; pos++) {
+		cell = &q->cells[pos & q->mask];
+		if (atomic_load(&cell->seq) != pos + 1 ||
+		    atomic_load(&cell->id) != jobId) {
+			continue;
+		}
+		/* The ids are unique: while the id matches, the slot holds
+		 * this job. */
+		job = atomic_load_explicit(&cell->job, memory_order_relaxed);
+		expected = jobId;
+		/* Counted first, WSQueuePop() may skip the slot at once. */
+		atomic_fetch_add(q->removedJobs, 1);
+		if (atomic_compare_exchange_strong(&cell->id, &expected,
+		                                   WS_REMOVED_JOB)) {
+			return job;
+		}
+		atomic_fetch_sub(q->removedJobs, 1);
+	}
+
+	return NULL;
+}
+
+/*!
+ * \brief Returns the time the job at the head of a queue was queued.
+ *
+ * The value is a hint, the job may be taken concurrently.
+ *
+ * \internal
+ *
+ * \return Milliseconds or -1 if the queue looks empty.
+ */
+static long long WSQueueHeadTime(
+	/*! . */
+	WSQueue *q) {
+	size_t pos = atomic_load(&q->head);
+	WSCell *cell = &q->cells[pos & q->mask];
+
+	if (atomic_load(&cell->seq) != pos + 1) {
+		return -1;
+	}
+
+	return atomic_load_explicit(&cell->queued, memory_order_relaxed);
+}
+
+/*!
+ * \brief Returns the time the oldest job of a priority was queued, in the
+ * pool queue or in the queues of the workers.
+ *
+ * \internal
+ *
+ * \return Milliseconds or -1 if the queues look empty.
+ */
+static long long WSOldestHeadTime(
+	/*! . */
+	struct ws_scheduler *ws,
+	/*! Queue index. */
+	int p) {
+	long long oldest = WSQueueHeadTime(&ws->queues[p]);
+	long long queued;
+	int i;
+
+	for (i = 0; i < ws->numWorkers; i++) {
+		queued = WSQueueHeadTime(&ws->workers[i].queues[p]);
+		if (queued >= 0 && (oldest < 0 || queued < oldest)) {
+			oldest = queued;
+		}
+	}
+
+	return oldest;
+}
+
+/*!
+ * \brief Tells whether a queue contains jobs, including pushes in progress.
+ *
+ * \internal
+ */
+static int WSQueueIsEmpty(
+	/*! . */
+	WSQueue *q) {
+	return atomic_load(&q->tail) == atomic_load(&q->head);
+}
+
+/*!
+ * \brief Tells whether a worker may find something to do.
+ *
+ * \internal
+ */
+static int WSHasWork(
+	/*! . */
+	ThreadPool *tp) {
+	struct ws_scheduler *ws = tp->ws;
+	int i;
+	int p;
+
+	if (atomic_load(&ws->shutdown) || atomic_load(&ws->persistentPending)) {
+		return 1;
+	}
+	for (p = LOW_PRIORITY; p <= HIGH_PRIORITY; p++) {
+		if (!WSQueueIsEmpty(&ws->queues[p])) {
+			return 1;
+		}
+		for (i = 0; i < ws->numWorkers; i++) {
+			if (!WSQueueIsEmpty(&ws->workers[i].queues[p])) {
+				return 1;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*!
+ * \brief Wakes up one sleeping worker.
+ *
+ * \internal
+ *
+ * \return 1 if a worker was woken up, 0 if none was sleeping.
+ */
+static int WSWakeOne(
+	/*! . */
+	ThreadPool *tp) {
+	struct ws_scheduler *ws = tp->ws;
+	WSWorker *w;
+	int start = (int) (atomic_fetch_add(&ws->nextWake, 1u) %
+	                   (unsigned int) ws->numWorkers);
+	int expected;
+	int i;
+
+	/* Orders the queued job before the look at the worker states. */
+	atomic_thread_fence(memory_order_seq_cst);
+	for (i = 0; i < ws->numWorkers; i++) {
+		w = &ws->workers[(start + i) % ws->numWorkers];
+		expected = WS_SLEEPING;
+		if (atomic_compare_exchange_strong(&w->state, &expected,
+		                                   WS_WAKING)) {
+			ithread_mutex_lock(&w->mutex);
+			ithread_cond_signal(&w->cond);
+			ithread_mutex_unlock(&w->mutex);
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*!
+ * \brief Wakes up every sleeping worker, used at shutdown.
+ *
+ * \internal
+ */
+static void WSWakeAll(
+	/*! . */
+	ThreadPool *tp) {
+	struct ws_scheduler *ws = tp->ws;
+	WSWorker *w;
+	int expected;
+	int i;
+
+	for (i = 0; i < ws->numWorkers; i++) {
+		w = &ws->workers[i];
+		expected = WS_SLEEPING;
+		if (atomic_compare_exchange_strong(&w->state, &expected,
+		                                   WS_WAKING)) {
+			ithread_mutex_lock(&w->mutex);
+			ithread_cond_signal(&w->cond);
+			ithread_mutex_unlock(&w->mutex);
+		}
+	}
+}
+
+/*!
+ * \brief Takes the next job of a priority: from the own queue of the
+ * worker, from the pool queue or from another worker.
+ *
+ * \internal
+ */
+static ThreadPoolJob *WSTakeJob(
+	/*! . */
+	ThreadPool *tp,
+	/*! Current worker. */
+	WSWorker *self,
+	/*! Queue index. */
+	int p) {
+	struct ws_scheduler *ws = tp->ws;
+	ThreadPoolJob *job;
+	int start = (int) (self - ws->workers);
+	int i;
+
+	job = WSQueuePop(&self->queues[p]);
+	if (job == NULL) {
+		job = WSQueuePop(&ws->queues[p]);
+	}
+	for (i = 1; job == NULL && i < ws->numWorkers; i++) {
+		job = WSQueuePop(&ws->workers[(start + i) %
+		                              ws->numWorkers].queues[p]);
+	}
+
+	return job;
+}
+
+/*!
+ * \brief Finds the next job to run, highest priority first.
+ *
+ * A med priority job queued for starvationTime, or a low priority job
+ * queued for maxIdleTime, in the pool queue or in the queue of any worker,
+ * is taken before the higher priority, like BumpPriority() does for the
+ * shared queues.
+ *
+ * \internal
+ *
+ * \return The job or NULL if there is no job.
+ */
+static ThreadPoolJob *WSNextJob(
+	/*! . */
+	ThreadPool *tp,
+	/*! Current worker. */
+	WSWorker *self) {
+	struct ws_scheduler *ws = tp->ws;
+	ThreadPoolJob *job = NULL;
+	struct timeval tv;
+	long long now;
+	long long queued;
+	int order[3] = {HIGH_PRIORITY, MED_PRIORITY, LOW_PRIORITY};
+	int i;
+
+	gettimeofday(&tv, NULL);
+	now = WSMillis(&tv);
+	queued = WSOldestHeadTime(ws, MED_PRIORITY);
+	if (queued >= 0 && now - queued >= tp->attr.starvationTime) {
+		order[0] = MED_PRIORITY;
+		order[1] = HIGH_PRIORITY;
+	}
+	queued = WSOldestHeadTime(ws, LOW_PRIORITY);
+	if (queued >= 0 && now - queued >= tp->attr.maxIdleTime) {
+		order[2] = order[1];
+		order[1] = LOW_PRIORITY;
+		if (order[0] == MED_PRIORITY) {
+			/* MED, LOW, HIGH would starve the high priority. */
+			order[1] = HIGH_PRIORITY;
+			order[2] = LOW_PRIORITY;
+		}
+	}
+	for (i = 0; i < 3 && job == NULL; i++) {
+		job = WSTakeJob(tp, self, order[i]);
+		if (job) {
+			atomic_fetch_sub(&ws->queuedJobs, 1);
+			atomic_fetch_sub(&ws->currentJobs[order[i]], 1);
+			atomic_fetch_add(&ws->totalJobs[order[i]], 1);
+			atomic_fetch_add(&ws->totalWait[order[i]],
+			                 now - WSMillis(&job->requestTime));
+		}
+	}
+
+	return job;
+}
+
+/*!
+ * \brief Runs the pending persistent job, if any.
+ *
+ * \internal
+ */
+static void WSRunPersistent(
+	/*! . */
+	ThreadPool *tp) {
+	ThreadPoolJob *job;
+
+	ithread_mutex_lock(&tp->mutex);
+	job = tp->persistentJob;
+	atomic_store(&tp->ws->persistentPending, 0);
+	if (job) {
+		tp->persistentJob = NULL;
+		tp->persistentThreads++;
+		ithread_cond_broadcast(&tp->start_and_shutdown);
+	}
+	ithread_mutex_unlock(&tp->mutex);
+	if (job == NULL) {
+		return;
+	}
+	SetPriority(job->priority);
+	job->func(job->arg);
+	SetPriority(DEFAULT_PRIORITY);
+	ithread_mutex_lock(&tp->mutex);
+	/* Persistent thread becomes a regular thread */
+	tp->persistentThreads--;
+	FreeThreadPoolJob(tp, job);
+	ithread_mutex_unlock(&tp->mutex);
+}
+
+/*!
+ * \brief Implements a worker of the work stealing scheduler.
+ *
+ * The worker runs the persistent job first, then the jobs returned by
+ * WSNextJob(). Without jobs it sleeps until it is chosen by WSWakeOne(),
+ * and exits after maxIdleTime if the pool has more than minThreads.
+ *
+ * \internal
+ */
+static void *WSWorkerThread(
+	/*! arg -> is cast to (WSWorker *). */
+	void *arg) {
+	WSWorker *w = (WSWorker *) arg;
+	ThreadPool *tp = w->tp;
+	struct ws_scheduler *ws = tp->ws;
+	ThreadPoolJob *job;
+	struct timespec timeout;
+	int retCode;
+	int expected;
+
+	ithread_initialize_thread();
+	wsCurrentWorker = w;
+
+	/* Increment total thread count */
+	ithread_mutex_lock(&tp->mutex);
+	tp->totalThreads++;
+	atomic_fetch_add(&ws->threads, 1);
+	tp->pendingWorkerThreadStart = 0;
+	ithread_cond_broadcast(&tp->start_and_shutdown);
+	ithread_mutex_unlock(&tp->mutex);
+
+	SetSeed();
+	while (!atomic_load(&ws->shutdown)) {
+		if (atomic_load(&ws->persistentPending)) {
+			WSRunPersistent(tp);
+			continue;
+		}
+		job = WSNextJob(tp, w);
+		if (job) {
+			atomic_fetch_add(&ws->busyThreads, 1);
+			SetPriority(job->priority);
+			job->func(job->arg);
+			SetPriority(DEFAULT_PRIORITY);
+			atomic_fetch_sub(&ws->busyThreads, 1);
+			free(job);
+			continue;
+		}
+		/* Announce the sleep before looking again: a job added
+		 * meanwhile is either seen here or wakes this worker up. */
+		atomic_store(&w->state, WS_SLEEPING);
+		if (WSHasWork(tp)) {
+			atomic_store(&w->state, WS_RUNNING);
+			continue;
+		}
+		retCode = 0;
+		ithread_mutex_lock(&w->mutex);
+		while (atomic_load(&w->state) == WS_SLEEPING &&
+		       retCode != ETIMEDOUT) {
+			SetRelTimeout(&timeout, tp->attr.maxIdleTime);
+			retCode = ithread_cond_timedwait(&w->cond, &w->mutex,
+			                                 &timeout);
+		}
+		ithread_mutex_unlock(&w->mutex);
+		if (retCode == ETIMEDOUT) {
+			ithread_mutex_lock(&tp->mutex);
+			expected = WS_SLEEPING;
+			if ((tp->totalThreads > tp->attr.minThreads ||
+			     tp->totalThreads > tp->attr.maxThreads) &&
+			    atomic_compare_exchange_strong(&w->state, &expected,
+			                                   WS_FREE)) {
+				goto exit_function;
+			}
+			ithread_mutex_unlock(&tp->mutex);
+		}
+		atomic_store(&w->state, WS_RUNNING);
+	}
+	ithread_mutex_lock(&tp->mutex);
+	atomic_store(&w->state, WS_FREE);
+
+	exit_function:
+	tp->totalThreads--;
+	atomic_fetch_sub(&ws->threads, 1);
+	ithread_cond_broadcast(&tp->start_and_shutdown);
+	ithread_mutex_unlock(&tp->mutex);
+	wsCurrentWorker = NULL;
+	ithread_cleanup_thread();
+
+	return NULL;
+}
+
+/*!
+ * \brief Reserves a free worker slot for a new thread.
+ *
+ * tp->mutex must be locked.
+ *
+ * \internal
+ *
+ * \return The slot or NULL if every slot is used.
+ */
+static WSWorker *WSClaimWorker(
+	/*! . */
+	ThreadPool *tp) {
+	struct ws_scheduler *ws = tp->ws;
+	int expected;
+	int i;
+
+	for (i = 0; i < ws->numWorkers; i++) {
+		expected = WS_FREE;
+		if (atomic_compare_exchange_strong(&ws->workers[i].state,
+		                                   &expected, WS_RUNNING)) {
+			return &ws->workers[i];
+		}
+	}
+
+	return NULL;
+}
+
+/* @} Work stealing scheduler */
+#endif /* TP_WORK_STEALING */
+
 /*!
  * \brief Implements a thread pool worker. Worker waits for a job to become
  * available. Worker picks up persistent jobs first, high priority,
@@ -613,6 +1304,20 @@ static int CreateWorker(
 	ithread_attr_init(&attr);
 	ithread_attr_setstacksize(&attr, tp->attr.stackSize);
 	ithread_attr_setdetachstate(&attr, ITHREAD_CREATE_DETACHED);
+#ifdef TP_WORK_STEALING
+	if (tp->ws) {
+		WSWorker *w = WSClaimWorker(tp);
+
+		if (w == NULL) {
+			ithread_attr_destroy(&attr);
+			return EMAXTHREADS;
+		}
+		rc = ithread_create(&temp, &attr, WSWorkerThread, w);
+		if (rc != 0) {
+			atomic_store(&w->state, WS_FREE);
+		}
+	} else
+#endif /* TP_WORK_STEALING */
 	rc = ithread_create(&temp, &attr, WorkerThread, tp);
 	ithread_attr_destroy(&attr);
 	if (rc == 0) {
@@ -667,6 +1372,238 @@ static void AddWorker(
 	}
 }
 
+#ifdef TP_WORK_STEALING
+/*!
+ * \brief Allocates the state of the work stealing scheduler.
+ *
+ * \internal
+ *
+ * \return 0 on success, EOUTOFMEM on failure.
+ */
+static int WSInit(
+	/*! . */
+	ThreadPool *tp) {
+	struct ws_scheduler *ws;
+	size_t capacity = 2;
+	int ret = 0;
+	int i;
+	int p;
+
+	while (capacity < (size_t) tp->attr.maxJobsTotal) {
+		capacity <<= 1;
+	}
+	ws = (struct ws_scheduler *) calloc(1, sizeof(struct ws_scheduler));
+	if (ws == NULL) {
+		return EOUTOFMEM;
+	}
+	ws->numWorkers = tp->attr.maxThreads;
+	ws->workers = (WSWorker *) calloc((size_t) ws->numWorkers,
+	                                  sizeof(WSWorker));
+	if (ws->workers == NULL) {
+		free(ws);
+		return EOUTOFMEM;
+	}
+	tp->ws = ws;
+	for (p = LOW_PRIORITY; p <= HIGH_PRIORITY; p++) {
+		ret += WSQueueInit(&ws->queues[p], capacity,
+		                   &ws->removedJobs);
+		atomic_init(&ws->currentJobs[p], 0);
+		atomic_init(&ws->totalJobs[p], 0);
+		atomic_init(&ws->totalWait[p], 0);
+	}
+	for (i = 0; i < ws->numWorkers; i++) {
+		ws->workers[i].tp = tp;
+		atomic_init(&ws->workers[i].state, WS_FREE);
+		ithread_mutex_init(&ws->workers[i].mutex, NULL);
+		ithread_cond_init(&ws->workers[i].cond, NULL);
+		for (p = LOW_PRIORITY; p <= HIGH_PRIORITY; p++) {
+			ret += WSQueueInit(&ws->workers[i].queues[p], capacity,
+			                   &ws->removedJobs);
+		}
+	}
+	atomic_init(&ws->queuedJobs, 0);
+	atomic_init(&ws->removedJobs, 0);
+	atomic_init(&ws->busyThreads, 0);
+	atomic_init(&ws->threads, 0);
+	atomic_init(&ws->nextJobId, 0);
+	atomic_init(&ws->shutdown, 0);
+	atomic_init(&ws->persistentPending, 0);
+	atomic_init(&ws->nextWake, 0u);
+
+	return ret ? EOUTOFMEM : 0;
+}
+
+/*!
+ * \brief Frees the queued jobs, calling their free functions.
+ *
+ * \internal
+ */
+static void WSDrain(
+	/*! . */
+	ThreadPool *tp) {
+	struct ws_scheduler *ws = tp->ws;
+	ThreadPoolJob *job;
+	int i;
+	int p;
+
+	for (p = LOW_PRIORITY; p <= HIGH_PRIORITY; p++) {
+		for (i = -1; i < ws->numWorkers; i++) {
+			WSQueue *q = i < 0 ? &ws->queues[p] :
+			                     &ws->workers[i].queues[p];
+
+			if (q->cells == NULL) {
+				continue;
+			}
+			while ((job = WSQueuePop(q)) != NULL) {
+				if (job->free_func) {
+					job->free_func(job->arg);
+				}
+				free(job);
+				atomic_fetch_sub(&ws->queuedJobs, 1);
+				atomic_fetch_sub(&ws->currentJobs[p], 1);
+			}
+		}
+	}
+}
+
+/*!
+ * \brief Releases the state of the work stealing scheduler. The workers
+ * must have exited.
+ *
+ * \internal
+ */
+static void WSDestroy(
+	/*! . */
+	ThreadPool *tp) {
+	struct ws_scheduler *ws = tp->ws;
+	int i;
+	int p;
+
+	if (ws == NULL) {
+		return;
+	}
+	WSDrain(tp);
+	for (i = 0; i < ws->numWorkers; i++) {
+		for (p = LOW_PRIORITY; p <= HIGH_PRIORITY; p++) {
+			free(ws->workers[i].queues[p].cells);
+		}
+		ithread_mutex_destroy(&ws->workers[i].mutex);
+		ithread_cond_destroy(&ws->workers[i].cond);
+	}
+	for (p = LOW_PRIORITY; p <= HIGH_PRIORITY; p++) {
+		free(ws->queues[p].cells);
+	}
+	free(ws->workers);
+	free(ws);
+	tp->ws = NULL;
+}
+
+/*!
+ * \brief Takes a queued job out of the queues of the work stealing
+ * scheduler.
+ *
+ * \internal
+ *
+ * \return The job or NULL if it is not queued.
+ */
+static ThreadPoolJob *WSRemove(
+	/*! . */
+	ThreadPool *tp,
+	/*! Id of the job. */
+	int jobId) {
+	struct ws_scheduler *ws = tp->ws;
+	ThreadPoolJob *job;
+	int i;
+	int p;
+
+	for (p = LOW_PRIORITY; p <= HIGH_PRIORITY; p++) {
+		for (i = -1; i < ws->numWorkers; i++) {
+			job = WSQueueRemove(i < 0 ? &ws->queues[p] :
+			                            &ws->workers[i].queues[p],
+			                    jobId);
+			if (job) {
+				atomic_fetch_sub(&ws->queuedJobs, 1);
+				atomic_fetch_sub(&ws->currentJobs[p], 1);
+				return job;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/*!
+ * \brief ThreadPoolAdd() for the work stealing scheduler.
+ *
+ * The pool mutex is only taken when a new worker must be created.
+ *
+ * \internal
+ */
+static int WSAdd(
+	/*! . */
+	ThreadPool *tp,
+	/*! . */
+	ThreadPoolJob *job,
+	/*! . */
+	int *jobId) {
+	struct ws_scheduler *ws = tp->ws;
+	ThreadPoolJob *temp;
+	WSWorker *self = wsCurrentWorker;
+	int totalJobs;
+	int threads;
+	int p = WSQueueIndex(job->priority);
+
+	*jobId = INVALID_JOB_ID;
+	/* The slots of the removed jobs stay in the queues until skipped. */
+	totalJobs = atomic_fetch_add(&ws->queuedJobs, 1) +
+	            atomic_load(&ws->removedJobs);
+	if (totalJobs >= tp->attr.maxJobsTotal) {
+		atomic_fetch_sub(&ws->queuedJobs, 1);
+		fprintf(stderr, "total jobs = %d, too many jobs", totalJobs);
+		return EOUTOFMEM;
+	}
+	temp = (ThreadPoolJob *) malloc(sizeof(ThreadPoolJob));
+	if (temp == NULL) {
+		atomic_fetch_sub(&ws->queuedJobs, 1);
+		return EOUTOFMEM;
+	}
+	*temp = *job;
+	/* Negative ids mark the free slots of the queues. */
+	temp->jobId = atomic_fetch_add(&ws->nextJobId, 1) & INT_MAX;
+	/* The job may run and be freed as soon as it is queued. */
+	*jobId = temp->jobId;
+	gettimeofday(&temp->requestTime, NULL);
+	atomic_fetch_add(&ws->currentJobs[p], 1);
+	/* A worker keeps the jobs it adds, the others may steal them. */
+	if (!WSQueuePush(self && self->tp == tp ? &self->queues[p] :
+	                                         &ws->queues[p], temp)) {
+		/* Cannot happen, every queue has maxJobsTotal slots and the
+		 * queued and removed jobs use fewer. */
+		atomic_fetch_sub(&ws->currentJobs[p], 1);
+		atomic_fetch_sub(&ws->queuedJobs, 1);
+		free(temp);
+		*jobId = INVALID_JOB_ID;
+		return EOUTOFMEM;
+	}
+	if (WSWakeOne(tp) ||
+	    atomic_load(&ws->threads) >= tp->attr.maxThreads) {
+		return 0;
+	}
+	/* No idle worker, add one if appropriate. */
+	ithread_mutex_lock(&tp->mutex);
+	threads = tp->totalThreads - tp->persistentThreads;
+	if (!tp->shutdown &&
+	    (threads <= 0 ||
+	     atomic_load(&ws->queuedJobs) / threads >= tp->attr.jobsPerThread ||
+	     atomic_load(&ws->busyThreads) >= threads)) {
+		CreateWorker(tp);
+	}
+	ithread_mutex_unlock(&tp->mutex);
+
+	return 0;
+}
+#endif /* TP_WORK_STEALING */
+
 int ThreadPoolInit(ThreadPool *tp, ThreadPoolAttr *attr) {
 	int retCode = 0;
 	int i = 0;
@@ -706,6 +1643,16 @@ int ThreadPoolInit(ThreadPool *tp, ThreadPoolAttr *attr) {
 	retCode += ListInit(&tp->highJobQ, CmpThreadPoolJob, NULL);
 	retCode += ListInit(&tp->medJobQ, CmpThreadPoolJob, NULL);
 	retCode += ListInit(&tp->lowJobQ, CmpThreadPoolJob, NULL);
+	tp->ws = NULL;
+#ifdef TP_WORK_STEALING
+	if (!retCode && tp->attr.scheduler == WORK_STEALING_SCHEDULER &&
+	    tp->attr.maxThreads > 0 && tp->attr.maxJobsTotal > 0) {
+		retCode += WSInit(tp);
+	}
+#endif /* TP_WORK_STEALING */
+	if (tp->ws == NULL) {
+		tp->attr.scheduler = SHARED_QUEUE_SCHEDULER;
+	}
 	if (retCode) {
 		retCode = EAGAIN;
 	} else {
@@ -768,6 +1715,12 @@ int ThreadPoolAddPersistent(ThreadPool *tp, ThreadPoolJob *job, int *jobId) {
 	tp->persistentJob = temp;
 
 	/* Notify a waiting thread */
+#ifdef TP_WORK_STEALING
+	if (tp->ws) {
+		atomic_store(&tp->ws->persistentPending, 1);
+		WSWakeOne(tp);
+	} else
+#endif /* TP_WORK_STEALING */
 	ithread_cond_signal(&tp->condition);
 
 	/* wait until long job has been picked up */
@@ -789,6 +1742,11 @@ int ThreadPoolAdd(ThreadPool *tp, ThreadPoolJob *job, int *jobId) {
 
 	if (!tp || !job)
 		return EINVAL;
+#ifdef TP_WORK_STEALING
+	if (tp->ws) {
+		return WSAdd(tp, job, jobId ? jobId : &tempId);
+	}
+#endif /* TP_WORK_STEALING */
 
 	ithread_mutex_lock(&tp->mutex);
 
@@ -842,6 +1800,16 @@ int ThreadPoolRemove(ThreadPool *tp, int jobId, ThreadPoolJob *out) {
 	if (!out)
 		out = &dummy;
 	dummy.jobId = jobId;
+#ifdef TP_WORK_STEALING
+	if (tp->ws && jobId >= 0) {
+		temp = WSRemove(tp, jobId);
+		if (temp) {
+			*out = *temp;
+			free(temp);
+			return 0;
+		}
+	}
+#endif /* TP_WORK_STEALING */
 
 	ithread_mutex_lock(&tp->mutex);
 
@@ -917,6 +1885,8 @@ int ThreadPoolSetAttr(ThreadPool *tp, ThreadPoolAttr *attr) {
 		ithread_mutex_unlock(&tp->mutex);
 		return INVALID_POLICY;
 	}
+	/* The scheduler of a running pool cannot be changed. */
+	temp.scheduler = tp->attr.scheduler;
 	tp->attr = temp;
 	/* add threads */
 	if (tp->totalThreads < tp->attr.minThreads) {
@@ -999,9 +1969,20 @@ int ThreadPoolShutdown(ThreadPool *tp) {
 	/* signal shutdown */
 	tp->shutdown = 1;
 	ithread_cond_broadcast(&tp->condition);
+#ifdef TP_WORK_STEALING
+	if (tp->ws) {
+		atomic_store(&tp->ws->shutdown, 1);
+		WSDrain(tp);
+		WSWakeAll(tp);
+	}
+#endif /* TP_WORK_STEALING */
 	/* wait for all threads to finish */
 	while (tp->totalThreads > 0)
 		ithread_cond_wait(&tp->start_and_shutdown, &tp->mutex);
+#ifdef TP_WORK_STEALING
+	/* Jobs added by the last running jobs. */
+	WSDestroy(tp);
+#endif /* TP_WORK_STEALING */
 	/* destroy condition */
 	while (ithread_cond_destroy(&tp->condition) != 0) {}
 	while (ithread_cond_destroy(&tp->start_and_shutdown) != 0) {}
@@ -1026,6 +2007,7 @@ int TPAttrInit(ThreadPoolAttr *attr) {
 	attr->schedPolicy = DEFAULT_POLICY;
 	attr->starvationTime = DEFAULT_STARVATION_TIME;
 	attr->maxJobsTotal = DEFAULT_MAX_JOBS_TOTAL;
+	attr->scheduler = DEFAULT_SCHEDULER;
 
 	return 0;
 }
@@ -1117,6 +2099,14 @@ int TPAttrSetSchedPolicy(ThreadPoolAttr *attr, PolicyType schedPolicy) {
 	return 0;
 }
 
+int TPAttrSetScheduler(ThreadPoolAttr *attr, SchedulerType scheduler) {
+	if (!attr)
+		return EINVAL;
+	attr->scheduler = scheduler;
+
+	return 0;
+}
+
 int TPAttrSetMaxJobsTotal(ThreadPoolAttr *attr, int maxJobsTotal) {
 	if (!attr)
 		return EINVAL;
@@ -1171,6 +2161,35 @@ int ThreadPoolGetStats(ThreadPool *tp, ThreadPoolStats *stats) {
 	stats->currentJobsHQ = (int) ListSize(&tp->highJobQ);
 	stats->currentJobsLQ = (int) ListSize(&tp->lowJobQ);
 	stats->currentJobsMQ = (int) ListSize(&tp->medJobQ);
+#ifdef TP_WORK_STEALING
+	if (tp->ws) {
+		struct ws_scheduler *ws = tp->ws;
+		int i;
+
+		stats->totalJobsHQ = atomic_load(&ws->totalJobs[HIGH_PRIORITY]);
+		stats->totalJobsMQ = atomic_load(&ws->totalJobs[MED_PRIORITY]);
+		stats->totalJobsLQ = atomic_load(&ws->totalJobs[LOW_PRIORITY]);
+		stats->avgWaitHQ = stats->totalJobsHQ > 0 ?
+			(double) atomic_load(&ws->totalWait[HIGH_PRIORITY]) /
+				(double) stats->totalJobsHQ : 0.0;
+		stats->avgWaitMQ = stats->totalJobsMQ > 0 ?
+			(double) atomic_load(&ws->totalWait[MED_PRIORITY]) /
+				(double) stats->totalJobsMQ : 0.0;
+		stats->avgWaitLQ = stats->totalJobsLQ > 0 ?
+			(double) atomic_load(&ws->totalWait[LOW_PRIORITY]) /
+				(double) stats->totalJobsLQ : 0.0;
+		stats->currentJobsHQ = atomic_load(&ws->currentJobs[HIGH_PRIORITY]);
+		stats->currentJobsMQ = atomic_load(&ws->currentJobs[MED_PRIORITY]);
+		stats->currentJobsLQ = atomic_load(&ws->currentJobs[LOW_PRIORITY]);
+		stats->workerThreads = atomic_load(&ws->busyThreads);
+		stats->idleThreads = 0;
+		for (i = 0; i < ws->numWorkers; i++) {
+			if (atomic_load(&ws->workers[i].state) == WS_SLEEPING) {
+				stats->idleThreads++;
+			}
+		}
+	}
+#endif /* TP_WORK_STEALING */
 
 	/* if not shutdown then release mutex */
 	if (!tp->shutdown)
@@ -37,6 +37,315 @@
 #include "TimerThread.h"
 
 #include <assert.h>
+#include <stdlib.h>
+
+#if defined(CLOCK_MONOTONIC) && !defined(WIN32)
+	/*! Event times are read from CLOCK_MONOTONIC. */
+	#define TIMER_MONOTONIC_CLOCK
+	#if !defined(__APPLE__)
+		/*! The condition variable can wait on CLOCK_MONOTONIC. */
+		#define TIMER_MONOTONIC_COND
+	#endif
+#endif
+
+/*! Initial number of heap slots and index buckets, a power of two. */
+#define TIMER_INITIAL_SIZE 64
+
+/*!
+ * \brief Returns the current time of the clock used for the event times,
+ * in milliseconds.
+ */
+static long long TimerNow(void) {
+#ifdef TIMER_MONOTONIC_CLOCK
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#else
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return (long long) tv.tv_sec * 1000 + tv.tv_usec / 1000;
+#endif
+}
+
+/*!
+ * \brief Converts an event time to the absolute timeout expected by
+ * ithread_cond_timedwait() on the timer condition.
+ */
+static void TimerWaitTime(
+	/*! [in] Valid timer thread pointer. */
+	TimerThread *timer,
+	/*! [in] Event time in milliseconds. */
+	long long eventTime,
+	/*! [out] Absolute timeout. */
+	struct timespec *timeToWait) {
+	long long target = eventTime;
+	struct timeval tv;
+
+	if (!timer->monotonicCond) {
+		/* The condition waits on the wall clock. */
+		gettimeofday(&tv, NULL);
+		target = (long long) tv.tv_sec * 1000 + tv.tv_usec / 1000 +
+		         (eventTime - TimerNow());
+	}
+	timeToWait->tv_sec = (time_t) (target / 1000);
+	timeToWait->tv_nsec = (long) (target % 1000) * 1000000;
+}
+
+/*!
+ * \brief Initializes the timer condition, on the monotonic clock when the
+ * platform supports it.
+ *
+ * \return 0 on success, error from ithread_cond_init on failure.
+ */
+static int TimerCondInit(
+	/*! [in] Valid timer thread pointer. */
+	TimerThread *timer) {
+#ifdef TIMER_MONOTONIC_COND
+	ithread_condattr_t attr;
+	int rc;
+#endif
+
+	timer->monotonicCond = 0;
+#ifdef TIMER_MONOTONIC_COND
+	if (pthread_condattr_init(&attr) == 0) {
+		if (pthread_condattr_setclock(&attr, CLOCK_MONOTONIC) == 0) {
+			rc = ithread_cond_init(&timer->condition, &attr);
+			pthread_condattr_destroy(&attr);
+			if (rc == 0)
+				timer->monotonicCond = 1;
+			return rc;
+		}
+		pthread_condattr_destroy(&attr);
+	}
+#endif
+
+	return ithread_cond_init(&timer->condition, NULL);
+}
+
+/*!
+ * \brief Heap order of the events: earliest time first, then scheduling
+ * order.
+ *
+ * \return Nonzero if \b a runs before \b b.
+ */
+static int EventBefore(
+	/*! [in] . */
+	const TimerEvent *a,
+	/*! [in] . */
+	const TimerEvent *b) {
+	if (a->eventTime != b->eventTime)
+		return a->eventTime < b->eventTime;
+
+	return a->id < b->id;
+}
+
+/*!
+ * \brief Stores an event in a heap slot.
+ */
+static void HeapSet(
+	/*! [in] Valid timer thread pointer. */
+	TimerThread *timer,
+	/*! [in] Heap slot. */
+	size_t pos,
+	/*! [in] Event. */
+	TimerEvent *event) {
+	timer->heap[pos] = event;
+	event->heapPos = pos;
+}
+
+/*!
+ * \brief Moves the event at \b pos towards the root until the heap is
+ * ordered.
+ */
+static void HeapSiftUp(
+	/*! [in] Valid timer thread pointer. */
+	TimerThread *timer,
+	/*! [in] Heap slot. */
+	size_t pos) {
+	TimerEvent *event = timer->heap[pos];
+	size_t parent;
+
+	while (pos > 0) {
+		parent = (pos - 1) / 2;
+		if (!EventBefore(event, timer->heap[parent]))
+			break;
+		HeapSet(timer, pos, timer->heap[parent]);
+		pos = parent;
+	}
+	HeapSet(timer, pos, event);
+}
+
+/*!
+ * \brief Moves the event at \b pos towards the leaves until the heap is
+ * ordered.
+ */
+static void HeapSiftDown(
+	/*! [in] Valid timer thread pointer. */
+	TimerThread *timer,
+	/*! [in] Heap slot. */
+	size_t pos) {
+	TimerEvent *event = timer->heap[pos];
+	size_t child;
+
+	while (1) {
+		child = 2 * pos + 1;
+		if (child >= timer->heapSize)
+			break;
+		if (child + 1 < timer->heapSize &&
+		    EventBefore(timer->heap[child + 1], timer->heap[child]))
+			child++;
+		if (!EventBefore(timer->heap[child], event))
+			break;
+		HeapSet(timer, pos, timer->heap[child]);
+		pos = child;
+	}
+	HeapSet(timer, pos, event);
+}
+
+/*!
+ * \brief Adds an event to the heap.
+ *
+ * \return 0 on success, EOUTOFMEM if the heap could not grow.
+ */
+static int HeapPush(
+	/*! [in] Valid timer thread pointer. */
+	TimerThread *timer,
+	/*! [in] Event. */
+	TimerEvent *event) {
+	TimerEvent **heap;
+	size_t capacity;
+
+	if (timer->heapSize == timer->heapCapacity) {
+		capacity = timer->heapCapacity * 2;
+		heap = (TimerEvent **) realloc(timer->heap,
+		                               capacity * sizeof(TimerEvent *));
+		if (heap == NULL)
+			return EOUTOFMEM;
+		timer->heap = heap;
+		timer->heapCapacity = capacity;
+	}
+	timer->heap[timer->heapSize] = event;
+	timer->heapSize++;
+	HeapSiftUp(timer, timer->heapSize - 1);
+
+	return 0;
+}
+
+/*!
+ * \brief Removes an event from the heap.
+ */
+static void HeapRemove(
+	/*! [in] Valid timer thread pointer. */
+	TimerThread *timer,
+	/*! [in] Event in the heap. */
+	TimerEvent *event) {
+	size_t pos = event->heapPos;
+	TimerEvent *last;
+
+	assert(pos < timer->heapSize && timer->heap[pos] == event);
+
+	timer->heapSize--;
+	if (pos == timer->heapSize)
+		return;
+	last = timer->heap[timer->heapSize];
+	HeapSet(timer, pos, last);
+	if (pos > 0 && EventBefore(last, timer->heap[(pos - 1) / 2]))
+		HeapSiftUp(timer, pos);
+	else
+		HeapSiftDown(timer, pos);
+}
+
+/*!
+ * \brief Returns the index bucket of an event id.
+ */
+static TimerEvent **IndexBucket(
+	/*! [in] Valid timer thread pointer. */
+	TimerThread *timer,
+	/*! [in] Event id. */
+	int id) {
+	return &timer->index[(size_t) (unsigned int) id & (timer->indexSize - 1)];
+}
+
+/*!
+ * \brief Adds an event to the id index.
+ *
+ * The index doubles when it holds as many events as buckets, if that fails
+ * the chains just get longer.
+ */
+static void IndexAdd(
+	/*! [in] Valid timer thread pointer. */
+	TimerThread *timer,
+	/*! [in] Event. */
+	TimerEvent *event) {
+	TimerEvent **oldIndex = timer->index;
+	size_t oldSize = timer->indexSize;
+	TimerEvent **bucket;
+	TimerEvent *temp;
+	size_t i;
+
+	if (timer->heapSize > oldSize) {
+		timer->index = (TimerEvent **) calloc(oldSize * 2,
+		                                      sizeof(TimerEvent *));
+		if (timer->index == NULL) {
+			timer->index = oldIndex;
+		} else {
+			timer->indexSize = oldSize * 2;
+			for (i = 0; i < oldSize; i++) {
+				while (oldIndex[i] != NULL) {
+					temp = oldIndex[i];
+					oldIndex[i] = temp->indexNext;
+					bucket = IndexBucket(timer, temp->id);
+					temp->indexNext = *bucket;
+					*bucket = temp;
+				}
+			}
+			free(oldIndex);
+		}
+	}
+	bucket = IndexBucket(timer, event->id);
+	event->indexNext = *bucket;
+	*bucket = event;
+}
+
+/*!
+ * \brief Removes an event from the id index.
+ */
+static void IndexRemove(
+	/*! [in] Valid timer thread pointer. */
+	TimerThread *timer,
+	/*! [in] Event in the index. */
+	TimerEvent *event) {
+	TimerEvent **link = IndexBucket(timer, event->id);
+
+	while (*link != NULL) {
+		if (*link == event) {
+			*link = event->indexNext;
+			event->indexNext = NULL;
+			return;
+		}
+		link = &(*link)->indexNext;
+	}
+}
+
+/*!
+ * \brief Looks up a pending event by id.
+ *
+ * \return The event, NULL if there is no pending event with this id.
+ */
+static TimerEvent *IndexFind(
+	/*! [in] Valid timer thread pointer. */
+	TimerThread *timer,
+	/*! [in] Event id. */
+	int id) {
+	TimerEvent *temp = *IndexBucket(timer, id);
+
+	while (temp != NULL && temp->id != id)
+		temp = temp->indexNext;
+
+	return temp;
+}
 
 /*!
  * \brief Deallocates a dynamically allocated TimerEvent.
@@ -60,10 +369,8 @@ static void *TimerThreadWorker(
 	/*! [in] arg is cast to (TimerThread *). */
 	void *arg) {
 	TimerThread *timer = (TimerThread *) arg;
-	ListNode *head = NULL;
 	TimerEvent *nextEvent = NULL;
-	time_t currentTime = 0;
-	time_t nextEventTime = 0;
+	long long currentTime = 0;
 	struct timespec timeToWait;
 	int tempId;
 
@@ -81,18 +388,13 @@ static void *TimerThreadWorker(
 		}
 		nextEvent = NULL;
 		/* Get the next event if possible. */
-		if (timer->eventQ.size > 0) {
-			head = ListHead(&timer->eventQ);
-			if (head == NULL) {
-				ithread_mutex_unlock(&timer->mutex);
-				return NULL;
-			}
-			nextEvent = (TimerEvent *) head->item;
-			nextEventTime = nextEvent->eventTime;
-		}
-		currentTime = time(NULL);
+		if (timer->heapSize > 0)
+			nextEvent = timer->heap[0];
+		currentTime = TimerNow();
 		/* If time has elapsed, schedule job. */
-		if (nextEvent && currentTime >= nextEventTime) {
+		if (nextEvent && currentTime >= nextEvent->eventTime) {
+			HeapRemove(timer, nextEvent);
+			IndexRemove(timer, nextEvent);
 			if (nextEvent->persistent) {
 				if (ThreadPoolAddPersistent(timer->tp, &nextEvent->job, &tempId) != 0) {
 					if (nextEvent->job.arg != NULL && nextEvent->job.free_func != NULL) {
@@ -106,13 +408,11 @@ static void *TimerThreadWorker(
 					}
 				}
 			}
-			ListDelNode(&timer->eventQ, head, 0);
 			FreeTimerEvent(timer, nextEvent);
 			continue;
 		}
 		if (nextEvent) {
-			timeToWait.tv_nsec = 0;
-			timeToWait.tv_sec = (long) nextEvent->eventTime;
+			TimerWaitTime(timer, nextEvent->eventTime, &timeToWait);
 			ithread_cond_timedwait(&timer->condition, &timer->mutex,
 			                       &timeToWait);
 		} else {
@@ -122,29 +422,22 @@ static void *TimerThreadWorker(
 }
 
 /*!
- * \brief Calculates the appropriate timeout in absolute seconds
- * since Jan 1, 1970.
+ * \brief Calculates the event time of a timeout, in milliseconds on the
+ * timer clock.
  *
- * \return 
+ * \return The event time.
  */
-static int CalculateEventTime(
+static long long CalculateEventTime(
 	/*! [in] Timeout. */
-	time_t *timeout,
+	time_t timeout,
 	/*! [in] Timeout type. */
 	TimeoutType type) {
-	time_t now;
-
-	assert(timeout != NULL);
-
 	switch (type) {
-		case ABS_SEC:return 0;
+		case ABS_SEC:
+			return TimerNow() + ((long long) timeout - (long long) time(NULL)) * 1000;
 		default: /* REL_SEC) */
-			time(&now);
-			(*timeout) += now;
-			return 0;
+			return TimerNow() + (long long) timeout * 1000;
 	}
-
-	return -1;
 }
 
 /*!
@@ -159,8 +452,8 @@ static TimerEvent *CreateTimerEvent(
 	ThreadPoolJob *job,
 	/*! [in] . */
 	Duration persistent,
-	/*! [in] The absoule time of the event in seconds from Jan, 1970. */
-	time_t eventTime,
+	/*! [in] The time of the event in milliseconds on the timer clock. */
+	long long eventTime,
 	/*! [in] Id of job. */
 	int id) {
 	TimerEvent *temp = NULL;
@@ -175,10 +468,62 @@ static TimerEvent *CreateTimerEvent(
 	temp->persistent = persistent;
 	temp->eventTime = eventTime;
 	temp->id = id;
+	temp->heapPos = 0;
+	temp->indexNext = NULL;
 
 	return temp;
 }
 
+/*!
+ * \brief Queues an event at an event time.
+ *
+ * \return 0 on success, EOUTOFMEM if not enough memory to schedule job.
+ */
+static int ScheduleEvent(
+	/*! [in] Valid timer thread pointer. */
+	TimerThread *timer,
+	/*! [in] The time of the event in milliseconds on the timer clock. */
+	long long eventTime,
+	/*! [in] Valid Thread pool job. */
+	ThreadPoolJob *job,
+	/*! [in] . */
+	Duration duration,
+	/*! [in] Id of timer event. (out, can be null). */
+	int *id) {
+	int rc = EOUTOFMEM;
+	int tempId = 0;
+	TimerEvent *newEvent = NULL;
+
+	ithread_mutex_lock(&timer->mutex);
+
+	if (id == NULL)
+		id = &tempId;
+
+	(*id) = INVALID_EVENT_ID;
+
+	newEvent = CreateTimerEvent(timer, job, duration, eventTime,
+	                            timer->lastEventId);
+
+	if (newEvent == NULL) {
+		ithread_mutex_unlock(&timer->mutex);
+		return rc;
+	}
+
+	rc = HeapPush(timer, newEvent);
+	if (rc == 0) {
+		IndexAdd(timer, newEvent);
+		/* signal a new head of the heap. */
+		if (newEvent->heapPos == 0)
+			ithread_cond_signal(&timer->condition);
+		(*id) = timer->lastEventId++;
+	} else {
+		FreeTimerEvent(timer, newEvent);
+	}
+	ithread_mutex_unlock(&timer->mutex);
+
+	return rc;
+}
+
 int TimerThreadInit(TimerThread *timer, ThreadPool *tp) {
 
 	int rc = 0;
@@ -199,7 +544,7 @@ int TimerThreadInit(TimerThread *timer, ThreadPool *tp) {
 	rc += ithread_mutex_lock(&timer->mutex);
 	assert(rc == 0);
 
-	rc += ithread_cond_init(&timer->condition, NULL);
+	rc += TimerCondInit(timer);
 	assert(rc == 0);
 
 	rc += FreeListInit(&timer->freeEvents, sizeof(TimerEvent), 100);
@@ -208,11 +553,13 @@ int TimerThreadInit(TimerThread *timer, ThreadPool *tp) {
 	timer->shutdown = 0;
 	timer->tp = tp;
 	timer->lastEventId = 0;
-	rc += ListInit(&timer->eventQ, NULL, NULL);
-
-	assert(rc == 0);
+	timer->heapSize = 0;
+	timer->heapCapacity = TIMER_INITIAL_SIZE;
+	timer->heap = (TimerEvent **) malloc(TIMER_INITIAL_SIZE * sizeof(TimerEvent *));
+	timer->indexSize = TIMER_INITIAL_SIZE;
+	timer->index = (TimerEvent **) calloc(TIMER_INITIAL_SIZE, sizeof(TimerEvent *));
 
-	if (rc != 0) {
+	if (rc != 0 || timer->heap == NULL || timer->index == NULL) {
 		rc = EAGAIN;
 	} else {
 
@@ -228,7 +575,10 @@ int TimerThreadInit(TimerThread *timer, ThreadPool *tp) {
 		ithread_cond_destroy(&timer->condition);
 		ithread_mutex_destroy(&timer->mutex);
 		FreeListDestroy(&timer->freeEvents);
-		ListDestroy(&timer->eventQ, 0);
+		free(timer->heap);
+		free(timer->index);
+		timer->heap = NULL;
+		timer->index = NULL;
 	}
 
 	return rc;
@@ -241,14 +591,6 @@ int TimerThreadSchedule(
 	ThreadPoolJob *job,
 	Duration duration,
 	int *id) {
-	int rc = EOUTOFMEM;
-	int found = 0;
-	int tempId = 0;
-
-	ListNode *tempNode = NULL;
-	TimerEvent *temp = NULL;
-	TimerEvent *newEvent = NULL;
-
 	assert(timer != NULL);
 	assert(job != NULL);
 
@@ -256,50 +598,24 @@ int TimerThreadSchedule(
 		return EINVAL;
 	}
 
-	CalculateEventTime(&timeout, type);
-	ithread_mutex_lock(&timer->mutex);
-
-	if (id == NULL)
-		id = &tempId;
-
-	(*id) = INVALID_EVENT_ID;
-
-	newEvent = CreateTimerEvent(timer, job, duration, timeout,
-	                            timer->lastEventId);
+	return ScheduleEvent(timer, CalculateEventTime(timeout, type), job,
+	                     duration, id);
+}
 
-	if (newEvent == NULL) {
-		ithread_mutex_unlock(&timer->mutex);
-		return rc;
-	}
+int TimerThreadScheduleMs(
+	TimerThread *timer,
+	long timeoutMs,
+	ThreadPoolJob *job,
+	Duration duration,
+	int *id) {
+	assert(timer != NULL);
+	assert(job != NULL);
 
-	tempNode = ListHead(&timer->eventQ);
-	/* add job to Q. Q is ordered by eventTime with the head of the Q being
-	 * the next event. */
-	while (tempNode != NULL) {
-		temp = (TimerEvent *) tempNode->item;
-		if (temp->eventTime >= timeout) {
-			if (ListAddBefore(&timer->eventQ, newEvent, tempNode))
-				rc = 0;
-			found = 1;
-			break;
-		}
-		tempNode = ListNext(&timer->eventQ, tempNode);
-	}
-	/* add to the end of Q. */
-	if (!found) {
-		if (ListAddTail(&timer->eventQ, newEvent) != NULL)
-			rc = 0;
-	}
-	/* signal change in Q. */
-	if (rc == 0) {
-		ithread_cond_signal(&timer->condition);
-	} else {
-		FreeTimerEvent(timer, newEvent);
+	if ((timer == NULL) || (job == NULL)) {
+		return EINVAL;
 	}
-	(*id) = timer->lastEventId++;
-	ithread_mutex_unlock(&timer->mutex);
 
-	return rc;
+	return ScheduleEvent(timer, TimerNow() + timeoutMs, job, duration, id);
 }
 
 int TimerThreadRemove(
@@ -307,7 +623,6 @@ int TimerThreadRemove(
 	int id,
 	ThreadPoolJob *out) {
 	int rc = INVALID_EVENT_ID;
-	ListNode *tempNode = NULL;
 	TimerEvent *temp = NULL;
 
 	assert(timer != NULL);
@@ -318,20 +633,14 @@ int TimerThreadRemove(
 
 	ithread_mutex_lock(&timer->mutex);
 
-	tempNode = ListHead(&timer->eventQ);
-
-	while (tempNode != NULL) {
-		temp = (TimerEvent *) tempNode->item;
-		if (temp->id == id) {
-
-			ListDelNode(&timer->eventQ, tempNode, 0);
-			if (out != NULL)
-				(*out) = temp->job;
-			FreeTimerEvent(timer, temp);
-			rc = 0;
-			break;
-		}
-		tempNode = ListNext(&timer->eventQ, tempNode);
+	temp = IndexFind(timer, id);
+	if (temp != NULL) {
+		HeapRemove(timer, temp);
+		IndexRemove(timer, temp);
+		if (out != NULL)
+			(*out) = temp->job;
+		FreeTimerEvent(timer, temp);
+		rc = 0;
 	}
 
 	ithread_mutex_unlock(&timer->mutex);
@@ -339,8 +648,7 @@ int TimerThreadRemove(
 }
 
 int TimerThreadShutdown(TimerThread *timer) {
-	ListNode *tempNode2 = NULL;
-	ListNode *tempNode = NULL;
+	size_t i;
 
 	assert(timer != NULL);
 
@@ -351,22 +659,22 @@ int TimerThreadShutdown(TimerThread *timer) {
 	ithread_mutex_lock(&timer->mutex);
 
 	timer->shutdown = 1;
-	tempNode = ListHead(&timer->eventQ);
 
-	/* Delete nodes in Q. Call registered free function on argument. */
-	while (tempNode != NULL) {
-		TimerEvent *temp = (TimerEvent *) tempNode->item;
+	/* Delete events in the heap. Call registered free function on
+	 * argument. */
+	for (i = 0; i < timer->heapSize; i++) {
+		TimerEvent *temp = timer->heap[i];
 
-		tempNode2 = ListNext(&timer->eventQ, tempNode);
-		ListDelNode(&timer->eventQ, tempNode, 0);
 		if (temp->job.free_func) {
 			temp->job.free_func(temp->job.arg);
 		}
 		FreeTimerEvent(timer, temp);
-		tempNode = tempNode2;
 	}
-
-	ListDestroy(&timer->eventQ, 0);
+	timer->heapSize = 0;
+	free(timer->heap);
+	free(timer->index);
+	timer->heap = NULL;
+	timer->index = NULL;
 	FreeListDestroy(&timer->freeEvents);
 
 	ithread_cond_broadcast(&timer->condition);
@@ -386,4 +694,3 @@ int TimerThreadShutdown(TimerThread *timer) {
 
 	return 0;
 }
-
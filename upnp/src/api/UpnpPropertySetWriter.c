@@ -0,0 +1,146 @@
+/*!
+ * \addtogroup UpnpPropertySetWriter
+ *
+ * @{
+ *
+ * \file
+ *
+ * \brief UpnpPropertySetWriter object implementation.
+ */
+
+#include "../include/config.h"
+
+#include "UpnpPropertySetWriter.h"
+
+#include "gena.h"
+#include "membuffer.h"
+#include "upnp.h"
+
+#include <string.h>
+
+/*! End of the property set, kept at the end of the buffer. */
+#define PROPERTYSET_FOOTER "</e:propertyset>\n\n"
+
+/*!
+ * \brief Internal implementation of the class UpnpPropertySetWriter.
+ *
+ * \internal
+ */
+struct SUpnpPropertySetWriter {
+	/*! \brief The property set, a complete document at any time. */
+	membuffer m_buffer;
+};
+
+UpnpPropertySetWriter *UpnpPropertySetWriter_new(void) {
+	struct SUpnpPropertySetWriter *p =
+		malloc(sizeof(struct SUpnpPropertySetWriter));
+
+	if (p == NULL)
+		return NULL;
+	membuffer_init(&p->m_buffer);
+	if (membuffer_assign_str(&p->m_buffer, XML_PROPERTYSET_HEADER
+	                         PROPERTYSET_FOOTER) != 0) {
+		free(p);
+		return NULL;
+	}
+
+	return (UpnpPropertySetWriter *) p;
+}
+
+void UpnpPropertySetWriter_delete(UpnpPropertySetWriter *p) {
+	struct SUpnpPropertySetWriter *q = (struct SUpnpPropertySetWriter *) p;
+
+	if (!q) return;
+
+	membuffer_destroy(&q->m_buffer);
+	free(q);
+}
+
+/*!
+ * \brief Truncates the buffer, keeping its memory for the next variables.
+ */
+static void truncate_buffer(
+	/*! [in] Buffer. */
+	membuffer *m,
+	/*! [in] New length, not above the current one. */
+	size_t length) {
+	m->length = length;
+	m->buf[length] = '\0';
+}
+
+void UpnpPropertySetWriter_clear(UpnpPropertySetWriter *p) {
+	struct SUpnpPropertySetWriter *q = (struct SUpnpPropertySetWriter *) p;
+
+	/* the header, then the footer */
+	truncate_buffer(&q->m_buffer, strlen(XML_PROPERTYSET_HEADER));
+	membuffer_append_str(&q->m_buffer, PROPERTYSET_FOOTER);
+}
+
+/*!
+ * \brief Appends a string to a buffer, escaping the characters that are
+ * special in XML.
+ *
+ * \return 0 if successful, UPNP_E_OUTOF_MEMORY otherwise.
+ */
+static int append_escaped(
+	/*! [in] Buffer. */
+	membuffer *m,
+	/*! [in] String. */
+	const char *s) {
+	const char *run = s;
+	const char *entity;
+
+	for (; *s != '\0'; s++) {
+		switch (*s) {
+			case '<': entity = "&lt;"; break;
+			case '>': entity = "&gt;"; break;
+			case '&': entity = "&amp;"; break;
+			case '"': entity = "&quot;"; break;
+			case '\'': entity = "&apos;"; break;
+			default: continue;
+		}
+		if (membuffer_append(m, run, (size_t) (s - run)) != 0 ||
+		    membuffer_append_str(m, entity) != 0)
+			return UPNP_E_OUTOF_MEMORY;
+		run = s + 1;
+	}
+
+	return membuffer_append(m, run, (size_t) (s - run));
+}
+
+int UpnpPropertySetWriter_add(UpnpPropertySetWriter *p, const char *VarName,
+                              const char *Value) {
+	struct SUpnpPropertySetWriter *q = (struct SUpnpPropertySetWriter *) p;
+	size_t length;
+
+	if (q == NULL || VarName == NULL || Value == NULL)
+		return UPNP_E_INVALID_PARAM;
+	/* the variable replaces the footer, which is then appended again */
+	length = q->m_buffer.length - strlen(PROPERTYSET_FOOTER);
+	truncate_buffer(&q->m_buffer, length);
+	if (membuffer_append_str(&q->m_buffer, "<e:property>\n<") != 0 ||
+	    membuffer_append_str(&q->m_buffer, VarName) != 0 ||
+	    membuffer_append_str(&q->m_buffer, ">") != 0 ||
+	    append_escaped(&q->m_buffer, Value) != 0 ||
+	    membuffer_append_str(&q->m_buffer, "</") != 0 ||
+	    membuffer_append_str(&q->m_buffer, VarName) != 0 ||
+	    membuffer_append_str(&q->m_buffer, ">\n</e:property>\n"
+	                         PROPERTYSET_FOOTER) != 0) {
+		/* back to the property set without the variable */
+		truncate_buffer(&q->m_buffer, length);
+		membuffer_append_str(&q->m_buffer, PROPERTYSET_FOOTER);
+		return UPNP_E_OUTOF_MEMORY;
+	}
+
+	return UPNP_E_SUCCESS;
+}
+
+const char *UpnpPropertySetWriter_get_String(const UpnpPropertySetWriter *p) {
+	return ((const struct SUpnpPropertySetWriter *) p)->m_buffer.buf;
+}
+
+size_t UpnpPropertySetWriter_get_Length(const UpnpPropertySetWriter *p) {
+	return ((const struct SUpnpPropertySetWriter *) p)->m_buffer.length;
+}
+
+/* @} UpnpPropertySetWriter */
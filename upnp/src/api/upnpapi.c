@@ -50,6 +50,7 @@
 
 /* Needed for GENA */
 #include "../include/gena.h"
+#include "../include/gena_device.h"
 
 #ifdef INTERNAL_WEB_SERVER
 	#include "../include/urlconfig.h"
@@ -228,6 +229,35 @@ static int UpnpInitMutexes(void) {
 	if (ithread_mutex_init(&gUUIDMutex, NULL) != 0) {
 		return UPNP_E_INIT_FAILED;
 	}
+	if (http_InitSendStats() != 0) {
+		return UPNP_E_INIT_FAILED;
+	}
+#if EXCLUDE_SSDP == 0
+	if (SsdpInitServerLocks() != UPNP_E_SUCCESS) {
+		return UPNP_E_INIT_FAILED;
+	}
+#endif
+#if EXCLUDE_SSDP == 0 && defined(INCLUDE_DEVICE_APIS)
+	if (SsdpInitSendLocks() != UPNP_E_SUCCESS) {
+		return UPNP_E_INIT_FAILED;
+	}
+#endif
+#if EXCLUDE_MINISERVER == 0
+	if (InitMiniServerLocks() != UPNP_E_SUCCESS) {
+		return UPNP_E_INIT_FAILED;
+	}
+#endif
+#if EXCLUDE_GENA == 0 && defined(INCLUDE_DEVICE_APIS)
+	if (genaInitStateVarLocks() != UPNP_E_SUCCESS) {
+		return UPNP_E_INIT_FAILED;
+	}
+	if (genaConnPoolInit() != UPNP_E_SUCCESS) {
+		return UPNP_E_INIT_FAILED;
+	}
+	if (genaDeliveryInit() != UPNP_E_SUCCESS) {
+		return UPNP_E_INIT_FAILED;
+	}
+#endif
 	/* initialize subscribe mutex. */
 #ifdef INCLUDE_CLIENT_APIS
 	if (ithread_mutex_init(&GlobalClientSubscribeMutex, NULL) != 0) {
@@ -254,6 +284,7 @@ static int UpnpInitThreadPools(void) {
 	TPAttrSetJobsPerThread(&attr, JOBS_PER_THREAD);
 	TPAttrSetIdleTime(&attr, THREAD_IDLE_TIME);
 	TPAttrSetMaxJobsTotal(&attr, MAX_JOBS_TOTAL);
+	TPAttrSetScheduler(&attr, THREAD_POOL_SCHEDULER);
 
 	if (ThreadPoolInit(&gSendThreadPool, &attr) != UPNP_E_SUCCESS) {
 		ret = UPNP_E_INIT_FAILED;
@@ -559,6 +590,56 @@ void PrintThreadPoolStats(
 		stats.totalWorkTime,
 		stats.totalIdleTime);
 }
+
+/*!
+ * \brief Prints the counters of the HTTP messages sent.
+ */
+static void PrintHttpSendStats(void)
+{
+	HttpSendStats stats;
+	http_GetSendStats(&stats);
+	UpnpPrintf(UPNP_INFO, API, __FILE__, __LINE__,
+		"HTTP Messages Sent: %lu\n"
+		"Write System Calls: %lu\n",
+		stats.messages,
+		stats.syscalls);
+}
+
+#if EXCLUDE_SSDP == 0
+/*!
+ * \brief Prints the counters of the SSDP datagrams received.
+ */
+static void PrintSsdpRecvStats(void)
+{
+	SsdpRecvStats stats;
+	SsdpGetRecvStats(&stats);
+	UpnpPrintf(UPNP_INFO, API, __FILE__, __LINE__,
+		"SSDP Datagrams Filtered: %lu\n"
+		"SSDP Datagrams Dispatched: %lu\n",
+		stats.filtered,
+		stats.dispatched);
+}
+#endif
+
+#if EXCLUDE_GENA == 0 && defined(INCLUDE_DEVICE_APIS)
+/*!
+ * \brief Prints the counters of the GENA connection pool.
+ */
+static void PrintGenaConnPoolStats(void)
+{
+	GenaConnPoolStats stats;
+	genaGetConnPoolStats(&stats);
+	UpnpPrintf(UPNP_INFO, API, __FILE__, __LINE__,
+		"GENA Connections Opened: %lu\n"
+		"GENA Connections Reused: %lu\n"
+		"GENA Connections Stale: %lu\n"
+		"GENA Connections Evicted: %lu\n",
+		stats.connects,
+		stats.reuses,
+		stats.stale,
+		stats.evictions);
+}
+#endif
 #else
 static UPNP_INLINE void PrintThreadPoolStats(ThreadPool *tp,
                                              const char *DbgFileName, int DbgLineNo, const char *msg) {
@@ -568,6 +649,15 @@ static UPNP_INLINE void PrintThreadPoolStats(ThreadPool *tp,
 	DbgLineNo = DbgLineNo;
 	msg = msg;
 }
+
+static UPNP_INLINE void PrintHttpSendStats(void) {
+}
+
+static UPNP_INLINE void PrintGenaConnPoolStats(void) {
+}
+
+static UPNP_INLINE void PrintSsdpRecvStats(void) {
+}
 #endif /* DEBUG */
 
 int UpnpFinish(void) {
@@ -592,6 +682,10 @@ int UpnpFinish(void) {
 	                     "Recv Thread Pool");
 	PrintThreadPoolStats(&gMiniServerThreadPool, __FILE__, __LINE__,
 	                     "MiniServer Thread Pool");
+	PrintHttpSendStats();
+#if EXCLUDE_SSDP == 0
+	PrintSsdpRecvStats();
+#endif
 #ifdef INCLUDE_DEVICE_APIS
 	switch (GetDeviceHandleInfo(AF_INET, &device_handle, &temp)) {
 		case HND_DEVICE: UpnpUnRegisterRootDevice(device_handle);
@@ -603,6 +697,9 @@ int UpnpFinish(void) {
 			break;
 		default: break;
 	}
+#if EXCLUDE_GENA == 0
+	genaSetSubscriptionSnapshot(NULL);
+#endif
 #endif
 #ifdef INCLUDE_CLIENT_APIS
 	switch (GetClientHandleInfo(&client_handle, &temp)) {
@@ -615,6 +712,9 @@ int UpnpFinish(void) {
 #if EXCLUDE_MINISERVER == 0
 	StopMiniServer();
 #endif
+#if EXCLUDE_SSDP == 0
+	SsdpFreeRecvRing();
+#endif
 #if EXCLUDE_WEB_SERVER == 0
 	web_server_destroy();
 #endif
@@ -622,14 +722,39 @@ int UpnpFinish(void) {
 	PrintThreadPoolStats(&gMiniServerThreadPool, __FILE__, __LINE__,
 	                     "MiniServer Thread Pool");
 	ThreadPoolShutdown(&gRecvThreadPool);
+#if EXCLUDE_GENA == 0 && defined(INCLUDE_DEVICE_APIS)
+	genaDeliveryShutdown();
+#endif
 	PrintThreadPoolStats(&gSendThreadPool, __FILE__, __LINE__,
 	                     "Send Thread Pool");
 	ThreadPoolShutdown(&gSendThreadPool);
 	PrintThreadPoolStats(&gRecvThreadPool, __FILE__, __LINE__,
 	                     "Recv Thread Pool");
+#if EXCLUDE_GENA == 0 && defined(INCLUDE_DEVICE_APIS)
+	PrintGenaConnPoolStats();
+	genaConnPoolShutdown();
+#endif
+#if EXCLUDE_SSDP == 0 && defined(INCLUDE_DEVICE_APIS)
+	SsdpCloseSendSockets();
+#endif
 #ifdef INCLUDE_CLIENT_APIS
 	ithread_mutex_destroy(&GlobalClientSubscribeMutex);
 #endif
+#if EXCLUDE_GENA == 0 && defined(INCLUDE_DEVICE_APIS)
+	genaDeliveryDestroy();
+	genaConnPoolDestroy();
+	genaDestroyStateVarLocks();
+#endif
+#if EXCLUDE_SSDP == 0 && defined(INCLUDE_DEVICE_APIS)
+	SsdpDestroySendLocks();
+#endif
+#if EXCLUDE_SSDP == 0
+	SsdpDestroyServerLocks();
+#endif
+#if EXCLUDE_MINISERVER == 0
+	DestroyMiniServerLocks();
+#endif
+	http_DestroySendStats();
 	ithread_rwlock_destroy(&GlobalHndRWLock);
 	ithread_mutex_destroy(&gUUIDMutex);
 	/* remove all virtual dirs */
@@ -802,6 +927,9 @@ int UpnpRegisterRootDevice(
 #endif /* INCLUDE_CLIENT_APIS */
 	HInfo->MaxSubscriptions = UPNP_INFINITE;
 	HInfo->MaxSubscriptionTimeOut = UPNP_INFINITE;
+	HInfo->CoalesceEvents = 0;
+	HInfo->SubscriptionSweepAt = 0;
+	HInfo->ModerationFlushAt = 0;
 	HInfo->DeviceAf = AF_INET;
 
 	retVal = UpnpDownloadXmlDoc(HInfo->DescURL, &(HInfo->DescDocument));
@@ -841,6 +969,23 @@ int UpnpRegisterRootDevice(
 		           "UpnpRegisterRootDevice: No services found for RootDevice\n");
 	}
 
+#if EXCLUDE_SSDP == 0
+	HInfo->SsdpPackets = SsdpCreatePacketCache(*Hnd, HInfo->DeviceList);
+	if (!HInfo->SsdpPackets) {
+#ifdef INCLUDE_CLIENT_APIS
+		ListDestroy(&HInfo->SsdpSearchList, 0);
+#endif /* INCLUDE_CLIENT_APIS */
+		ixmlNodeList_free(HInfo->ServiceList);
+		ixmlNodeList_free(HInfo->DeviceList);
+		ixmlDocument_free(HInfo->DescDocument);
+		FreeHandle(*Hnd);
+		UpnpPrintf(UPNP_CRITICAL, API, __FILE__, __LINE__,
+		           "UpnpRegisterRootDevice: Out of memory for the SSDP packets\n");
+		retVal = UPNP_E_OUTOF_MEMORY;
+		goto exit_function;
+	}
+#endif /* EXCLUDE_SSDP */
+
 #if EXCLUDE_GENA == 0
 	/*
 	 * GENA SET UP
@@ -857,6 +1002,7 @@ int UpnpRegisterRootDevice(
 		           "UpnpRegisterRootDevice: GENA Service Table\n"
 			           "Here are the known services:\n");
 		printServiceTable(&HInfo->ServiceTable, UPNP_ALL, API);
+		genaLoadSubscriptions(*Hnd, HInfo);
 	} else {
 		UpnpPrintf(UPNP_ALL, API, __FILE__, __LINE__,
 		           "\nUpnpRegisterRootDevice: Empty service table\n");
@@ -864,6 +1010,9 @@ int UpnpRegisterRootDevice(
 #endif /* EXCLUDE_GENA */
 
 	UpnpSdkDeviceRegisteredV4 = 1;
+#if EXCLUDE_SSDP == 0
+	SsdpUpdateHandleSnapshot();
+#endif
 
 	retVal = UPNP_E_SUCCESS;
 
@@ -973,6 +1122,9 @@ int UpnpRegisterRootDevice2(
 #endif /* INCLUDE_CLIENT_APIS */
 	HInfo->MaxSubscriptions = UPNP_INFINITE;
 	HInfo->MaxSubscriptionTimeOut = UPNP_INFINITE;
+	HInfo->CoalesceEvents = 0;
+	HInfo->SubscriptionSweepAt = 0;
+	HInfo->ModerationFlushAt = 0;
 	HInfo->DeviceAf = AF_INET;
 
 	UpnpPrintf(UPNP_ALL, API, __FILE__, __LINE__,
@@ -1001,6 +1153,23 @@ int UpnpRegisterRootDevice2(
 		           "UpnpRegisterRootDevice2: No services found for RootDevice\n");
 	}
 
+#if EXCLUDE_SSDP == 0
+	HInfo->SsdpPackets = SsdpCreatePacketCache(*Hnd, HInfo->DeviceList);
+	if (!HInfo->SsdpPackets) {
+#ifdef INCLUDE_CLIENT_APIS
+		ListDestroy(&HInfo->SsdpSearchList, 0);
+#endif /* INCLUDE_CLIENT_APIS */
+		ixmlNodeList_free(HInfo->ServiceList);
+		ixmlNodeList_free(HInfo->DeviceList);
+		ixmlDocument_free(HInfo->DescDocument);
+		FreeHandle(*Hnd);
+		UpnpPrintf(UPNP_CRITICAL, API, __FILE__, __LINE__,
+		           "UpnpRegisterRootDevice2: Out of memory for the SSDP packets\n");
+		retVal = UPNP_E_OUTOF_MEMORY;
+		goto exit_function;
+	}
+#endif /* EXCLUDE_SSDP */
+
 #if EXCLUDE_GENA == 0
 	/*
 	 * GENA SET UP
@@ -1017,6 +1186,7 @@ int UpnpRegisterRootDevice2(
 		           "UpnpRegisterRootDevice2: GENA Service Table\n"
 			           "Here are the known services: \n");
 		printServiceTable(&HInfo->ServiceTable, UPNP_ALL, API);
+		genaLoadSubscriptions(*Hnd, HInfo);
 	} else {
 		UpnpPrintf(UPNP_ALL, API, __FILE__, __LINE__,
 		           "\nUpnpRegisterRootDevice2: Empty service table\n");
@@ -1024,6 +1194,9 @@ int UpnpRegisterRootDevice2(
 #endif /* EXCLUDE_GENA */
 
 	UpnpSdkDeviceRegisteredV4 = 1;
+#if EXCLUDE_SSDP == 0
+	SsdpUpdateHandleSnapshot();
+#endif
 
 	retVal = UPNP_E_SUCCESS;
 
@@ -1135,6 +1308,9 @@ int UpnpRegisterRootDevice4(
 #endif /* INCLUDE_CLIENT_APIS */
 	HInfo->MaxSubscriptions = UPNP_INFINITE;
 	HInfo->MaxSubscriptionTimeOut = UPNP_INFINITE;
+	HInfo->CoalesceEvents = 0;
+	HInfo->SubscriptionSweepAt = 0;
+	HInfo->ModerationFlushAt = 0;
 	HInfo->DeviceAf = AddressFamily;
 	retVal = UpnpDownloadXmlDoc(HInfo->DescURL, &(HInfo->DescDocument));
 	if (retVal != UPNP_E_SUCCESS) {
@@ -1170,6 +1346,23 @@ int UpnpRegisterRootDevice4(
 		           "UpnpRegisterRootDevice4: No services found for RootDevice\n");
 	}
 
+#if EXCLUDE_SSDP == 0
+	HInfo->SsdpPackets = SsdpCreatePacketCache(*Hnd, HInfo->DeviceList);
+	if (!HInfo->SsdpPackets) {
+#ifdef INCLUDE_CLIENT_APIS
+		ListDestroy(&HInfo->SsdpSearchList, 0);
+#endif /* INCLUDE_CLIENT_APIS */
+		ixmlNodeList_free(HInfo->ServiceList);
+		ixmlNodeList_free(HInfo->DeviceList);
+		ixmlDocument_free(HInfo->DescDocument);
+		FreeHandle(*Hnd);
+		UpnpPrintf(UPNP_CRITICAL, API, __FILE__, __LINE__,
+		           "UpnpRegisterRootDevice4: Out of memory for the SSDP packets\n");
+		retVal = UPNP_E_OUTOF_MEMORY;
+		goto exit_function;
+	}
+#endif /* EXCLUDE_SSDP */
+
 #if EXCLUDE_GENA == 0
 	/*
 	 * GENA SET UP
@@ -1186,6 +1379,7 @@ int UpnpRegisterRootDevice4(
 		           "UpnpRegisterRootDevice4: GENA Service Table \n"
 			           "Here are the known services: \n");
 		printServiceTable(&HInfo->ServiceTable, UPNP_ALL, API);
+		genaLoadSubscriptions(*Hnd, HInfo);
 	} else {
 		UpnpPrintf(UPNP_ALL, API, __FILE__, __LINE__,
 		           "\nUpnpRegisterRootDevice4: Empty service table\n");
@@ -1197,6 +1391,9 @@ int UpnpRegisterRootDevice4(
 			break;
 		default: UpnpSdkDeviceregisteredV6 = 1;
 	}
+#if EXCLUDE_SSDP == 0
+	SsdpUpdateHandleSnapshot();
+#endif
 
 	retVal = UPNP_E_SUCCESS;
 
@@ -1220,6 +1417,9 @@ int UpnpUnRegisterRootDeviceLowPower(UpnpDevice_Handle Hnd, int PowerState,
                                      int SleepPeriod, int RegistrationState) {
 	int retVal = 0;
 	struct Handle_Info *HInfo = NULL;
+#if EXCLUDE_SSDP == 0
+	SsdpPacketCache *packets;
+#endif /* EXCLUDE_SSDP */
 
 	if (UpnpSdkInit != 1)
 		return UPNP_E_FINISH;
@@ -1258,6 +1458,10 @@ int UpnpUnRegisterRootDeviceLowPower(UpnpDevice_Handle Hnd, int PowerState,
 	ixmlNodeList_free(HInfo->DeviceList);
 	ixmlNodeList_free(HInfo->ServiceList);
 	ixmlDocument_free(HInfo->DescDocument);
+#if EXCLUDE_SSDP == 0
+	/* freed once the SSDP listener can no longer see it */
+	packets = HInfo->SsdpPackets;
+#endif /* EXCLUDE_SSDP */
 #ifdef INCLUDE_CLIENT_APIS
 	ListDestroy(&HInfo->SsdpSearchList, 0);
 #endif /* INCLUDE_CLIENT_APIS */
@@ -1273,6 +1477,10 @@ int UpnpUnRegisterRootDeviceLowPower(UpnpDevice_Handle Hnd, int PowerState,
 		default: break;
 	}
 	FreeHandle(Hnd);
+#if EXCLUDE_SSDP == 0
+	SsdpUpdateHandleSnapshot();
+	SsdpFreePacketCache(packets);
+#endif
 	HandleUnlock();
 
 	UpnpPrintf(UPNP_INFO, API, __FILE__, __LINE__,
@@ -1317,9 +1525,15 @@ int UpnpRegisterClient(Upnp_FunPtr Fun, const void *Cookie,
 	HInfo->MaxAge = 0;
 	HInfo->MaxSubscriptions = UPNP_INFINITE;
 	HInfo->MaxSubscriptionTimeOut = UPNP_INFINITE;
+	HInfo->CoalesceEvents = 0;
+	HInfo->SubscriptionSweepAt = 0;
+	HInfo->ModerationFlushAt = 0;
 #endif
 	HandleTable[*Hnd] = HInfo;
 	UpnpSdkClientRegistered = 1;
+#if EXCLUDE_SSDP == 0
+	SsdpUpdateHandleSnapshot();
+#endif
 	HandleUnlock();
 
 	UpnpPrintf(UPNP_ALL, API, __FILE__, __LINE__,
@@ -1371,6 +1585,9 @@ int UpnpUnRegisterClient(UpnpClient_Handle Hnd) {
 	ListDestroy(&HInfo->SsdpSearchList, 0);
 	FreeHandle(Hnd);
 	UpnpSdkClientRegistered = 0;
+#if EXCLUDE_SSDP == 0
+	SsdpUpdateHandleSnapshot();
+#endif
 	HandleUnlock();
 
 	UpnpPrintf(UPNP_ALL, API, __FILE__, __LINE__,
@@ -1640,6 +1857,9 @@ int UpnpSendAdvertisementLowPower(UpnpDevice_Handle Hnd, int Exp,
 		SleepPeriod = -1;
 	SInfo->SleepPeriod = SleepPeriod;
 	SInfo->RegistrationState = RegistrationState;
+#if EXCLUDE_SSDP == 0
+	SsdpUpdateHandleSnapshot();
+#endif
 	HandleUnlock();
 	retVal = AdvertiseAndReply(1, Hnd, (enum SsdpSearchType) 0,
 	                           (struct sockaddr *) NULL, (char *) NULL,
@@ -1833,6 +2053,33 @@ int UpnpSetMaxSubscriptionTimeOut(UpnpDevice_Handle Hnd, int MaxSubscriptionTime
 }
 #endif /* INCLUDE_DEVICE_APIS */
 
+#ifdef INCLUDE_DEVICE_APIS
+int UpnpSetEventCoalescing(UpnpDevice_Handle Hnd, int Enable) {
+	struct Handle_Info *SInfo = NULL;
+
+	if (UpnpSdkInit != 1) {
+		return UPNP_E_FINISH;
+	}
+
+	UpnpPrintf(UPNP_ALL, API, __FILE__, __LINE__,
+	           "Inside UpnpSetEventCoalescing\n");
+
+	HandleLock();
+	switch (GetHandleInfo(Hnd, &SInfo)) {
+		case HND_DEVICE:break;
+		default:HandleUnlock();
+			return UPNP_E_INVALID_HANDLE;
+	}
+	SInfo->CoalesceEvents = Enable ? 1 : 0;
+	HandleUnlock();
+
+	UpnpPrintf(UPNP_ALL, API, __FILE__, __LINE__,
+	           "Exiting UpnpSetEventCoalescing\n");
+
+	return UPNP_E_SUCCESS;
+}
+#endif /* INCLUDE_DEVICE_APIS */
+
 #ifdef INCLUDE_CLIENT_APIS
 int UpnpSubscribeAsync(
 	UpnpClient_Handle Hnd,
@@ -2289,6 +2536,203 @@ int UpnpNotifyExt(
 
 	return retVal;
 }
+
+int UpnpNotifyPropertySet(
+	UpnpDevice_Handle Hnd,
+	const char *DevID_const,
+	const char *ServName_const,
+	const UpnpPropertySetWriter *PropSet) {
+	struct Handle_Info *SInfo = NULL;
+	char *DevID = (char *) DevID_const;
+	char *ServName = (char *) ServName_const;
+
+	if (UpnpSdkInit != 1) {
+		return UPNP_E_FINISH;
+	}
+
+	HandleReadLock();
+	switch (GetHandleInfo(Hnd, &SInfo)) {
+		case HND_DEVICE:break;
+		default:HandleUnlock();
+			return UPNP_E_INVALID_HANDLE;
+	}
+	HandleUnlock();
+	if (DevID == NULL || ServName == NULL || PropSet == NULL) {
+		return UPNP_E_INVALID_PARAM;
+	}
+
+	return genaNotifyAllString(Hnd, DevID, ServName,
+	                           UpnpPropertySetWriter_get_String(PropSet),
+	                           UpnpPropertySetWriter_get_Length(PropSet));
+}
+
+int UpnpSetSubscriptionSnapshot(const char *FileName) {
+	if (UpnpSdkInit != 1) {
+		return UPNP_E_FINISH;
+	}
+
+	return genaSetSubscriptionSnapshot(FileName);
+}
+
+int UpnpSaveSubscriptions(UpnpDevice_Handle Hnd) {
+	if (UpnpSdkInit != 1) {
+		return UPNP_E_FINISH;
+	}
+
+	return genaSaveSubscriptions(Hnd);
+}
+
+int UpnpSetStateVariableModeration(
+	UpnpDevice_Handle Hnd,
+	const char *DevID_const,
+	const char *ServID_const,
+	const char *VarName_const,
+	int MinimumIntervalMs,
+	double MinimumDelta) {
+	if (UpnpSdkInit != 1) {
+		return UPNP_E_FINISH;
+	}
+
+	if (DevID_const == NULL || ServID_const == NULL ||
+		VarName_const == NULL || MinimumIntervalMs < 0 ||
+		MinimumDelta < 0) {
+		return UPNP_E_INVALID_PARAM;
+	}
+
+	return genaSetModeration(Hnd, (char *) DevID_const,
+	                         (char *) ServID_const, (char *) VarName_const,
+	                         (long) MinimumIntervalMs, MinimumDelta);
+}
+
+int UpnpLoadStateVariableModeration(
+	UpnpDevice_Handle Hnd,
+	const char *DevID_const,
+	const char *ServID_const,
+	IXML_Document *Scpd) {
+	if (UpnpSdkInit != 1) {
+		return UPNP_E_FINISH;
+	}
+
+	if (DevID_const == NULL || ServID_const == NULL || Scpd == NULL) {
+		return UPNP_E_INVALID_PARAM;
+	}
+
+	return genaLoadScpdModeration(Hnd, (char *) DevID_const,
+	                              (char *) ServID_const, Scpd);
+}
+
+int UpnpGetSubscriptionStats(
+	UpnpDevice_Handle Hnd,
+	const char *DevID_const,
+	const char *ServID_const,
+	const Upnp_SID SubsId,
+	struct Upnp_Subscription_Stats *Stats) {
+	if (UpnpSdkInit != 1) {
+		return UPNP_E_FINISH;
+	}
+
+	if (DevID_const == NULL || ServID_const == NULL || SubsId == NULL ||
+		Stats == NULL) {
+		return UPNP_E_INVALID_PARAM;
+	}
+
+	return genaGetSubscriptionStats(Hnd, (char *) DevID_const,
+	                                (char *) ServID_const,
+	                                (char *) SubsId, Stats);
+}
+
+int UpnpGetConnectionPoolStats(struct Upnp_Connection_Pool_Stats *Stats) {
+	GenaConnPoolStats stats;
+
+	if (UpnpSdkInit != 1) {
+		return UPNP_E_FINISH;
+	}
+
+	if (Stats == NULL) {
+		return UPNP_E_INVALID_PARAM;
+	}
+
+	genaGetConnPoolStats(&stats);
+	Stats->Connects = stats.connects;
+	Stats->Reuses = stats.reuses;
+	Stats->Stale = stats.stale;
+	Stats->Evictions = stats.evictions;
+
+	return UPNP_E_SUCCESS;
+}
+
+int UpnpSetStateVariables(
+	UpnpDevice_Handle Hnd,
+	const char *DevID_const,
+	const char *ServName_const,
+	const char **VarName_const,
+	const char **NewVal_const,
+	int cVariables) {
+	int retVal;
+	int i;
+
+	if (UpnpSdkInit != 1) {
+		return UPNP_E_FINISH;
+	}
+
+	UpnpPrintf(UPNP_ALL, API, __FILE__, __LINE__,
+	           "Inside UpnpSetStateVariables\n");
+
+	if (DevID_const == NULL || ServName_const == NULL ||
+		VarName_const == NULL || NewVal_const == NULL || cVariables < 0) {
+		return UPNP_E_INVALID_PARAM;
+	}
+	for (i = 0; i < cVariables; i++) {
+		if (VarName_const[i] == NULL || NewVal_const[i] == NULL) {
+			return UPNP_E_INVALID_PARAM;
+		}
+	}
+
+	retVal = genaSetStateVariables(Hnd, (char *) DevID_const,
+	                               (char *) ServName_const,
+	                               (char **) VarName_const,
+	                               (char **) NewVal_const, cVariables);
+	if (retVal == GENA_E_BAD_HANDLE) {
+		retVal = UPNP_E_INVALID_HANDLE;
+	}
+
+	UpnpPrintf(UPNP_ALL, API, __FILE__, __LINE__,
+	           "Exiting UpnpSetStateVariables\n");
+
+	return retVal;
+}
+
+int UpnpSetStateVariable(
+	UpnpDevice_Handle Hnd,
+	const char *DevID,
+	const char *ServName,
+	const char *VarName,
+	const char *NewVal) {
+	return UpnpSetStateVariables(Hnd, DevID, ServName, &VarName, &NewVal, 1);
+}
+
+int UpnpSetStateVariableInt(
+	UpnpDevice_Handle Hnd,
+	const char *DevID,
+	const char *ServName,
+	const char *VarName,
+	long NewVal) {
+	char value[32];
+
+	snprintf(value, sizeof(value), "%ld", NewVal);
+
+	return UpnpSetStateVariable(Hnd, DevID, ServName, VarName, value);
+}
+
+int UpnpSetStateVariableBool(
+	UpnpDevice_Handle Hnd,
+	const char *DevID,
+	const char *ServName,
+	const char *VarName,
+	int NewVal) {
+	return UpnpSetStateVariable(Hnd, DevID, ServName, VarName,
+	                            NewVal ? "1" : "0");
+}
 #endif /* INCLUDE_DEVICE_APIS */
 
 #ifdef INCLUDE_DEVICE_APIS
@@ -2436,6 +2880,38 @@ int UpnpAcceptSubscriptionExt(
 
 	return ret;
 }
+
+int UpnpAcceptSubscriptionPropertySet(
+	UpnpDevice_Handle Hnd,
+	const char *DevID_const,
+	const char *ServName_const,
+	const UpnpPropertySetWriter *PropSet,
+	const Upnp_SID SubsId) {
+	struct Handle_Info *SInfo = NULL;
+	char *DevID = (char *) DevID_const;
+	char *ServName = (char *) ServName_const;
+
+	if (UpnpSdkInit != 1) {
+		return UPNP_E_FINISH;
+	}
+
+	HandleReadLock();
+	switch (GetHandleInfo(Hnd, &SInfo)) {
+		case HND_DEVICE: break;
+		default: HandleUnlock();
+			return UPNP_E_INVALID_HANDLE;
+	}
+	HandleUnlock();
+	if (DevID == NULL || ServName == NULL || PropSet == NULL ||
+		SubsId == NULL) {
+		return UPNP_E_INVALID_PARAM;
+	}
+
+	return genaInitNotifyString(Hnd, DevID, ServName,
+	                            UpnpPropertySetWriter_get_String(PropSet),
+	                            UpnpPropertySetWriter_get_Length(PropSet),
+	                            SubsId);
+}
 #endif /* INCLUDE_DEVICE_APIS */
 #endif /* EXCLUDE_GENA == 0 */
 
@@ -0,0 +1,444 @@
+/*!
+ * \file
+ *
+ * \brief Pool of idle connections to control points, reused by the GENA
+ * notifications sent to the same host and port, and circuit breakers of the
+ * hosts that fail to take the notifications.
+ */
+
+#include "../include/config.h"
+
+#if EXCLUDE_GENA == 0
+#ifdef INCLUDE_DEVICE_APIS
+
+#include "../include/gena_device.h"
+#include "../include/httpreadwrite.h"
+#include "../include/upnpapi.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*! One idle connection. */
+typedef struct {
+	/*! The connection; its foreign_sockaddr is the pool key. */
+	SOCKINFO info;
+	/*! Time from sock_now_ms() when the connection became idle. */
+	long long idleSince;
+} GenaPooledConn;
+
+/*! Number of buckets of the breaker table, a power of 2. */
+#define GENA_BREAKER_BUCKETS 64
+
+/*! Circuit breaker of a host and port failing to take notifications. */
+typedef struct GENA_BREAKER {
+	/*! Host and port of the delivery URL, the key. */
+	struct sockaddr_storage addr;
+	/*! Failed notifications since the last successful one. */
+	int failures;
+	/*! Time from sock_now_ms() before which no notification is sent, 0
+	 * while the breaker is closed. */
+	long long retryAt;
+	/*! Delay of the last retry, in milliseconds. */
+	long backoff;
+	/*! Set while a notification probes the host after the delay. */
+	int probing;
+	/*! Next breaker in the same bucket. */
+	struct GENA_BREAKER *next;
+} GenaBreaker;
+
+/*! Protects the pool, its counters and the breakers. */
+static ithread_mutex_t gConnPoolMutex;
+/*! Idle connections, the oldest first. */
+static GenaPooledConn gConnPool[GENA_CONN_POOL_SIZE > 0 ?
+	GENA_CONN_POOL_SIZE : 1];
+/*! Number of entries in gConnPool. */
+static int gConnPoolCount;
+/*! Set while a sweep of the idle connections is scheduled. */
+static int gConnPoolSweeping;
+/*! Counters. */
+static GenaConnPoolStats gConnPoolStats;
+/*! Breakers of the hosts with failed notifications, by host and port. A
+ * host is removed when a notification to it succeeds. */
+static GenaBreaker *gBreakers[GENA_BREAKER_BUCKETS];
+
+/*!
+ * \brief Compares the address and port of two socket addresses.
+ *
+ * \return 1 if they are the same, 0 otherwise.
+ */
+static int same_host_port(
+	const struct sockaddr_storage *a,
+	const struct sockaddr_storage *b) {
+	const struct sockaddr_in *a4 = (const struct sockaddr_in *) a;
+	const struct sockaddr_in *b4 = (const struct sockaddr_in *) b;
+	const struct sockaddr_in6 *a6 = (const struct sockaddr_in6 *) a;
+	const struct sockaddr_in6 *b6 = (const struct sockaddr_in6 *) b;
+
+	if (a->ss_family != b->ss_family)
+		return 0;
+	switch (a->ss_family) {
+		case AF_INET:
+			return a4->sin_port == b4->sin_port &&
+			       a4->sin_addr.s_addr == b4->sin_addr.s_addr;
+		case AF_INET6:
+			return a6->sin6_port == b6->sin6_port &&
+			       a6->sin6_scope_id == b6->sin6_scope_id &&
+			       memcmp(&a6->sin6_addr, &b6->sin6_addr,
+			              sizeof(a6->sin6_addr)) == 0;
+		default:
+			return 0;
+	}
+}
+
+/*!
+ * \brief Hashes the address and port of a socket address.
+ *
+ * \return The bucket of the address in gBreakers.
+ */
+static size_t host_port_bucket(
+	/*! [in] Socket address. */
+	const struct sockaddr_storage *addr) {
+	const struct sockaddr_in *a4 = (const struct sockaddr_in *) addr;
+	const struct sockaddr_in6 *a6 = (const struct sockaddr_in6 *) addr;
+	const unsigned char *buf;
+	size_t length;
+	size_t h = (size_t) 2166136261u;
+	size_t i;
+
+	switch (addr->ss_family) {
+		case AF_INET:
+			buf = (const unsigned char *) &a4->sin_addr;
+			length = sizeof(a4->sin_addr);
+			h = (h ^ (size_t) a4->sin_port) * (size_t) 16777619u;
+			break;
+		case AF_INET6:
+			buf = (const unsigned char *) &a6->sin6_addr;
+			length = sizeof(a6->sin6_addr);
+			h = (h ^ (size_t) a6->sin6_port) * (size_t) 16777619u;
+			break;
+		default:
+			return 0;
+	}
+	for (i = 0; i < length; i++)
+		h = (h ^ buf[i]) * (size_t) 16777619u;
+
+	return h & (GENA_BREAKER_BUCKETS - 1);
+}
+
+/*!
+ * \brief Finds the breaker of a host and port.
+ *
+ * \return The breaker, NULL if the host has no failed notification.
+ *
+ * \note Called with gConnPoolMutex held.
+ */
+static GenaBreaker *breaker_find(
+	/*! [in] Host and port. */
+	const struct sockaddr_storage *addr) {
+	GenaBreaker *b;
+
+	for (b = gBreakers[host_port_bucket(addr)]; b != NULL; b = b->next) {
+		if (same_host_port(&b->addr, addr))
+			return b;
+	}
+
+	return NULL;
+}
+
+/*!
+ * \brief Removes the breaker of a host and port, if any.
+ *
+ * \note Called with gConnPoolMutex held.
+ */
+static void breaker_remove(
+	/*! [in] Host and port. */
+	const struct sockaddr_storage *addr) {
+	GenaBreaker **prev = &gBreakers[host_port_bucket(addr)];
+	GenaBreaker *b;
+
+	for (b = *prev; b != NULL; prev = &b->next, b = b->next) {
+		if (same_host_port(&b->addr, addr)) {
+			*prev = b->next;
+			free(b);
+			return;
+		}
+	}
+}
+
+/*!
+ * \brief Removes an entry from the pool, keeping the order of the others.
+ *
+ * \note Called with gConnPoolMutex held.
+ */
+static void pool_remove(
+	/*! [in] Index of the entry. */
+	int i) {
+	gConnPoolCount--;
+	memmove(&gConnPool[i], &gConnPool[i + 1],
+	        (size_t) (gConnPoolCount - i) * sizeof(GenaPooledConn));
+}
+
+/*!
+ * \brief Closes the connections idle for GENA_CONN_POOL_IDLE_MS.
+ *
+ * \return The time in milliseconds until the next connection expires, -1 if
+ * 	the pool is empty.
+ *
+ * \note Called with gConnPoolMutex held.
+ */
+static long long pool_evict_idle(
+	/*! [in] Current time, from sock_now_ms(). */
+	long long now) {
+	while (gConnPoolCount > 0 &&
+	       now - gConnPool[0].idleSince >= GENA_CONN_POOL_IDLE_MS) {
+		sock_destroy(&gConnPool[0].info, SD_BOTH);
+		pool_remove(0);
+		gConnPoolStats.evictions++;
+	}
+	if (gConnPoolCount == 0)
+		return -1;
+
+	return gConnPool[0].idleSince + GENA_CONN_POOL_IDLE_MS - now;
+}
+
+static void pool_schedule_sweep(long long delayMs);
+
+/*!
+ * \brief Timer job closing the expired idle connections.
+ */
+static void pool_sweep(
+	/*! [in] Unused. */
+	void *arg) {
+	long long delayMs;
+
+	ithread_mutex_lock(&gConnPoolMutex);
+	gConnPoolSweeping = 0;
+	delayMs = pool_evict_idle(sock_now_ms());
+	if (delayMs >= 0)
+		pool_schedule_sweep(delayMs);
+	ithread_mutex_unlock(&gConnPoolMutex);
+
+	return;
+	arg = arg;
+}
+
+/*!
+ * \brief Schedules a sweep of the idle connections, unless one is pending.
+ *
+ * \note Called with gConnPoolMutex held.
+ */
+static void pool_schedule_sweep(
+	/*! [in] Delay of the sweep in milliseconds. */
+	long long delayMs) {
+	ThreadPoolJob job;
+
+	if (gConnPoolSweeping)
+		return;
+	TPJobInit(&job, (start_routine) pool_sweep, NULL);
+	TPJobSetFreeFunction(&job, NULL);
+	if (TimerThreadScheduleMs(&gTimerThread, (long) delayMs + 1, &job,
+	                          SHORT_TERM, NULL) == 0)
+		gConnPoolSweeping = 1;
+}
+
+int genaConnPoolGet(
+	uri_type *destination_url,
+	uri_type *url,
+	SOCKINFO *info,
+	int *reused) {
+	SOCKET conn_fd;
+	socklen_t addrLen;
+	int ret_code;
+	int i;
+
+	*reused = 0;
+	http_FixUrl(destination_url, url);
+	ithread_mutex_lock(&gConnPoolMutex);
+	pool_evict_idle(sock_now_ms());
+	/* the most recently used connection first */
+	for (i = gConnPoolCount - 1; i >= 0; i--) {
+		if (!same_host_port(&gConnPool[i].info.foreign_sockaddr,
+		                    &url->hostport.IPaddress))
+			continue;
+		*info = gConnPool[i].info;
+		pool_remove(i);
+		if (sock_is_idle(info)) {
+			gConnPoolStats.reuses++;
+			*reused = 1;
+			break;
+		}
+		sock_destroy(info, SD_BOTH);
+		gConnPoolStats.stale++;
+	}
+	ithread_mutex_unlock(&gConnPoolMutex);
+	if (*reused) {
+		info->deadline = 0;
+		return UPNP_E_SUCCESS;
+	}
+
+	conn_fd = socket((int) url->hostport.IPaddress.ss_family, SOCK_STREAM,
+	                 0);
+	if (conn_fd == INVALID_SOCKET)
+		return UPNP_E_OUTOF_SOCKET;
+	ret_code = sock_init(info, conn_fd);
+	if (ret_code) {
+		sock_destroy(info, SD_BOTH);
+		return ret_code;
+	}
+	addrLen = (socklen_t) (url->hostport.IPaddress.ss_family == AF_INET6 ?
+	                       sizeof(struct sockaddr_in6) :
+	                       sizeof(struct sockaddr_in));
+	if (sock_make_no_blocking(conn_fd) == -1 ||
+	    (connect(conn_fd, (struct sockaddr *) &url->hostport.IPaddress,
+	             addrLen) == -1 &&
+#ifdef WIN32
+	     WSAGetLastError() != WSAEWOULDBLOCK
+#else
+	     errno != EINPROGRESS
+#endif
+	    )) {
+		sock_destroy(info, SD_BOTH);
+		return UPNP_E_SOCKET_CONNECT;
+	}
+	memcpy(&info->foreign_sockaddr, &url->hostport.IPaddress,
+	       sizeof(info->foreign_sockaddr));
+	ithread_mutex_lock(&gConnPoolMutex);
+	gConnPoolStats.connects++;
+	ithread_mutex_unlock(&gConnPoolMutex);
+
+	return UPNP_E_SUCCESS;
+}
+
+void genaConnPoolPut(SOCKINFO *info, int reusable) {
+	long long now;
+
+	if (!reusable || GENA_CONN_POOL_SIZE <= 0) {
+		/* should shutdown completely when closing socket */
+		sock_destroy(info, SD_BOTH);
+		return;
+	}
+	now = sock_now_ms();
+	ithread_mutex_lock(&gConnPoolMutex);
+	if (gConnPoolCount >= GENA_CONN_POOL_SIZE) {
+		/* make room by closing the oldest connection */
+		sock_destroy(&gConnPool[0].info, SD_BOTH);
+		pool_remove(0);
+		gConnPoolStats.evictions++;
+	}
+	gConnPool[gConnPoolCount].info = *info;
+	gConnPool[gConnPoolCount].idleSince = now;
+	gConnPoolCount++;
+	pool_schedule_sweep(pool_evict_idle(now));
+	ithread_mutex_unlock(&gConnPoolMutex);
+	info->socket = INVALID_SOCKET;
+}
+
+int genaConnPoolInit(void) {
+	if (ithread_mutex_init(&gConnPoolMutex, NULL) != 0)
+		return UPNP_E_INIT_FAILED;
+
+	return UPNP_E_SUCCESS;
+}
+
+void genaConnPoolDestroy(void) {
+	ithread_mutex_destroy(&gConnPoolMutex);
+}
+
+void genaConnPoolShutdown(void) {
+	GenaBreaker *b;
+	int i;
+
+	ithread_mutex_lock(&gConnPoolMutex);
+	while (gConnPoolCount > 0) {
+		sock_destroy(&gConnPool[0].info, SD_BOTH);
+		pool_remove(0);
+		gConnPoolStats.evictions++;
+	}
+	gConnPoolSweeping = 0;
+	for (i = 0; i < GENA_BREAKER_BUCKETS; i++) {
+		while ((b = gBreakers[i]) != NULL) {
+			gBreakers[i] = b->next;
+			free(b);
+		}
+	}
+	ithread_mutex_unlock(&gConnPoolMutex);
+}
+
+long long genaBreakerCheck(uri_type *url, long long now) {
+	GenaBreaker *b;
+	long long retryAt = 0;
+
+	if (GENA_BREAKER_THRESHOLD <= 0)
+		return 0;
+	ithread_mutex_lock(&gConnPoolMutex);
+	b = breaker_find(&url->hostport.IPaddress);
+	if (b != NULL && b->retryAt != 0) {
+		if (now < b->retryAt) {
+			retryAt = b->retryAt;
+		} else {
+			/* this notification probes the host, the others wait */
+			b->probing = 1;
+			b->retryAt = now + b->backoff;
+		}
+	}
+	ithread_mutex_unlock(&gConnPoolMutex);
+
+	return retryAt;
+}
+
+long long genaBreakerCount(uri_type *url, int delivered, long long now) {
+	GenaBreaker *b;
+	long long retryAt = 0;
+
+	if (GENA_BREAKER_THRESHOLD <= 0)
+		return 0;
+	ithread_mutex_lock(&gConnPoolMutex);
+	if (delivered) {
+		breaker_remove(&url->hostport.IPaddress);
+		goto ExitFunction;
+	}
+	b = breaker_find(&url->hostport.IPaddress);
+	if (b == NULL) {
+		b = (GenaBreaker *) calloc((size_t) 1, sizeof(GenaBreaker));
+		if (b == NULL)
+			goto ExitFunction;
+		memcpy(&b->addr, &url->hostport.IPaddress, sizeof(b->addr));
+		b->next = gBreakers[host_port_bucket(&b->addr)];
+		gBreakers[host_port_bucket(&b->addr)] = b;
+	}
+	b->failures++;
+	if (b->failures < GENA_BREAKER_THRESHOLD)
+		goto ExitFunction;
+	/* the failures of the notifications sent before the breaker opened
+	 * do not extend the delay, a failed probe does */
+	if (b->retryAt == 0 || b->probing) {
+		if (b->backoff == 0)
+			b->backoff = GENA_BREAKER_MIN_BACKOFF_MS;
+		else if (b->backoff < GENA_BREAKER_MAX_BACKOFF_MS / 2)
+			b->backoff *= 2;
+		else
+			b->backoff = GENA_BREAKER_MAX_BACKOFF_MS;
+		b->retryAt = now + b->backoff;
+		b->probing = 0;
+		UpnpPrintf(UPNP_INFO, GENA, __FILE__, __LINE__,
+			"Suspending events to %.*s for %ld ms after %d failures\n",
+			(int) url->hostport.text.size, url->hostport.text.buff,
+			b->backoff, b->failures);
+	}
+	retryAt = b->retryAt;
+
+	ExitFunction:
+	ithread_mutex_unlock(&gConnPoolMutex);
+
+	return retryAt;
+}
+
+void genaGetConnPoolStats(GenaConnPoolStats *stats) {
+	ithread_mutex_lock(&gConnPoolMutex);
+	*stats = gConnPoolStats;
+	ithread_mutex_unlock(&gConnPoolMutex);
+}
+
+#endif /* INCLUDE_DEVICE_APIS */
+#endif /* EXCLUDE_GENA */
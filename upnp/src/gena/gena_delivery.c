@@ -0,0 +1,584 @@
+/*!
+ * \file
+ *
+ * \brief Delivery engine of the GENA notifications.
+ *
+ * One thread of the send thread pool multiplexes all the outstanding NOTIFY
+ * requests on non-blocking sockets with a reactor. Each delivery goes
+ * through connecting, sending and receiving, bounded by
+ * GENA_NOTIFICATION_SENDING_TIMEOUT_MS until the request is sent and by
+ * GENA_NOTIFICATION_ANSWERING_TIMEOUT_MS for the response. Deliveries are
+ * independent: the order of the events of a subscription is kept by its
+ * queue, which only hands its head to the engine.
+ */
+
+#include "../include/config.h"
+
+#if EXCLUDE_GENA == 0
+#ifdef INCLUDE_DEVICE_APIS
+
+#include "../include/gena_device.h"
+#include "../include/httpreadwrite.h"
+#include "../include/reactor.h"
+#include "../include/upnpapi.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*! Maximum number of socket events handled per reactor_wait(). */
+#define GENA_DELIVERY_MAX_EVENTS 64
+
+/*! The connection to the control point is being established. */
+#define DELIVERY_CONNECTING 0
+/*! The NOTIFY request is being sent. */
+#define DELIVERY_SENDING 1
+/*! The response is being received. */
+#define DELIVERY_RECEIVING 2
+
+/*! The engine thread is not running. */
+#define ENGINE_STOPPED 0
+/*! The engine thread is running. */
+#define ENGINE_RUNNING 1
+/*! The engine thread is asked to stop. */
+#define ENGINE_STOPPING 2
+
+/*! One NOTIFY to deliver. */
+typedef struct GENA_DELIVERY {
+	/*! Delivery URLs of the subscription, tried in order. */
+	URL_list urls;
+	/*! Index in urls of the URL being tried. */
+	size_t url;
+	/*! Headers of the request, with SID, SEQ and the empty line. */
+	membuffer headers;
+	/*! The evented XML, owned by the caller. */
+	const char *propertySet;
+	/*! Start line and headers for the URL being tried. */
+	membuffer startMsg;
+	/*! Parts of the request left to send. */
+	SockBuffer out[3];
+	/*! First entry of out not completely sent. */
+	int outFirst;
+	/*! The connection. */
+	SOCKINFO info;
+	/*! Set if the connection was taken from the connection pool. */
+	int reused;
+	/*! DELIVERY_CONNECTING, DELIVERY_SENDING or DELIVERY_RECEIVING. */
+	int state;
+	/*! The response, while receiving. */
+	http_parser_t response;
+	/*! Set if the body of the response ends with the connection. */
+	int okOnClose;
+	/*! Number of bytes of the response received. */
+	size_t received;
+	/*! Time from sock_now_ms() when the current step times out. */
+	long long deadline;
+	/*! Completion callback. */
+	GenaDeliveryDone done;
+	/*! Argument of the callback. */
+	void *cookie;
+	/*! Next delivery in the pending or active list. */
+	struct GENA_DELIVERY *next;
+	/*! Previous delivery in the active list. */
+	struct GENA_DELIVERY *prev;
+} GenaDelivery;
+
+/*! Protects the pending list and the engine state. */
+static ithread_mutex_t gDeliveryMutex;
+/*! Signaled when the engine thread stops. */
+static ithread_cond_t gDeliveryCond;
+/*! ENGINE_STOPPED, ENGINE_RUNNING or ENGINE_STOPPING. */
+static int gDeliveryState = ENGINE_STOPPED;
+/*! Reactor of the engine thread. */
+static Reactor *gDeliveryReactor;
+/*! Deliveries not yet seen by the engine thread, in order. */
+static GenaDelivery *gPendingHead;
+/*! Last entry of the pending list. */
+static GenaDelivery *gPendingTail;
+/*! Deliveries in progress, only used by the engine thread. */
+static GenaDelivery *gActive;
+
+/*!
+ * \brief Releases a delivery.
+ */
+static void delivery_free(
+	/*! [in] The delivery. */
+	GenaDelivery *d) {
+	free_URL_list(&d->urls);
+	membuffer_destroy(&d->headers);
+	membuffer_destroy(&d->startMsg);
+	free(d);
+}
+
+/*!
+ * \brief Closes the connection of the current attempt.
+ */
+static void delivery_close(
+	/*! [in] The delivery. */
+	GenaDelivery *d,
+	/*! [in] 1 if the connection can be reused by other deliveries. */
+	int reusable) {
+	if (d->info.socket != INVALID_SOCKET) {
+		reactor_del(gDeliveryReactor, d->info.socket);
+		genaConnPoolPut(&d->info, reusable);
+		d->info.socket = INVALID_SOCKET;
+	}
+	if (d->state == DELIVERY_RECEIVING) {
+		httpmsg_destroy(&d->response.msg);
+		d->state = DELIVERY_CONNECTING;
+	}
+}
+
+/*!
+ * \brief Ends a delivery and reports its result.
+ */
+static void delivery_finish(
+	/*! [in] The delivery. */
+	GenaDelivery *d,
+	/*! [in] UPNP_E_SUCCESS if a response was received, otherwise an
+	 * error. */
+	int result) {
+	int statusCode = 0;
+	int keepAlive = 0;
+
+	if (result == UPNP_E_SUCCESS) {
+		statusCode = d->response.msg.status_code;
+		keepAlive = parser_keep_alive(&d->response);
+	}
+	delivery_close(d, keepAlive);
+	if (d->prev)
+		d->prev->next = d->next;
+	else if (gActive == d)
+		gActive = d->next;
+	if (d->next)
+		d->next->prev = d->prev;
+	d->done(d->cookie, result, statusCode);
+	delivery_free(d);
+}
+
+/*!
+ * \brief Starts an attempt on the current URL, or the next ones if it
+ * cannot be connected.
+ *
+ * \return UPNP_E_SUCCESS, or the error of the last URL tried.
+ */
+static int delivery_connect(
+	/*! [in] The delivery. */
+	GenaDelivery *d) {
+	uri_type url;
+	int ret = UPNP_E_INVALID_URL;
+
+	for (; d->url < d->urls.size; d->url++) {
+		UpnpPrintf(UPNP_ALL, GENA, __FILE__, __LINE__,
+		           "gena notify to: %.*s\n",
+		           (int) d->urls.parsedURLs[d->url].hostport.text.size,
+		           d->urls.parsedURLs[d->url].hostport.text.buff);
+		ret = genaConnPoolGet(&d->urls.parsedURLs[d->url], &url,
+		                      &d->info, &d->reused);
+		if (ret != UPNP_E_SUCCESS)
+			continue;
+		/* make start line and HOST header */
+		membuffer_destroy(&d->startMsg);
+		if (http_MakeMessage(&d->startMsg, 1, 1,
+		                     "q" "s",
+		                     HTTPMETHOD_NOTIFY, &url,
+		                     d->headers.buf) != 0) {
+			delivery_close(d, 0);
+			return UPNP_E_OUTOF_MEMORY;
+		}
+		/* note: end of notification will contain "\r\n" twice */
+		d->out[0].buf = d->startMsg.buf;
+		d->out[0].length = d->startMsg.length;
+		d->out[1].buf = d->propertySet;
+		d->out[1].length = strlen(d->propertySet);
+		d->out[2].buf = "\r\n";
+		d->out[2].length = (size_t) 2;
+		d->outFirst = 0;
+		d->received = (size_t) 0;
+		d->state = d->reused ? DELIVERY_SENDING : DELIVERY_CONNECTING;
+		d->deadline = sock_now_ms() + GENA_NOTIFICATION_SENDING_TIMEOUT_MS;
+		ret = reactor_add(gDeliveryReactor, d->info.socket,
+		                  REACTOR_WRITE, d);
+		if (ret == UPNP_E_SUCCESS)
+			return UPNP_E_SUCCESS;
+		genaConnPoolPut(&d->info, 0);
+		d->info.socket = INVALID_SOCKET;
+	}
+
+	return ret;
+}
+
+/*!
+ * \brief Ends the current attempt after an error and goes on with the next
+ * one, if any.
+ */
+static void delivery_retry(
+	/*! [in] The delivery. */
+	GenaDelivery *d,
+	/*! [in] Error of the attempt. */
+	int error) {
+	int ret;
+
+	delivery_close(d, 0);
+	/* The control point may have closed a pooled connection just before
+	 * it was reused, retry the same URL once on another connection. */
+	if (!d->reused || error == UPNP_E_TIMEDOUT ||
+	    d->received > (size_t) 0)
+		d->url++;
+	if (d->url >= d->urls.size) {
+		delivery_finish(d, error);
+		return;
+	}
+	ret = delivery_connect(d);
+	if (ret != UPNP_E_SUCCESS)
+		delivery_finish(d, ret);
+}
+
+/*!
+ * \brief Sends as much of the request as the socket accepts.
+ *
+ * \return 1 if the request is sent, 0 if the socket is full,
+ * 	UPNP_E_SOCKET_WRITE on error.
+ */
+static int delivery_send(
+	/*! [in] The delivery. */
+	GenaDelivery *d) {
+	SockBuffer *b;
+	size_t left;
+	ssize_t num_written;
+#ifndef WIN32
+	struct iovec iov[3];
+	struct msghdr msg;
+	int numIov;
+	int i;
+#endif
+
+	while (d->outFirst < 3) {
+#ifdef WIN32
+		b = &d->out[d->outFirst];
+		num_written = send(d->info.socket, b->buf, (int) b->length, 0);
+#else
+		numIov = 0;
+		for (i = d->outFirst; i < 3; i++) {
+			iov[numIov].iov_base = (void *) d->out[i].buf;
+			iov[numIov].iov_len = d->out[i].length;
+			numIov++;
+		}
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = (size_t) numIov;
+		num_written = sendmsg(d->info.socket, &msg,
+		                      MSG_DONTWAIT | MSG_NOSIGNAL);
+#endif
+		d->info.write_syscalls++;
+		if (num_written == -1) {
+#ifdef WIN32
+			if (WSAGetLastError() == WSAEWOULDBLOCK)
+				return 0;
+#else
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+#endif
+			return UPNP_E_SOCKET_WRITE;
+		}
+		/* skip the buffers sent completely. */
+		left = (size_t) num_written;
+		while (d->outFirst < 3 && left >= d->out[d->outFirst].length) {
+			left -= d->out[d->outFirst].length;
+			d->outFirst++;
+		}
+		if (left > (size_t) 0) {
+			b = &d->out[d->outFirst];
+			b->buf += left;
+			b->length -= left;
+		}
+	}
+
+	return 1;
+}
+
+/*!
+ * \brief Reads what is available of the response.
+ *
+ * \return 1 if the response is complete, 0 if more is expected, or
+ * 	UPNP_E_BAD_HTTPMSG or UPNP_E_SOCKET_READ on error.
+ */
+static int delivery_recv(
+	/*! [in] The delivery. */
+	GenaDelivery *d) {
+	char buf[2 * 1024];
+	ssize_t num_read;
+
+	while (TRUE) {
+		num_read = recv(d->info.socket, buf, sizeof(buf), 0);
+		if (num_read > 0) {
+			d->received += (size_t) num_read;
+			switch (parser_append(&d->response, buf,
+			                      (size_t) num_read)) {
+				case PARSE_SUCCESS:
+				case PARSE_CONTINUE_1:
+					return 1;
+				case PARSE_FAILURE:
+				case PARSE_NO_MATCH:
+					return UPNP_E_BAD_HTTPMSG;
+				case PARSE_INCOMPLETE_ENTITY:
+					/* read until close */
+					d->okOnClose = 1;
+					break;
+				default:
+					break;
+			}
+		} else if (num_read == 0) {
+			return d->okOnClose ? 1 : UPNP_E_BAD_HTTPMSG;
+		} else {
+#ifdef WIN32
+			if (WSAGetLastError() == WSAEWOULDBLOCK)
+				return 0;
+#else
+			if (errno == EINTR)
+				continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+#endif
+			return UPNP_E_SOCKET_READ;
+		}
+	}
+}
+
+/*!
+ * \brief Makes a delivery progress after its socket became ready.
+ */
+static void delivery_io(
+	/*! [in] The delivery. */
+	GenaDelivery *d) {
+	int ret;
+	int err = 0;
+	socklen_t errLen = (socklen_t) sizeof(err);
+
+	switch (d->state) {
+		case DELIVERY_CONNECTING:
+			if (getsockopt(d->info.socket, SOL_SOCKET, SO_ERROR,
+			               (char *) &err, &errLen) == -1 || err != 0) {
+				delivery_retry(d, UPNP_E_SOCKET_CONNECT);
+				return;
+			}
+			d->state = DELIVERY_SENDING;
+			/* fall through */
+		case DELIVERY_SENDING:
+			ret = delivery_send(d);
+			if (ret < 0) {
+				delivery_retry(d, ret);
+			} else if (ret == 1) {
+				parser_response_init(&d->response,
+				                     HTTPMETHOD_NOTIFY);
+				d->okOnClose = 0;
+				d->state = DELIVERY_RECEIVING;
+				d->deadline = sock_now_ms() +
+				              GENA_NOTIFICATION_ANSWERING_TIMEOUT_MS;
+				reactor_mod(gDeliveryReactor, d->info.socket,
+				            REACTOR_READ);
+			}
+			break;
+		case DELIVERY_RECEIVING:
+			ret = delivery_recv(d);
+			if (ret < 0)
+				delivery_retry(d, ret);
+			else if (ret == 1)
+				delivery_finish(d, UPNP_E_SUCCESS);
+			break;
+		default:
+			break;
+	}
+}
+
+/*!
+ * \brief Takes the pending deliveries.
+ *
+ * \return The pending list, in order.
+ */
+static GenaDelivery *delivery_take_pending(void) {
+	GenaDelivery *list;
+
+	ithread_mutex_lock(&gDeliveryMutex);
+	list = gPendingHead;
+	gPendingHead = NULL;
+	gPendingTail = NULL;
+	ithread_mutex_unlock(&gDeliveryMutex);
+
+	return list;
+}
+
+/*!
+ * \brief Thread of the delivery engine.
+ */
+static void delivery_thread(
+	/*! [in] Unused. */
+	void *arg) {
+	ReactorEvent events[GENA_DELIVERY_MAX_EVENTS];
+	GenaDelivery *d;
+	GenaDelivery *next;
+	long long now;
+	long long wait;
+	int hasDeadline;
+	int n;
+	int i;
+	int ret;
+
+	while (TRUE) {
+		ithread_mutex_lock(&gDeliveryMutex);
+		ret = gDeliveryState == ENGINE_STOPPING;
+		ithread_mutex_unlock(&gDeliveryMutex);
+		if (ret)
+			break;
+		for (d = delivery_take_pending(); d != NULL; d = next) {
+			next = d->next;
+			d->prev = NULL;
+			d->next = gActive;
+			if (gActive)
+				gActive->prev = d;
+			gActive = d;
+			ret = delivery_connect(d);
+			if (ret != UPNP_E_SUCCESS)
+				delivery_finish(d, ret);
+		}
+		/* wait until the earliest deadline, not at all if one passed */
+		hasDeadline = FALSE;
+		wait = 0;
+		now = sock_now_ms();
+		for (d = gActive; d != NULL; d = d->next) {
+			if (!hasDeadline || d->deadline - now < wait)
+				wait = d->deadline - now;
+			hasDeadline = TRUE;
+		}
+		if (wait < 0)
+			wait = 0;
+		else if (wait > INT_MAX)
+			wait = INT_MAX;
+		n = reactor_wait(gDeliveryReactor, events,
+		                 GENA_DELIVERY_MAX_EVENTS,
+		                 hasDeadline ? (int) wait : -1);
+		for (i = 0; i < n; i++)
+			delivery_io((GenaDelivery *) events[i].data);
+		now = sock_now_ms();
+		for (d = gActive; d != NULL; d = next) {
+			next = d->next;
+			if (d->deadline <= now)
+				delivery_retry(d, UPNP_E_TIMEDOUT);
+		}
+	}
+
+	/* report what is left, the callbacks cannot start new deliveries */
+	while (gActive)
+		delivery_finish(gActive, UPNP_E_CANCELED);
+	while ((d = delivery_take_pending()) != NULL) {
+		for (; d != NULL; d = next) {
+			next = d->next;
+			d->done(d->cookie, UPNP_E_CANCELED, 0);
+			delivery_free(d);
+		}
+	}
+	ithread_mutex_lock(&gDeliveryMutex);
+	gDeliveryState = ENGINE_STOPPED;
+	ithread_cond_broadcast(&gDeliveryCond);
+	ithread_mutex_unlock(&gDeliveryMutex);
+
+	return;
+	arg = arg;
+}
+
+int genaDeliveryStart(
+	URL_list *urls,
+	membuffer *headers,
+	const char *propertySet,
+	GenaDeliveryDone done,
+	void *cookie) {
+	GenaDelivery *d;
+	ThreadPoolJob job;
+	size_t length;
+	char *buf;
+	int ret = UPNP_E_SUCCESS;
+
+	d = (GenaDelivery *) malloc(sizeof(GenaDelivery));
+	if (d == NULL)
+		return UPNP_E_OUTOF_MEMORY;
+	memset(d, 0, sizeof(GenaDelivery));
+	if (copy_URL_list(urls, &d->urls) != HTTP_SUCCESS) {
+		free(d);
+		return UPNP_E_OUTOF_MEMORY;
+	}
+	membuffer_init(&d->headers);
+	length = headers->length;
+	buf = membuffer_detach(headers);
+	membuffer_attach(&d->headers, buf, length);
+	membuffer_init(&d->startMsg);
+	d->propertySet = propertySet;
+	d->info.socket = INVALID_SOCKET;
+	d->done = done;
+	d->cookie = cookie;
+
+	ithread_mutex_lock(&gDeliveryMutex);
+	if (gDeliveryState == ENGINE_STOPPING) {
+		ret = UPNP_E_FINISH;
+		goto ExitFunction;
+	}
+	if (gDeliveryState == ENGINE_STOPPED) {
+		ret = reactor_create(&gDeliveryReactor);
+		if (ret != UPNP_E_SUCCESS)
+			goto ExitFunction;
+		TPJobInit(&job, (start_routine) delivery_thread, NULL);
+		if (ThreadPoolAddPersistent(&gSendThreadPool, &job, NULL) != 0) {
+			reactor_destroy(gDeliveryReactor);
+			gDeliveryReactor = NULL;
+			ret = UPNP_E_OUTOF_MEMORY;
+			goto ExitFunction;
+		}
+		gDeliveryState = ENGINE_RUNNING;
+	}
+	if (gPendingTail)
+		gPendingTail->next = d;
+	else
+		gPendingHead = d;
+	gPendingTail = d;
+	reactor_wakeup(gDeliveryReactor);
+
+ExitFunction:
+	ithread_mutex_unlock(&gDeliveryMutex);
+	if (ret != UPNP_E_SUCCESS)
+		delivery_free(d);
+
+	return ret;
+}
+
+int genaDeliveryInit(void) {
+	if (ithread_mutex_init(&gDeliveryMutex, NULL) != 0)
+		return UPNP_E_INIT_FAILED;
+	if (ithread_cond_init(&gDeliveryCond, NULL) != 0) {
+		ithread_mutex_destroy(&gDeliveryMutex);
+		return UPNP_E_INIT_FAILED;
+	}
+
+	return UPNP_E_SUCCESS;
+}
+
+void genaDeliveryDestroy(void) {
+	ithread_cond_destroy(&gDeliveryCond);
+	ithread_mutex_destroy(&gDeliveryMutex);
+}
+
+void genaDeliveryShutdown(void) {
+	ithread_mutex_lock(&gDeliveryMutex);
+	if (gDeliveryState == ENGINE_RUNNING) {
+		gDeliveryState = ENGINE_STOPPING;
+		reactor_wakeup(gDeliveryReactor);
+		while (gDeliveryState != ENGINE_STOPPED)
+			ithread_cond_wait(&gDeliveryCond, &gDeliveryMutex);
+		reactor_destroy(gDeliveryReactor);
+		gDeliveryReactor = NULL;
+	}
+	ithread_mutex_unlock(&gDeliveryMutex);
+}
+
+#endif /* INCLUDE_DEVICE_APIS */
+#endif /* EXCLUDE_GENA */
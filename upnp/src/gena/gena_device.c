@@ -40,19 +40,28 @@
 #ifdef INCLUDE_DEVICE_APIS
 
 #include <assert.h>
+#include <ctype.h>
+#include <limits.h>
+#include <stdio.h>
 
 #include "../include/gena.h"
+#include "../include/gena_device.h"
 #include "../include/httpreadwrite.h"
 #include "../include/ssdplib.h"
 #include "../include/statcodes.h"
 #include "../include/upnpapi.h"
+#include "../include/upnp_timeout.h"
 #include "../include/uuid.h"
 
 #ifdef WIN32
 	#define snprintf _snprintf
 #endif
 
-#define STALE_JOBID (INVALID_JOB_ID -1)
+/*! File of the subscription snapshot, NULL if none. Protected by
+ * HandleLock. */
+static char *gSubscriptionSnapshot = NULL;
+
+static int SaveSubscriptions(struct Handle_Info *handle_info);
 
 /*!
  * \brief Unregisters a device.
@@ -72,6 +81,8 @@ int genaUnregisterDevice(
 		           device_handle);
 		ret = GENA_E_BAD_HANDLE;
 	} else {
+		if (gSubscriptionSnapshot != NULL)
+			SaveSubscriptions(handle_info);
 		freeServiceTable(&handle_info->ServiceTable);
 		ret = UPNP_E_SUCCESS;
 	}
@@ -153,189 +164,205 @@ static void free_notify_struct(
 	free(input);
 }
 
-/*!
- * \brief Sends the notify message and returns a reply.
- *
- * \return on success returns UPNP_E_SUCCESS, otherwise returns a UPNP error.
- *
- * \note called by genaNotify
- */
-static UPNP_INLINE int notify_send_and_recv(
-	/*! [in] subscription callback URL (URL of the control point). */
-	uri_type *destination_url,
-	/*! [in] Common HTTP headers. */
-	membuffer *mid_msg,
-	/*! [in] The evented XML. */
-	char *propertySet,
-	/*! [out] The response from the control point. */
-	http_parser_t *response) {
-	uri_type url;
-	SOCKET conn_fd;
-	membuffer start_msg;
-	int ret_code;
-	int err_code;
-	int timeout;
-	SOCKINFO info;
-	const char *CRLF = "\r\n";
-
-	/* connect */
-	UpnpPrintf(UPNP_ALL, GENA, __FILE__, __LINE__,
-	           "gena notify to: %.*s\n",
-	           (int) destination_url->hostport.text.size,
-	           destination_url->hostport.text.buff);
-
-	conn_fd = http_Connect(destination_url, &url);
-	if (conn_fd < 0)
-		/* return UPNP error */
-		return UPNP_E_SOCKET_CONNECT;
-	ret_code = sock_init(&info, conn_fd);
-	if (ret_code) {
-		sock_destroy(&info, SD_BOTH);
-		return ret_code;
-	}
-	/* make start line and HOST header */
-	membuffer_init(&start_msg);
-	if (http_MakeMessage(
-		&start_msg, 1, 1,
-		"q" "s",
-		HTTPMETHOD_NOTIFY, &url,
-		mid_msg->buf) != 0) {
-		membuffer_destroy(&start_msg);
-		sock_destroy(&info, SD_BOTH);
-		return UPNP_E_OUTOF_MEMORY;
-	}
-	timeout = GENA_NOTIFICATION_SENDING_TIMEOUT;
-	/* send msg (note: end of notification will contain "\r\n" twice) */
-	ret_code = http_SendMessage(&info, &timeout,
-	                            "bbb",
-	                            start_msg.buf, start_msg.length,
-	                            propertySet, strlen(propertySet),
-	                            CRLF, strlen(CRLF));
-	if (ret_code) {
-		membuffer_destroy(&start_msg);
-		sock_destroy(&info, SD_BOTH);
-		return ret_code;
-	}
-	timeout = GENA_NOTIFICATION_ANSWERING_TIMEOUT;
-	ret_code = http_RecvMessage(&info, response,
-	                            HTTPMETHOD_NOTIFY, &timeout, &err_code);
-	if (ret_code) {
-		membuffer_destroy(&start_msg);
-		sock_destroy(&info, SD_BOTH);
-		httpmsg_destroy(&response->msg);
-		return ret_code;
-	}
-	/* should shutdown completely when closing socket */
-	sock_destroy(&info, SD_BOTH);
-	membuffer_destroy(&start_msg);
+static void genaNotifyDone(void *cookie, int result, int statusCode);
 
-	return UPNP_E_SUCCESS;
-}
+static void genaScheduleRetry(UpnpDevice_Handle device_handle,
+	subscription *sub, long long now);
 
 /*!
- * \brief Function to Notify a particular subscription of a particular event.
+ * \brief Hands an event to the delivery engine for a subscription.
  *
- * In general the service should NOT be blocked around this call (this may
- * cause deadlock with a client).
+ * The event must be the head of the queue of the subscription: the SEQ header
+ * is the key of the next event to send. While the delivery to the host of the
+ * subscription is suspended after failures, the event stays queued and a
+ * timer job retries it later.
  *
- * NOTIFY http request is sent and the reply is processed.
+ * \return GENA_SUCCESS if the delivery is started or delayed, otherwise
+ * 	returns the appropriate error code.
  *
- * \return GENA_SUCCESS if the event was delivered, otherwise returns the
- * 	appropriate error code.
+ * \note Called with HandleLock held.
  */
-static int genaNotify(
-	/*! [in] Null terminated, includes all headers (including \\r\\n) except SID and SEQ. */
-	char *headers,
-	/*! [in] The evented XML. */
-	char *propertySet,
-	/*! [in] subscription to be Notified, assumes this is valid for life of function. */
-	subscription *sub) {
-	size_t i;
+static int genaNotifyStart(
+	/*! [in] Subscription to be notified. */
+	subscription *sub,
+	/*! [in] Event, released by genaNotifyDone(). */
+	notify_thread_struct *in) {
 	membuffer mid_msg;
-	uri_type *url;
-	http_parser_t response;
-	int return_code = -1;
+	long long now = sock_now_ms();
+	int ret;
 
+	sub->retryAt = genaBreakerCheck(&sub->DeliveryURLs.parsedURLs[0], now);
+	if (sub->retryAt != 0) {
+		genaScheduleRetry(in->device_handle, sub, now);
+		return GENA_SUCCESS;
+	}
 	membuffer_init(&mid_msg);
 	if (http_MakeMessage(&mid_msg, 1, 1,
 	                     "s" "ssc" "sdcc",
-	                     headers,
+	                     in->headers,
 	                     "SID: ", sub->sid,
 	                     "SEQ: ", sub->ToSendEventKey) != 0) {
 		membuffer_destroy(&mid_msg);
 		return UPNP_E_OUTOF_MEMORY;
 	}
-	/* send a notify to each url until one goes thru */
-	for (i = 0; i < sub->DeliveryURLs.size; i++) {
-		url = &sub->DeliveryURLs.parsedURLs[i];
-		return_code = notify_send_and_recv(
-			url, &mid_msg, propertySet, &response);
-		if (return_code == UPNP_E_SUCCESS)
-			break;
-	}
+	ret = genaDeliveryStart(&sub->DeliveryURLs, &mid_msg, in->propertySet,
+	                        genaNotifyDone, in);
 	membuffer_destroy(&mid_msg);
-	if (return_code == UPNP_E_SUCCESS) {
-		if (response.msg.status_code == HTTP_OK)
-			return_code = GENA_SUCCESS;
-		else {
-			if (response.msg.status_code == HTTP_PRECONDITION_FAILED)
-				/*Invalid SID gets removed */
-				return_code = GENA_E_NOTIFY_UNACCEPTED_REMOVE_SUB;
-			else
-				return_code = GENA_E_NOTIFY_UNACCEPTED;
-		}
-		httpmsg_destroy(&response.msg);
-	}
+	if (ret == GENA_SUCCESS)
+		sub->deliveryStart = now;
 
-	return return_code;
+	return ret;
 }
 
 /*!
- * \brief Thread job to Notify a control point.
+ * \brief Starts the delivery of the event at the head of the queue of a
+ * subscription, dropping the events that cannot be started.
  *
- * It validates the subscription and copies the subscription. Also make sure
- * that events are sent in order.
+ * \note Called with HandleLock held.
+ */
+static void genaNotifyQueued(
+	/*! [in] Subscription to be notified. */
+	subscription *sub) {
+	notify_thread_struct *next;
+	ListNode *node;
+
+	while ((node = ListHead(&sub->outgoing)) != NULL) {
+		next = (notify_thread_struct *) node->item;
+		if (genaNotifyStart(sub, next) == GENA_SUCCESS)
+			break;
+		/* The engine is shutting down, drop the event. */
+		free_notify_struct(next);
+		ListDelNode(&sub->outgoing, node, 0);
+	}
+}
+
+/*!
+ * \brief Updates the delivery counters of a subscription and the breaker of
+ * its host, which suspends the delivery to all the subscriptions of the host
+ * after GENA_BREAKER_THRESHOLD consecutive failures.
  *
- * \note calls the genaNotify to do the actual work.
+ * \note Called with HandleLock held.
  */
-static void genaNotifyThread(
-	/*! [in] notify thread structure containing all the headers and property set info. */
+static void genaCountDelivery(
+	/*! [in] Subscription notified. */
+	subscription *sub,
+	/*! [in] GENA_SUCCESS if the event was accepted. */
+	int return_code) {
+	long long now = sock_now_ms();
+	long long latency = now - sub->deliveryStart;
+
+	if (return_code == GENA_SUCCESS) {
+		sub->delivered++;
+		sub->latencySum += latency;
+		sub->lastLatency = latency;
+		if (latency > sub->maxLatency)
+			sub->maxLatency = latency;
+		sub->consecutiveFailures = 0;
+	} else {
+		sub->failed++;
+		sub->consecutiveFailures++;
+	}
+	sub->retryAt = genaBreakerCount(&sub->DeliveryURLs.parsedURLs[0],
+	                                return_code == GENA_SUCCESS, now);
+}
+
+/*!
+ * \brief Timer job retrying the delivery to a subscription suspended after
+ * failures.
+ */
+static void genaRetryDelivery(
+	/*! [in] upnp_timeout whose Event is the SID of the subscription. */
 	void *input) {
-	subscription *sub;
-	service_info *service;
-	subscription sub_copy;
-	notify_thread_struct *in = (notify_thread_struct *) input;
-	int return_code;
+	upnp_timeout *event = (upnp_timeout *) input;
 	struct Handle_Info *handle_info;
+	service_info *service;
+	subscription *sub = NULL;
 
-	/* This should be a HandleLock and not a HandleReadLock otherwise if there
-	 * is a lot of notifications, then multiple threads will acquire a read
-	 * lock and the thread which sends the notification will be blocked forever
-	 * on the HandleLock at the end of this function. */
-	/*HandleReadLock(); */
 	HandleLock();
-	/* validate context */
+	if (GetHandleInfo(event->handle, &handle_info) == HND_DEVICE) {
+		service = handle_info->ServiceTable.serviceList;
+		for (; service != NULL && sub == NULL; service = service->next)
+			sub = GetSubscriptionSID((char *) event->Event, service);
+		if (sub != NULL) {
+			sub->retryScheduled = 0;
+			genaNotifyQueued(sub);
+		}
+	}
+	HandleUnlock();
+	free_upnp_timeout(event);
+}
 
-	if (GetHandleInfo(in->device_handle, &handle_info) != HND_DEVICE) {
-		free_notify_struct(in);
-		HandleUnlock();
+/*!
+ * \brief Schedules a timer job retrying the delivery to a subscription when
+ * its delivery is resumed, unless one is already scheduled.
+ *
+ * \note Called with HandleLock held.
+ */
+static void genaScheduleRetry(
+	/*! [in] Device handle. */
+	UpnpDevice_Handle device_handle,
+	/*! [in] Subscription. */
+	subscription *sub,
+	/*! [in] Current time, from sock_now_ms(). */
+	long long now) {
+	ThreadPoolJob job;
+	upnp_timeout *event;
+	char *sid;
+
+	if (sub->retryScheduled)
+		return;
+	event = (upnp_timeout *) malloc(sizeof(upnp_timeout));
+	sid = (char *) malloc(sizeof(Upnp_SID));
+	if (event == NULL || sid == NULL) {
+		free(event);
+		free(sid);
 		return;
 	}
-
-	if (!(service = FindServiceId(&handle_info->ServiceTable, in->servId, in->UDN)) ||
-		!service->active ||
-		!(sub = GetSubscriptionSID(in->sid, service)) ||
-		copy_subscription(sub, &sub_copy) != HTTP_SUCCESS) {
-		free_notify_struct(in);
-		HandleUnlock();
+	memset(event, 0, sizeof(upnp_timeout));
+	memcpy(sid, sub->sid, sizeof(Upnp_SID));
+	event->handle = device_handle;
+	event->Event = sid;
+	TPJobInit(&job, (start_routine) genaRetryDelivery, event);
+	TPJobSetFreeFunction(&job, (free_routine) free_upnp_timeout);
+	TPJobSetPriority(&job, MED_PRIORITY);
+	if (TimerThreadScheduleMs(&gTimerThread, (long) (sub->retryAt - now),
+	                          &job, SHORT_TERM, &event->eventId) != 0) {
+		free_upnp_timeout(event);
 		return;
 	}
+	sub->retryScheduled = 1;
+}
 
-	HandleUnlock();
+/*!
+ * \brief Called by the delivery engine when the event at the head of the
+ * queue of a subscription is delivered or failed.
+ *
+ * It validates the subscription, then removes the head of its queue and
+ * starts the next event, so that events are sent in order.
+ */
+static void genaNotifyDone(
+	/*! [in] notify thread structure containing all the headers and property set info. */
+	void *cookie,
+	/*! [in] Result of the delivery. */
+	int result,
+	/*! [in] HTTP status code of the response. */
+	int statusCode) {
+	subscription *sub;
+	service_info *service;
+	notify_thread_struct *in = (notify_thread_struct *) cookie;
+	ListNode *node;
+	int return_code = result;
+	struct Handle_Info *handle_info;
 
-	/* send the notify */
-	return_code = genaNotify(in->headers, in->propertySet, &sub_copy);
-	freeSubscription(&sub_copy);
+	if (result == UPNP_E_SUCCESS) {
+		if (statusCode == HTTP_OK)
+			return_code = GENA_SUCCESS;
+		else if (statusCode == HTTP_PRECONDITION_FAILED)
+			/*Invalid SID gets removed */
+			return_code = GENA_E_NOTIFY_UNACCEPTED_REMOVE_SUB;
+		else
+			return_code = GENA_E_NOTIFY_UNACCEPTED;
+	}
 	HandleLock();
 	if (GetHandleInfo(in->device_handle, &handle_info) != HND_DEVICE) {
 		free_notify_struct(in);
@@ -350,28 +377,19 @@ static void genaNotifyThread(
 		HandleUnlock();
 		return;
 	}
+	if (result != UPNP_E_CANCELED)
+		genaCountDelivery(sub, return_code);
+	sub->deliveryStart = 0;
 	sub->ToSendEventKey++;
 	if (sub->ToSendEventKey < 0)
 		/* wrap to 1 for overflow */
 		sub->ToSendEventKey = 1;
 
 	/* Remove head of event queue. Possibly activate next */
-	{
-		ListNode *node = ListHead(&sub->outgoing);
-		if (node)
-			ListDelNode(&sub->outgoing, node, 1);
-		if (ListSize(&sub->outgoing) > 0) {
-			ThreadPoolJob *job;
-			ListNode *node = ListHead(&sub->outgoing);
-			job = (ThreadPoolJob *) node->item;
-			/* The new head of queue should not have already been
-			   added to the pool, else something is very wrong */
-			assert(job->jobId != STALE_JOBID);
-
-			ThreadPoolAdd(&gSendThreadPool, job, NULL);
-			job->jobId = STALE_JOBID;
-		}
-	}
+	node = ListHead(&sub->outgoing);
+	if (node)
+		ListDelNode(&sub->outgoing, node, 0);
+	genaNotifyQueued(sub);
 
 	if (return_code == GENA_E_NOTIFY_UNACCEPTED_REMOVE_SUB)
 		RemoveSubscriptionSID(in->sid, service);
@@ -436,25 +454,231 @@ static char *AllocGenaHeaders(
 void freeSubscriptionQueuedEvents(subscription *sub) {
 	if (ListSize(&sub->outgoing) > 0) {
 		/* The first event is discarded without dealing
-		   notify_thread_struct: there is a mirror ThreadPool entry for
-		   this one, and it will take care of the refcount etc. Other
-		   entries must be fully cleaned-up here */
-		int first = 1;
+		   notify_thread_struct if it is being delivered: the delivery
+		   engine will take care of the refcount etc. Other entries must
+		   be fully cleaned-up here */
+		int first = sub->deliveryStart != 0;
 		ListNode *node = ListHead(&sub->outgoing);
 		while (node) {
-			ThreadPoolJob *job = (ThreadPoolJob *) node->item;
 			if (first) {
 				first = 0;
 			} else {
-				free_notify_struct((notify_thread_struct *) job->arg);
+				free_notify_struct((notify_thread_struct *) node->item);
 			}
-			free(node->item);
 			ListDelNode(&sub->outgoing, node, 0);
 			node = ListHead(&sub->outgoing);
 		}
 	}
 }
 
+/*!
+ * \brief Merges property sets, keeping the last value of each state variable
+ * in the order the variables first appear.
+ *
+ * \return UPNP_E_SUCCESS, UPNP_E_OUTOF_MEMORY, or UPNP_E_INVALID_PARAM if a
+ * 	property set cannot be parsed.
+ */
+static int MergePropertySets(
+	/*! [in] Property sets, the oldest first. */
+	DOMString *propertySets,
+	/*! [in] Number of property sets. */
+	int count,
+	/*! [out] Merged property set, to free with ixmlFreeDOMString(). */
+	DOMString *out) {
+	IXML_Document **docs = NULL;
+	IXML_Node **vars = NULL;
+	IXML_Node **tmp;
+	IXML_Node *prop;
+	IXML_Node *var;
+	DOMString varString;
+	membuffer buf;
+	size_t numVars = 0;
+	size_t maxVars = 0;
+	size_t j;
+	int ret = UPNP_E_SUCCESS;
+	int i;
+
+	membuffer_init(&buf);
+	docs = (IXML_Document **) calloc((size_t) count, sizeof(IXML_Document *));
+	if (docs == NULL) {
+		ret = UPNP_E_OUTOF_MEMORY;
+		goto ExitFunction;
+	}
+	/* collect the last element of each state variable */
+	for (i = 0; i < count; i++) {
+		if (ixmlParseBufferEx(propertySets[i], &docs[i]) != IXML_SUCCESS) {
+			ret = UPNP_E_INVALID_PARAM;
+			goto ExitFunction;
+		}
+		prop = ixmlNode_getFirstChild(
+			ixmlNode_getFirstChild((IXML_Node *) docs[i]));
+		for (; prop != NULL; prop = ixmlNode_getNextSibling(prop)) {
+			var = ixmlNode_getFirstChild(prop);
+			for (; var != NULL; var = ixmlNode_getNextSibling(var)) {
+				if (ixmlNode_getNodeType(var) != eELEMENT_NODE)
+					continue;
+				for (j = 0; j < numVars; j++) {
+					if (strcmp(ixmlNode_getNodeName(vars[j]),
+					           ixmlNode_getNodeName(var)) == 0)
+						break;
+				}
+				if (j == maxVars) {
+					maxVars = maxVars ? 2 * maxVars : (size_t) 8;
+					tmp = (IXML_Node **) realloc(vars,
+						maxVars * sizeof(IXML_Node *));
+					if (tmp == NULL) {
+						ret = UPNP_E_OUTOF_MEMORY;
+						goto ExitFunction;
+					}
+					vars = tmp;
+				}
+				vars[j] = var;
+				if (j == numVars)
+					numVars++;
+			}
+		}
+	}
+	if (membuffer_append_str(&buf, XML_PROPERTYSET_HEADER) != 0) {
+		ret = UPNP_E_OUTOF_MEMORY;
+		goto ExitFunction;
+	}
+	for (j = 0; j < numVars; j++) {
+		varString = ixmlNodetoString(vars[j]);
+		if (varString == NULL ||
+		    membuffer_append_str(&buf, "<e:property>\n") != 0 ||
+		    membuffer_append_str(&buf, varString) != 0 ||
+		    membuffer_append_str(&buf, "\n</e:property>\n") != 0) {
+			ixmlFreeDOMString(varString);
+			ret = UPNP_E_OUTOF_MEMORY;
+			goto ExitFunction;
+		}
+		ixmlFreeDOMString(varString);
+	}
+	if (membuffer_append_str(&buf, "</e:propertyset>\n\n") != 0) {
+		ret = UPNP_E_OUTOF_MEMORY;
+		goto ExitFunction;
+	}
+	*out = membuffer_detach(&buf);
+
+	ExitFunction:
+	if (docs != NULL) {
+		for (i = 0; i < count; i++)
+			ixmlDocument_free(docs[i]);
+	}
+	free(docs);
+	free(vars);
+	membuffer_destroy(&buf);
+
+	return ret;
+}
+
+/*!
+ * \brief Replaces the events queued behind the one being delivered, and a new
+ * event, by a single event with the last value of each state variable.
+ *
+ * The merged event takes the place of the first event it replaces, so the
+ * event keys of the subscription go on from there.
+ *
+ * \return GENA_SUCCESS if the events are merged, otherwise the queue is
+ * 	unchanged and the appropriate error code is returned.
+ *
+ * \note Called with HandleLock held.
+ */
+static int genaCoalesceEvents(
+	/*! [in] Subscription with a full queue. */
+	subscription *sub,
+	/*! [in] Device handle. */
+	UpnpDevice_Handle device_handle,
+	/*! [in] UDN of the service. */
+	const char *UDN,
+	/*! [in] Service ID. */
+	const char *servId,
+	/*! [in] Property set of the new event, not taken. */
+	DOMString propertySet) {
+	DOMString *propertySets = NULL;
+	DOMString merged = NULL;
+	notify_thread_struct *thread_struct = NULL;
+	ListNode *node;
+	ListNode *next;
+	ListNode *tail;
+	int count = 0;
+	int ret = GENA_SUCCESS;
+
+	if (ListSize(&sub->outgoing) < 2)
+		return GENA_E_NOTIFY_UNACCEPTED;
+	propertySets = (DOMString *) malloc(
+		ListSize(&sub->outgoing) * sizeof(DOMString));
+	thread_struct = (notify_thread_struct *) malloc(
+		sizeof(notify_thread_struct));
+	if (propertySets == NULL || thread_struct == NULL) {
+		ret = UPNP_E_OUTOF_MEMORY;
+		goto ExitFunction;
+	}
+	memset(thread_struct, 0, sizeof(notify_thread_struct));
+	/* the head stays as it is: it is being delivered, or waits for the
+	 * delivery to resume */
+	node = ListNext(&sub->outgoing, ListHead(&sub->outgoing));
+	for (; node != NULL; node = ListNext(&sub->outgoing, node))
+		propertySets[count++] =
+			((notify_thread_struct *) node->item)->propertySet;
+	propertySets[count++] = propertySet;
+	ret = MergePropertySets(propertySets, count, &merged);
+	if (ret != UPNP_E_SUCCESS)
+		goto ExitFunction;
+
+	thread_struct->reference_count = (int *) malloc(sizeof(int));
+	thread_struct->UDN = strdup(UDN);
+	thread_struct->servId = strdup(servId);
+	thread_struct->headers = AllocGenaHeaders(merged);
+	if (thread_struct->reference_count == NULL ||
+	    thread_struct->UDN == NULL ||
+	    thread_struct->servId == NULL ||
+	    thread_struct->headers == NULL) {
+		ret = UPNP_E_OUTOF_MEMORY;
+		goto ExitFunction;
+	}
+	*thread_struct->reference_count = 1;
+	thread_struct->propertySet = merged;
+	memset(thread_struct->sid, 0, sizeof(thread_struct->sid));
+	strncpy(thread_struct->sid, sub->sid, sizeof(thread_struct->sid) - 1);
+	thread_struct->device_handle = device_handle;
+
+	/* queue the merged event, then drop the events it replaces */
+	node = ListNext(&sub->outgoing, ListHead(&sub->outgoing));
+	thread_struct->eventKey =
+		((notify_thread_struct *) node->item)->eventKey;
+	tail = ListAddTail(&sub->outgoing, thread_struct);
+	if (tail == NULL) {
+		ret = UPNP_E_OUTOF_MEMORY;
+		goto ExitFunction;
+	}
+	while (node != tail) {
+		next = ListNext(&sub->outgoing, node);
+		free_notify_struct((notify_thread_struct *) node->item);
+		ListDelNode(&sub->outgoing, node, 0);
+		node = next;
+	}
+	sub->eventKey = thread_struct->eventKey + 1;
+	/* if overflow, wrap to 1 */
+	if (sub->eventKey < 0)
+		sub->eventKey = 1;
+	thread_struct = NULL;
+	merged = NULL;
+
+	ExitFunction:
+	if (thread_struct != NULL) {
+		free(thread_struct->reference_count);
+		free(thread_struct->UDN);
+		free(thread_struct->servId);
+		free(thread_struct->headers);
+		free(thread_struct);
+	}
+	ixmlFreeDOMString(merged);
+	free(propertySets);
+
+	return ret;
+}
+
 /* We take ownership of propertySet and will free it */
 static int genaInitNotifyCommon(
 	UpnpDevice_Handle device_handle,
@@ -474,19 +698,10 @@ static int genaInitNotifyCommon(
 	subscription *sub = NULL;
 	service_info *service = NULL;
 	struct Handle_Info *handle_info;
-	ThreadPoolJob *job = NULL;
 
 	UpnpPrintf(UPNP_INFO, GENA, __FILE__, __LINE__,
 	           "GENA BEGIN INITIAL NOTIFY COMMON\n");
 
-	job = (ThreadPoolJob *) malloc(sizeof(ThreadPoolJob));
-	if (job == NULL) {
-		line = __LINE__;
-		ret = UPNP_E_OUTOF_MEMORY;
-		goto ExitFunction;
-	}
-	memset(job, 0, sizeof(ThreadPoolJob));
-
 	reference_count = (int *) malloc(sizeof(int));
 	if (reference_count == NULL) {
 		line = __LINE__;
@@ -563,32 +778,21 @@ static int genaInitNotifyCommon(
 		thread_struct->reference_count = reference_count;
 		thread_struct->device_handle = device_handle;
 
-		TPJobInit(job, (start_routine) genaNotifyThread, thread_struct);
-		TPJobSetFreeFunction(job, (free_routine) free_notify_struct);
-		TPJobSetPriority(job, MED_PRIORITY);
-
-		ret = ThreadPoolAdd(&gSendThreadPool, job, NULL);
-		if (ret != 0) {
-			if (ret == EOUTOFMEM) {
-				line = __LINE__;
-				ret = UPNP_E_OUTOF_MEMORY;
-			}
-		} else {
-			ListNode *node = ListAddTail(&sub->outgoing, job);
-			if (node != NULL) {
-				((ThreadPoolJob *) node->item)->jobId = STALE_JOBID;
-				line = __LINE__;
-				ret = GENA_SUCCESS;
-			} else {
+		if (ListAddTail(&sub->outgoing, thread_struct) == NULL) {
+			line = __LINE__;
+			ret = UPNP_E_OUTOF_MEMORY;
+		} else if (ListSize(&sub->outgoing) == 1) {
+			ret = genaNotifyStart(sub, thread_struct);
+			if (ret != GENA_SUCCESS) {
 				line = __LINE__;
-				ret = UPNP_E_OUTOF_MEMORY;
+				ListDelNode(&sub->outgoing,
+				            ListTail(&sub->outgoing), 0);
 			}
 		}
 	}
 
 	ExitFunction:
 	if (ret != GENA_SUCCESS) {
-		free(job);
 		free(thread_struct);
 		free(headers);
 		ixmlFreeDOMString(propertySet);
@@ -688,6 +892,42 @@ int genaInitNotifyExt(
 	return ret;
 }
 
+/*!
+ * \brief Copies the text of a property set in a string of the DOM, for the
+ * functions that take the ownership of the property set.
+ *
+ * \return The copy, NULL if out of memory.
+ */
+static DOMString CopyPropertySet(
+	/*! [in] Property set. */
+	const char *propertySet,
+	/*! [in] Length of the property set. */
+	size_t length) {
+	DOMString copy = (DOMString) malloc(length + 1);
+
+	if (copy == NULL)
+		return NULL;
+	memcpy(copy, propertySet, length);
+	copy[length] = '\0';
+
+	return copy;
+}
+
+int genaInitNotifyString(
+	UpnpDevice_Handle device_handle,
+	char *UDN,
+	char *servId,
+	const char *propertySet,
+	size_t length,
+	const Upnp_SID sid) {
+	DOMString copy = CopyPropertySet(propertySet, length);
+
+	if (copy == NULL)
+		return UPNP_E_OUTOF_MEMORY;
+
+	return genaInitNotifyCommon(device_handle, UDN, servId, copy, sid);
+}
+
 /* We take ownership of propertySet and will free it */
 static int genaNotifyAllCommon(
 	UpnpDevice_Handle device_handle,
@@ -750,8 +990,17 @@ static int genaNotifyAllCommon(
 		if (service != NULL) {
 			finger = GetFirstSubscription(service);
 			while (finger) {
-				ThreadPoolJob *job = NULL;
-				ListNode *node;
+
+				/* Merge the queued events rather than dropping one. */
+				if (handle_info->CoalesceEvents &&
+					ListSize(&finger->outgoing) >=
+					MAX_SUBSCRIPTION_QUEUED_EVENTS &&
+					genaCoalesceEvents(finger, device_handle, UDN,
+					                   servId, propertySet) ==
+					GENA_SUCCESS) {
+					finger = GetNextSubscription(service, finger);
+					continue;
+				}
 
 				thread_struct = (notify_thread_struct *) malloc(sizeof(notify_thread_struct));
 				if (thread_struct == NULL) {
@@ -786,40 +1035,31 @@ static int genaNotifyAllCommon(
 					if (node) {
 						/* We delete the node ourselves because we also need
 						   to do the right thing about the thread struct */
-						job = (ThreadPoolJob *) node->item;
-						free_notify_struct((notify_thread_struct *) job->arg);
-						free(node->item);
+						free_notify_struct((notify_thread_struct *) node->item);
 						ListDelNode(&finger->outgoing, node, 0);
 					}
 				}
 
-				job = (ThreadPoolJob *) malloc(sizeof(ThreadPoolJob));
-				if (job == NULL) {
+				if (ListAddTail(&finger->outgoing, thread_struct) == NULL) {
 					line = __LINE__;
+					(*reference_count)--;
+					free(thread_struct);
 					ret = UPNP_E_OUTOF_MEMORY;
 					break;
 				}
-				memset(job, 0, sizeof(ThreadPoolJob));
-				TPJobInit(job, (start_routine) genaNotifyThread, thread_struct);
-				TPJobSetFreeFunction(job, (free_routine) free_notify_struct);
-				TPJobSetPriority(job, MED_PRIORITY);
-				node = ListAddTail(&finger->outgoing, job);
 
 				/* If there is only one element on the list (which we just 
-				   added), need to kickstart the threadpool */
+				   added), need to kickstart the delivery */
 				if (ListSize(&finger->outgoing) == 1) {
-					ret = ThreadPoolAdd(&gSendThreadPool, job, NULL);
-					if (ret != 0) {
+					ret = genaNotifyStart(finger, thread_struct);
+					if (ret != GENA_SUCCESS) {
 						line = __LINE__;
-						if (ret == EOUTOFMEM) {
-							line = __LINE__;
-							ret = UPNP_E_OUTOF_MEMORY;
-						}
+						ListDelNode(&finger->outgoing,
+						            ListHead(&finger->outgoing), 0);
+						(*reference_count)--;
+						free(thread_struct);
 						break;
 					}
-					if (node) {
-						((ThreadPoolJob *) (node->item))->jobId = STALE_JOBID;
-					}
 				}
 				finger = GetNextSubscription(service, finger);
 			}
@@ -851,11 +1091,16 @@ static int genaNotifyAllCommon(
 	return ret;
 }
 
+static ithread_mutex_t *StateVarLock(const char *UDN, const char *servId);
+static void genaDropHeldValues(UpnpDevice_Handle device_handle, char *UDN,
+	char *servId, IXML_Document *PropSet, const char *propertySet);
+
 int genaNotifyAllExt(
 	UpnpDevice_Handle device_handle,
 	char *UDN,
 	char *servId,
 	IXML_Document *PropSet) {
+	ithread_mutex_t *lock;
 	int ret = GENA_SUCCESS;
 	int line = 0;
 
@@ -874,7 +1119,11 @@ int genaNotifyAllExt(
 	           "GENERATED PROPERTY SET IN EXT NOTIFY: %s\n",
 	           propertySet);
 
+	lock = StateVarLock(UDN, servId);
+	ithread_mutex_lock(lock);
+	genaDropHeldValues(device_handle, UDN, servId, PropSet, NULL);
 	ret = genaNotifyAllCommon(device_handle, UDN, servId, propertySet);
+	ithread_mutex_unlock(lock);
 
 	ExitFunction:
 
@@ -885,104 +1134,1134 @@ int genaNotifyAllExt(
 	return ret;
 }
 
-int genaNotifyAll(
+int genaNotifyAllString(
 	UpnpDevice_Handle device_handle,
 	char *UDN,
 	char *servId,
-	char **VarNames,
-	char **VarValues,
-	int var_count) {
-	int ret = GENA_SUCCESS;
-	int line = 0;
+	const char *propertySet,
+	size_t length) {
+	DOMString copy = CopyPropertySet(propertySet, length);
+	ithread_mutex_t *lock;
+	int ret;
 
-	DOMString propertySet = NULL;
+	if (copy == NULL)
+		return UPNP_E_OUTOF_MEMORY;
 
-	UpnpPrintf(UPNP_INFO, GENA, __FILE__, __LINE__,
-	           "GENA BEGIN NOTIFY ALL\n");
+	lock = StateVarLock(UDN, servId);
+	ithread_mutex_lock(lock);
+	genaDropHeldValues(device_handle, UDN, servId, NULL, copy);
+	ret = genaNotifyAllCommon(device_handle, UDN, servId, copy);
+	ithread_mutex_unlock(lock);
 
-	ret = GeneratePropertySet(VarNames, VarValues, var_count, &propertySet);
-	if (ret != XML_SUCCESS) {
-		line = __LINE__;
-		goto ExitFunction;
-	}
-	UpnpPrintf(UPNP_INFO, GENA, __FILE__, __LINE__,
-	           "GENERATED PROPERTY SET IN EXT NOTIFY: %s\n",
-	           propertySet);
+	return ret;
+}
 
-	ret = genaNotifyAllCommon(device_handle, UDN, servId, propertySet);
+/*! Moderation of an evented state variable. */
+typedef struct {
+	/*! Name of the variable. */
+	char *name;
+	/*! Minimum time between two events of the variable, in milliseconds. */
+	long interval;
+	/*! Minimum change of a numeric value to be evented, 0 for any change. */
+	double minimumDelta;
+	/*! Set if the moderation was set for this variable, which takes
+	 * precedence over the SCPD. */
+	int fromApi;
+	/*! Last value evented, NULL before the first event. */
+	char *sentValue;
+	/*! Time from sock_now_ms() of the last event. */
+	long long sentAt;
+	/*! Latest value held back until interval is elapsed, NULL if none. */
+	char *heldValue;
+} ModeratedVar;
+
+/*! Moderated state variables of a service. */
+struct EVENT_MODERATION {
+	ModeratedVar *vars;
+	/*! Number of variables. */
+	int count;
+	/*! Size of vars. */
+	int size;
+};
+
+/*! Serialize the updates of the state variables of a service with their
+ * events: the stores, the moderation and the delta events. A service uses
+ * the lock its UDN and service id hash to, see StateVarLock(). */
+static ithread_mutex_t gStateVarLocks[GENA_STATE_VAR_LOCKS];
+
+int genaInitStateVarLocks(void) {
+	int i;
+
+	for (i = 0; i < GENA_STATE_VAR_LOCKS; i++) {
+		if (ithread_mutex_init(&gStateVarLocks[i], NULL) != 0) {
+			while (--i >= 0)
+				ithread_mutex_destroy(&gStateVarLocks[i]);
+			return UPNP_E_INIT_FAILED;
+		}
+	}
 
-	ExitFunction:
+	return UPNP_E_SUCCESS;
+}
 
-	UpnpPrintf(UPNP_INFO, GENA, __FILE__, line,
-	           "GENA END NOTIFY ALL, ret = %d\n",
-	           ret);
+void genaDestroyStateVarLocks(void) {
+	int i;
 
-	return ret;
+	for (i = 0; i < GENA_STATE_VAR_LOCKS; i++)
+		ithread_mutex_destroy(&gStateVarLocks[i]);
 }
 
 /*!
- * \brief Returns OK message in the case of a subscription request.
+ * \brief Returns the lock serializing the updates of the state variables of
+ * a service.
  *
- * \return UPNP_E_SUCCESS if successful, otherwise the appropriate error code.
+ * \return The lock of the service.
  */
-static int respond_ok(
-	/*! [in] Socket connection of request. */
-	SOCKINFO *info,
-	/*! [in] Accepted duration. */
-	int time_out,
-	/*! [in] Accepted subscription. */
-	subscription *sub,
-	/*! [in] Http request. */
-	http_message_t *request) {
-	int major;
-	int minor;
-	membuffer response;
-	int return_code;
-	char timeout_str[100];
-	int upnp_timeout = UPNP_TIMEOUT;
-	int rc = 0;
-
-	http_CalcResponseVersion(request->major_version,
-	                         request->minor_version, &major, &minor);
+static ithread_mutex_t *StateVarLock(
+	/*! [in] Device udn. */
+	const char *UDN,
+	/*! [in] Service ID. */
+	const char *servId) {
+	return &gStateVarLocks[ServiceIdHash(servId, UDN) %
+	                       (size_t) GENA_STATE_VAR_LOCKS];
+}
 
-	if (time_out >= 0) {
-		rc = snprintf(timeout_str, sizeof(timeout_str),
-		              "TIMEOUT: Second-%d", time_out);
-	} else {
-		memset(timeout_str, 0, sizeof(timeout_str));
-		strncpy(timeout_str, "TIMEOUT: Second-infinite",
-		        sizeof(timeout_str) - 1);
-	}
-	if (rc < 0 || (unsigned int) rc >= sizeof(timeout_str)) {
-		error_respond(info, HTTP_INTERNAL_SERVER_ERROR, request);
-		return UPNP_E_OUTOF_MEMORY;
-	}
+void freeEventModeration(struct EVENT_MODERATION *moderation) {
+	int i;
 
-	membuffer_init(&response);
-	response.size_inc = 30;
-	if (http_MakeMessage(
-		&response, major, minor,
-		"R" "D" "S" "N" "Xc" "ssc" "scc",
-		HTTP_OK,
-		(off_t) 0,
-		X_USER_AGENT,
-		"SID: ", sub->sid,
-		timeout_str) != 0) {
-		membuffer_destroy(&response);
-		error_respond(info, HTTP_INTERNAL_SERVER_ERROR, request);
-		return UPNP_E_OUTOF_MEMORY;
+	if (moderation == NULL)
+		return;
+	for (i = 0; i < moderation->count; i++) {
+		free(moderation->vars[i].name);
+		free(moderation->vars[i].sentValue);
+		free(moderation->vars[i].heldValue);
 	}
-
-	return_code = http_SendMessage(info, &upnp_timeout, "b",
-	                               response.buf, response.length);
-
-	membuffer_destroy(&response);
-
-	return return_code;
+	free(moderation->vars);
+	free(moderation);
 }
 
 /*!
- * \brief Function to parse the Callback header value in subscription requests.
+ * \brief Finds the moderation of a state variable.
+ *
+ * \return The moderation, NULL if the variable is not moderated.
+ */
+static ModeratedVar *FindModeratedVar(
+	/*! [in] Moderation of the service, may be NULL. */
+	struct EVENT_MODERATION *moderation,
+	/*! [in] Name of the variable. */
+	const char *name) {
+	int i;
+
+	if (moderation == NULL)
+		return NULL;
+	for (i = 0; i < moderation->count; i++)
+		if (strcmp(moderation->vars[i].name, name) == 0)
+			return &moderation->vars[i];
+
+	return NULL;
+}
+
+/*!
+ * \brief Sets the moderation of a state variable of a service.
+ *
+ * \return GENA_SUCCESS if successful, UPNP_E_OUTOF_MEMORY otherwise.
+ *
+ * \note Called with HandleLock held.
+ */
+static int SetModeratedVar(
+	/*! [in] Service of the variable. */
+	service_info *service,
+	/*! [in] Name of the variable. */
+	const char *name,
+	/*! [in] Minimum time between two events, in milliseconds. */
+	long interval,
+	/*! [in] Minimum change of a numeric value to be evented. */
+	double minimumDelta,
+	/*! [in] Set for a single variable, otherwise read from an SCPD. */
+	int fromApi) {
+	struct EVENT_MODERATION *moderation = service->moderation;
+	ModeratedVar *var;
+	ModeratedVar *vars;
+	int size;
+
+	if (moderation == NULL) {
+		moderation = (struct EVENT_MODERATION *) calloc((size_t) 1,
+			sizeof(struct EVENT_MODERATION));
+		if (moderation == NULL)
+			return UPNP_E_OUTOF_MEMORY;
+		service->moderation = moderation;
+	}
+	var = FindModeratedVar(moderation, name);
+	if (var != NULL) {
+		if (var->fromApi && !fromApi)
+			return GENA_SUCCESS;
+	} else {
+		if (moderation->count == moderation->size) {
+			size = moderation->size ? 2 * moderation->size : 4;
+			vars = (ModeratedVar *) realloc(moderation->vars,
+				(size_t) size * sizeof(ModeratedVar));
+			if (vars == NULL)
+				return UPNP_E_OUTOF_MEMORY;
+			moderation->vars = vars;
+			moderation->size = size;
+		}
+		var = &moderation->vars[moderation->count];
+		memset(var, 0, sizeof(ModeratedVar));
+		var->name = strdup(name);
+		if (var->name == NULL)
+			return UPNP_E_OUTOF_MEMORY;
+		moderation->count++;
+	}
+	var->interval = interval > 0 ? interval : 0;
+	var->minimumDelta = minimumDelta > 0 ? minimumDelta : 0;
+	var->fromApi = fromApi;
+
+	return GENA_SUCCESS;
+}
+
+/*!
+ * \brief Reads a numeric state variable value.
+ *
+ * \return 1 if the whole value is a number, 0 otherwise.
+ */
+static int ParseNumericValue(
+	/*! [in] Value of the variable. */
+	const char *value,
+	/*! [out] Number. */
+	double *number) {
+	char *end;
+
+	*number = strtod(value, &end);
+	if (end == value)
+		return 0;
+	while (isspace((unsigned char) *end))
+		end++;
+
+	return *end == '\0';
+}
+
+/*!
+ * \brief Removes from an update the moderated variables that must not be
+ * evented yet.
+ *
+ * A variable whose numeric value changed by less than its minimum delta
+ * since its last event is not evented. A variable evented less than its
+ * interval ago is held back, and its latest value is evented when the
+ * interval is elapsed.
+ *
+ * \return The time from sock_now_ms() when held values must be evented, 0 if
+ * 	no value is held back.
+ *
+ * \note Called with HandleLock held.
+ */
+static long long ModerateStateVariables(
+	/*! [in] Service of the variables. */
+	service_info *service,
+	/*! [in,out] Names of the variables, compacted to the ones to event. */
+	char **VarNames,
+	/*! [in,out] Values of the variables, compacted like VarNames. */
+	char **VarValues,
+	/*! [in,out] Number of variables. */
+	int *var_count,
+	/*! [in] Current time, from sock_now_ms(). */
+	long long now) {
+	ModeratedVar *var;
+	long long flushAt = 0;
+	double sent;
+	double value;
+	char *copy;
+	int kept = 0;
+	int i;
+
+	for (i = 0; i < *var_count; i++) {
+		var = FindModeratedVar(service->moderation, VarNames[i]);
+		if (var == NULL) {
+			VarNames[kept] = VarNames[i];
+			VarValues[kept] = VarValues[i];
+			kept++;
+			continue;
+		}
+		if (var->minimumDelta > 0 && var->sentValue != NULL &&
+		    ParseNumericValue(var->sentValue, &sent) &&
+		    ParseNumericValue(VarValues[i], &value) &&
+		    (value > sent ? value - sent : sent - value) <
+		    var->minimumDelta) {
+			/* back near the last evented value */
+			free(var->heldValue);
+			var->heldValue = NULL;
+			continue;
+		}
+		if (var->sentValue != NULL && now - var->sentAt < var->interval) {
+			copy = strdup(VarValues[i]);
+			if (copy != NULL) {
+				free(var->heldValue);
+				var->heldValue = copy;
+				if (flushAt == 0 ||
+				    var->sentAt + var->interval < flushAt)
+					flushAt = var->sentAt + var->interval;
+				continue;
+			}
+		}
+		copy = strdup(VarValues[i]);
+		if (copy != NULL) {
+			free(var->sentValue);
+			var->sentValue = copy;
+			var->sentAt = now;
+		}
+		free(var->heldValue);
+		var->heldValue = NULL;
+		VarNames[kept] = VarNames[i];
+		VarValues[kept] = VarValues[i];
+		kept++;
+	}
+	*var_count = kept;
+
+	return flushAt;
+}
+
+/*!
+ * \brief Builds the event of the held values of a service whose interval is
+ * elapsed.
+ *
+ * \return GENA_SUCCESS with a NULL property set if no value is due,
+ * 	otherwise the result of GeneratePropertySet().
+ *
+ * \note Called with HandleLock held.
+ */
+static int FlushModeratedVars(
+	/*! [in] Service of the variables. */
+	service_info *service,
+	/*! [in] Current time, from sock_now_ms(). */
+	long long now,
+	/*! [in,out] Time when the values still held must be evented, 0 if
+	 * none. */
+	long long *flushAt,
+	/*! [out] Event of the due values. */
+	DOMString *propertySet) {
+	struct EVENT_MODERATION *moderation = service->moderation;
+	ModeratedVar *var;
+	char **names;
+	char **values;
+	int count = 0;
+	int ret = GENA_SUCCESS;
+	int i;
+
+	*propertySet = NULL;
+	if (moderation == NULL || moderation->count == 0)
+		return GENA_SUCCESS;
+	names = (char **) malloc((size_t) moderation->count * sizeof(char *));
+	values = (char **) malloc((size_t) moderation->count * sizeof(char *));
+	if (names == NULL || values == NULL) {
+		free(names);
+		free(values);
+		return UPNP_E_OUTOF_MEMORY;
+	}
+	for (i = 0; i < moderation->count; i++) {
+		var = &moderation->vars[i];
+		if (var->heldValue == NULL)
+			continue;
+		if (var->sentAt + var->interval > now) {
+			if (*flushAt == 0 || var->sentAt + var->interval < *flushAt)
+				*flushAt = var->sentAt + var->interval;
+			continue;
+		}
+		names[count] = var->name;
+		values[count] = var->heldValue;
+		count++;
+	}
+	if (count > 0)
+		ret = GeneratePropertySet(names, values, count, propertySet);
+	if (ret == XML_SUCCESS) {
+		for (i = 0; i < moderation->count; i++) {
+			var = &moderation->vars[i];
+			if (var->heldValue == NULL ||
+			    var->sentAt + var->interval > now)
+				continue;
+			free(var->sentValue);
+			var->sentValue = var->heldValue;
+			var->heldValue = NULL;
+			var->sentAt = now;
+		}
+	}
+	free(names);
+	free(values);
+
+	return ret;
+}
+
+static void genaScheduleModerationFlush(UpnpDevice_Handle device_handle,
+	struct Handle_Info *handle_info, long long flushAt);
+
+/*!
+ * \brief Timer job sending the held values of the moderated variables of a
+ * device whose interval is elapsed.
+ */
+static void genaFlushModeration(
+	/*! [in] upnp_timeout whose Event is the time from sock_now_ms() the
+	 * flush was scheduled for. */
+	void *input) {
+	upnp_timeout *event = (upnp_timeout *) input;
+	struct Handle_Info *handle_info;
+	service_info *service;
+	ithread_mutex_t *lock;
+	DOMString propertySet;
+	char *UDN;
+	char *servId;
+	long long flushAt = 0;
+	int index;
+	int i;
+
+	HandleLock();
+	if (GetHandleInfo(event->handle, &handle_info) != HND_DEVICE) {
+		HandleUnlock();
+		free_upnp_timeout(event);
+		return;
+	}
+	if (handle_info->ModerationFlushAt == *(long long *) event->Event)
+		handle_info->ModerationFlushAt = 0;
+	HandleUnlock();
+	/* one service at a time, under the lock of the service, HandleLock is
+	 * released to send its event */
+	for (index = 0; ; index++) {
+		UDN = NULL;
+		servId = NULL;
+		HandleReadLock();
+		if (GetHandleInfo(event->handle, &handle_info) != HND_DEVICE) {
+			HandleUnlock();
+			break;
+		}
+		service = handle_info->ServiceTable.serviceList;
+		for (i = 0; service != NULL && i < index; i++)
+			service = service->next;
+		if (service != NULL && service->moderation != NULL) {
+			UDN = strdup(service->UDN);
+			servId = strdup(service->serviceId);
+		}
+		HandleUnlock();
+		if (service == NULL)
+			break;
+		if (UDN == NULL || servId == NULL) {
+			free(UDN);
+			free(servId);
+			continue;
+		}
+		propertySet = NULL;
+		lock = StateVarLock(UDN, servId);
+		ithread_mutex_lock(lock);
+		HandleLock();
+		if (GetHandleInfo(event->handle, &handle_info) == HND_DEVICE &&
+		    (service = FindServiceId(&handle_info->ServiceTable,
+		                             servId, UDN)) != NULL)
+			FlushModeratedVars(service, sock_now_ms(), &flushAt,
+			                   &propertySet);
+		HandleUnlock();
+		if (propertySet != NULL)
+			genaNotifyAllCommon(event->handle, UDN, servId,
+			                    propertySet);
+		ithread_mutex_unlock(lock);
+		free(UDN);
+		free(servId);
+	}
+	HandleLock();
+	if (GetHandleInfo(event->handle, &handle_info) == HND_DEVICE)
+		genaScheduleModerationFlush(event->handle, handle_info, flushAt);
+	HandleUnlock();
+	free_upnp_timeout(event);
+}
+
+/*!
+ * \brief Makes sure that the held values of the moderated variables of a
+ * device are sent by a timer job soon after a given time.
+ *
+ * \note Called with HandleLock held.
+ */
+static void genaScheduleModerationFlush(
+	/*! [in] Device handle. */
+	UpnpDevice_Handle device_handle,
+	/*! [in] Device handle information. */
+	struct Handle_Info *handle_info,
+	/*! [in] Time from sock_now_ms() when held values must be sent, 0 if
+	 * none. */
+	long long flushAt) {
+	ThreadPoolJob job;
+	upnp_timeout *event;
+	long long *scheduledAt;
+	long long now;
+
+	if (flushAt == 0 || (handle_info->ModerationFlushAt != 0 &&
+	                     handle_info->ModerationFlushAt <= flushAt))
+		return;
+	event = (upnp_timeout *) malloc(sizeof(upnp_timeout));
+	scheduledAt = (long long *) malloc(sizeof(long long));
+	if (event == NULL || scheduledAt == NULL) {
+		free(event);
+		free(scheduledAt);
+		return;
+	}
+	memset(event, 0, sizeof(upnp_timeout));
+	*scheduledAt = flushAt;
+	event->handle = device_handle;
+	event->Event = scheduledAt;
+	now = sock_now_ms();
+	TPJobInit(&job, (start_routine) genaFlushModeration, event);
+	TPJobSetFreeFunction(&job, (free_routine) free_upnp_timeout);
+	TPJobSetPriority(&job, MED_PRIORITY);
+	if (TimerThreadScheduleMs(&gTimerThread,
+	                          flushAt > now ? (long) (flushAt - now) : 0,
+	                          &job, SHORT_TERM, &event->eventId) != 0) {
+		free_upnp_timeout(event);
+		return;
+	}
+	handle_info->ModerationFlushAt = flushAt;
+}
+
+/*!
+ * \brief Applies the moderation of a service to an update of its state
+ * variables, and schedules the event of the values held back.
+ *
+ * \note Called with HandleLock held.
+ */
+static void genaModerate(
+	/*! [in] Device handle. */
+	UpnpDevice_Handle device_handle,
+	/*! [in] Device handle information. */
+	struct Handle_Info *handle_info,
+	/*! [in] Service of the variables. */
+	service_info *service,
+	/*! [in,out] Names of the variables, compacted to the ones to event. */
+	char **VarNames,
+	/*! [in,out] Values of the variables, compacted like VarNames. */
+	char **VarValues,
+	/*! [in,out] Number of variables. */
+	int *var_count) {
+	if (service->moderation == NULL)
+		return;
+	genaScheduleModerationFlush(device_handle, handle_info,
+		ModerateStateVariables(service, VarNames, VarValues, var_count,
+		                       sock_now_ms()));
+}
+
+/*!
+ * \brief Drops the value held back for a moderated variable, if any.
+ *
+ * \note Called with HandleLock held.
+ */
+static void DropHeldValue(
+	/*! [in] Moderation of the service. */
+	struct EVENT_MODERATION *moderation,
+	/*! [in] Name of the variable, not null-terminated. */
+	const char *name,
+	/*! [in] Length of the name. */
+	size_t length) {
+	ModeratedVar *var;
+	int i;
+
+	for (i = 0; i < moderation->count; i++) {
+		var = &moderation->vars[i];
+		if (strncmp(var->name, name, length) == 0 &&
+		    var->name[length] == '\0') {
+			free(var->heldValue);
+			var->heldValue = NULL;
+			return;
+		}
+	}
+}
+
+/*!
+ * \brief Drops the values held back for the moderated variables of a
+ * property set sent as is, so that a held value older than the one sent is
+ * not sent after it.
+ *
+ * The property set is either a document or the text written by an
+ * UpnpPropertySetWriter.
+ *
+ * \note Called with the lock of the service held, see StateVarLock().
+ */
+static void genaDropHeldValues(
+	/*! [in] Device handle. */
+	UpnpDevice_Handle device_handle,
+	/*! [in] Device udn. */
+	char *UDN,
+	/*! [in] Service ID. */
+	char *servId,
+	/*! [in] Property set document, NULL if given as text. */
+	IXML_Document *PropSet,
+	/*! [in] Property set text, NULL if given as a document. */
+	const char *propertySet) {
+	struct Handle_Info *handle_info;
+	service_info *service;
+	IXML_Node *root;
+	IXML_Node *property;
+	IXML_Node *var;
+	const char *name;
+	const char *p;
+
+	HandleLock();
+	if (GetHandleInfo(device_handle, &handle_info) != HND_DEVICE ||
+	    (service = FindServiceId(&handle_info->ServiceTable,
+	                             servId, UDN)) == NULL ||
+	    service->moderation == NULL) {
+		HandleUnlock();
+		return;
+	}
+	if (PropSet != NULL) {
+		root = ixmlNode_getFirstChild((IXML_Node *) PropSet);
+		while (root != NULL &&
+		       ixmlNode_getNodeType(root) != eELEMENT_NODE)
+			root = ixmlNode_getNextSibling(root);
+		property = root ? ixmlNode_getFirstChild(root) : NULL;
+		for (; property != NULL;
+		     property = ixmlNode_getNextSibling(property)) {
+			for (var = ixmlNode_getFirstChild(property); var != NULL;
+			     var = ixmlNode_getNextSibling(var)) {
+				if (ixmlNode_getNodeType(var) != eELEMENT_NODE)
+					continue;
+				name = ixmlNode_getNodeName(var);
+				DropHeldValue(service->moderation, name,
+				              strlen(name));
+			}
+		}
+	} else {
+		for (p = strstr(propertySet, "<e:property>"); p != NULL;
+		     p = strstr(p, "<e:property>")) {
+			p += strlen("<e:property>");
+			while (isspace((unsigned char) *p))
+				p++;
+			if (*p != '<')
+				continue;
+			p++;
+			DropHeldValue(service->moderation, p,
+			              strcspn(p, " \t\r\n/>"));
+		}
+	}
+	HandleUnlock();
+}
+
+int genaSetModeration(
+	UpnpDevice_Handle device_handle,
+	char *UDN,
+	char *servId,
+	char *VarName,
+	long interval,
+	double minimumDelta) {
+	struct Handle_Info *handle_info;
+	service_info *service;
+	int ret;
+
+	HandleLock();
+	if (GetHandleInfo(device_handle, &handle_info) != HND_DEVICE) {
+		ret = GENA_E_BAD_HANDLE;
+	} else if ((service = FindServiceId(&handle_info->ServiceTable,
+	                                    servId, UDN)) == NULL) {
+		ret = GENA_E_BAD_SERVICE;
+	} else {
+		ret = SetModeratedVar(service, VarName, interval, minimumDelta,
+		                      1);
+	}
+	HandleUnlock();
+
+	return ret;
+}
+
+int genaLoadScpdModeration(
+	UpnpDevice_Handle device_handle,
+	char *UDN,
+	char *servId,
+	IXML_Document *scpd) {
+	struct Handle_Info *handle_info;
+	service_info *service;
+	IXML_NodeList *vars;
+	IXML_Node *var;
+	IXML_Node *element;
+	DOMString name;
+	DOMString value;
+	double maximumRate;
+	double minimumDelta;
+	unsigned long i;
+	int ret = GENA_SUCCESS;
+
+	vars = ixmlDocument_getElementsByTagName(scpd, "stateVariable");
+	HandleLock();
+	if (GetHandleInfo(device_handle, &handle_info) != HND_DEVICE) {
+		ret = GENA_E_BAD_HANDLE;
+		goto ExitFunction;
+	}
+	service = FindServiceId(&handle_info->ServiceTable, servId, UDN);
+	if (service == NULL) {
+		ret = GENA_E_BAD_SERVICE;
+		goto ExitFunction;
+	}
+	for (i = 0; i < ixmlNodeList_length(vars); i++) {
+		var = ixmlNodeList_item(vars, i);
+		maximumRate = 0;
+		minimumDelta = 0;
+		if (getSubElement("maximumRate", var, &element) &&
+		    (value = getElementValue(element)) != NULL) {
+			if (!ParseNumericValue(value, &maximumRate))
+				maximumRate = 0;
+			ixmlFreeDOMString(value);
+		}
+		if (getSubElement("minimumDelta", var, &element) &&
+		    (value = getElementValue(element)) != NULL) {
+			if (!ParseNumericValue(value, &minimumDelta))
+				minimumDelta = 0;
+			ixmlFreeDOMString(value);
+		}
+		if (maximumRate <= 0 && minimumDelta <= 0)
+			continue;
+		if (!getSubElement("name", var, &element) ||
+		    (name = getElementValue(element)) == NULL)
+			continue;
+		ret = SetModeratedVar(service, name, (long) (maximumRate * 1000),
+		                      minimumDelta, 0);
+		ixmlFreeDOMString(name);
+		if (ret != GENA_SUCCESS)
+			break;
+	}
+
+	ExitFunction:
+	HandleUnlock();
+	ixmlNodeList_free(vars);
+
+	return ret;
+}
+
+/*! Evented state variables of a service, kept by the library. */
+struct STATE_VAR_STORE {
+	/*! Names of the variables, in the order they were first set. */
+	char **names;
+	/*! Values of the variables. */
+	char **values;
+	/*! Number of variables. */
+	int count;
+	/*! Size of names and values. */
+	int size;
+	/*! Initial event for the current values, shared by the new
+	 * subscriptions through its reference count; NULL until a subscription
+	 * needs it, and dropped when a value changes. */
+	notify_thread_struct *initialEvent;
+};
+
+void freeStateVarStore(struct STATE_VAR_STORE *store) {
+	int i;
+
+	if (store == NULL)
+		return;
+	for (i = 0; i < store->count; i++) {
+		free(store->names[i]);
+		free(store->values[i]);
+	}
+	free(store->names);
+	free(store->values);
+	if (store->initialEvent)
+		free_notify_struct(store->initialEvent);
+	free(store);
+}
+
+/*!
+ * \brief Stores values of state variables.
+ *
+ * \return GENA_SUCCESS or UPNP_E_OUTOF_MEMORY. On success, the names and
+ * 	values that changed are in changedNames and changedValues, which point
+ * 	into the store.
+ *
+ * \note Called with HandleLock held.
+ */
+static int StoreStateVariables(
+	/*! [in] Store of the service. */
+	struct STATE_VAR_STORE *store,
+	/*! [in] Names of the variables. */
+	char **VarNames,
+	/*! [in] Values of the variables. */
+	char **VarValues,
+	/*! [in] Number of variables. */
+	int var_count,
+	/*! [out] Names of the variables that changed, var_count entries. */
+	char **changedNames,
+	/*! [out] New values of the variables that changed. */
+	char **changedValues,
+	/*! [out] Number of variables that changed. */
+	int *changed) {
+	char **names;
+	char **values;
+	char *value;
+	int size;
+	int i;
+	int j;
+	int k;
+
+	*changed = 0;
+	for (i = 0; i < var_count; i++) {
+		for (j = 0; j < store->count; j++) {
+			if (!strcmp(store->names[j], VarNames[i]))
+				break;
+		}
+		if (j < store->count && !strcmp(store->values[j], VarValues[i]))
+			continue;
+		value = strdup(VarValues[i]);
+		if (value == NULL)
+			return UPNP_E_OUTOF_MEMORY;
+		if (j == store->count) {
+			if (store->count == store->size) {
+				size = store->size ? 2 * store->size : 8;
+				names = (char **) realloc(store->names,
+				                          (size_t) size * sizeof(char *));
+				if (names != NULL)
+					store->names = names;
+				values = (char **) realloc(store->values,
+				                           (size_t) size * sizeof(char *));
+				if (values != NULL)
+					store->values = values;
+				if (names == NULL || values == NULL) {
+					free(value);
+					return UPNP_E_OUTOF_MEMORY;
+				}
+				store->size = size;
+			}
+			store->names[j] = strdup(VarNames[i]);
+			if (store->names[j] == NULL) {
+				free(value);
+				return UPNP_E_OUTOF_MEMORY;
+			}
+			store->values[j] = NULL;
+			store->count++;
+		}
+		free(store->values[j]);
+		store->values[j] = value;
+		/* a variable set twice is reported once, with its last value */
+		for (k = 0; k < *changed; k++) {
+			if (changedNames[k] == store->names[j])
+				break;
+		}
+		changedNames[k] = store->names[j];
+		changedValues[k] = store->values[j];
+		if (k == *changed)
+			(*changed)++;
+	}
+	if (*changed > 0 && store->initialEvent != NULL) {
+		free_notify_struct(store->initialEvent);
+		store->initialEvent = NULL;
+	}
+
+	return GENA_SUCCESS;
+}
+
+/*!
+ * \brief Applies an update of state variables of a service: it is stored if
+ * the service has a store, moderated, and sent to all the subscribed control
+ * points.
+ *
+ * With a store, only the variables whose value changed are sent.
+ *
+ * \return GENA_SUCCESS if successful, otherwise the appropriate error code.
+ */
+static int genaUpdateStateVariables(
+	/*! [in] Device handle. */
+	UpnpDevice_Handle device_handle,
+	/*! [in] Device udn. */
+	char *UDN,
+	/*! [in] Service ID. */
+	char *servId,
+	/*! [in] Names of the variables. */
+	char **VarNames,
+	/*! [in] Values of the variables. */
+	char **VarValues,
+	/*! [in] Number of variables. */
+	int var_count,
+	/*! [in] Set to create the store of the service if it has none. */
+	int createStore) {
+	struct Handle_Info *handle_info;
+	service_info *service;
+	ithread_mutex_t *lock;
+	char **names;
+	char **values;
+	DOMString propertySet = NULL;
+	size_t size = (size_t) (var_count > 0 ? var_count : 1);
+	int count = 0;
+	int ret = GENA_SUCCESS;
+
+	names = (char **) malloc(size * sizeof(char *));
+	values = (char **) malloc(size * sizeof(char *));
+	if (names == NULL || values == NULL) {
+		free(names);
+		free(values);
+		return UPNP_E_OUTOF_MEMORY;
+	}
+
+	/* The event of an update is queued before another update of the
+	 * service, so that the control points see the values in the order
+	 * they were set. */
+	lock = StateVarLock(UDN, servId);
+	ithread_mutex_lock(lock);
+	HandleLock();
+	if (GetHandleInfo(device_handle, &handle_info) != HND_DEVICE) {
+		ret = GENA_E_BAD_HANDLE;
+	} else if ((service = FindServiceId(&handle_info->ServiceTable,
+	                                    servId, UDN)) == NULL) {
+		ret = GENA_E_BAD_SERVICE;
+	} else {
+		if (createStore && service->stateVars == NULL) {
+			service->stateVars = (struct STATE_VAR_STORE *) calloc(
+				(size_t) 1, sizeof(struct STATE_VAR_STORE));
+			if (service->stateVars == NULL)
+				ret = UPNP_E_OUTOF_MEMORY;
+		}
+		if (service->stateVars != NULL) {
+			ret = StoreStateVariables(service->stateVars,
+			                          VarNames, VarValues, var_count,
+			                          names, values, &count);
+		} else if (ret == GENA_SUCCESS && var_count > 0) {
+			memcpy(names, VarNames, (size_t) var_count * sizeof(char *));
+			memcpy(values, VarValues,
+			       (size_t) var_count * sizeof(char *));
+			count = var_count;
+		}
+		/* a partial store is reported, its changes are not evented */
+		if (ret == GENA_SUCCESS && count > 0)
+			genaModerate(device_handle, handle_info, service,
+			             names, values, &count);
+		/* the stored entries may be freed once unlocked; an update of
+		 * no variable is sent as is, without a store */
+		if (ret == GENA_SUCCESS &&
+		    (count > 0 || (var_count == 0 && service->stateVars == NULL)))
+			ret = GeneratePropertySet(names, values, count,
+			                          &propertySet);
+	}
+	HandleUnlock();
+	if (propertySet != NULL) {
+		UpnpPrintf(UPNP_INFO, GENA, __FILE__, __LINE__,
+		           "GENERATED PROPERTY SET IN NOTIFY: %s\n",
+		           propertySet);
+		ret = genaNotifyAllCommon(device_handle, UDN, servId,
+		                          propertySet);
+	}
+	ithread_mutex_unlock(lock);
+	free(names);
+	free(values);
+
+	return ret;
+}
+
+int genaNotifyAll(
+	UpnpDevice_Handle device_handle,
+	char *UDN,
+	char *servId,
+	char **VarNames,
+	char **VarValues,
+	int var_count) {
+	int ret;
+
+	UpnpPrintf(UPNP_INFO, GENA, __FILE__, __LINE__,
+	           "GENA BEGIN NOTIFY ALL\n");
+	ret = genaUpdateStateVariables(device_handle, UDN, servId, VarNames,
+	                               VarValues, var_count, 0);
+	UpnpPrintf(UPNP_INFO, GENA, __FILE__, __LINE__,
+	           "GENA END NOTIFY ALL, ret = %d\n",
+	           ret);
+
+	return ret;
+}
+
+int genaSetStateVariables(
+	UpnpDevice_Handle device_handle,
+	char *UDN,
+	char *servId,
+	char **VarNames,
+	char **VarValues,
+	int var_count) {
+	if (var_count <= 0)
+		return GENA_SUCCESS;
+
+	return genaUpdateStateVariables(device_handle, UDN, servId, VarNames,
+	                                VarValues, var_count, 1);
+}
+
+int genaGetSubscriptionStats(
+	UpnpDevice_Handle device_handle,
+	char *UDN,
+	char *servId,
+	char *sid,
+	struct Upnp_Subscription_Stats *stats) {
+	struct Handle_Info *handle_info;
+	service_info *service;
+	subscription *sub;
+	long long now;
+
+	HandleReadLock();
+	if (GetHandleInfo(device_handle, &handle_info) != HND_DEVICE) {
+		HandleUnlock();
+		return GENA_E_BAD_HANDLE;
+	}
+	service = FindServiceId(&handle_info->ServiceTable, servId, UDN);
+	if (service == NULL) {
+		HandleUnlock();
+		return GENA_E_BAD_SERVICE;
+	}
+	sub = GetSubscriptionSID(sid, service);
+	if (sub == NULL) {
+		HandleUnlock();
+		return GENA_E_BAD_SID;
+	}
+	now = sock_now_ms();
+	memset(stats, 0, sizeof(struct Upnp_Subscription_Stats));
+	stats->Delivered = sub->delivered;
+	stats->Failed = sub->failed;
+	stats->ConsecutiveFailures = sub->consecutiveFailures;
+	stats->QueuedEvents = (int) ListSize(&sub->outgoing);
+	stats->LastLatency = (long) sub->lastLatency;
+	if (sub->delivered > 0)
+		stats->AverageLatency =
+			(long) (sub->latencySum / (long long) sub->delivered);
+	stats->MaxLatency = (long) sub->maxLatency;
+	if (sub->retryAt > now)
+		stats->RetryIn = (long) (sub->retryAt - now);
+	HandleUnlock();
+
+	return GENA_SUCCESS;
+}
+
+/*!
+ * \brief Queues the initial event of a new subscription from the state
+ * variables kept by the library.
+ *
+ * \return GENA_SUCCESS if successful, otherwise the appropriate error code.
+ *
+ * \note Called with HandleLock held.
+ */
+static int genaInitNotifyFromStore(
+	/*! [in] Device handle. */
+	UpnpDevice_Handle device_handle,
+	/*! [in] Service with a store. */
+	service_info *service,
+	/*! [in] New subscription. */
+	subscription *sub) {
+	struct STATE_VAR_STORE *store = service->stateVars;
+	notify_thread_struct *shared = store->initialEvent;
+	notify_thread_struct *thread_struct;
+	DOMString propertySet = NULL;
+	int ret;
+
+	if (shared == NULL) {
+		ret = GeneratePropertySet(store->names, store->values,
+		                          store->count, &propertySet);
+		if (ret != XML_SUCCESS)
+			return ret;
+		shared = (notify_thread_struct *) calloc((size_t) 1,
+			sizeof(notify_thread_struct));
+		if (shared == NULL) {
+			ixmlFreeDOMString(propertySet);
+			return UPNP_E_OUTOF_MEMORY;
+		}
+		shared->propertySet = propertySet;
+		shared->reference_count = (int *) malloc(sizeof(int));
+		shared->UDN = strdup(service->UDN);
+		shared->servId = strdup(service->serviceId);
+		shared->headers = AllocGenaHeaders(propertySet);
+		if (shared->reference_count == NULL || shared->UDN == NULL ||
+		    shared->servId == NULL || shared->headers == NULL) {
+			free(shared->reference_count);
+			free(shared->UDN);
+			free(shared->servId);
+			free(shared->headers);
+			ixmlFreeDOMString(propertySet);
+			free(shared);
+			return UPNP_E_OUTOF_MEMORY;
+		}
+		/* the reference of the store */
+		*shared->reference_count = 1;
+		shared->device_handle = device_handle;
+		store->initialEvent = shared;
+	}
+
+	thread_struct = (notify_thread_struct *) malloc(
+		sizeof(notify_thread_struct));
+	if (thread_struct == NULL)
+		return UPNP_E_OUTOF_MEMORY;
+	*thread_struct = *shared;
+	memset(thread_struct->sid, 0, sizeof(thread_struct->sid));
+	strncpy(thread_struct->sid, sub->sid, sizeof(thread_struct->sid) - 1);
+	thread_struct->eventKey = sub->eventKey++;
+	(*thread_struct->reference_count)++;
+	sub->active = 1;
+	if (ListAddTail(&sub->outgoing, thread_struct) == NULL) {
+		free_notify_struct(thread_struct);
+		return UPNP_E_OUTOF_MEMORY;
+	}
+	if (ListSize(&sub->outgoing) == 1) {
+		ret = genaNotifyStart(sub, thread_struct);
+		if (ret != GENA_SUCCESS) {
+			ListDelNode(&sub->outgoing, ListTail(&sub->outgoing), 0);
+			free_notify_struct(thread_struct);
+			return ret;
+		}
+	}
+
+	return GENA_SUCCESS;
+}
+
+/*!
+ * \brief Returns OK message in the case of a subscription request.
+ *
+ * \return UPNP_E_SUCCESS if successful, otherwise the appropriate error code.
+ */
+static int respond_ok(
+	/*! [in] Socket connection of request. */
+	SOCKINFO *info,
+	/*! [in] Accepted duration. */
+	int time_out,
+	/*! [in] Accepted subscription. */
+	subscription *sub,
+	/*! [in] Http request. */
+	http_message_t *request) {
+	int major;
+	int minor;
+	membuffer response;
+	int return_code;
+	char timeout_str[100];
+	int upnp_timeout = UPNP_TIMEOUT;
+	int rc = 0;
+
+	http_CalcResponseVersion(request->major_version,
+	                         request->minor_version, &major, &minor);
+
+	if (time_out >= 0) {
+		rc = snprintf(timeout_str, sizeof(timeout_str),
+		              "TIMEOUT: Second-%d", time_out);
+	} else {
+		memset(timeout_str, 0, sizeof(timeout_str));
+		strncpy(timeout_str, "TIMEOUT: Second-infinite",
+		        sizeof(timeout_str) - 1);
+	}
+	if (rc < 0 || (unsigned int) rc >= sizeof(timeout_str)) {
+		error_respond(info, HTTP_INTERNAL_SERVER_ERROR, request);
+		return UPNP_E_OUTOF_MEMORY;
+	}
+
+	membuffer_init(&response);
+	response.size_inc = 30;
+	if (http_MakeMessage(
+		&response, major, minor,
+		"R" "D" "S" "N" "Xc" "ssc" "sc" "Ac",
+		HTTP_OK,
+		(off_t) 0,
+		X_USER_AGENT,
+		"SID: ", sub->sid,
+		timeout_str,
+		info) != 0) {
+		membuffer_destroy(&response);
+		error_respond(info, HTTP_INTERNAL_SERVER_ERROR, request);
+		return UPNP_E_OUTOF_MEMORY;
+	}
+
+	return_code = http_SendMessage(info, &upnp_timeout, "b",
+	                               response.buf, response.length);
+
+	membuffer_destroy(&response);
+
+	return return_code;
+}
+
+/*!
+ * \brief Function to parse the Callback header value in subscription requests.
  *
  * Takes in a buffer containing URLS delimited by '<' and '>'. The entire buffer
  * is copied into dynamic memory and stored in the URL_list. Pointers to the
@@ -1065,6 +2344,363 @@ static int create_url_list(
 	return (int) URLcount;
 }
 
+static void genaScheduleSubscriptionSweep(UpnpDevice_Handle device_handle,
+	struct Handle_Info *handle_info, time_t expireTime);
+
+/*!
+ * \brief Timer job freeing the expired subscriptions of a device.
+ */
+static void genaSweepSubscriptions(
+	/*! [in] upnp_timeout whose Event is the time_t the sweep was scheduled
+	 * for. */
+	void *input) {
+	upnp_timeout *event = (upnp_timeout *) input;
+	struct Handle_Info *handle_info;
+	service_info *service;
+	time_t next = 0;
+	time_t expireTime;
+	time_t current_time;
+
+	HandleLock();
+	if (GetHandleInfo(event->handle, &handle_info) == HND_DEVICE) {
+		if (handle_info->SubscriptionSweepAt == *(time_t *) event->Event)
+			handle_info->SubscriptionSweepAt = 0;
+		time(&current_time);
+		service = handle_info->ServiceTable.serviceList;
+		for (; service != NULL; service = service->next) {
+			expireTime = ExpireSubscriptions(service, current_time);
+			if (expireTime != 0 && (next == 0 || expireTime < next))
+				next = expireTime;
+		}
+		genaScheduleSubscriptionSweep(event->handle, handle_info, next);
+	}
+	HandleUnlock();
+	free_upnp_timeout(event);
+}
+
+/*!
+ * \brief Makes sure that the expired subscriptions of a device are freed by
+ * a timer job soon after a given expiration time.
+ *
+ * \note Called with HandleLock held.
+ */
+static void genaScheduleSubscriptionSweep(
+	/*! [in] Device handle. */
+	UpnpDevice_Handle device_handle,
+	/*! [in] Device handle information. */
+	struct Handle_Info *handle_info,
+	/*! [in] Expiration time of a subscription, 0 if it does not expire. */
+	time_t expireTime) {
+	ThreadPoolJob job;
+	upnp_timeout *event;
+	time_t *sweepAt;
+
+	if (expireTime == 0 || (handle_info->SubscriptionSweepAt != 0 &&
+	                        handle_info->SubscriptionSweepAt <= expireTime))
+		return;
+	event = (upnp_timeout *) malloc(sizeof(upnp_timeout));
+	sweepAt = (time_t *) malloc(sizeof(time_t));
+	if (event == NULL || sweepAt == NULL) {
+		free(event);
+		free(sweepAt);
+		return;
+	}
+	memset(event, 0, sizeof(upnp_timeout));
+	/* a subscription expires once its time is passed */
+	*sweepAt = expireTime + 1;
+	event->handle = device_handle;
+	event->Event = sweepAt;
+	TPJobInit(&job, (start_routine) genaSweepSubscriptions, event);
+	TPJobSetFreeFunction(&job, (free_routine) free_upnp_timeout);
+	TPJobSetPriority(&job, LOW_PRIORITY);
+	if (TimerThreadSchedule(&gTimerThread, *sweepAt, ABS_SEC, &job,
+	                        SHORT_TERM, &event->eventId) != UPNP_E_SUCCESS) {
+		free_upnp_timeout(event);
+		return;
+	}
+	handle_info->SubscriptionSweepAt = *sweepAt;
+}
+
+
+/*! First line of a subscription snapshot, with its format version. */
+#define SNAPSHOT_HEADER "UPNP-SUBSCRIPTIONS 1\n"
+
+int genaSetSubscriptionSnapshot(const char *fileName) {
+	char *copy = NULL;
+
+	if (fileName != NULL) {
+		copy = strdup(fileName);
+		if (copy == NULL)
+			return UPNP_E_OUTOF_MEMORY;
+	}
+	HandleLock();
+	free(gSubscriptionSnapshot);
+	gSubscriptionSnapshot = copy;
+	HandleUnlock();
+
+	return UPNP_E_SUCCESS;
+}
+
+/*!
+ * \brief Tells if a string can be a field of a subscription snapshot.
+ *
+ * \return 1 if the string is not empty and holds no white space, 0
+ * 	otherwise.
+ */
+static int IsSnapshotField(
+	/*! [in] String. */
+	const char *s) {
+	if (*s == '\0')
+		return 0;
+	for (; *s != '\0'; s++)
+		if (isspace((unsigned char) *s))
+			return 0;
+
+	return 1;
+}
+
+/*!
+ * \brief Returns the file of the subscription snapshot of a device: the
+ * IPv6 device, which has its own subscriptions, adds ".ipv6" to the name.
+ *
+ * \return The file name, to free, or NULL if out of memory.
+ *
+ * \note Called with HandleLock held.
+ */
+static char *SnapshotFileName(
+	/*! [in] Device handle information. */
+	struct Handle_Info *handle_info) {
+	char *fileName;
+
+	fileName = (char *) malloc(strlen(gSubscriptionSnapshot) +
+	                           sizeof(".ipv6"));
+	if (fileName == NULL)
+		return NULL;
+	strcpy(fileName, gSubscriptionSnapshot);
+	if (handle_info->DeviceAf == AF_INET6)
+		strcat(fileName, ".ipv6");
+
+	return fileName;
+}
+
+/*!
+ * \brief Writes the active subscriptions of a device to the subscription
+ * snapshot.
+ *
+ * Each line holds the expiration time (0 if the subscription does not
+ * expire), the next event key, the SID, the UDN and the service ID, then the
+ * callback URLs up to the end of the line. The file is replaced atomically.
+ *
+ * \return UPNP_E_SUCCESS if successful, UPNP_E_FILE_WRITE_ERROR otherwise.
+ *
+ * \note Called with HandleLock held.
+ */
+static int SaveSubscriptions(
+	/*! [in] Device handle information. */
+	struct Handle_Info *handle_info) {
+	char *fileName;
+	service_info *service;
+	subscription *sub;
+	char *tempName;
+	FILE *fp;
+	time_t now = time(NULL);
+	int ret = UPNP_E_SUCCESS;
+
+	fileName = SnapshotFileName(handle_info);
+	tempName = (char *) malloc(strlen(gSubscriptionSnapshot) +
+	                           sizeof(".ipv6.tmp"));
+	if (fileName == NULL || tempName == NULL) {
+		free(fileName);
+		free(tempName);
+		return UPNP_E_OUTOF_MEMORY;
+	}
+	sprintf(tempName, "%s.tmp", fileName);
+	fp = fopen(tempName, "wb");
+	if (fp == NULL) {
+		free(fileName);
+		free(tempName);
+		return UPNP_E_FILE_WRITE_ERROR;
+	}
+	if (fputs(SNAPSHOT_HEADER, fp) == EOF)
+		ret = UPNP_E_FILE_WRITE_ERROR;
+	service = handle_info->ServiceTable.serviceList;
+	for (; service != NULL && ret == UPNP_E_SUCCESS;
+	     service = service->next) {
+		if (!service->active || !IsSnapshotField(service->UDN) ||
+		    !IsSnapshotField(service->serviceId))
+			continue;
+		sub = service->subscriptionList;
+		for (; sub != NULL; sub = sub->next) {
+			if (!sub->active || sub->DeliveryURLs.URLs == NULL ||
+			    strpbrk(sub->DeliveryURLs.URLs, "\r\n") != NULL ||
+			    (sub->expireTime != 0 && sub->expireTime <= now))
+				continue;
+			if (fprintf(fp, "%lld %d %s %s %s %s\n",
+			            (long long) sub->expireTime, sub->eventKey,
+			            sub->sid, service->UDN, service->serviceId,
+			            sub->DeliveryURLs.URLs) < 0) {
+				ret = UPNP_E_FILE_WRITE_ERROR;
+				break;
+			}
+		}
+	}
+	if (fclose(fp) != 0)
+		ret = UPNP_E_FILE_WRITE_ERROR;
+#ifdef WIN32
+	if (ret == UPNP_E_SUCCESS)
+		remove(fileName);
+#endif
+	if (ret == UPNP_E_SUCCESS && rename(tempName, fileName) != 0)
+		ret = UPNP_E_FILE_WRITE_ERROR;
+	if (ret != UPNP_E_SUCCESS)
+		remove(tempName);
+	free(fileName);
+	free(tempName);
+
+	return ret;
+}
+
+int genaSaveSubscriptions(UpnpDevice_Handle device_handle) {
+	struct Handle_Info *handle_info;
+	int ret;
+
+	HandleReadLock();
+	if (GetHandleInfo(device_handle, &handle_info) != HND_DEVICE)
+		ret = GENA_E_BAD_HANDLE;
+	else if (gSubscriptionSnapshot == NULL)
+		ret = UPNP_E_INVALID_PARAM;
+	else
+		ret = SaveSubscriptions(handle_info);
+	HandleUnlock();
+
+	return ret;
+}
+
+/*!
+ * \brief Restores a subscription from a line of the subscription snapshot.
+ *
+ * \return The expiration time of the subscription, 0 if it does not expire,
+ * 	-1 if the line is not restored.
+ *
+ * \note Called with HandleLock held.
+ */
+static time_t RestoreSubscription(
+	/*! [in] Device handle information. */
+	struct Handle_Info *handle_info,
+	/*! [in] The line, without its end of line, modified. */
+	char *line,
+	/*! [in] Current time. */
+	time_t now) {
+	char *fields[5];
+	char *end;
+	memptr urls;
+	service_info *service;
+	subscription *sub;
+	long long expireTime;
+	long eventKey;
+	int i;
+
+	for (i = 0; i < 5; i++) {
+		fields[i] = line;
+		line = strchr(line, ' ');
+		if (line == NULL)
+			return -1;
+		*line++ = '\0';
+	}
+	expireTime = strtoll(fields[0], &end, 10);
+	if (*end != '\0' || expireTime < 0 ||
+	    (expireTime != 0 && expireTime <= (long long) now))
+		return -1;
+	eventKey = strtol(fields[1], &end, 10);
+	if (*end != '\0' || eventKey < 0 || eventKey > INT_MAX ||
+	    strlen(fields[2]) >= sizeof(Upnp_SID))
+		return -1;
+	service = FindServiceId(&handle_info->ServiceTable, fields[4],
+	                        fields[3]);
+	if (service == NULL || !service->active ||
+	    GetSubscriptionSID(fields[2], service) != NULL)
+		return -1;
+	sub = (subscription *) malloc(sizeof(subscription));
+	if (sub == NULL)
+		return -1;
+	memset(sub, 0, sizeof(subscription));
+	if (ListInit(&sub->outgoing, 0, NULL) != 0) {
+		free(sub);
+		return -1;
+	}
+	strcpy(sub->sid, fields[2]);
+	sub->eventKey = (int) eventKey;
+	sub->ToSendEventKey = (int) eventKey;
+	sub->expireTime = (time_t) expireTime;
+	sub->active = 1;
+	urls.buf = line;
+	urls.length = strlen(line);
+	if (create_url_list(&urls, &sub->DeliveryURLs) <= 0 ||
+	    AddSubscription(service, sub) != UPNP_E_SUCCESS) {
+		freeSubscriptionList(sub);
+		return -1;
+	}
+
+	return sub->expireTime;
+}
+
+void genaLoadSubscriptions(
+	UpnpDevice_Handle device_handle,
+	struct Handle_Info *handle_info) {
+	FILE *fp;
+	char *fileName;
+	char *buffer;
+	char *line;
+	char *next;
+	long size;
+	time_t now = time(NULL);
+	time_t expireTime;
+	time_t sweepAt = 0;
+	int restored = 0;
+
+	if (gSubscriptionSnapshot == NULL ||
+	    (fileName = SnapshotFileName(handle_info)) == NULL)
+		return;
+	fp = fopen(fileName, "rb");
+	free(fileName);
+	if (fp == NULL)
+		return;
+	/* the whole snapshot is read at once and parsed in place */
+	if (fseek(fp, 0, SEEK_END) != 0 || (size = ftell(fp)) <= 0 ||
+	    fseek(fp, 0, SEEK_SET) != 0 ||
+	    (buffer = (char *) malloc((size_t) size + 1)) == NULL) {
+		fclose(fp);
+		return;
+	}
+	if (fread(buffer, (size_t) 1, (size_t) size, fp) != (size_t) size ||
+	    strncmp(buffer, SNAPSHOT_HEADER, strlen(SNAPSHOT_HEADER)) != 0) {
+		free(buffer);
+		fclose(fp);
+		return;
+	}
+	fclose(fp);
+	buffer[size] = '\0';
+	for (line = buffer + strlen(SNAPSHOT_HEADER); *line != '\0';
+	     line = next) {
+		next = strchr(line, '\n');
+		if (next == NULL)
+			/* truncated line */
+			break;
+		*next++ = '\0';
+		expireTime = RestoreSubscription(handle_info, line, now);
+		if (expireTime == -1)
+			continue;
+		restored++;
+		if (expireTime != 0 && (sweepAt == 0 || expireTime < sweepAt))
+			sweepAt = expireTime;
+	}
+	free(buffer);
+	genaScheduleSubscriptionSweep(device_handle, handle_info, sweepAt);
+	UpnpPrintf(UPNP_INFO, GENA, __FILE__, __LINE__,
+	           "Restored %d subscriptions\n", restored);
+}
+
+
 void gena_process_subscription_request(
 	SOCKINFO *info,
 	http_message_t *request) {
@@ -1138,6 +2774,7 @@ void gena_process_subscription_request(
 		goto exit_function;
 	}
 
+	ExpireSubscriptions(service, time(NULL));
 	UpnpPrintf(UPNP_INFO, GENA, __FILE__, __LINE__,
 	           "Subscription Request: Number of subscriptions already: %d, "
 		           "Max Subscriptions allowed: %d\n",
@@ -1158,6 +2795,7 @@ void gena_process_subscription_request(
 		HandleUnlock();
 		goto exit_function;
 	}
+	memset(sub, 0, sizeof(subscription));
 	sub->eventKey = 0;
 	sub->ToSendEventKey = 0;
 	sub->active = 0;
@@ -1165,7 +2803,7 @@ void gena_process_subscription_request(
 	sub->DeliveryURLs.size = 0;
 	sub->DeliveryURLs.URLs = NULL;
 	sub->DeliveryURLs.parsedURLs = NULL;
-	if (ListInit(&sub->outgoing, 0, free) != 0) {
+	if (ListInit(&sub->outgoing, 0, NULL) != 0) {
 		error_respond(info, HTTP_INTERNAL_SERVER_ERROR, request);
 		HandleUnlock();
 		goto exit_function;
@@ -1223,18 +2861,31 @@ void gena_process_subscription_request(
 	uuid_unpack(&uid, temp_sid);
 	rc = snprintf(sub->sid, sizeof(sub->sid), "uuid:%s", temp_sid);
 
-	/* respond OK */
+	/* add to subscription list */
 	if (rc < 0 || (unsigned int) rc >= sizeof(sub->sid) ||
-		(respond_ok(info, time_out,
-		            sub, request) != UPNP_E_SUCCESS)) {
+		AddSubscription(service, sub) != UPNP_E_SUCCESS) {
+		error_respond(info, HTTP_INTERNAL_SERVER_ERROR, request);
 		freeSubscriptionList(sub);
 		HandleUnlock();
 		goto exit_function;
 	}
-	/* add to subscription list */
-	sub->next = service->subscriptionList;
-	service->subscriptionList = sub;
-	service->TotalSubscriptions++;
+	/* respond OK */
+	if (respond_ok(info, time_out, sub, request) != UPNP_E_SUCCESS) {
+		RemoveSubscriptionSID(sub->sid, service);
+		HandleUnlock();
+		goto exit_function;
+	}
+	genaScheduleSubscriptionSweep(device_handle, handle_info,
+	                              sub->expireTime);
+
+	/* the library sends the initial event of the state variables it keeps */
+	if (service->stateVars != NULL && service->stateVars->count > 0) {
+		if (genaInitNotifyFromStore(device_handle, service, sub) !=
+		    GENA_SUCCESS)
+			RemoveSubscriptionSID(sub->sid, service);
+		HandleUnlock();
+		goto exit_function;
+	}
 
 	/* finally generate callback for init table dump */
 	request_struct.ServiceId = service->serviceId;
@@ -1355,14 +3006,14 @@ void gena_process_subscription_renewal_request(
 		}
 	}
 
-	if (time_out == -1) {
-		sub->expireTime = 0;
-	} else {
-		sub->expireTime = time(NULL) + time_out;
-	}
-
-	if (respond_ok(info, time_out, sub, request) != UPNP_E_SUCCESS) {
+	if (SetSubscriptionExpireTime(service, sub, time_out == -1 ?
+	                              0 : time(NULL) + time_out) !=
+	    UPNP_E_SUCCESS ||
+	    respond_ok(info, time_out, sub, request) != UPNP_E_SUCCESS) {
 		RemoveSubscriptionSID(sub->sid, service);
+	} else {
+		genaScheduleSubscriptionSweep(device_handle, handle_info,
+		                              sub->expireTime);
 	}
 
 	HandleUnlock();
@@ -50,6 +50,7 @@
 #include "../../include/miniserver.h"
 
 #include "../../include/httpreadwrite.h"
+#include "../../include/reactor.h"
 #include "../../include/ssdplib.h"
 #include "../../include/statcodes.h"
 #include "ThreadPool.h"
@@ -58,11 +59,32 @@
 /*! . */
 #define APPLICATION_LISTENING_PORT 49152
 
+/*! Maximum number of ready sockets handled per reactor wakeup. */
+#define MINISERVER_MAX_EVENTS 32
+
+/*! Interval in milliseconds between two sweeps of the watched connections. */
+#define MINISERVER_SWEEP_INTERVAL 1000
+
 struct mserv_request_t {
 	/*! Connection handle. */
 	SOCKET connfd;
 	/*! . */
 	struct sockaddr_storage foreign_sockaddr;
+	/*! Parser receiving the current request. */
+	http_parser_t parser;
+	/*! HTTP error to answer instead of dispatching the request. */
+	int http_error_code;
+	/*! Set when the end of the request is given by the end of the
+	 * connection. */
+	int ok_on_close;
+	/*! Number of requests received on the connection. */
+	int requests;
+	/*! Time after which the watched connection is closed. */
+	time_t deadline;
+	/*! Next watched connection. */
+	struct mserv_request_t *next;
+	/*! Previous watched connection. */
+	struct mserv_request_t *prev;
 };
 
 /*! . */
@@ -82,10 +104,30 @@ uint16_t miniStopSockPort;
  * module vars
  */
 static MiniServerState gMServState = MSERV_IDLE;
+/*! Event loop of the miniserver, valid while the miniserver runs. */
+static Reactor *gMServReactor = NULL;
 #ifdef INTERNAL_WEB_SERVER
 static MiniServerCallback gGetCallback = NULL;
 static MiniServerCallback gSoapCallback = NULL;
 static MiniServerCallback gGenaCallback = NULL;
+/*! Protects gConns and gConnAccept. */
+static ithread_mutex_t gConnMutex;
+/*! Connections whose request is being read by the event loop, including
+ * idle persistent connections. */
+static struct mserv_request_t *gConns = NULL;
+/*! Set while the event loop accepts connections to watch. */
+static int gConnAccept = 0;
+
+int InitMiniServerLocks(void) {
+	if (ithread_mutex_init(&gConnMutex, NULL) != 0)
+		return UPNP_E_INIT_FAILED;
+
+	return UPNP_E_SUCCESS;
+}
+
+void DestroyMiniServerLocks(void) {
+	ithread_mutex_destroy(&gConnMutex);
+}
 
 void SetHTTPGetCallback(MiniServerCallback callback) {
 	gGetCallback = callback;
@@ -167,11 +209,73 @@ static void free_handle_request_arg(
 	struct mserv_request_t *request = (struct mserv_request_t *) args;
 
 	sock_close(request->connfd);
+	httpmsg_destroy(&request->parser.msg);
 	free(request);
 }
 
 /*!
- * \brief Receive the request and dispatch it for handling.
+ * \brief Hands a connection to the event loop, which reads the next request
+ * without blocking and schedules handle_request() once it is received.
+ *
+ * \return UPNP_E_SUCCESS if the connection is watched by the reactor,
+ * 	otherwise the caller keeps the ownership of the request.
+ */
+static int watch_connection(
+	/*! [in] Connection with an initialized parser. */
+	struct mserv_request_t *request,
+	/*! [in] Seconds to wait for the beginning of the request. */
+	int timeout) {
+	int ret = UPNP_E_FINISH;
+
+	ithread_mutex_lock(&gConnMutex);
+	if (gConnAccept) {
+		request->deadline = time(NULL) + timeout;
+		request->prev = NULL;
+		request->next = gConns;
+		if (gConns) {
+			gConns->prev = request;
+		}
+		gConns = request;
+		/* From here on the reactor thread may pick up the request. */
+		ret = reactor_add(gMServReactor, request->connfd, REACTOR_READ,
+		                  request);
+		if (ret != UPNP_E_SUCCESS) {
+			gConns = request->next;
+			if (gConns) {
+				gConns->prev = NULL;
+			}
+		}
+	}
+	ithread_mutex_unlock(&gConnMutex);
+
+	return ret;
+}
+
+/*!
+ * \brief Removes a connection from the watched list and from the reactor.
+ *
+ * gConnMutex must be locked. Called from the event loop thread only.
+ */
+static void unwatch_connection(
+	/*! [in] Watched connection. */
+	struct mserv_request_t *request) {
+	if (request->prev) {
+		request->prev->next = request->next;
+	} else {
+		gConns = request->next;
+	}
+	if (request->next) {
+		request->next->prev = request->prev;
+	}
+	reactor_del(gMServReactor, request->connfd);
+}
+
+/*!
+ * \brief Sends the response to a received request.
+ *
+ * When the client wants a persistent connection and the response could be
+ * delimited, the connection is handed back to the event loop instead of
+ * being closed.
  */
 static void handle_request(
 	/*! [in] Request Message to be handled. */
@@ -181,33 +285,27 @@ static void handle_request(
 	int ret_code;
 	int major = 1;
 	int minor = 1;
-	http_parser_t parser;
-	http_message_t *hmsg = NULL;
-	int timeout = HTTP_DEFAULT_TIMEOUT;
 	struct mserv_request_t *request = (struct mserv_request_t *) args;
+	http_parser_t *parser = &request->parser;
+	http_message_t *hmsg = &parser->msg;
 	SOCKET connfd = request->connfd;
 
-	UpnpPrintf(UPNP_INFO, MSERV, __FILE__, __LINE__,
-	           "miniserver %d: READING\n", connfd);
-	/* parser_request_init( &parser ); */ /* LEAK_FIX_MK */
-	hmsg = &parser.msg;
 	ret_code = sock_init_with_ip(
 		&info, connfd, (struct sockaddr *) &request->foreign_sockaddr);
 	if (ret_code != UPNP_E_SUCCESS) {
-		free(request);
-		httpmsg_destroy(hmsg);
+		free_handle_request_arg(request);
 		return;
 	}
-	/* read */
-	ret_code = http_RecvMessage(
-		&info, &parser, HTTPMETHOD_UNKNOWN, &timeout, &http_error_code);
-	if (ret_code != 0) {
+	http_error_code = request->http_error_code;
+	if (http_error_code != 0) {
 		goto error_handler;
 	}
+	info.keep_alive = request->requests < HTTP_KEEP_ALIVE_MAX_REQUESTS &&
+	                  parser_keep_alive(parser);
 	UpnpPrintf(UPNP_INFO, MSERV, __FILE__, __LINE__,
 	           "miniserver %d: PROCESSING...\n", connfd);
 	/* dispatch */
-	http_error_code = dispatch_request(&info, &parser);
+	http_error_code = dispatch_request(&info, parser);
 	if (http_error_code != 0) {
 		goto error_handler;
 	}
@@ -215,33 +313,158 @@ static void handle_request(
 
 	error_handler:
 	if (http_error_code > 0) {
-		if (hmsg) {
-			major = hmsg->major_version;
-			minor = hmsg->minor_version;
-		}
+		major = hmsg->major_version;
+		minor = hmsg->minor_version;
+		info.keep_alive = 0;
 		handle_error(&info, http_error_code, major, minor);
 	}
+	UpnpPrintf(UPNP_INFO, MSERV, __FILE__, __LINE__,
+	           "miniserver %d: COMPLETE\n", connfd);
+	if (info.keep_alive) {
+		httpmsg_destroy(hmsg);
+		parser_request_init(parser);
+		request->http_error_code = 0;
+		request->ok_on_close = 0;
+		if (watch_connection(request, HTTP_KEEP_ALIVE_TIMEOUT) ==
+		    UPNP_E_SUCCESS) {
+			UpnpPrintf(UPNP_INFO, MSERV, __FILE__, __LINE__,
+			           "miniserver %d: IDLE\n", connfd);
+			return;
+		}
+	}
 	sock_destroy(&info, SD_BOTH);
 	httpmsg_destroy(hmsg);
 	free(request);
+}
 
-	UpnpPrintf(UPNP_INFO, MSERV, __FILE__, __LINE__,
-	           "miniserver %d: COMPLETE\n", connfd);
+/*!
+ * \brief Removes a connection whose request is received from the event loop
+ * and adds handle_request() to the thread pool.
+ */
+static void schedule_request_job(
+	/*! [in] Watched connection. */
+	struct mserv_request_t *request) {
+	ThreadPoolJob job;
+
+	ithread_mutex_lock(&gConnMutex);
+	unwatch_connection(request);
+	ithread_mutex_unlock(&gConnMutex);
+	request->requests++;
+	memset(&job, 0, sizeof(job));
+	TPJobInit(&job, (start_routine) handle_request, (void *) request);
+	TPJobSetFreeFunction(&job, free_handle_request_arg);
+	TPJobSetPriority(&job, MED_PRIORITY);
+	if (ThreadPoolAdd(&gMiniServerThreadPool, &job, NULL) != 0) {
+		UpnpPrintf(UPNP_INFO, MSERV, __FILE__, __LINE__,
+		           "mserv %d: cannot schedule request\n",
+		           request->connfd);
+		free_handle_request_arg(request);
+	}
 }
 
 /*!
- * \brief Initilize the thread pool to handle a request, sets priority for the
- * job and adds the job to the thread pool.
+ * \brief Closes a watched connection without answering.
  */
-static UPNP_INLINE void schedule_request_job(
+static void close_connection(
+	/*! [in] Watched connection. */
+	struct mserv_request_t *request) {
+	ithread_mutex_lock(&gConnMutex);
+	unwatch_connection(request);
+	ithread_mutex_unlock(&gConnMutex);
+	free_handle_request_arg(request);
+}
+
+/*!
+ * \brief Reads the available bytes of a request on a readable connection.
+ *
+ * Called from the event loop. The request is parsed incrementally, a job is
+ * added to the thread pool only when the request can be answered, so the
+ * workers never wait for the client.
+ */
+static void read_request_data(
+	/*! [in] Watched connection. */
+	struct mserv_request_t *request) {
+	http_parser_t *parser = &request->parser;
+	char buf[2 * 1024];
+	ssize_t num_read;
+	parse_status_t status;
+	int first = parser->msg.msg.length == (size_t) 0;
+
+	/* Level triggered readiness, recv() does not block. */
+	num_read = recv(request->connfd, buf, sizeof(buf), 0);
+	if (num_read > 0) {
+		if (first) {
+			UpnpPrintf(UPNP_INFO, MSERV, __FILE__, __LINE__,
+			           "miniserver %d: READING\n", request->connfd);
+			/* The whole request is given HTTP_DEFAULT_TIMEOUT. */
+			ithread_mutex_lock(&gConnMutex);
+			request->deadline = time(NULL) + HTTP_DEFAULT_TIMEOUT;
+			ithread_mutex_unlock(&gConnMutex);
+		}
+		status = parser_append(parser, buf, (size_t) num_read);
+		if (g_maxContentLength > (size_t) 0 &&
+		    parser->ent_position == ENTREAD_USING_CLEN &&
+		    parser->content_length > (unsigned int) g_maxContentLength) {
+			request->http_error_code = HTTP_REQ_ENTITY_TOO_LARGE;
+			schedule_request_job(request);
+			return;
+		}
+		if (g_maxContentLength > (size_t) 0 &&
+		    parser->ent_position == ENTREAD_USING_CLEN) {
+			/* room for the whole body */
+			membuffer_reserve(&parser->msg.msg,
+			                  parser->entity_start_position +
+			                  (size_t) parser->content_length);
+		}
+		switch (status) {
+			case PARSE_SUCCESS:
+			case PARSE_CONTINUE_1:
+				/* Complete message, or headers of a web post
+				 * request. */
+				UpnpPrintf(UPNP_INFO, HTTP, __FILE__, __LINE__,
+				           "<<< (RECVD) <<<\n%s\n-----------------\n",
+				           parser->msg.msg.buf);
+				schedule_request_job(request);
+				break;
+			case PARSE_FAILURE:
+			case PARSE_NO_MATCH:
+				request->http_error_code = parser->http_error_code;
+				schedule_request_job(request);
+				break;
+			case PARSE_INCOMPLETE_ENTITY:
+				/* read until close */
+				request->ok_on_close = 1;
+				break;
+			default:
+				break;
+		}
+	} else if (num_read == 0) {
+		if (request->ok_on_close) {
+			schedule_request_job(request);
+		} else if (first) {
+			/* The client closed an idle connection. */
+			close_connection(request);
+		} else {
+			/* partial msg */
+			request->http_error_code = HTTP_BAD_REQUEST;
+			schedule_request_job(request);
+		}
+	} else if (errno != EINTR && errno != EAGAIN &&
+	           errno != EWOULDBLOCK) {
+		close_connection(request);
+	}
+}
+
+/*!
+ * \brief Creates the state of an accepted connection and waits for its
+ * first request in the event loop.
+ */
+static UPNP_INLINE void new_connection(
 	/*! [in] Socket Descriptor on which connection is accepted. */
 	SOCKET connfd,
 	/*! [in] Clients Address information. */
 	struct sockaddr *clientAddr) {
 	struct mserv_request_t *request;
-	ThreadPoolJob job;
-
-	memset(&job, 0, sizeof(job));
 
 	request = (struct mserv_request_t *) malloc(
 		sizeof(struct mserv_request_t));
@@ -251,85 +474,105 @@ static UPNP_INLINE void schedule_request_job(
 		sock_close(connfd);
 		return;
 	}
-
+	memset(request, 0, sizeof(struct mserv_request_t));
 	request->connfd = connfd;
 	memcpy(&request->foreign_sockaddr, clientAddr,
 	       sizeof(request->foreign_sockaddr));
-	TPJobInit(&job, (start_routine) handle_request, (void *) request);
-	TPJobSetFreeFunction(&job, free_handle_request_arg);
-	TPJobSetPriority(&job, MED_PRIORITY);
-	if (ThreadPoolAdd(&gMiniServerThreadPool, &job, NULL) != 0) {
+	parser_request_init(&request->parser);
+	if (watch_connection(request, HTTP_DEFAULT_TIMEOUT) != UPNP_E_SUCCESS) {
 		UpnpPrintf(UPNP_INFO, MSERV, __FILE__, __LINE__,
-		           "mserv %d: cannot schedule request\n", connfd);
-		free(request);
-		sock_close(connfd);
-		return;
+		           "mserv %d: cannot watch connection\n", connfd);
+		free_handle_request_arg(request);
 	}
 }
+
+/*!
+ * \brief Closes the watched connections whose deadline has passed, or all
+ * of them.
+ */
+static void sweep_connections(
+	/*! [in] Non zero to close every watched connection. */
+	int all) {
+	struct mserv_request_t *request;
+	struct mserv_request_t *next;
+	time_t now = time(NULL);
+
+	ithread_mutex_lock(&gConnMutex);
+	for (request = gConns; request != NULL; request = next) {
+		next = request->next;
+		if (all || request->deadline <= now) {
+			UpnpPrintf(UPNP_INFO, MSERV, __FILE__, __LINE__,
+			           "miniserver %d: TIMEOUT\n", request->connfd);
+			unwatch_connection(request);
+			free_handle_request_arg(request);
+		}
+	}
+	ithread_mutex_unlock(&gConnMutex);
+}
 #endif
 
-static UPNP_INLINE void fdset_if_valid(SOCKET sock, fd_set *set) {
+/*!
+ * \brief Registers a socket in the miniserver reactor for reading if the
+ * socket is valid.
+ */
+static UPNP_INLINE void reactor_add_if_valid(Reactor *reactor, SOCKET sock) {
+	int ret;
+
 	if (sock != INVALID_SOCKET) {
-		FD_SET(sock, set);
+		ret = reactor_add(reactor, sock, REACTOR_READ, NULL);
+		if (ret != UPNP_E_SUCCESS) {
+			UpnpPrintf(UPNP_CRITICAL, MSERV, __FILE__, __LINE__,
+			           "miniserver: cannot watch socket %d: %d\n",
+			           sock, ret);
+		}
 	}
 }
 
-static void web_server_accept(SOCKET lsock, fd_set *set) {
+static void web_server_accept(SOCKET lsock) {
 #ifdef INTERNAL_WEB_SERVER
 	SOCKET asock;
 	socklen_t clientLen;
 	struct sockaddr_storage clientAddr;
 	char errorBuffer[ERROR_BUFFER_LEN];
 
-	if (lsock != INVALID_SOCKET && FD_ISSET(lsock, set)) {
-		clientLen = sizeof(clientAddr);
-		asock = accept(lsock, (struct sockaddr *) &clientAddr,
-		               &clientLen);
-		if (asock == INVALID_SOCKET) {
-			strerror_r(errno, errorBuffer, ERROR_BUFFER_LEN);
-			UpnpPrintf(UPNP_INFO, MSERV, __FILE__, __LINE__,
-			           "miniserver: Error in accept(): %s\n",
-			           errorBuffer);
-		} else {
-			schedule_request_job(asock,
-			                     (struct sockaddr *) &clientAddr);
-		}
+	clientLen = sizeof(clientAddr);
+	asock = accept(lsock, (struct sockaddr *) &clientAddr,
+	               &clientLen);
+	if (asock == INVALID_SOCKET) {
+		strerror_r(errno, errorBuffer, ERROR_BUFFER_LEN);
+		UpnpPrintf(UPNP_INFO, MSERV, __FILE__, __LINE__,
+		           "miniserver: Error in accept(): %s\n",
+		           errorBuffer);
+	} else {
+		new_connection(asock, (struct sockaddr *) &clientAddr);
 	}
 #endif /* INTERNAL_WEB_SERVER */
 }
 
-static void ssdp_read(SOCKET rsock, fd_set *set) {
-	if (rsock != INVALID_SOCKET && FD_ISSET(rsock, set)) {
-		readFromSSDPSocket(rsock);
-	}
-}
-
-static int receive_from_stopSock(SOCKET ssock, fd_set *set) {
+static int receive_from_stopSock(SOCKET ssock) {
 	ssize_t byteReceived;
 	socklen_t clientLen;
 	struct sockaddr_storage clientAddr;
 	char requestBuf[256];
 	char buf_ntop[INET6_ADDRSTRLEN];
 
-	if (FD_ISSET(ssock, set)) {
-		clientLen = sizeof(clientAddr);
-		memset((char *) &clientAddr, 0, sizeof(clientAddr));
-		byteReceived = recvfrom(ssock, requestBuf,
-		                        (size_t) 25, 0, (struct sockaddr *) &clientAddr, &clientLen);
-		if (byteReceived > 0) {
-			requestBuf[byteReceived] = '\0';
-			inet_ntop(AF_INET,
-			          &((struct sockaddr_in *) &clientAddr)->sin_addr,
-			          buf_ntop, sizeof(buf_ntop));
-			UpnpPrintf(UPNP_INFO, MSERV, __FILE__, __LINE__,
-			           "Received response: %s From host %s \n",
-			           requestBuf, buf_ntop);
-			UpnpPrintf(UPNP_PACKET, MSERV, __FILE__, __LINE__,
-			           "Received multicast packet: \n %s\n",
-			           requestBuf);
-			if (NULL != strstr(requestBuf, "ShutDown")) {
-				return 1;
-			}
+	clientLen = sizeof(clientAddr);
+	memset((char *) &clientAddr, 0, sizeof(clientAddr));
+	byteReceived = recvfrom(ssock, requestBuf,
+	                        (size_t) 25, 0, (struct sockaddr *) &clientAddr, &clientLen);
+	if (byteReceived > 0) {
+		requestBuf[byteReceived] = '\0';
+		inet_ntop(AF_INET,
+		          &((struct sockaddr_in *) &clientAddr)->sin_addr,
+		          buf_ntop, sizeof(buf_ntop));
+		UpnpPrintf(UPNP_INFO, MSERV, __FILE__, __LINE__,
+		           "Received response: %s From host %s \n",
+		           requestBuf, buf_ntop);
+		UpnpPrintf(UPNP_PACKET, MSERV, __FILE__, __LINE__,
+		           "Received multicast packet: \n %s\n",
+		           requestBuf);
+		if (NULL != strstr(requestBuf, "ShutDown")) {
+			return 1;
 		}
 	}
 
@@ -342,71 +585,99 @@ static int receive_from_stopSock(SOCKET ssock, fd_set *set) {
  * The MiniServer accepts a new request and schedules a thread to handle the
  * new request. Checks for socket state and invokes appropriate read and
  * shutdown actions for the Miniserver and SSDP sockets.
+ *
+ * Socket readiness is obtained from the reactor created by StartMiniServer(),
+ * so the cost of one iteration does not depend on the number of sockets.
  */
 static void RunMiniServer(
 	/*! [in] Socket Array. */
 	MiniServerSockArray *miniSock) {
 	char errorBuffer[ERROR_BUFFER_LEN];
-	fd_set expSet;
-	fd_set rdSet;
-	SOCKET maxMiniSock;
+	ReactorEvent events[MINISERVER_MAX_EVENTS];
+	SOCKET sock;
 	int ret = 0;
+	int i;
 	int stopSock = 0;
+#ifdef INTERNAL_WEB_SERVER
+	time_t lastSweep = 0;
+#endif /* INTERNAL_WEB_SERVER */
 
-	maxMiniSock = 0;
-	maxMiniSock = max(maxMiniSock, miniSock->miniServerSock4);
-	maxMiniSock = max(maxMiniSock, miniSock->miniServerSock6);
-	maxMiniSock = max(maxMiniSock, miniSock->miniServerStopSock);
-	maxMiniSock = max(maxMiniSock, miniSock->ssdpSock4);
-	maxMiniSock = max(maxMiniSock, miniSock->ssdpSock6);
-	maxMiniSock = max(maxMiniSock, miniSock->ssdpSock6UlaGua);
+	reactor_add_if_valid(gMServReactor, miniSock->miniServerStopSock);
+	reactor_add_if_valid(gMServReactor, miniSock->miniServerSock4);
+	reactor_add_if_valid(gMServReactor, miniSock->miniServerSock6);
+	reactor_add_if_valid(gMServReactor, miniSock->ssdpSock4);
+	reactor_add_if_valid(gMServReactor, miniSock->ssdpSock6);
+	reactor_add_if_valid(gMServReactor, miniSock->ssdpSock6UlaGua);
 #ifdef INCLUDE_CLIENT_APIS
-	maxMiniSock = max(maxMiniSock, miniSock->ssdpReqSock4);
-	maxMiniSock = max(maxMiniSock, miniSock->ssdpReqSock6);
+	reactor_add_if_valid(gMServReactor, miniSock->ssdpReqSock4);
+	reactor_add_if_valid(gMServReactor, miniSock->ssdpReqSock6);
 #endif /* INCLUDE_CLIENT_APIS */
-	++maxMiniSock;
+	UpnpPrintf(UPNP_INFO, MSERV, __FILE__, __LINE__,
+	           "miniserver: using %s reactor\n", reactor_backend());
+
+#ifdef INTERNAL_WEB_SERVER
+	ithread_mutex_lock(&gConnMutex);
+	gConnAccept = 1;
+	ithread_mutex_unlock(&gConnMutex);
+#endif /* INTERNAL_WEB_SERVER */
 
 	gMServState = MSERV_RUNNING;
 	while (!stopSock) {
-		FD_ZERO(&rdSet);
-		FD_ZERO(&expSet);
-		/* FD_SET()'s */
-		FD_SET(miniSock->miniServerStopSock, &expSet);
-		FD_SET(miniSock->miniServerStopSock, &rdSet);
-		fdset_if_valid(miniSock->miniServerSock4, &rdSet);
-		fdset_if_valid(miniSock->miniServerSock6, &rdSet);
-		fdset_if_valid(miniSock->ssdpSock4, &rdSet);
-		fdset_if_valid(miniSock->ssdpSock6, &rdSet);
-		fdset_if_valid(miniSock->ssdpSock6UlaGua, &rdSet);
-#ifdef INCLUDE_CLIENT_APIS
-		fdset_if_valid(miniSock->ssdpReqSock4, &rdSet);
-		fdset_if_valid(miniSock->ssdpReqSock6, &rdSet);
-#endif /* INCLUDE_CLIENT_APIS */
-		/* select() */
-		ret = select((int) maxMiniSock, &rdSet, NULL, &expSet, NULL);
+		ret = reactor_wait(gMServReactor, events, MINISERVER_MAX_EVENTS,
+		                   MINISERVER_SWEEP_INTERVAL);
 		if (ret == SOCKET_ERROR && errno == EINTR) {
 			continue;
 		}
 		if (ret == SOCKET_ERROR) {
 			strerror_r(errno, errorBuffer, ERROR_BUFFER_LEN);
 			UpnpPrintf(UPNP_CRITICAL, SSDP, __FILE__, __LINE__,
-			           "Error in select(): %s\n", errorBuffer);
+			           "Error in reactor_wait(): %s\n", errorBuffer);
 			continue;
-		} else {
-			web_server_accept(miniSock->miniServerSock4, &rdSet);
-			web_server_accept(miniSock->miniServerSock6, &rdSet);
-#ifdef INCLUDE_CLIENT_APIS
-			ssdp_read(miniSock->ssdpReqSock4, &rdSet);
-			ssdp_read(miniSock->ssdpReqSock6, &rdSet);
-#endif /* INCLUDE_CLIENT_APIS */
-			ssdp_read(miniSock->ssdpSock4, &rdSet);
-			ssdp_read(miniSock->ssdpSock6, &rdSet);
-			ssdp_read(miniSock->ssdpSock6UlaGua, &rdSet);
-			stopSock = receive_from_stopSock(
-				miniSock->miniServerStopSock, &rdSet);
 		}
+		for (i = 0; i < ret; i++) {
+			sock = events[i].sock;
+#ifdef INTERNAL_WEB_SERVER
+			if (events[i].data != NULL) {
+				/* Request data, or close, on a client
+				 * connection. */
+				read_request_data(
+					(struct mserv_request_t *) events[i].data);
+				continue;
+			}
+#endif /* INTERNAL_WEB_SERVER */
+			if (sock == miniSock->miniServerSock4 ||
+			    sock == miniSock->miniServerSock6) {
+				/* Only a pending connection keeps accept()
+				 * from blocking. */
+				if (events[i].events & REACTOR_READ) {
+					web_server_accept(sock);
+				}
+			} else if (sock == miniSock->miniServerStopSock) {
+				if (receive_from_stopSock(sock)) {
+					stopSock = 1;
+				}
+			} else {
+				/* A pending error is returned by recvfrom()
+				 * without blocking. */
+				readFromSSDPSocket(sock);
+			}
+		}
+#ifdef INTERNAL_WEB_SERVER
+		if (time(NULL) != lastSweep) {
+			lastSweep = time(NULL);
+			sweep_connections(0);
+		}
+#endif /* INTERNAL_WEB_SERVER */
 	}
+#ifdef INTERNAL_WEB_SERVER
+	ithread_mutex_lock(&gConnMutex);
+	gConnAccept = 0;
+	ithread_mutex_unlock(&gConnMutex);
+	sweep_connections(1);
+#endif /* INTERNAL_WEB_SERVER */
 	/* Close all sockets. */
+	reactor_destroy(gMServReactor);
+	gMServReactor = NULL;
 	sock_close(miniSock->miniServerSock4);
 	sock_close(miniSock->miniServerSock6);
 	sock_close(miniSock->miniServerStopSock);
@@ -880,6 +1151,21 @@ int StartMiniServer(
 		free(miniSocket);
 		return ret_code;
 	}
+	ret_code = reactor_create(&gMServReactor);
+	if (ret_code != UPNP_E_SUCCESS) {
+		sock_close(miniSocket->miniServerSock4);
+		sock_close(miniSocket->miniServerSock6);
+		sock_close(miniSocket->miniServerStopSock);
+		sock_close(miniSocket->ssdpSock4);
+		sock_close(miniSocket->ssdpSock6);
+		sock_close(miniSocket->ssdpSock6UlaGua);
+#ifdef INCLUDE_CLIENT_APIS
+		sock_close(miniSocket->ssdpReqSock4);
+		sock_close(miniSocket->ssdpReqSock6);
+#endif /* INCLUDE_CLIENT_APIS */
+		free(miniSocket);
+		return ret_code;
+	}
 	TPJobInit(&job, (start_routine) RunMiniServer, (void *) miniSocket);
 	TPJobSetPriority(&job, MED_PRIORITY);
 	TPJobSetFreeFunction(&job, (free_routine) free);
@@ -896,6 +1182,8 @@ int StartMiniServer(
 		sock_close(miniSocket->ssdpReqSock6);
 #endif /* INCLUDE_CLIENT_APIS */
 		free(miniSocket);
+		reactor_destroy(gMServReactor);
+		gMServReactor = NULL;
 		return UPNP_E_OUTOF_MEMORY;
 	}
 	/* Wait for miniserver to start. */
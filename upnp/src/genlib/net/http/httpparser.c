@@ -55,7 +55,7 @@ static str_int_entry Http_Method_Table[NUM_HTTP_METHODS] = {
 	{"POST", SOAPMETHOD_POST},
 };
 
-#define NUM_HTTP_HEADER_NAMES 33
+#define NUM_HTTP_HEADER_NAMES 34
 str_int_entry Http_Header_Names[NUM_HTTP_HEADER_NAMES] = {
 	{"ACCEPT", HDR_ACCEPT},
 	{"ACCEPT-CHARSET", HDR_ACCEPT_CHARSET},
@@ -64,6 +64,7 @@ str_int_entry Http_Header_Names[NUM_HTTP_HEADER_NAMES] = {
 	{"ACCEPT-RANGES", HDR_ACCEPT_RANGE},
 	{"CACHE-CONTROL", HDR_CACHE_CONTROL},
 	{"CALLBACK", HDR_CALLBACK},
+	{"CONNECTION", HDR_CONNECTION},
 	{"CONTENT-ENCODING", HDR_CONTENT_ENCODING},
 	{"CONTENT-LANGUAGE", HDR_CONTENT_LANGUAGE},
 	{"CONTENT-LENGTH", HDR_CONTENT_LENGTH},
@@ -321,45 +322,54 @@ static UPNP_INLINE char *scanner_get_str(IN scanner_t *scanner) {
 }
 
 /************************************************************************
-* Function :	httpmsg_compare
+* Function :	httpheader_free
 *
 * Parameters :
-*	void* param1 ;	
-*	void* param2 ;	
+*	http_header_t *hdr ;	
 *
-* Description :	Compares name id in the http headers.
+* Description :	Free memory allocated for the http header
 *
-* Return : int ;
+* Return : void ;
 *
 * Note :
 ************************************************************************/
-static int httpmsg_compare(void *param1, void *param2) {
-	assert(param1 != NULL);
-	assert(param2 != NULL);
-
-	return
-		((http_header_t *) param1)->name_id ==
-			((http_header_t *) param2)->name_id;
+static void httpheader_free(http_header_t *hdr) {
+	membuffer_destroy(&hdr->name_buf);
+	membuffer_destroy(&hdr->value);
 }
 
 /************************************************************************
-* Function :	httpheader_free
+* Function :	httpmsg_reserve_hdr
 *
 * Parameters :
-*	void *msg ;	
+*	INOUT http_message_t* msg ;	HTTP Message Object
 *
-* Description :	Free memory allocated for the http header
+* Description :	Makes room for one more header in the header array.
 *
-* Return : void ;
+* Return : int ;
+*	UPNP_E_SUCCESS
+*	UPNP_E_OUTOF_MEMORY
 *
 * Note :
 ************************************************************************/
-static void httpheader_free(void *msg) {
-	http_header_t *hdr = (http_header_t *) msg;
+static int httpmsg_reserve_hdr(INOUT http_message_t *msg) {
+	http_header_t *headers;
+	size_t max_headers;
 
-	membuffer_destroy(&hdr->name_buf);
-	membuffer_destroy(&hdr->value);
-	free(hdr);
+	if (msg->num_headers < msg->max_headers) {
+		return UPNP_E_SUCCESS;
+	}
+	max_headers = msg->max_headers == (size_t) 0 ?
+		(size_t) 16 : msg->max_headers * (size_t) 2;
+	headers = (http_header_t *) realloc(msg->headers,
+	                                   max_headers * sizeof(http_header_t));
+	if (headers == NULL) {
+		return UPNP_E_OUTOF_MEMORY;
+	}
+	msg->headers = headers;
+	msg->max_headers = max_headers;
+
+	return UPNP_E_SUCCESS;
 }
 
 /************************************************************************
@@ -378,7 +388,10 @@ void httpmsg_init(INOUT http_message_t *msg) {
 	msg->initialized = 1;
 	msg->entity.buf = NULL;
 	msg->entity.length = (size_t) 0;
-	ListInit(&msg->headers, httpmsg_compare, httpheader_free);
+	msg->headers = NULL;
+	msg->num_headers = (size_t) 0;
+	msg->max_headers = (size_t) 0;
+	memset(msg->header_index, 0, sizeof(msg->header_index));
 	membuffer_init(&msg->msg);
 	membuffer_init(&msg->status_msg);
 }
@@ -396,10 +409,18 @@ void httpmsg_init(INOUT http_message_t *msg) {
 * Note :
 ************************************************************************/
 void httpmsg_destroy(INOUT http_message_t *msg) {
+	size_t i;
+
 	assert(msg != NULL);
 
 	if (msg->initialized == 1) {
-		ListDestroy(&msg->headers, 1);
+		for (i = (size_t) 0; i < msg->num_headers; i++) {
+			httpheader_free(&msg->headers[i]);
+		}
+		free(msg->headers);
+		msg->headers = NULL;
+		msg->num_headers = (size_t) 0;
+		msg->max_headers = (size_t) 0;
 		membuffer_destroy(&msg->msg);
 		membuffer_destroy(&msg->status_msg);
 		free(msg->urlbuf);
@@ -414,8 +435,9 @@ void httpmsg_destroy(INOUT http_message_t *msg) {
 *	IN http_message_t* msg ;	HTTP Message Object
 *	IN const char* header_name ; Header name to be compared with
 *
-* Description :	Compares the header name with the header names stored
-*	in	the linked list of messages
+* Description :	Finds a header by name. Known names are looked up in
+*	the header index, other names are compared with the unknown
+*	headers of the message
 *
 * Return : http_header_t* - Pointer to a header on success;
 *		 NULL on failure
@@ -426,19 +448,20 @@ http_header_t *httpmsg_find_hdr_str(
 	IN http_message_t *msg,
 	IN const char *header_name) {
 	http_header_t *header;
+	size_t i;
+	int index;
 
-	ListNode *node;
-
-	node = ListHead(&msg->headers);
-	while (node != NULL) {
-
-		header = (http_header_t *) node->item;
-
-		if (memptr_cmp_nocase(&header->name, header_name) == 0) {
+	index = map_str_to_int(header_name, strlen(header_name),
+	                       Http_Header_Names, NUM_HTTP_HEADER_NAMES, FALSE);
+	if (index != -1) {
+		return httpmsg_find_hdr(msg, Http_Header_Names[index].id, NULL);
+	}
+	for (i = (size_t) 0; i < msg->num_headers; i++) {
+		header = &msg->headers[i];
+		if (header->name_id == HDR_UNKNOWN &&
+		    memptr_cmp_nocase(&header->name, header_name) == 0) {
 			return header;
 		}
-
-		node = ListNext(&msg->headers, node);
 	}
 	return NULL;
 }
@@ -451,7 +474,8 @@ http_header_t *httpmsg_find_hdr_str(
 *	IN int header_name_id ;	 Header Name ID to be compared with
 *	OUT memptr* value ;		 Buffer to get the ouput to.
 *
-* Description :	Finds header from a list, with the given 'name_id'.
+* Description :	Finds the header with the given 'name_id' through the
+*	header index of the message.
 *
 * Return : http_header_t*  - Pointer to a header on success;
 *				NULL on failure
@@ -462,16 +486,17 @@ http_header_t *httpmsg_find_hdr(
 	IN http_message_t *msg,
 	IN int header_name_id,
 	OUT memptr *value) {
-	http_header_t header;       /* temp header for searching */
-	ListNode *node;
 	http_header_t *data;
+	int pos;
 
-	header.name_id = header_name_id;
-	node = ListFind(&msg->headers, NULL, &header);
-	if (node == NULL) {
+	if (header_name_id < 0 || header_name_id >= HDR_INDEX_SIZE) {
+		return NULL;
+	}
+	pos = msg->header_index[header_name_id];
+	if (pos == 0) {
 		return NULL;
 	}
-	data = (http_header_t *) node->item;
+	data = &msg->headers[pos - 1];
 	if (value != NULL) {
 		value->buf = data->value.buf;
 		value->length = data->value.length;
@@ -1473,13 +1498,12 @@ parse_status_t parser_parse_headers(INOUT http_parser_t *parser) {
 		}
 		if (orig_header == NULL) {
 			/* add new header */
-			header =
-				(http_header_t *) malloc(sizeof(http_header_t));
-			if (header == NULL) {
+			if (httpmsg_reserve_hdr(&parser->msg) != UPNP_E_SUCCESS) {
 				parser->http_error_code =
 					HTTP_INTERNAL_SERVER_ERROR;
 				return PARSE_FAILURE;
 			}
+			header = &parser->msg.headers[parser->msg.num_headers];
 			membuffer_init(&header->name_buf);
 			membuffer_init(&header->value);
 			/* value can be 0 length */
@@ -1492,21 +1516,17 @@ parse_status_t parser_parse_headers(INOUT http_parser_t *parser) {
 			if (membuffer_assign(&header->name_buf, token.buf, token.length) ||
 				membuffer_assign(&header->value, hdr_value.buf, hdr_value.length)) {
 				/* not enough mem */
-				membuffer_destroy(&header->value);
-				membuffer_destroy(&header->name_buf);
-				free(header);
+				httpheader_free(header);
 				parser->http_error_code = HTTP_INTERNAL_SERVER_ERROR;
 				return PARSE_FAILURE;
 			}
 			header->name.buf = header->name_buf.buf;
 			header->name.length = header->name_buf.length;
 			header->name_id = header_id;
-			if (!ListAddTail(&parser->msg.headers, header)) {
-				membuffer_destroy(&header->value);
-				membuffer_destroy(&header->name_buf);
-				free(header);
-				parser->http_error_code = HTTP_INTERNAL_SERVER_ERROR;
-				return PARSE_FAILURE;
+			parser->msg.num_headers++;
+			if (header_id != HDR_UNKNOWN) {
+				parser->msg.header_index[header_id] =
+					(int) parser->msg.num_headers;
 			}
 		} else if (hdr_value.length > (size_t) 0) {
 			/* append value to existing header */
@@ -2121,4 +2141,68 @@ const char *method_to_str(IN http_method_t method) {
 	return index == -1 ? NULL : Http_Method_Table[index].name;
 }
 
+/************************************************************************
+* Function: connection_has_token
+*
+* Parameters:
+*	IN const memptr* value ;	Value of the Connection header
+*	IN const char* token ;	Lowercase token
+*
+* Description: Checks whether a Connection header value contains a
+*	token, ignoring the case.
+*
+* Returns:
+*	 1 if the token is found, 0 otherwise
+************************************************************************/
+static int connection_has_token(
+	IN const memptr *value,
+	IN const char *token) {
+	size_t len = strlen(token);
+	size_t i;
+
+	for (i = 0; i + len <= value->length; i++) {
+		if (strncasecmp(value->buf + i, token, len) == 0) {
+			return 1;
+		}
+	}
+
+	return 0;
+}
 
+/************************************************************************
+* Function: parser_keep_alive
+*
+* Parameters:
+*	IN http_parser_t* parser ; HTTP Parser object
+*
+* Description: Tells whether the connection may be used for another
+*	message once the parsed one is complete.
+*
+* Returns:
+*	 1 if the connection is persistent, 0 otherwise
+************************************************************************/
+int parser_keep_alive(IN http_parser_t *parser) {
+	http_message_t *hmsg = &parser->msg;
+	memptr value;
+	int keep_alive;
+
+	if (parser->position != POS_COMPLETE ||
+	    (parser->ent_position != ENTREAD_DETERMINE_READ_METHOD &&
+	     parser->ent_position != ENTREAD_USING_CLEN) ||
+	    hmsg->msg.length + hmsg->amount_discarded !=
+		    parser->entity_start_position + hmsg->entity.length) {
+		return 0;
+	}
+	/* HTTP/1.1 connections are persistent by default. */
+	keep_alive = hmsg->major_version > 1 ||
+	             (hmsg->major_version == 1 && hmsg->minor_version >= 1);
+	if (httpmsg_find_hdr(hmsg, HDR_CONNECTION, &value) != NULL) {
+		if (connection_has_token(&value, "close")) {
+			keep_alive = 0;
+		} else if (connection_has_token(&value, "keep-alive")) {
+			keep_alive = 1;
+		}
+	}
+
+	return keep_alive;
+}
@@ -47,6 +47,13 @@
 
 #include <assert.h>
 
+#if defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L && \
+	!defined(__STDC_NO_ATOMICS__)
+	/*! The send counters are updated without a lock. */
+	#define HTTP_ATOMIC_STATS 1
+	#include <stdatomic.h>
+#endif
+
 #ifdef WIN32
 	#ifndef fseeko
 		#define fseeko fseek
@@ -55,6 +62,7 @@
 		#define snprintf _snprintf
 	#endif
 #else
+	#include <sys/stat.h>
 	#include <sys/utsname.h>
 #endif
 
@@ -69,6 +77,19 @@ const int CHUNK_TAIL_SIZE = 10;
 #define CHUNK_HEADER_SIZE (size_t)10
 #define CHUNK_TAIL_SIZE (size_t)10
 
+#ifdef HTTP_ATOMIC_STATS
+/*! Number of messages sent by http_SendMessage(). */
+static atomic_ulong gSentMessages;
+/*! Number of system calls made to write them. */
+static atomic_ulong gSentSyscalls;
+#else /* HTTP_ATOMIC_STATS */
+/*! Protects gSendStats. */
+static ithread_mutex_t gSendStatsMutex;
+
+/*! Counters of the messages sent by http_SendMessage(). */
+static HttpSendStats gSendStats;
+#endif /* HTTP_ATOMIC_STATS */
+
 #ifndef UPNP_ENABLE_BLOCKING_TCP_CONNECTIONS
 
 /* in seconds */
@@ -288,6 +309,15 @@ int http_RecvMessage(
 		if (num_read > 0) {
 			/* got data */
 			status = parser_append(parser, buf, (size_t) num_read);
+			if (status == PARSE_INCOMPLETE &&
+			    parser->ent_position == ENTREAD_USING_CLEN &&
+			    g_maxContentLength > (size_t) 0 &&
+			    parser->content_length <= (unsigned int) g_maxContentLength) {
+				/* room for the whole body */
+				membuffer_reserve(&parser->msg.msg,
+				                  parser->entity_start_position +
+				                  (size_t) parser->content_length);
+			}
 			switch (status) {
 				case PARSE_SUCCESS:
 					UpnpPrintf(UPNP_INFO, HTTP, __FILE__, __LINE__,
@@ -352,6 +382,126 @@ int http_RecvMessage(
 	return ret;
 }
 
+#if EXCLUDE_WEB_SERVER == 0 && defined(UPNP_ENABLE_SENDFILE)
+/*!
+ * \brief Sends a regular file from its current position with sendfile().
+ *
+ * \return 1 if the file was sent or the socket failed, 0 if sendfile()
+ * 	cannot read the file and the buffered copy must be used instead.
+ */
+static int http_SendFileZeroCopy(
+	/*! [in] Socket information object. */
+	SOCKINFO *info,
+	/*! [in,out] Time out value. */
+	int *TimeOut,
+	/*! [in] File opened with fopen() and positioned on the first byte to
+	 * send. */
+	FILE *Fp,
+	/*! [in] Send instruction, can be NULL. */
+	struct SendInstruction *Instr,
+	/*! [out] Return value of http_SendMessage. */
+	int *RetVal) {
+	struct stat st;
+	off_t start;
+	off_t offset;
+	size_t count;
+	int rc;
+
+	start = ftello(Fp);
+	if (start < 0)
+		return 0;
+	if (Instr && Instr->ReadSendSize >= 0) {
+		count = (size_t) Instr->ReadSendSize;
+	} else {
+		/* read until close */
+		if (fstat(fileno(Fp), &st) != 0 || !S_ISREG(st.st_mode))
+			return 0;
+		count = st.st_size > start ? (size_t) (st.st_size - start) : 0;
+	}
+	offset = start;
+	rc = sock_sendfile(info, fileno(Fp), &offset, count, TimeOut);
+	if (rc == UPNP_E_FILE_READ_ERROR)
+		return 0;
+	UpnpPrintf(UPNP_INFO, HTTP, __FILE__, __LINE__,
+	           ">>> (SENT) >>>\n%" PRId64 " bytes of file data\n"
+		           "------------\n",
+	           (int64_t) (offset - start));
+	if (rc == UPNP_E_SUCCESS && (size_t) (offset - start) != count)
+		/* EOF before the announced length. */
+		rc = UPNP_E_FILE_READ_ERROR;
+	*RetVal = rc;
+
+	return 1;
+}
+#endif /* EXCLUDE_WEB_SERVER == 0 && UPNP_ENABLE_SENDFILE */
+
+int http_InitSendStats(void) {
+#ifdef HTTP_ATOMIC_STATS
+	atomic_init(&gSentMessages, 0UL);
+	atomic_init(&gSentSyscalls, 0UL);
+
+	return 0;
+#else /* HTTP_ATOMIC_STATS */
+	memset(&gSendStats, 0, sizeof(gSendStats));
+
+	return ithread_mutex_init(&gSendStatsMutex, NULL);
+#endif /* HTTP_ATOMIC_STATS */
+}
+
+void http_DestroySendStats(void) {
+#ifndef HTTP_ATOMIC_STATS
+	ithread_mutex_destroy(&gSendStatsMutex);
+#endif /* HTTP_ATOMIC_STATS */
+}
+
+void http_GetSendStats(HttpSendStats *stats) {
+#ifdef HTTP_ATOMIC_STATS
+	stats->messages = atomic_load_explicit(&gSentMessages,
+	                                       memory_order_relaxed);
+	stats->syscalls = atomic_load_explicit(&gSentSyscalls,
+	                                       memory_order_relaxed);
+#else /* HTTP_ATOMIC_STATS */
+	ithread_mutex_lock(&gSendStatsMutex);
+	*stats = gSendStats;
+	ithread_mutex_unlock(&gSendStatsMutex);
+#endif /* HTTP_ATOMIC_STATS */
+}
+
+/*!
+ * \brief Writes the buffers gathered by http_SendMessage().
+ *
+ * \return 0 if all the buffers were sent, -1 otherwise.
+ */
+static int http_SendBuffers(
+	/*! [in] Socket information object. */
+	SOCKINFO *info,
+	/*! [in,out] Time out value. */
+	int *TimeOut,
+	/*! [in] Buffers. */
+	const SockBuffer *buffers,
+	/*! [in] Number of buffers. */
+	int count) {
+	size_t total = (size_t) 0;
+	int nw;
+	int i;
+
+	for (i = 0; i < count; i++)
+		total += buffers[i].length;
+	nw = sock_writev(info, buffers, count, TimeOut);
+	for (i = 0; i < count; i++) {
+		UpnpPrintf(UPNP_INFO, HTTP, __FILE__, __LINE__,
+		           ">>> (SENT) >>>\n"
+			           "%.*s\nbuf_length=%" PRIzd ", num_written=%d\n"
+			           "------------\n",
+		           (int) buffers[i].length, buffers[i].buf,
+		           buffers[i].length, nw);
+	}
+	if (nw < 0 || (size_t) nw != total)
+		return -1;
+
+	return 0;
+}
+
 int http_SendMessage(SOCKINFO *info, int *TimeOut, const char *fmt, ...) {
 #if EXCLUDE_WEB_SERVER == 0
 	FILE *Fp;
@@ -364,20 +514,28 @@ int http_SendMessage(SOCKINFO *info, int *TimeOut, const char *fmt, ...) {
 	size_t num_read;
 	size_t amount_to_be_read = (size_t) 0;
 	size_t Data_Buf_Size = WEB_SERVER_BUF_SIZE;
+	int nw;
+	size_t num_written;
 #endif /* EXCLUDE_WEB_SERVER */
 	va_list argp;
-	char *buf = NULL;
+	SockBuffer buffers[SOCK_MAX_BUFFERS];
+	int numBuffers = 0;
+	unsigned long syscalls = info->write_syscalls;
 	char c;
-	int nw;
 	int RetVal = 0;
-	size_t buf_length;
-	size_t num_written;
 
 #if EXCLUDE_WEB_SERVER == 0
 	memset(Chunk_Header, 0, sizeof(Chunk_Header));
 #endif /* EXCLUDE_WEB_SERVER */
 	va_start(argp, fmt);
 	while ((c = *fmt++)) {
+		if (numBuffers > 0 &&
+		    (c != 'b' || numBuffers == SOCK_MAX_BUFFERS)) {
+			/* write the buffers gathered so far. */
+			if (http_SendBuffers(info, TimeOut, buffers, numBuffers) != 0)
+				goto ExitFunction;
+			numBuffers = 0;
+		}
 #if EXCLUDE_WEB_SERVER == 0
 		if (c == 'I') {
 			Instr = va_arg(argp, struct SendInstruction *);
@@ -387,14 +545,6 @@ int http_SendMessage(SOCKINFO *info, int *TimeOut, const char *fmt, ...) {
 				amount_to_be_read = Data_Buf_Size;
 			if (amount_to_be_read < WEB_SERVER_BUF_SIZE)
 				Data_Buf_Size = amount_to_be_read;
-			ChunkBuf = malloc((size_t)
-				                  (Data_Buf_Size + CHUNK_HEADER_SIZE +
-					                  CHUNK_TAIL_SIZE));
-			if (!ChunkBuf) {
-				RetVal = UPNP_E_OUTOF_MEMORY;
-				goto ExitFunction;
-			}
-			file_buf = ChunkBuf + CHUNK_HEADER_SIZE;
 		} else if (c == 'f') {
 			/* file name */
 			filename = va_arg(argp, char *);
@@ -418,6 +568,22 @@ int http_SendMessage(SOCKINFO *info, int *TimeOut, const char *fmt, ...) {
 					goto Cleanup_File;
 				}
 			}
+#ifdef UPNP_ENABLE_SENDFILE
+			/* Regular files are sent without copying, the buffered loop
+			 * is only needed for chunks and virtual files. */
+			if (!(Instr && (Instr->IsVirtualFile || Instr->IsChunkActive)) &&
+			    http_SendFileZeroCopy(info, TimeOut, Fp, Instr, &RetVal))
+				goto Cleanup_File;
+#endif /* UPNP_ENABLE_SENDFILE */
+			/* The buffer is allocated only when it is needed. */
+			ChunkBuf = malloc((size_t)
+				                  (Data_Buf_Size + CHUNK_HEADER_SIZE +
+					                  CHUNK_TAIL_SIZE));
+			if (!ChunkBuf) {
+				RetVal = UPNP_E_OUTOF_MEMORY;
+				goto Cleanup_File;
+			}
+			file_buf = ChunkBuf + CHUNK_HEADER_SIZE;
 			while (amount_to_be_read) {
 				if (Instr) {
 					int nr;
@@ -502,30 +668,32 @@ int http_SendMessage(SOCKINFO *info, int *TimeOut, const char *fmt, ...) {
 		} else
 #endif /* EXCLUDE_WEB_SERVER */
 		if (c == 'b') {
-			/* memory buffer */
-			buf = va_arg(argp, char *);
-			buf_length = va_arg(argp, size_t);
-			if (buf_length > (size_t) 0) {
-				nw = sock_write(info, buf, buf_length, TimeOut);
-				num_written = (size_t) nw;
-				UpnpPrintf(UPNP_INFO, HTTP, __FILE__, __LINE__,
-				           ">>> (SENT) >>>\n"
-					           "%.*s\nbuf_length=%" PRIzd ", num_written=%" PRIzd "\n"
-					           "------------\n",
-				           (int) buf_length, buf, buf_length, num_written);
-				if (num_written != buf_length) {
-					RetVal = 0;
-					goto ExitFunction;
-				}
-			}
+			/* memory buffer, gathered with the following ones. */
+			buffers[numBuffers].buf = va_arg(argp, char *);
+			buffers[numBuffers].length = va_arg(argp, size_t);
+			if (buffers[numBuffers].length > (size_t) 0)
+				numBuffers++;
 		}
 	}
+	if (numBuffers > 0)
+		http_SendBuffers(info, TimeOut, buffers, numBuffers);
 
 	ExitFunction:
 	va_end(argp);
 #if EXCLUDE_WEB_SERVER == 0
 	free(ChunkBuf);
 #endif /* EXCLUDE_WEB_SERVER */
+#ifdef HTTP_ATOMIC_STATS
+	atomic_fetch_add_explicit(&gSentMessages, 1UL, memory_order_relaxed);
+	atomic_fetch_add_explicit(&gSentSyscalls,
+	                          info->write_syscalls - syscalls,
+	                          memory_order_relaxed);
+#else /* HTTP_ATOMIC_STATS */
+	ithread_mutex_lock(&gSendStatsMutex);
+	gSendStats.messages++;
+	gSendStats.syscalls += info->write_syscalls - syscalls;
+	ithread_mutex_unlock(&gSendStatsMutex);
+#endif /* HTTP_ATOMIC_STATS */
 	return RetVal;
 }
 
@@ -1565,8 +1733,8 @@ int http_SendStatusResponse(IN SOCKINFO *info, IN int http_status_code,
 	membuffer_init(&membuf);
 	membuf.size_inc = (size_t) 70;
 	/* response start line */
-	ret = http_MakeMessage(&membuf, response_major, response_minor, "RSCB",
-	                       http_status_code, http_status_code);
+	ret = http_MakeMessage(&membuf, response_major, response_minor, "RSAB",
+	                       http_status_code, info, http_status_code);
 	if (ret == 0) {
 		timeout = HTTP_DEFAULT_TIMEOUT;
 		ret = http_SendMessage(info, &timeout, "b",
@@ -1710,6 +1878,19 @@ int http_MakeMessage(membuffer *buf, int http_major_version,
 				if (membuffer_append_str(buf, "CONNECTION: close\r\n"))
 					goto error_handler;
 			}
+		} else if (c == 'A') {
+			/* connection header of a miniserver response */
+			SOCKINFO *sinfo = (SOCKINFO *) va_arg(argp, SOCKINFO *);
+			assert(sinfo);
+			if (!sinfo->keep_alive) {
+				if (http_MakeMessage(buf, http_major_version,
+				                     http_minor_version, "C") != 0)
+					goto error_handler;
+			} else if (http_major_version == 1 && http_minor_version == 0) {
+				/* HTTP/1.0 connections are persistent on request only */
+				if (membuffer_append_str(buf, "CONNECTION: Keep-Alive\r\n"))
+					goto error_handler;
+			}
 		} else if (c == 'N') {
 			/* content-length header */
 			bignum = (off_t) va_arg(argp, off_t);
@@ -120,7 +120,6 @@ static const char *gMediaTypes[] = {
 
 /* general */
 #define NUM_MEDIA_TYPES       70
-#define NUM_HTTP_HEADER_NAMES 33
 
 #define ASCTIME_R_BUFFER_SIZE 26
 #ifdef WIN32
@@ -221,7 +220,6 @@ membuffer gDocumentRootDir;
 /*! XML document. */
 static struct xml_alias_t gAliasDoc;
 static ithread_mutex_t gWebMutex;
-extern str_int_entry Http_Header_Names[NUM_HTTP_HEADER_NAMES];
 
 /*!
  * \brief Decodes list and stores it in gMediaTypeList.
@@ -872,22 +870,16 @@ static int CheckOtherHTTPHeaders(
 	/*! Size of the file containing the request document. */
 	off_t FileSize) {
 	http_header_t *header;
-	ListNode *node;
-	/*NNS: dlist_node* node; */
-	int index, RetCode = HTTP_OK;
+	size_t i;
+	int RetCode = HTTP_OK;
 	char *TmpBuf;
 	size_t TmpBufSize = LINE_SIZE;
 
 	TmpBuf = (char *) malloc(TmpBufSize);
 	if (!TmpBuf)
 		return HTTP_INTERNAL_SERVER_ERROR;
-	node = ListHead(&Req->headers);
-	while (node != NULL) {
-		header = (http_header_t *) node->item;
-		/* find header type. */
-		index = map_str_to_int((const char *) header->name.buf,
-		                       header->name.length, Http_Header_Names,
-		                       NUM_HTTP_HEADER_NAMES, FALSE);
+	for (i = (size_t) 0; i < Req->num_headers; i++) {
+		header = &Req->headers[i];
 		if (header->value.length >= TmpBufSize) {
 			free(TmpBuf);
 			TmpBufSize = header->value.length + 1;
@@ -897,8 +889,8 @@ static int CheckOtherHTTPHeaders(
 		}
 		memcpy(TmpBuf, header->value.buf, header->value.length);
 		TmpBuf[header->value.length] = '\0';
-		if (index >= 0) {
-			switch (Http_Header_Names[index].id) {
+		if (header->name_id != HDR_UNKNOWN) {
+			switch (header->name_id) {
 				case HDR_TE: {
 					/* Request */
 					RespInstr->IsChunkActive = 1;
@@ -969,7 +961,6 @@ static int CheckOtherHTTPHeaders(
 					break;
 			}
 		}
-		node = ListNext(&Req->headers, node);
 	}
 	free(TmpBuf);
 
@@ -989,6 +980,8 @@ static int CheckOtherHTTPHeaders(
  * \li \c HTTP_OK
  */
 static int process_request(
+	/*! [in] Socket info, the keep alive state is used for the headers. */
+	SOCKINFO *info,
 	/*! [in] HTTP Request message. */
 	http_message_t *req,
 	/*! [out] Tpye of response. */
@@ -1204,20 +1197,20 @@ static int process_request(
 		/* Content-Range: bytes 222-3333/4000  HTTP_PARTIAL_CONTENT */
 		/* Transfer-Encoding: chunked */
 		if (http_MakeMessage(headers, resp_major, resp_minor,
-		                     "R" "T" "GKLD" "s" "tcS" "Xc" "sCc",
+		                     "R" "T" "GKLD" "s" "tcS" "Xc" "sAc",
 		                     HTTP_PARTIAL_CONTENT,    /* status code */
 		                     finfo.content_type,    /* content type */
 		                     RespInstr,    /* range info */
 		                     RespInstr,    /* language info */
 		                     "LAST-MODIFIED: ",
 		                     &finfo.last_modified,
-		                     X_USER_AGENT, extra_headers) != 0) {
+		                     X_USER_AGENT, extra_headers, info) != 0) {
 			goto error_handler;
 		}
 	} else if (RespInstr->IsRangeActive && !RespInstr->IsChunkActive) {
 		/* Content-Range: bytes 222-3333/4000  HTTP_PARTIAL_CONTENT */
 		if (http_MakeMessage(headers, resp_major, resp_minor,
-		                     "R" "N" "T" "GLD" "s" "tcS" "Xc" "sCc",
+		                     "R" "N" "T" "GLD" "s" "tcS" "Xc" "sAc",
 		                     HTTP_PARTIAL_CONTENT,    /* status code */
 		                     RespInstr->ReadSendSize,    /* content length */
 		                     finfo.content_type,    /* content type */
@@ -1225,26 +1218,26 @@ static int process_request(
 		                     RespInstr,    /* language info */
 		                     "LAST-MODIFIED: ",
 		                     &finfo.last_modified,
-		                     X_USER_AGENT, extra_headers) != 0) {
+		                     X_USER_AGENT, extra_headers, info) != 0) {
 			goto error_handler;
 		}
 	} else if (!RespInstr->IsRangeActive && RespInstr->IsChunkActive) {
 		/* Transfer-Encoding: chunked */
 		if (http_MakeMessage(headers, resp_major, resp_minor,
-		                     "RK" "TLD" "s" "tcS" "Xc" "sCc",
+		                     "RK" "TLD" "s" "tcS" "Xc" "sAc",
 		                     HTTP_OK,    /* status code */
 		                     finfo.content_type,    /* content type */
 		                     RespInstr,    /* language info */
 		                     "LAST-MODIFIED: ",
 		                     &finfo.last_modified,
-		                     X_USER_AGENT, extra_headers) != 0) {
+		                     X_USER_AGENT, extra_headers, info) != 0) {
 			goto error_handler;
 		}
 	} else {
 		/* !RespInstr->IsRangeActive && !RespInstr->IsChunkActive */
 		if (RespInstr->ReadSendSize >= 0) {
 			if (http_MakeMessage(headers, resp_major, resp_minor,
-			                     "R" "N" "TLD" "s" "tcS" "Xc" "sCc",
+			                     "R" "N" "TLD" "s" "tcS" "Xc" "sAc",
 			                     HTTP_OK,    /* status code */
 			                     RespInstr->ReadSendSize,    /* content length */
 			                     finfo.content_type,    /* content type */
@@ -1252,19 +1245,23 @@ static int process_request(
 			                     "LAST-MODIFIED: ",
 			                     &finfo.last_modified,
 			                     X_USER_AGENT,
-			                     extra_headers) != 0) {
+			                     extra_headers,
+			                     info) != 0) {
 				goto error_handler;
 			}
 		} else {
+			/* Only closing the connection delimits the body. */
+			info->keep_alive = 0;
 			if (http_MakeMessage(headers, resp_major, resp_minor,
-			                     "R" "TLD" "s" "tcS" "Xc" "sCc",
+			                     "R" "TLD" "s" "tcS" "Xc" "sAc",
 			                     HTTP_OK,    /* status code */
 			                     finfo.content_type,    /* content type */
 			                     RespInstr,    /* language info */
 			                     "LAST-MODIFIED: ",
 			                     &finfo.last_modified,
 			                     X_USER_AGENT,
-			                     extra_headers) != 0) {
+			                     extra_headers,
+			                     info) != 0) {
 				goto error_handler;
 			}
 		}
@@ -1452,7 +1449,7 @@ void web_server_callback(http_parser_t *parser, INOUT http_message_t *req,
 
 	/*Process request should create the different kind of header depending on the */
 	/*the type of request. */
-	ret = process_request(req, &rtype, &headers, &filename, &xmldoc,
+	ret = process_request(info, req, &rtype, &headers, &filename, &xmldoc,
 	                      &RespInstr);
 	if (ret != HTTP_OK) {
 		/* send error code */
@@ -1490,7 +1487,8 @@ void web_server_callback(http_parser_t *parser, INOUT http_message_t *req,
 				                 headers.buf, headers.length);
 				break;
 			case RESP_POST:
-				/* headers only */
+				/* headers only, the body is not delimited */
+				info->keep_alive = 0;
 				ret = http_RecvPostMessage(parser, info, filename.buf,
 				                           &RespInstr);
 				/* Send response. */
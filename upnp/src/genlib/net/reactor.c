@@ -0,0 +1,584 @@
+/*!
+ * \addtogroup Sock
+ *
+ * @{
+ *
+ * \file
+ *
+ * \brief Implements the reactor with an epoll or a select() backend.
+ */
+
+#include "../../include/reactor.h"
+
+#include "ithread.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef UPNP_ENABLE_EPOLL
+	#include <sys/epoll.h>
+	#include <sys/eventfd.h>
+	#include <unistd.h>
+#endif
+
+/*! Initial number of buckets of the socket table, a power of 2. */
+#define REACTOR_MIN_BUCKETS 64
+
+/*! One registered socket. */
+struct reactor_entry {
+	/*! Watched socket. */
+	SOCKET sock;
+	/*! REACTOR_READ and/or REACTOR_WRITE. */
+	int events;
+	/*! User data returned with the events. */
+	void *data;
+	/*! Next registration. */
+	struct reactor_entry *next;
+	/*! Previous registration. */
+	struct reactor_entry *prev;
+	/*! Next registration in the same bucket. */
+	struct reactor_entry *hashNext;
+};
+
+struct reactor {
+	/*! Protects the registration list. */
+	ithread_mutex_t mutex;
+	/*! Registered sockets. */
+	struct reactor_entry *entries;
+	/*! Number of registered sockets. */
+	int count;
+	/*! Registrations by socket, so that reactor_add(), reactor_mod() and
+	 * reactor_del() do not walk the whole list. */
+	struct reactor_entry **buckets;
+	/*! Number of buckets, a power of 2. */
+	size_t bucketCount;
+#ifdef UPNP_ENABLE_EPOLL
+	/*! epoll descriptor. */
+	int epfd;
+	/*! eventfd registered in epfd, used by reactor_wakeup(). */
+	int wakeFd;
+#else
+	/*! Loopback datagram socket connected to itself, used to interrupt
+	 * select() when the registrations change. */
+	SOCKET wakeSock;
+	/*! Set while a thread is blocked in select(). */
+	int waiting;
+#endif
+};
+
+/*!
+ * \brief Gives the bucket of a socket.
+ *
+ * \return The index of the bucket.
+ */
+static size_t reactor_bucket(
+	/*! [in] Number of buckets, a power of 2. */
+	size_t bucketCount,
+	/*! [in] Socket. */
+	SOCKET sock) {
+	size_t h = (size_t) sock;
+
+	/* descriptors are small integers, but WIN32 sockets are multiples
+	 * of 4 */
+	h ^= h >> 2;
+
+	return h & (bucketCount - 1);
+}
+
+/*!
+ * \brief Finds the registration of a socket.
+ *
+ * r->mutex must be locked.
+ *
+ * \return The registration or NULL.
+ */
+static struct reactor_entry *reactor_find(
+	/*! [in] Reactor. */
+	Reactor *r,
+	/*! [in] Socket to look up. */
+	SOCKET sock) {
+	struct reactor_entry *e;
+
+	e = r->buckets[reactor_bucket(r->bucketCount, sock)];
+	for (; e != NULL; e = e->hashNext) {
+		if (e->sock == sock) {
+			return e;
+		}
+	}
+
+	return NULL;
+}
+
+/*!
+ * \brief Doubles the number of buckets once there are as many
+ * registrations as buckets. The table is kept if the allocation fails.
+ *
+ * r->mutex must be locked.
+ */
+static void reactor_grow(
+	/*! [in] Reactor. */
+	Reactor *r) {
+	struct reactor_entry **buckets;
+	struct reactor_entry *e;
+	size_t bucketCount = r->bucketCount * (size_t) 2;
+	size_t i;
+
+	if ((size_t) r->count < r->bucketCount) {
+		return;
+	}
+	buckets = (struct reactor_entry **) calloc(bucketCount,
+		sizeof(struct reactor_entry *));
+	if (buckets == NULL) {
+		return;
+	}
+	for (e = r->entries; e != NULL; e = e->next) {
+		i = reactor_bucket(bucketCount, e->sock);
+		e->hashNext = buckets[i];
+		buckets[i] = e;
+	}
+	free(r->buckets);
+	r->buckets = buckets;
+	r->bucketCount = bucketCount;
+}
+
+/*!
+ * \brief Unlinks and frees a registration.
+ *
+ * r->mutex must be locked.
+ */
+static void reactor_unlink(
+	/*! [in] Reactor. */
+	Reactor *r,
+	/*! [in] Registration to remove. */
+	struct reactor_entry *e) {
+	struct reactor_entry **p;
+
+	p = &r->buckets[reactor_bucket(r->bucketCount, e->sock)];
+	while (*p != e) {
+		p = &(*p)->hashNext;
+	}
+	*p = e->hashNext;
+	if (e->prev) {
+		e->prev->next = e->next;
+	} else {
+		r->entries = e->next;
+	}
+	if (e->next) {
+		e->next->prev = e->prev;
+	}
+	r->count--;
+	free(e);
+}
+
+#ifdef UPNP_ENABLE_EPOLL
+/*!
+ * \brief Translates REACTOR_* flags to epoll flags.
+ */
+static uint32_t to_epoll_events(int events) {
+	uint32_t ev = 0;
+
+	if (events & REACTOR_READ) {
+		ev |= EPOLLIN;
+	}
+	if (events & REACTOR_WRITE) {
+		ev |= EPOLLOUT;
+	}
+
+	return ev;
+}
+
+static int backend_init(Reactor *r) {
+	struct epoll_event ev;
+
+	r->epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (r->epfd == -1) {
+		return UPNP_E_OUTOF_SOCKET;
+	}
+	r->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	/* The only registration without a reactor_entry. */
+	ev.data.ptr = NULL;
+	if (r->wakeFd == -1 ||
+	    epoll_ctl(r->epfd, EPOLL_CTL_ADD, r->wakeFd, &ev) == -1) {
+		if (r->wakeFd != -1) {
+			close(r->wakeFd);
+		}
+		close(r->epfd);
+		return UPNP_E_OUTOF_SOCKET;
+	}
+
+	return UPNP_E_SUCCESS;
+}
+
+static void backend_close(Reactor *r) {
+	close(r->wakeFd);
+	close(r->epfd);
+}
+
+static void backend_wakeup(Reactor *r) {
+	uint64_t one = 1;
+
+	if (write(r->wakeFd, &one, sizeof(one)) == -1) {
+		/* The counter is already non zero. */
+	}
+}
+
+static int backend_ctl(Reactor *r, int op, struct reactor_entry *e) {
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = to_epoll_events(e->events);
+	ev.data.ptr = e;
+	if (epoll_ctl(r->epfd, op, e->sock, &ev) == -1) {
+		return UPNP_E_SOCKET_ERROR;
+	}
+
+	return UPNP_E_SUCCESS;
+}
+
+static int backend_add(Reactor *r, struct reactor_entry *e) {
+	return backend_ctl(r, EPOLL_CTL_ADD, e);
+}
+
+static int backend_mod(Reactor *r, struct reactor_entry *e) {
+	return backend_ctl(r, EPOLL_CTL_MOD, e);
+}
+
+static void backend_del(Reactor *r, struct reactor_entry *e) {
+	struct epoll_event ev;
+
+	/* Kernels before 2.6.9 require a non NULL event. */
+	memset(&ev, 0, sizeof(ev));
+	epoll_ctl(r->epfd, EPOLL_CTL_DEL, e->sock, &ev);
+}
+
+int reactor_wait(Reactor *r, ReactorEvent *events, int maxEvents, int timeoutMs) {
+	struct epoll_event ready[64];
+	struct reactor_entry *e;
+	int n;
+	int i;
+	int count;
+
+	if (maxEvents > (int) (sizeof(ready) / sizeof(ready[0]))) {
+		maxEvents = (int) (sizeof(ready) / sizeof(ready[0]));
+	}
+	n = epoll_wait(r->epfd, ready, maxEvents, timeoutMs < 0 ? -1 : timeoutMs);
+	if (n == -1) {
+		return SOCKET_ERROR;
+	}
+	for (i = 0, count = 0; i < n; i++) {
+		e = (struct reactor_entry *) ready[i].data.ptr;
+		if (e == NULL) {
+			uint64_t value;
+
+			if (read(r->wakeFd, &value, sizeof(value)) == -1) {
+				/* Already reset. */
+			}
+			continue;
+		}
+		events[count].sock = e->sock;
+		events[count].data = e->data;
+		events[count].events = 0;
+		if (ready[i].events & EPOLLIN) {
+			events[count].events |= REACTOR_READ;
+		}
+		if (ready[i].events & EPOLLOUT) {
+			events[count].events |= REACTOR_WRITE;
+		}
+		if (ready[i].events & (EPOLLERR | EPOLLHUP)) {
+			events[count].events |= REACTOR_ERROR;
+		}
+		count++;
+	}
+
+	return count;
+}
+
+const char *reactor_backend(void) {
+	return "epoll";
+}
+#else /* UPNP_ENABLE_EPOLL */
+static int backend_init(Reactor *r) {
+	struct sockaddr_in addr;
+	socklen_t addrLen = sizeof(addr);
+
+	r->wakeSock = socket(AF_INET, SOCK_DGRAM, 0);
+	if (r->wakeSock == INVALID_SOCKET) {
+		return UPNP_E_OUTOF_SOCKET;
+	}
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	addr.sin_port = 0;
+	if (bind(r->wakeSock, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+	    getsockname(r->wakeSock, (struct sockaddr *) &addr, &addrLen) == -1 ||
+	    connect(r->wakeSock, (struct sockaddr *) &addr, sizeof(addr)) == -1 ||
+	    sock_make_no_blocking(r->wakeSock) == -1) {
+		sock_close(r->wakeSock);
+		return UPNP_E_OUTOF_SOCKET;
+	}
+
+	return UPNP_E_SUCCESS;
+}
+
+static void backend_close(Reactor *r) {
+	sock_close(r->wakeSock);
+}
+
+/*!
+ * \brief Interrupts a pending select() so that it picks up the new
+ * registrations.
+ *
+ * r->mutex must be locked.
+ */
+static void backend_wakeup_waiting(Reactor *r) {
+	if (r->waiting) {
+		send(r->wakeSock, "w", (size_t) 1, 0);
+		r->waiting = 0;
+	}
+}
+
+/*!
+ * \brief Interrupts the pending or the next select().
+ *
+ * r->mutex must be locked.
+ */
+static void backend_wakeup(Reactor *r) {
+	send(r->wakeSock, "w", (size_t) 1, 0);
+	r->waiting = 0;
+}
+
+static int backend_add(Reactor *r, struct reactor_entry *e) {
+#ifndef WIN32
+	/* fd_set is a bitmap on POSIX systems. */
+	if (e->sock >= FD_SETSIZE) {
+		return UPNP_E_OUTOF_SOCKET;
+	}
+#else
+	/* One slot is used by the wake up socket. */
+	if (r->count + 1 >= FD_SETSIZE) {
+		return UPNP_E_OUTOF_SOCKET;
+	}
+#endif
+	backend_wakeup_waiting(r);
+
+	return UPNP_E_SUCCESS;
+}
+
+static int backend_mod(Reactor *r, struct reactor_entry *e) {
+	backend_wakeup_waiting(r);
+
+	return UPNP_E_SUCCESS;
+}
+
+static void backend_del(Reactor *r, struct reactor_entry *e) {
+}
+
+int reactor_wait(Reactor *r, ReactorEvent *events, int maxEvents, int timeoutMs) {
+	fd_set rdSet;
+	fd_set wrSet;
+	fd_set expSet;
+	struct timeval tv;
+	struct reactor_entry *e;
+	SOCKET maxSock = 0;
+	int ret;
+	int n = 0;
+
+	FD_ZERO(&rdSet);
+	FD_ZERO(&wrSet);
+	FD_ZERO(&expSet);
+	FD_SET(r->wakeSock, &rdSet);
+	maxSock = r->wakeSock;
+	ithread_mutex_lock(&r->mutex);
+	r->waiting = 1;
+	for (e = r->entries; e != NULL; e = e->next) {
+		if (e->events & REACTOR_READ) {
+			FD_SET(e->sock, &rdSet);
+		}
+		if (e->events & REACTOR_WRITE) {
+			FD_SET(e->sock, &wrSet);
+		}
+		FD_SET(e->sock, &expSet);
+		maxSock = max(maxSock, e->sock);
+	}
+	ithread_mutex_unlock(&r->mutex);
+	if (timeoutMs >= 0) {
+		tv.tv_sec = timeoutMs / 1000;
+		tv.tv_usec = (timeoutMs % 1000) * 1000;
+	}
+	ret = select((int) maxSock + 1, &rdSet, &wrSet, &expSet,
+	             timeoutMs >= 0 ? &tv : NULL);
+	ithread_mutex_lock(&r->mutex);
+	r->waiting = 0;
+	if (ret == SOCKET_ERROR || ret == 0) {
+		ithread_mutex_unlock(&r->mutex);
+		return ret;
+	}
+	if (FD_ISSET(r->wakeSock, &rdSet)) {
+		char buf[16];
+
+		while (recv(r->wakeSock, buf, sizeof(buf), 0) > 0) {
+		}
+	}
+	for (e = r->entries; e != NULL && n < maxEvents; e = e->next) {
+		int ev = 0;
+
+		if ((e->events & REACTOR_READ) && FD_ISSET(e->sock, &rdSet)) {
+			ev |= REACTOR_READ;
+		}
+		if ((e->events & REACTOR_WRITE) && FD_ISSET(e->sock, &wrSet)) {
+			ev |= REACTOR_WRITE;
+		}
+		if (FD_ISSET(e->sock, &expSet)) {
+			ev |= REACTOR_ERROR;
+		}
+		if (ev) {
+			events[n].sock = e->sock;
+			events[n].events = ev;
+			events[n].data = e->data;
+			n++;
+		}
+	}
+	ithread_mutex_unlock(&r->mutex);
+
+	return n;
+}
+
+const char *reactor_backend(void) {
+	return "select";
+}
+#endif /* UPNP_ENABLE_EPOLL */
+
+int reactor_create(Reactor **out) {
+	Reactor *r;
+
+	assert(out);
+
+	*out = NULL;
+	r = (Reactor *) malloc(sizeof(Reactor));
+	if (r == NULL) {
+		return UPNP_E_OUTOF_MEMORY;
+	}
+	memset(r, 0, sizeof(Reactor));
+	r->bucketCount = (size_t) REACTOR_MIN_BUCKETS;
+	r->buckets = (struct reactor_entry **) calloc(r->bucketCount,
+		sizeof(struct reactor_entry *));
+	if (r->buckets == NULL) {
+		free(r);
+		return UPNP_E_OUTOF_MEMORY;
+	}
+	if (backend_init(r) != UPNP_E_SUCCESS) {
+		free(r->buckets);
+		free(r);
+		return UPNP_E_OUTOF_SOCKET;
+	}
+	ithread_mutex_init(&r->mutex, NULL);
+	*out = r;
+
+	return UPNP_E_SUCCESS;
+}
+
+void reactor_destroy(Reactor *r) {
+	if (r == NULL) {
+		return;
+	}
+	ithread_mutex_lock(&r->mutex);
+	while (r->entries != NULL) {
+		reactor_unlink(r, r->entries);
+	}
+	ithread_mutex_unlock(&r->mutex);
+	backend_close(r);
+	ithread_mutex_destroy(&r->mutex);
+	free(r->buckets);
+	free(r);
+}
+
+int reactor_add(Reactor *r, SOCKET sock, int events, void *data) {
+	struct reactor_entry *e;
+	size_t i;
+	int ret;
+
+	if (r == NULL || sock == INVALID_SOCKET) {
+		return UPNP_E_INVALID_PARAM;
+	}
+	ithread_mutex_lock(&r->mutex);
+	if (reactor_find(r, sock) != NULL) {
+		ret = UPNP_E_INVALID_PARAM;
+		goto exit_function;
+	}
+	e = (struct reactor_entry *) malloc(sizeof(struct reactor_entry));
+	if (e == NULL) {
+		ret = UPNP_E_OUTOF_MEMORY;
+		goto exit_function;
+	}
+	e->sock = sock;
+	e->events = events;
+	e->data = data;
+	ret = backend_add(r, e);
+	if (ret != UPNP_E_SUCCESS) {
+		free(e);
+		goto exit_function;
+	}
+	e->prev = NULL;
+	e->next = r->entries;
+	if (r->entries) {
+		r->entries->prev = e;
+	}
+	r->entries = e;
+	i = reactor_bucket(r->bucketCount, sock);
+	e->hashNext = r->buckets[i];
+	r->buckets[i] = e;
+	r->count++;
+	reactor_grow(r);
+
+exit_function:
+	ithread_mutex_unlock(&r->mutex);
+
+	return ret;
+}
+
+int reactor_mod(Reactor *r, SOCKET sock, int events) {
+	struct reactor_entry *e;
+	int ret = UPNP_E_INVALID_PARAM;
+
+	if (r == NULL) {
+		return UPNP_E_INVALID_PARAM;
+	}
+	ithread_mutex_lock(&r->mutex);
+	e = reactor_find(r, sock);
+	if (e != NULL) {
+		e->events = events;
+		ret = backend_mod(r, e);
+	}
+	ithread_mutex_unlock(&r->mutex);
+
+	return ret;
+}
+
+void reactor_wakeup(Reactor *r) {
+	ithread_mutex_lock(&r->mutex);
+	backend_wakeup(r);
+	ithread_mutex_unlock(&r->mutex);
+}
+
+int reactor_del(Reactor *r, SOCKET sock) {
+	struct reactor_entry *e;
+	int ret = UPNP_E_INVALID_PARAM;
+
+	if (r == NULL) {
+		return UPNP_E_INVALID_PARAM;
+	}
+	ithread_mutex_lock(&r->mutex);
+	e = reactor_find(r, sock);
+	if (e != NULL) {
+		backend_del(r, e);
+		reactor_unlink(r, e);
+		ret = UPNP_E_SUCCESS;
+	}
+	ithread_mutex_unlock(&r->mutex);
+
+	return ret;
+}
+
+/* @} Sock */
@@ -42,6 +42,20 @@
 
 #include "../../include/sock.h"
 
+#include <limits.h>
+
+#ifndef WIN32
+	#include <poll.h>
+	#include <sys/uio.h>
+	#include <time.h>
+#endif
+
+#ifdef UPNP_ENABLE_SENDFILE
+	#include <pthread.h>
+	#include <signal.h>
+	#include <sys/sendfile.h>
+#endif
+
 #ifndef MSG_NOSIGNAL
 #define MSG_NOSIGNAL 0
 #endif
@@ -89,6 +103,157 @@ int sock_destroy(SOCKINFO *info, int ShutdownMethod) {
 	return ret;
 }
 
+long long sock_now_ms(void) {
+#ifdef WIN32
+	return (long long) GetTickCount64();
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+#endif
+}
+
+void sock_set_deadline(SOCKINFO *info, int timeoutMs) {
+	if (timeoutMs < 0)
+		info->deadline = 0;
+	else
+		info->deadline = sock_now_ms() + timeoutMs;
+}
+
+int sock_is_idle(SOCKINFO *info) {
+	int retCode;
+#ifdef WIN32
+	fd_set readSet;
+	struct timeval timeout;
+
+	FD_ZERO(&readSet);
+	FD_SET(info->socket, &readSet);
+	timeout.tv_sec = 0;
+	timeout.tv_usec = 0;
+	retCode = select(info->socket + 1, &readSet, NULL, NULL, &timeout);
+#else
+	struct pollfd pfd;
+
+	pfd.fd = info->socket;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	do {
+		retCode = poll(&pfd, 1, 0);
+	} while (retCode == -1 && errno == EINTR);
+#endif
+
+	/* readable means pending data, end of file or a pending error. */
+	return retCode == 0;
+}
+
+/*!
+ * \brief Returns how long a socket call started at \b start may still wait,
+ * from its timeout and the deadline of the socket.
+ *
+ * \return The time left in milliseconds, -1 to wait forever, 0 if the time
+ * 	is up.
+ */
+static int sock_time_left(
+	/*! [in] Socket Information Object. */
+	SOCKINFO *info,
+	/*! [in] timeout value in seconds, 0 for none. */
+	int timeoutSecs,
+	/*! [in] Start of the call, from sock_now_ms(). */
+	long long start) {
+	long long end = 0;
+	long long now;
+
+	if (timeoutSecs > 0)
+		end = start + (long long) timeoutSecs * 1000;
+	if (info->deadline > 0 && (end == 0 || info->deadline < end))
+		end = info->deadline;
+	if (end == 0)
+		return -1;
+	now = sock_now_ms();
+	if (end <= now)
+		return 0;
+	if (end - now > INT_MAX)
+		return INT_MAX;
+
+	return (int) (end - now);
+}
+
+/*!
+ * \brief Subtracts the whole seconds elapsed since \b start from a timeout.
+ *
+ * Seconds are counted at the clock boundaries, so that a sequence of short
+ * calls consumes the timeout as a single long one does.
+ */
+static void sock_charge_timeout(
+	/*! [in,out] timeout value in seconds, 0 for none. */
+	int *timeoutSecs,
+	/*! [in] Start of the call, from sock_now_ms(). */
+	long long start) {
+	if (*timeoutSecs != 0)
+		*timeoutSecs -= (int) (sock_now_ms() / 1000 - start / 1000);
+}
+
+/*!
+ * \brief Waits until the socket can be read or written.
+ *
+ * \return
+ *	\li \c 0 - The socket is ready.
+ *	\li \c UPNP_E_TIMEDOUT - Timeout
+ *	\li \c UPNP_E_SOCKET_ERROR - Error on socket calls
+ */
+static int sock_wait(
+	/*! [in] Socket Information Object. */
+	SOCKINFO *info,
+	/*! [in] timeout value in seconds, 0 for none. */
+	int timeoutSecs,
+	/*! [in] Start of the call, from sock_now_ms(). */
+	long long start,
+	/*! [in] Boolean value specifying read or write readiness. */
+	int bRead) {
+	int retCode;
+	int timeLeft;
+#ifdef WIN32
+	fd_set readSet;
+	fd_set writeSet;
+	struct timeval timeout;
+#else
+	struct pollfd pfd;
+#endif
+
+	while (TRUE) {
+		timeLeft = sock_time_left(info, timeoutSecs, start);
+		if (timeLeft == 0)
+			return UPNP_E_TIMEDOUT;
+#ifdef WIN32
+		FD_ZERO(&readSet);
+		FD_ZERO(&writeSet);
+		if (bRead)
+			FD_SET(info->socket, &readSet);
+		else
+			FD_SET(info->socket, &writeSet);
+		timeout.tv_sec = timeLeft / 1000;
+		timeout.tv_usec = (timeLeft % 1000) * 1000;
+		retCode = select(info->socket + 1, &readSet, &writeSet, NULL,
+		                 timeLeft < 0 ? NULL : &timeout);
+#else
+		pfd.fd = info->socket;
+		pfd.events = bRead ? POLLIN : POLLOUT;
+		pfd.revents = 0;
+		retCode = poll(&pfd, 1, timeLeft);
+#endif
+		if (retCode == 0)
+			return UPNP_E_TIMEDOUT;
+		if (retCode == -1) {
+			if (errno == EINTR)
+				continue;
+			return UPNP_E_SOCKET_ERROR;
+		} else
+			/* read or write. */
+			return 0;
+	}
+}
+
 /*!
  * \brief Receives or sends data. Also returns the time taken to receive or
  * send data.
@@ -110,11 +275,8 @@ static int sock_read_write(
 	/*! [in] Boolean value specifying read or write option. */
 	int bRead) {
 	int retCode;
-	fd_set readSet;
-	fd_set writeSet;
-	struct timeval timeout;
 	long numBytes;
-	time_t start_time = time(NULL);
+	long long start = sock_now_ms();
 	SOCKET sockfd = info->socket;
 	long bytes_sent = 0;
 	size_t byte_left = (size_t) 0;
@@ -122,31 +284,9 @@ static int sock_read_write(
 
 	if (*timeoutSecs < 0)
 		return UPNP_E_TIMEDOUT;
-	FD_ZERO(&readSet);
-	FD_ZERO(&writeSet);
-	if (bRead)
-		FD_SET(sockfd, &readSet);
-	else
-		FD_SET(sockfd, &writeSet);
-	timeout.tv_sec = *timeoutSecs;
-	timeout.tv_usec = 0;
-	while (TRUE) {
-		if (*timeoutSecs == 0)
-			retCode = select(sockfd + 1, &readSet, &writeSet,
-			                 NULL, NULL);
-		else
-			retCode = select(sockfd + 1, &readSet, &writeSet,
-			                 NULL, &timeout);
-		if (retCode == 0)
-			return UPNP_E_TIMEDOUT;
-		if (retCode == -1) {
-			if (errno == EINTR)
-				continue;
-			return UPNP_E_SOCKET_ERROR;
-		} else
-			/* read or write. */
-			break;
-	}
+	retCode = sock_wait(info, *timeoutSecs, start, bRead);
+	if (retCode != 0)
+		return retCode;
 #ifdef SO_NOSIGPIPE
 	{
 		int old;
@@ -166,6 +306,7 @@ static int sock_read_write(
 			num_written = send(sockfd,
 			                   buffer + bytes_sent, byte_left,
 			                   MSG_DONTROUTE | MSG_NOSIGNAL);
+			info->write_syscalls++;
 			if (num_written == -1) {
 #ifdef SO_NOSIGPIPE
 				setsockopt(sockfd, SOL_SOCKET,
@@ -185,8 +326,7 @@ static int sock_read_write(
 	if (numBytes < 0)
 		return UPNP_E_SOCKET_ERROR;
 	/* subtract time used for reading/writing. */
-	if (*timeoutSecs != 0)
-		*timeoutSecs -= (int) (time(NULL) - start_time);
+	sock_charge_timeout(timeoutSecs, start);
 
 	return (int) numBytes;
 }
@@ -200,6 +340,154 @@ int sock_write(SOCKINFO *info, const char *buffer, size_t bufsize, int *timeoutS
 	return sock_read_write(info, (char *) buffer, bufsize, timeoutSecs, FALSE);
 }
 
+int sock_writev(SOCKINFO *info, const SockBuffer *buffers, int count,
+                int *timeoutSecs) {
+#ifdef WIN32
+	int total = 0;
+	int nw;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		if (buffers[i].length == (size_t) 0)
+			continue;
+		nw = sock_write(info, buffers[i].buf, buffers[i].length,
+		                timeoutSecs);
+		if (nw < 0)
+			return nw;
+		total += nw;
+	}
+
+	return total;
+#else
+	struct iovec iov[SOCK_MAX_BUFFERS];
+	struct msghdr msg;
+	int numIov = 0;
+	int first = 0;
+	int retCode;
+	int i;
+	long long start = sock_now_ms();
+	SOCKET sockfd = info->socket;
+	long bytes_sent = 0;
+	size_t left;
+	ssize_t num_written;
+#ifdef SO_NOSIGPIPE
+	int old;
+	int set = 1;
+	socklen_t olen = sizeof(old);
+#endif
+
+	assert(count <= SOCK_MAX_BUFFERS);
+
+	if (*timeoutSecs < 0)
+		return UPNP_E_TIMEDOUT;
+	for (i = 0; i < count && i < SOCK_MAX_BUFFERS; i++) {
+		if (buffers[i].length == (size_t) 0)
+			continue;
+		iov[numIov].iov_base = (void *) buffers[i].buf;
+		iov[numIov].iov_len = buffers[i].length;
+		numIov++;
+	}
+	retCode = sock_wait(info, *timeoutSecs, start, FALSE);
+	if (retCode != 0)
+		return retCode;
+#ifdef SO_NOSIGPIPE
+	getsockopt(sockfd, SOL_SOCKET, SO_NOSIGPIPE, &old, &olen);
+	setsockopt(sockfd, SOL_SOCKET, SO_NOSIGPIPE, &set, sizeof(set));
+#endif
+	while (first < numIov) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov + first;
+		msg.msg_iovlen = numIov - first;
+		num_written = sendmsg(sockfd, &msg,
+		                      MSG_DONTROUTE | MSG_NOSIGNAL);
+		info->write_syscalls++;
+		if (num_written == -1) {
+			if (errno == EINTR)
+				continue;
+			bytes_sent = UPNP_E_SOCKET_ERROR;
+			break;
+		}
+		bytes_sent += num_written;
+		/* skip the buffers sent completely. */
+		left = (size_t) num_written;
+		while (first < numIov && left >= iov[first].iov_len) {
+			left -= iov[first].iov_len;
+			first++;
+		}
+		if (left > (size_t) 0) {
+			iov[first].iov_base = (char *) iov[first].iov_base + left;
+			iov[first].iov_len -= left;
+		}
+	}
+#ifdef SO_NOSIGPIPE
+	setsockopt(sockfd, SOL_SOCKET, SO_NOSIGPIPE, &old, olen);
+#endif
+	/* subtract time used for writing. */
+	sock_charge_timeout(timeoutSecs, start);
+
+	return (int) bytes_sent;
+#endif /* WIN32 */
+}
+
+#ifdef UPNP_ENABLE_SENDFILE
+int sock_sendfile(SOCKINFO *info, int fd, off_t *offset, size_t count,
+                  int *timeoutSecs) {
+	int retCode = UPNP_E_SUCCESS;
+	int pipePending;
+	struct timespec noWait = {0, 0};
+	long long start = sock_now_ms();
+	SOCKET sockfd = info->socket;
+	off_t first = *offset;
+	ssize_t num_written;
+	sigset_t pipeSet;
+	sigset_t oldSet;
+	sigset_t pending;
+
+	if (*timeoutSecs < 0)
+		return UPNP_E_TIMEDOUT;
+	/* sendfile() has no MSG_NOSIGNAL, a peer closing the connection must
+	 * not kill the process. */
+	sigemptyset(&pipeSet);
+	sigaddset(&pipeSet, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &pipeSet, &oldSet);
+	sigpending(&pending);
+	pipePending = sigismember(&pending, SIGPIPE);
+	while (count > (size_t) 0) {
+		retCode = sock_wait(info, *timeoutSecs, start, FALSE);
+		if (retCode != 0)
+			break;
+		num_written = sendfile(sockfd, fd, offset, count);
+		info->write_syscalls++;
+		if (num_written == 0)
+			/* end of file. */
+			break;
+		if (num_written == -1) {
+			if (errno == EINTR || errno == EAGAIN ||
+			    errno == EWOULDBLOCK)
+				continue;
+			if ((errno == EINVAL || errno == ENOSYS) &&
+			    *offset == first)
+				retCode = UPNP_E_FILE_READ_ERROR;
+			else
+				retCode = UPNP_E_SOCKET_ERROR;
+			break;
+		}
+		count -= (size_t) num_written;
+	}
+	if (!pipePending) {
+		/* Discard the SIGPIPE raised by sendfile(), if any. */
+		sigpending(&pending);
+		if (sigismember(&pending, SIGPIPE))
+			sigtimedwait(&pipeSet, NULL, &noWait);
+	}
+	pthread_sigmask(SIG_SETMASK, &oldSet, NULL);
+	/* subtract time used for writing. */
+	sock_charge_timeout(timeoutSecs, start);
+
+	return retCode;
+}
+#endif /* UPNP_ENABLE_SENDFILE */
+
 int sock_make_blocking(SOCKET sock) {
 #ifdef WIN32
 	u_long val = 0;
@@ -39,11 +39,92 @@
 ************************************************************************/
 
 #include "../../include/config.h"
+#include "../../include/membuffer.h"
 #include "../../include/service_table.h"
 
+#include <stddef.h>
+
 #ifdef INCLUDE_DEVICE_APIS
 
+#if EXCLUDE_GENA == 0 || EXCLUDE_SOAP == 0
+/*! Initial value of the FNV-1a hashes. */
+#define HASH_INIT ((size_t) 2166136261u)
+
+/*!
+ * \brief Adds bytes to a FNV-1a hash.
+ *
+ * \return The updated hash.
+ */
+static size_t hash_bytes(
+	/*! [in] Hash so far, HASH_INIT to start. */
+	size_t h,
+	/*! [in] Bytes to add. */
+	const char *buf,
+	/*! [in] Number of bytes. */
+	size_t length) {
+	size_t i;
+
+	for (i = 0; i < length; i++)
+		h = (h ^ (unsigned char) buf[i]) * (size_t) 16777619u;
+
+	return h;
+}
+
+/*!
+ * \brief Finds the service whose control or event URL has the path of a
+ * given URL.
+ *
+ * \return The service, NULL if not found.
+ */
+static service_info *find_service_path(
+	/*! [in] Service table. */
+	service_table *table,
+	/*! [in] URL whose path and query are looked for. */
+	const char *urlPath,
+	/*! [in] 1 to search the event URLs, 0 for the control URLs. */
+	int event) {
+	service_info *finger;
+	uri_type parsed_url_in;
+	const char *path;
+	size_t h;
+
+	if (table == NULL ||
+	    parse_uri(urlPath, strlen(urlPath), &parsed_url_in) != HTTP_SUCCESS)
+		return NULL;
+	if (table->indexSize > 0) {
+		h = hash_bytes(HASH_INIT, parsed_url_in.pathquery.buff,
+		               parsed_url_in.pathquery.size) &
+		    (table->indexSize - 1);
+		finger = event ? table->eventPathIndex[h] :
+		                 table->controlPathIndex[h];
+	} else {
+		finger = table->serviceList;
+	}
+	while (finger) {
+		path = event ? finger->eventPath : finger->controlPath;
+		if (path != NULL &&
+		    strlen(path) == parsed_url_in.pathquery.size &&
+		    !memcmp(path, parsed_url_in.pathquery.buff,
+		            parsed_url_in.pathquery.size))
+			return finger;
+		if (table->indexSize == 0)
+			finger = finger->next;
+		else if (event)
+			finger = finger->eventPathNext;
+		else
+			finger = finger->controlPathNext;
+	}
+
+	return NULL;
+}
+#endif /* EXCLUDE_GENA || EXCLUDE_SOAP */
+
 #if EXCLUDE_GENA == 0
+size_t ServiceIdHash(const char *serviceId, const char *UDN) {
+	return hash_bytes(hash_bytes(HASH_INIT, UDN, strlen(UDN) + 1),
+	                  serviceId, strlen(serviceId));
+}
+
 /************************************************************************
 *	Function :	copy_subscription
 *
@@ -75,129 +156,305 @@ copy_subscription(subscription *in,
 		return return_code;
 	ListInit(&out->outgoing, 0, 0);
 	out->next = NULL;
+	out->prev = NULL;
+	out->hashNext = NULL;
+	out->expiryIndex = 0;
 	return HTTP_SUCCESS;
 }
 
-/************************************************************************
-*	Function :	RemoveSubscriptionSID
-*
-*	Parameters :
-*		Upnp_SID sid ;	subscription ID
-*		service_info * service ;	service object providing the list of
-*						subscriptions
-*
-*	Description :	Remove the subscription represented by the
-*		const Upnp_SID sid parameter from the service table and update 
-*		the service table.
-*
-*	Return : void ;
-*
-*	Note :
-************************************************************************/
-void
-RemoveSubscriptionSID(Upnp_SID sid,
-                      service_info *service) {
-	subscription *finger = service->subscriptionList;
-	subscription *previous = NULL;
+/*!
+ * \brief Hashes a SID.
+ *
+ * \return FNV-1a hash of the SID.
+ */
+static size_t sid_hash(
+	/*! [in] Subscription ID. */
+	const char *sid) {
+	return hash_bytes(HASH_INIT, sid, strlen(sid));
+}
 
-	while (finger) {
-		if (!(strcmp(sid, finger->sid))) {
-			if (previous)
-				previous->next = finger->next;
-			else
-				service->subscriptionList = finger->next;
-			finger->next = NULL;
-			freeSubscriptionList(finger);
-			finger = NULL;
-			service->TotalSubscriptions--;
-		} else {
-			previous = finger;
-			finger = finger->next;
+/*!
+ * \brief Grows the SID hash table of a service to hold its subscriptions.
+ *
+ * \return UPNP_E_SUCCESS or UPNP_E_OUTOF_MEMORY.
+ */
+static int sid_table_reserve(
+	/*! [in] Service object. */
+	service_info *service,
+	/*! [in] Number of subscriptions to hold. */
+	size_t count) {
+	subscription **buckets;
+	subscription *sub;
+	subscription *next;
+	size_t size;
+	size_t i;
+	size_t h;
+
+	if (count <= service->subscriptionHashSize)
+		return UPNP_E_SUCCESS;
+	size = service->subscriptionHashSize ?
+	       2 * service->subscriptionHashSize :
+	       (size_t) SUBSCRIPTION_HASH_SIZE;
+	while (size < count)
+		size *= 2;
+	buckets = (subscription **) calloc(size, sizeof(subscription *));
+	if (buckets == NULL)
+		return UPNP_E_OUTOF_MEMORY;
+	for (i = 0; i < service->subscriptionHashSize; i++) {
+		for (sub = service->subscriptionHash[i]; sub; sub = next) {
+			next = sub->hashNext;
+			h = sid_hash(sub->sid) & (size - 1);
+			sub->hashNext = buckets[h];
+			buckets[h] = sub;
 		}
 	}
+	free(service->subscriptionHash);
+	service->subscriptionHash = buckets;
+	service->subscriptionHashSize = size;
 
+	return UPNP_E_SUCCESS;
 }
 
-subscription *GetSubscriptionSID(const Upnp_SID sid, service_info *service) {
-	subscription *next = service->subscriptionList;
-	subscription *previous = NULL;
-	subscription *found = NULL;
+/*!
+ * \brief Places an entry of the expiry heap, updating its index.
+ */
+static void expiry_set(
+	/*! [in] Service object. */
+	service_info *service,
+	/*! [in] Index in the heap. */
+	size_t i,
+	/*! [in] Subscription. */
+	subscription *sub) {
+	service->expiryHeap[i] = sub;
+	sub->expiryIndex = i + 1;
+}
 
-	time_t current_time;
+/*!
+ * \brief Restores the order of the expiry heap around an entry whose
+ * expiration time changed.
+ */
+static void expiry_fix(
+	/*! [in] Service object. */
+	service_info *service,
+	/*! [in] Index in the heap. */
+	size_t i) {
+	subscription **heap = service->expiryHeap;
+	subscription *sub = heap[i];
+	size_t child;
+
+	while (i > 0 && heap[(i - 1) / 2]->expireTime > sub->expireTime) {
+		expiry_set(service, i, heap[(i - 1) / 2]);
+		i = (i - 1) / 2;
+	}
+	while ((child = 2 * i + 1) < service->expiryHeapCount) {
+		if (child + 1 < service->expiryHeapCount &&
+		    heap[child + 1]->expireTime < heap[child]->expireTime)
+			child++;
+		if (heap[child]->expireTime >= sub->expireTime)
+			break;
+		expiry_set(service, i, heap[child]);
+		i = child;
+	}
+	expiry_set(service, i, sub);
+}
 
-	while ((next) && (found == NULL)) {
-		if (!strcmp(next->sid, sid))
-			found = next;
-		else {
-			previous = next;
-			next = next->next;
-		}
+/*!
+ * \brief Removes a subscription from the expiry heap, if it is in it.
+ */
+static void expiry_remove(
+	/*! [in] Service object. */
+	service_info *service,
+	/*! [in] Subscription. */
+	subscription *sub) {
+	size_t i = sub->expiryIndex;
+
+	if (i == 0)
+		return;
+	sub->expiryIndex = 0;
+	service->expiryHeapCount--;
+	if (i - 1 == service->expiryHeapCount)
+		return;
+	expiry_set(service, i - 1,
+	           service->expiryHeap[service->expiryHeapCount]);
+	expiry_fix(service, i - 1);
+}
+
+/*!
+ * \brief Adds a subscription to the expiry heap.
+ *
+ * \return UPNP_E_SUCCESS or UPNP_E_OUTOF_MEMORY.
+ */
+static int expiry_add(
+	/*! [in] Service object. */
+	service_info *service,
+	/*! [in] Subscription, with an expiration time. */
+	subscription *sub) {
+	subscription **heap;
+	size_t size;
+
+	if (service->expiryHeapCount == service->expiryHeapSize) {
+		size = service->expiryHeapSize ?
+		       2 * service->expiryHeapSize :
+		       (size_t) SUBSCRIPTION_HASH_SIZE;
+		heap = (subscription **) realloc(service->expiryHeap,
+		                                 size * sizeof(subscription *));
+		if (heap == NULL)
+			return UPNP_E_OUTOF_MEMORY;
+		service->expiryHeap = heap;
+		service->expiryHeapSize = size;
 	}
-	if (found) {
-		/*get the current_time */
-		time(&current_time);
-		if ((found->expireTime != 0)
-			&& (found->expireTime < current_time)) {
-			if (previous)
-				previous->next = found->next;
-			else
-				service->subscriptionList = found->next;
-			found->next = NULL;
-			freeSubscriptionList(found);
-			found = NULL;
-			service->TotalSubscriptions--;
-		}
+	expiry_set(service, service->expiryHeapCount++, sub);
+	expiry_fix(service, service->expiryHeapCount - 1);
+
+	return UPNP_E_SUCCESS;
+}
+
+/*!
+ * \brief Unlinks a subscription from the list, the hash table and the expiry
+ * heap of its service, and frees it.
+ */
+static void unlink_subscription(
+	/*! [in] Service object. */
+	service_info *service,
+	/*! [in] Subscription. */
+	subscription *sub) {
+	subscription **p;
+
+	p = &service->subscriptionHash[sid_hash(sub->sid) &
+	                               (service->subscriptionHashSize - 1)];
+	while (*p != sub)
+		p = &(*p)->hashNext;
+	*p = sub->hashNext;
+	expiry_remove(service, sub);
+	if (sub->prev)
+		sub->prev->next = sub->next;
+	else
+		service->subscriptionList = sub->next;
+	if (sub->next)
+		sub->next->prev = sub->prev;
+	sub->next = NULL;
+	freeSubscriptionList(sub);
+	service->TotalSubscriptions--;
+}
+
+/*!
+ * \brief Tells whether a subscription expired.
+ *
+ * \return 1 if it expired, 0 otherwise.
+ */
+static int subscription_expired(
+	/*! [in] Subscription. */
+	const subscription *sub,
+	/*! [in] Current time. */
+	time_t current_time) {
+	return sub->expireTime != 0 && sub->expireTime < current_time;
+}
+
+int AddSubscription(service_info *service, subscription *sub) {
+	size_t h;
+
+	if (sid_table_reserve(service,
+	                      (size_t) service->TotalSubscriptions + 1) !=
+	    UPNP_E_SUCCESS)
+		return UPNP_E_OUTOF_MEMORY;
+	sub->expiryIndex = 0;
+	if (sub->expireTime != 0 &&
+	    expiry_add(service, sub) != UPNP_E_SUCCESS)
+		return UPNP_E_OUTOF_MEMORY;
+	h = sid_hash(sub->sid) & (service->subscriptionHashSize - 1);
+	sub->hashNext = service->subscriptionHash[h];
+	service->subscriptionHash[h] = sub;
+	sub->prev = NULL;
+	sub->next = service->subscriptionList;
+	if (sub->next)
+		sub->next->prev = sub;
+	service->subscriptionList = sub;
+	service->TotalSubscriptions++;
+
+	return UPNP_E_SUCCESS;
+}
+
+int SetSubscriptionExpireTime(service_info *service,
+                              subscription *sub,
+                              time_t expireTime) {
+	sub->expireTime = expireTime;
+	if (expireTime == 0) {
+		expiry_remove(service, sub);
+		return UPNP_E_SUCCESS;
 	}
-	return found;
+	if (sub->expiryIndex == 0)
+		return expiry_add(service, sub);
+	expiry_fix(service, sub->expiryIndex - 1);
 
+	return UPNP_E_SUCCESS;
+}
+
+time_t ExpireSubscriptions(service_info *service, time_t current_time) {
+	while (service->expiryHeapCount > 0 &&
+	       subscription_expired(service->expiryHeap[0], current_time))
+		unlink_subscription(service, service->expiryHeap[0]);
+
+	return service->expiryHeapCount > 0 ?
+	       service->expiryHeap[0]->expireTime : 0;
+}
+
+void RemoveSubscriptionSID(Upnp_SID sid, service_info *service) {
+	subscription *sub;
+
+	if (service->subscriptionHashSize == 0)
+		return;
+	sub = service->subscriptionHash[sid_hash(sid) &
+	                                (service->subscriptionHashSize - 1)];
+	while (sub && strcmp(sub->sid, sid))
+		sub = sub->hashNext;
+	if (sub)
+		unlink_subscription(service, sub);
+}
+
+subscription *GetSubscriptionSID(const Upnp_SID sid, service_info *service) {
+	subscription *found;
+
+	if (service->subscriptionHashSize == 0)
+		return NULL;
+	found = service->subscriptionHash[sid_hash(sid) &
+	                                  (service->subscriptionHashSize - 1)];
+	while (found && strcmp(found->sid, sid))
+		found = found->hashNext;
+	/* expired subscriptions are left to ExpireSubscriptions() */
+	if (found && subscription_expired(found, time(NULL)))
+		found = NULL;
+
+	return found;
 }
 
 subscription *GetNextSubscription(service_info *service, subscription *current) {
 	time_t current_time;
-	subscription *next = NULL;
-	subscription *previous = NULL;
-	int notDone = 1;
 
 	/* get the current_time */
 	time(&current_time);
-	while ((notDone) && (current)) {
-		previous = current;
-		current = current->next;
-
-		if (current == NULL) {
-			notDone = 0;
-			next = current;
-		} else if ((current->expireTime != 0)
-			&& (current->expireTime < current_time)) {
-			previous->next = current->next;
-			current->next = NULL;
-			freeSubscriptionList(current);
-			current = previous;
-			service->TotalSubscriptions--;
-		} else if (current->active) {
-			notDone = 0;
-			next = current;
-		}
+	for (current = current->next; current; current = current->next) {
+		if (current->active &&
+		    !subscription_expired(current, current_time))
+			break;
 	}
-	return next;
+
+	return current;
+	service = service;
 }
 
 subscription *GetFirstSubscription(service_info *service) {
 	subscription temp;
-	subscription *next = NULL;
 
 	temp.next = service->subscriptionList;
-	next = GetNextSubscription(service, &temp);
-	service->subscriptionList = temp.next;
-	/* service->subscriptionList = next; */
 
-	return next;
+	return GetNextSubscription(service, &temp);
 }
 
 void freeSubscription(subscription *sub) {
 	if (sub) {
 		free_URL_list(&sub->DeliveryURLs);
 		freeSubscriptionQueuedEvents(sub);
+		ListDestroy(&sub->outgoing, 0);
 	}
 }
 
@@ -250,15 +507,20 @@ FindServiceId(service_table *table,
               const char *UDN) {
 	service_info *finger = NULL;
 
-	if (table) {
+	if (table == NULL)
+		return NULL;
+	if (table->indexSize > 0)
+		finger = table->serviceIdIndex[ServiceIdHash(serviceId, UDN) &
+		                               (table->indexSize - 1)];
+	else
 		finger = table->serviceList;
-		while (finger) {
-			if ((!strcmp(serviceId, finger->serviceId)) &&
-				(!strcmp(UDN, finger->UDN))) {
-				return finger;
-			}
-			finger = finger->next;
+	while (finger) {
+		if ((!strcmp(serviceId, finger->serviceId)) &&
+			(!strcmp(UDN, finger->UDN))) {
+			return finger;
 		}
+		finger = table->indexSize > 0 ? finger->serviceIdNext :
+		                                finger->next;
 	}
 
 	return NULL;
@@ -283,34 +545,7 @@ FindServiceId(service_table *table,
 service_info *
 FindServiceEventURLPath(service_table *table,
                         char *eventURLPath) {
-	service_info *finger = NULL;
-	uri_type parsed_url;
-	uri_type parsed_url_in;
-
-	if ((table)
-		&&
-			(parse_uri(eventURLPath,
-			           strlen(eventURLPath),
-			           &parsed_url_in) == HTTP_SUCCESS)) {
-
-		finger = table->serviceList;
-		while (finger) {
-			if (finger->eventURL)
-				if ((parse_uri
-					(finger->eventURL, strlen(finger->eventURL),
-					 &parsed_url) == HTTP_SUCCESS)) {
-
-					if (!token_cmp
-						(&parsed_url.pathquery,
-						 &parsed_url_in.pathquery))
-						return finger;
-
-				}
-			finger = finger->next;
-		}
-	}
-
-	return NULL;
+	return find_service_path(table, eventURLPath, 1);
 }
 #endif /* EXCLUDE_GENA */
 
@@ -334,32 +569,7 @@ FindServiceEventURLPath(service_table *table,
 service_info *
 FindServiceControlURLPath(service_table *table,
                           const char *controlURLPath) {
-	service_info *finger = NULL;
-	uri_type parsed_url;
-	uri_type parsed_url_in;
-
-	if ((table)
-		&&
-			(parse_uri
-				(controlURLPath, strlen(controlURLPath),
-				 &parsed_url_in) == HTTP_SUCCESS)) {
-		finger = table->serviceList;
-		while (finger) {
-			if (finger->controlURL)
-				if ((parse_uri
-					(finger->controlURL, strlen(finger->controlURL),
-					 &parsed_url) == HTTP_SUCCESS)) {
-					if (!token_cmp
-						(&parsed_url.pathquery,
-						 &parsed_url_in.pathquery))
-						return finger;
-				}
-			finger = finger->next;
-		}
-	}
-
-	return NULL;
-
+	return find_service_path(table, controlURLPath, 0);
 }
 #endif /* EXCLUDE_SOAP */
 
@@ -543,6 +753,12 @@ void freeService(service_info *in) {
 
 		if (in->subscriptionList)
 			freeSubscriptionList(in->subscriptionList);
+		free(in->subscriptionHash);
+		free(in->expiryHeap);
+		free(in->controlPath);
+		free(in->eventPath);
+		freeStateVarStore(in->stateVars);
+		freeEventModeration(in->moderation);
 
 		in->TotalSubscriptions = 0;
 		free(in);
@@ -581,6 +797,12 @@ freeServiceList(service_info *head) {
 			ixmlFreeDOMString(head->UDN);
 		if (head->subscriptionList)
 			freeSubscriptionList(head->subscriptionList);
+		free(head->subscriptionHash);
+		free(head->expiryHeap);
+		free(head->controlPath);
+		free(head->eventPath);
+		freeStateVarStore(head->stateVars);
+		freeEventModeration(head->moderation);
 
 		head->TotalSubscriptions = 0;
 		next = head->next;
@@ -589,6 +811,117 @@ freeServiceList(service_info *head) {
 	}
 }
 
+/*!
+ * \brief Gets the path and query of a service URL, the key of the service in
+ * the path indexes.
+ *
+ * \return The path, to free with free(), NULL if it cannot be parsed.
+ */
+static char *service_url_path(
+	/*! [in] Control or event URL of a service. */
+	const char *url) {
+	uri_type parsed_url;
+
+	if (url == NULL ||
+	    parse_uri(url, strlen(url), &parsed_url) != HTTP_SUCCESS)
+		return NULL;
+
+	return str_alloc(parsed_url.pathquery.buff, parsed_url.pathquery.size);
+}
+
+/*!
+ * \brief Appends a service to a bucket, so that lookups find the services
+ * in the order of the service list.
+ */
+static void index_append(
+	/*! [in] First service of the bucket. */
+	service_info **bucket,
+	/*! [in] Service to add. */
+	service_info *service,
+	/*! [in] Offset of the link to the next service in the bucket. */
+	size_t nextOffset) {
+	service_info **p = bucket;
+
+	while (*p)
+		p = (service_info **) ((char *) *p + nextOffset);
+	*p = service;
+	*(service_info **) ((char *) service + nextOffset) = NULL;
+}
+
+/*!
+ * \brief Frees the indexes of a service table.
+ */
+static void freeServiceIndex(
+	/*! [in] Service table. */
+	service_table *table) {
+	free(table->controlPathIndex);
+	free(table->eventPathIndex);
+	free(table->serviceIdIndex);
+	table->controlPathIndex = NULL;
+	table->eventPathIndex = NULL;
+	table->serviceIdIndex = NULL;
+	table->indexSize = 0;
+}
+
+/*!
+ * \brief Indexes the services of a table by control path, event path and
+ * (UDN, serviceId), after services were added or removed.
+ *
+ * If memory runs out, the table is left without indexes and the lookups
+ * walk the service list.
+ */
+static void indexServiceTable(
+	/*! [in] Service table. */
+	service_table *table) {
+	service_info *finger;
+	size_t count = 0;
+	size_t size = (size_t) 8;
+	size_t h;
+
+	freeServiceIndex(table);
+	for (finger = table->serviceList; finger; finger = finger->next) {
+		if (finger->controlPath == NULL)
+			finger->controlPath = service_url_path(finger->controlURL);
+		if (finger->eventPath == NULL)
+			finger->eventPath = service_url_path(finger->eventURL);
+		count++;
+	}
+	if (count == 0)
+		return;
+	while (size < 2 * count)
+		size *= 2;
+	table->controlPathIndex =
+		(service_info **) calloc(size, sizeof(service_info *));
+	table->eventPathIndex =
+		(service_info **) calloc(size, sizeof(service_info *));
+	table->serviceIdIndex =
+		(service_info **) calloc(size, sizeof(service_info *));
+	if (table->controlPathIndex == NULL ||
+	    table->eventPathIndex == NULL ||
+	    table->serviceIdIndex == NULL) {
+		freeServiceIndex(table);
+		return;
+	}
+	for (finger = table->serviceList; finger; finger = finger->next) {
+		if (finger->controlPath) {
+			h = hash_bytes(HASH_INIT, finger->controlPath,
+			               strlen(finger->controlPath)) & (size - 1);
+			index_append(&table->controlPathIndex[h], finger,
+			             offsetof(service_info, controlPathNext));
+		}
+		if (finger->eventPath) {
+			h = hash_bytes(HASH_INIT, finger->eventPath,
+			               strlen(finger->eventPath)) & (size - 1);
+			index_append(&table->eventPathIndex[h], finger,
+			             offsetof(service_info, eventPathNext));
+		}
+		h = ServiceIdHash(finger->serviceId, finger->UDN) & (size - 1);
+		index_append(&table->serviceIdIndex[h], finger,
+		             offsetof(service_info, serviceIdNext));
+	}
+	table->indexSize = size;
+}
+
 /************************************************************************
 *	Function :	freeServiceTable
 *
@@ -606,6 +939,7 @@ freeServiceList(service_info *head) {
 void
 freeServiceTable(service_table *table) {
 	ixmlFreeDOMString(table->URLBase);
+	freeServiceIndex(table);
 	freeServiceList(table->serviceList);
 	table->serviceList = NULL;
 	table->endServiceList = NULL;
@@ -760,6 +1094,15 @@ service_info *getServiceList(
 				current->active = 1;
 				current->subscriptionList = NULL;
 				current->TotalSubscriptions = 0;
+				current->subscriptionHash = NULL;
+				current->subscriptionHashSize = 0;
+				current->expiryHeap = NULL;
+				current->expiryHeapCount = 0;
+				current->expiryHeapSize = 0;
+				current->controlPath = NULL;
+				current->eventPath = NULL;
+				current->stateVars = NULL;
+				current->moderation = NULL;
 				if (!(current->UDN = getElementValue(UDN)))
 					fail = 1;
 				if (!getSubElement("serviceType", current_service, &serviceType) ||
@@ -946,6 +1289,7 @@ removeServiceTable(IXML_Node *node,
 			ixmlNodeList_free(deviceList);
 		}
 	}
+	indexServiceTable(in);
 	return 1;
 }
 
@@ -993,6 +1337,7 @@ addServiceTable(IXML_Node *node,
 		if ((in->endServiceList->next =
 			     getAllServiceList(root, in->URLBase, &tempEnd))) {
 			in->endServiceList = tempEnd;
+			indexServiceTable(in);
 			return 1;
 		}
 
@@ -1037,6 +1382,7 @@ getServiceTable(IXML_Node *node,
 
 		if ((out->serviceList = getAllServiceList(
 			root, out->URLBase, &out->endServiceList))) {
+			indexServiceTable(out);
 			return 1;
 		}
 
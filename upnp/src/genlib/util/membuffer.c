@@ -95,7 +95,6 @@ static UPNP_INLINE void membuffer_initialize(
 }
 
 int membuffer_set_size(membuffer *m, size_t new_length) {
-	size_t diff;
 	size_t alloc_len;
 	char *temp_buf;
 
@@ -105,14 +104,17 @@ int membuffer_set_size(membuffer *m, size_t new_length) {
 			return 0;    /* have enough mem; done */
 		}
 
-		diff = new_length - m->length;
-		alloc_len = MAXVAL(m->size_inc, diff) + m->capacity;
+		/* grow geometrically, so that appends are amortized O(1). */
+		alloc_len = m->capacity + MAXVAL(m->size_inc, m->capacity);
+		if (alloc_len < m->capacity || alloc_len < new_length)
+			alloc_len = new_length;
 	} else {        /* decrease length */
 
 		assert(new_length <= m->length);
 
-		/* if diff is 0..m->size_inc, don't free */
-		if ((m->capacity - new_length) <= m->size_inc) {
+		/* keep the memory unless most of it is unused. */
+		if ((m->capacity - new_length) <= m->size_inc ||
+		    new_length >= m->capacity / 4) {
 			return 0;
 		}
 
@@ -141,6 +143,24 @@ int membuffer_set_size(membuffer *m, size_t new_length) {
 	return 0;
 }
 
+int membuffer_reserve(membuffer *m, size_t capacity) {
+	char *temp_buf;
+
+	assert(m != NULL);
+
+	if (capacity <= m->capacity)
+		return 0;
+	temp_buf = realloc(m->buf, capacity + (size_t) 1);
+	if (temp_buf == NULL)
+		return UPNP_E_OUTOF_MEMORY;
+	if (m->buf == NULL)
+		temp_buf[0] = 0;
+	m->buf = temp_buf;
+	m->capacity = capacity;
+
+	return 0;
+}
+
 void membuffer_init(membuffer *m) {
 	assert(m != NULL);
 
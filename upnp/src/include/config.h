@@ -140,6 +140,22 @@
 #define MAX_JOBS_TOTAL 100
 /* @} */
 
+
+/*! \name THREAD_POOL_SCHEDULER
+ *
+ *  The {\tt THREAD_POOL_SCHEDULER} constant selects how the jobs of the
+ *  thread pools are scheduled. {\tt SHARED_QUEUE_SCHEDULER} keeps every job
+ *  in queues shared by all the threads, {\tt WORK_STEALING_SCHEDULER} gives
+ *  each thread its own queues and reduces the contention when many jobs are
+ *  added concurrently, e.g. by SSDP and GENA. The default value is
+ *  {\tt SHARED_QUEUE_SCHEDULER}.
+ *
+ * @{
+ */
+#define THREAD_POOL_SCHEDULER SHARED_QUEUE_SCHEDULER
+/* @} */
+
+
 /*! \name MAX_SUBSCRIPTION_QUEUED_EVENTS
  *
  *  The {\tt MAX_SUBSCRIPTION_QUEUED_EVENTS} determines the maximum number of 
@@ -153,6 +169,19 @@
 /* @} */
 
 
+/*! \name SUBSCRIPTION_HASH_SIZE
+ *
+ *  The {\tt SUBSCRIPTION_HASH_SIZE} is the initial number of buckets of the
+ *  table indexing the subscriptions of a service by SID, and the initial
+ *  capacity of the heap ordering them by expiration time. Both double as
+ *  needed. It must be a power of 2.
+ *
+ * @{
+ */
+#define SUBSCRIPTION_HASH_SIZE 16
+/* @} */
+
+
 /*!
  * \name DEFAULT_SOAP_CONTENT_LENGTH
  *
@@ -306,34 +335,34 @@
 
 
 /*!
- * \name GENA_NOTIFICATION_SENDING_TIMEOUT
+ * \name GENA_NOTIFICATION_SENDING_TIMEOUT_MS
  *
- * The {\tt GENA_NOTIFICATION_SENDING_TIMEOUT} specifies the number of seconds
- * to wait for sending GENA notifications to the Control Point.
+ * The {\tt GENA_NOTIFICATION_SENDING_TIMEOUT_MS} specifies the number of
+ * milliseconds to wait for sending GENA notifications to the Control Point.
  *
- * This timeout will be used to know how many seconds GENA notification threads
+ * This timeout will be used to know how long GENA notification threads
  * will wait to write on the socket to send the notification. By putting a
  * lower value than HTTP_DEFAULT_TIMEOUT, the thread will not wait too long and
  * will return quickly if writing is impossible. This is very useful as some
  * Control Points disconnect from the network without unsubscribing as a result
  * if HTTP_DEFAULT_TIMEOUT is used, all the GENA threads will be blocked to send
  * notifications to those disconnected Control Points until the subscription
- * expires.
+ * expires. Values below one second are honoured.
  *
  * @{
  */
-#define GENA_NOTIFICATION_SENDING_TIMEOUT HTTP_DEFAULT_TIMEOUT
+#define GENA_NOTIFICATION_SENDING_TIMEOUT_MS (HTTP_DEFAULT_TIMEOUT * 1000)
 /* @} */
 
 
 /*!
- * \name GENA_NOTIFICATION_ANSWERING_TIMEOUT
+ * \name GENA_NOTIFICATION_ANSWERING_TIMEOUT_MS
  *
- * The {\tt GENA_NOTIFICATION_ANSWERING_TIMEOUT} specifies the number of seconds
- * to wait for receiving the answer to a GENA notification from the Control
- * Point.
+ * The {\tt GENA_NOTIFICATION_ANSWERING_TIMEOUT_MS} specifies the number of
+ * milliseconds to wait for receiving the answer to a GENA notification from
+ * the Control Point.
  *
- * This timeout will be used to know how many seconds GENA notification threads
+ * This timeout will be used to know how long GENA notification threads
  * will wait on the socket to read for an answer from the CP. By putting a
  * lower value than HTTP_DEFAULT_TIMEOUT, the thread will not wait too long and
  * will return quickly if there is no answer from the CP. This is very useful as
@@ -345,7 +374,98 @@
  *
  * @{
  */
-#define GENA_NOTIFICATION_ANSWERING_TIMEOUT HTTP_DEFAULT_TIMEOUT
+#define GENA_NOTIFICATION_ANSWERING_TIMEOUT_MS (HTTP_DEFAULT_TIMEOUT * 1000)
+/* @} */
+
+
+/*!
+ * \name HTTP_KEEP_ALIVE_TIMEOUT
+ *
+ * The {\tt HTTP_KEEP_ALIVE_TIMEOUT} specifies the number of seconds an idle
+ * persistent connection is kept open by the miniserver while waiting for the
+ * next request of the client. Idle connections do not use a thread, they are
+ * watched by the miniserver event loop.
+ *
+ * @{
+ */
+#define HTTP_KEEP_ALIVE_TIMEOUT 5
+/* @} */
+
+
+/*!
+ * \name HTTP_KEEP_ALIVE_MAX_REQUESTS
+ *
+ * The {\tt HTTP_KEEP_ALIVE_MAX_REQUESTS} specifies the maximum number of
+ * requests served on one connection of the miniserver. The response to the
+ * last request closes the connection. A value of 1 disables persistent
+ * connections.
+ *
+ * @{
+ */
+#define HTTP_KEEP_ALIVE_MAX_REQUESTS 100
+/* @} */
+
+
+/*!
+ * \name GENA_CONN_POOL_SIZE
+ *
+ * The {\tt GENA_CONN_POOL_SIZE} specifies the maximum number of idle
+ * connections to control points kept open by the device for later GENA
+ * notifications. Connections are reused by the notifications to the same
+ * host and port, whatever the subscription. A value of 0 disables the pool,
+ * every notification then opens its own connection.
+ *
+ * @{
+ */
+#define GENA_CONN_POOL_SIZE 16
+/* @} */
+
+
+/*!
+ * \name GENA_CONN_POOL_IDLE_MS
+ *
+ * The {\tt GENA_CONN_POOL_IDLE_MS} specifies the number of milliseconds an
+ * idle connection stays in the GENA connection pool before it is closed.
+ * It should be below the idle timeout of the control points, which close
+ * their side first otherwise.
+ *
+ * @{
+ */
+#define GENA_CONN_POOL_IDLE_MS 10000
+/* @} */
+
+
+/*!
+ * \name GENA_BREAKER_THRESHOLD
+ *
+ * The {\tt GENA_BREAKER_THRESHOLD} specifies the number of consecutive failed
+ * notifications to a control point, whatever the subscription, after which
+ * the device stops sending events to it. A control point is the host and
+ * port of the first delivery URL of a subscription. The queued events wait,
+ * and one notification probes the control point again after a delay
+ * starting at {\tt GENA_BREAKER_MIN_BACKOFF_MS}, doubled at each failed
+ * probe up to {\tt GENA_BREAKER_MAX_BACKOFF_MS}. A successful notification
+ * resumes the delivery. A value of 0 disables the breaker.
+ *
+ * @{
+ */
+#define GENA_BREAKER_THRESHOLD 3
+#define GENA_BREAKER_MIN_BACKOFF_MS 1000
+#define GENA_BREAKER_MAX_BACKOFF_MS 60000
+/* @} */
+
+
+/*!
+ * \name GENA_STATE_VAR_LOCKS
+ *
+ * The {\tt GENA_STATE_VAR_LOCKS} specifies the number of locks serializing
+ * the updates of the evented state variables with their events. A service
+ * always uses the same lock, so that its values are evented in order, and
+ * the services using different locks are updated concurrently.
+ *
+ * @{
+ */
+#define GENA_STATE_VAR_LOCKS 16
 /* @} */
 
 
@@ -261,6 +261,9 @@ EXTERN_C int genaRenewSubscription(
 /*!
  * \brief Sends a notification to all the subscribed control points.
  *
+ * If the service has state variables kept by the library, the values are
+ * stored as by genaSetStateVariables() and only the changed ones are sent.
+ *
  * \return int
  *
  * \note This function is similar to the genaNotifyAllExt. The only difference
@@ -304,6 +307,174 @@ EXTERN_C int genaNotifyAllExt(
 #endif /* INCLUDE_DEVICE_APIS */
 
 
+/*!
+ * \brief Sends a property set already written as text to all the subscribed
+ * control points.
+ *
+ * \return GENA_SUCCESS if successful, otherwise the appropriate error code.
+ *
+ * \note This function is similar to the genaNotifyAllExt. The only
+ * 	difference is it takes the text of the property set instead of a
+ * 	document.
+ */
+#ifdef INCLUDE_DEVICE_APIS
+EXTERN_C int genaNotifyAllString(
+	/*! [in] Device handle. */
+	UpnpDevice_Handle device_handle,
+	/*! [in] Device udn. */
+	char *UDN,
+	/*! [in] Service ID. */
+	char *servId,
+	/*! [in] Property set. */
+	const char *propertySet,
+	/*! [in] Length of the property set. */
+	size_t length);
+#endif /* INCLUDE_DEVICE_APIS */
+
+
+/*!
+ * \brief Sets state variables kept by the library for a service, and sends
+ * the variables that changed to all the subscribed control points.
+ *
+ * Once a service has state variables, the library sends the initial event of
+ * its new subscriptions from them, without an UPNP_EVENT_SUBSCRIPTION_REQUEST
+ * callback.
+ *
+ * \return GENA_SUCCESS if successful, otherwise the appropriate error code.
+ */
+#ifdef INCLUDE_DEVICE_APIS
+EXTERN_C int genaSetStateVariables(
+	/*! [in] Device handle. */
+	UpnpDevice_Handle device_handle,
+	/*! [in] Device udn. */
+	char *UDN,
+	/*! [in] Service ID. */
+	char *servId,
+	/*! [in] Array of variable names. */
+	char **VarNames,
+	/*! [in] Array of variable values. */
+	char **VarValues,
+	/*! [in] Number of variables. */
+	int var_count);
+#endif /* INCLUDE_DEVICE_APIS */
+
+
+/*!
+ * \brief Sets the moderation of an evented state variable of a service.
+ *
+ * The events of the variable sent with genaNotifyAll() or
+ * genaSetStateVariables() are limited to one per interval, the latest value
+ * being sent when the interval is elapsed, and to the numeric changes of at
+ * least minimumDelta. genaNotifyAllExt() and genaNotifyAllString() send the
+ * variable at once and drop the value held back, if any.
+ *
+ * \return GENA_SUCCESS if successful, otherwise the appropriate error code.
+ */
+#ifdef INCLUDE_DEVICE_APIS
+EXTERN_C int genaSetModeration(
+	/*! [in] Device handle. */
+	UpnpDevice_Handle device_handle,
+	/*! [in] Device udn. */
+	char *UDN,
+	/*! [in] Service ID. */
+	char *servId,
+	/*! [in] Variable name. */
+	char *VarName,
+	/*! [in] Minimum time between two events, in milliseconds, 0 for no
+	 * limit. */
+	long interval,
+	/*! [in] Minimum change of a numeric value, 0 for any change. */
+	double minimumDelta);
+#endif /* INCLUDE_DEVICE_APIS */
+
+
+/*!
+ * \brief Reads the moderation of the state variables of a service from its
+ * SCPD.
+ *
+ * The maximumRate element of a stateVariable gives the minimum number of
+ * seconds between two events of the variable, the minimumDelta element the
+ * minimum change of a numeric value. The moderation set by
+ * genaSetModeration() takes precedence.
+ *
+ * \return GENA_SUCCESS if successful, otherwise the appropriate error code.
+ */
+#ifdef INCLUDE_DEVICE_APIS
+EXTERN_C int genaLoadScpdModeration(
+	/*! [in] Device handle. */
+	UpnpDevice_Handle device_handle,
+	/*! [in] Device udn. */
+	char *UDN,
+	/*! [in] Service ID. */
+	char *servId,
+	/*! [in] SCPD of the service. */
+	IXML_Document *scpd);
+#endif /* INCLUDE_DEVICE_APIS */
+
+
+/*!
+ * \brief Sets the file of the subscription snapshot.
+ *
+ * \return UPNP_E_SUCCESS if successful, UPNP_E_OUTOF_MEMORY otherwise.
+ */
+#ifdef INCLUDE_DEVICE_APIS
+EXTERN_C int genaSetSubscriptionSnapshot(
+	/*! [in] File name, NULL to disable the snapshot. */
+	const char *fileName);
+#endif /* INCLUDE_DEVICE_APIS */
+
+
+/*!
+ * \brief Writes the subscriptions of a device to the subscription snapshot.
+ *
+ * \return UPNP_E_SUCCESS if successful, otherwise the appropriate error code.
+ */
+#ifdef INCLUDE_DEVICE_APIS
+EXTERN_C int genaSaveSubscriptions(
+	/*! [in] Device handle. */
+	UpnpDevice_Handle device_handle);
+#endif /* INCLUDE_DEVICE_APIS */
+
+
+/*!
+ * \brief Restores the subscriptions of a device being registered from the
+ * subscription snapshot, if any.
+ *
+ * The subscriptions expired since the snapshot are not restored.
+ *
+ * \note Called with HandleLock held.
+ */
+#ifdef INCLUDE_DEVICE_APIS
+struct Handle_Info;
+
+EXTERN_C void genaLoadSubscriptions(
+	/*! [in] Device handle. */
+	UpnpDevice_Handle device_handle,
+	/*! [in] Device handle information, with its service table. */
+	struct Handle_Info *handle_info);
+#endif /* INCLUDE_DEVICE_APIS */
+
+
+/*!
+ * \brief Reads the delivery counters of a subscription.
+ *
+ * \return GENA_SUCCESS if successful, otherwise the appropriate error code.
+ */
+#ifdef INCLUDE_DEVICE_APIS
+EXTERN_C int genaGetSubscriptionStats(
+	/*! [in] Device handle. */
+	UpnpDevice_Handle device_handle,
+	/*! [in] Device udn. */
+	char *UDN,
+	/*! [in] Service ID. */
+	char *servId,
+	/*! [in] Subscription ID. */
+	char *sid,
+	/*! [out] Counters of the subscription. */
+	struct Upnp_Subscription_Stats *stats);
+#endif /* INCLUDE_DEVICE_APIS */
+
+
 /*!
  * \brief Sends the intial state table dump to newly subscribed control point.
  *
@@ -355,6 +526,28 @@ EXTERN_C int genaInitNotifyExt(
 	const Upnp_SID sid);
 #endif /* INCLUDE_DEVICE_APIS */
 
+/*!
+ * \brief Similar to the genaInitNotifyExt. The only difference is that it
+ * takes the text of the property set instead of a document.
+ *
+ * \return GENA_E_SUCCESS if successful, otherwise the appropriate error code.
+ */
+#ifdef INCLUDE_DEVICE_APIS
+EXTERN_C int genaInitNotifyString(
+	/*! [in] Device handle. */
+	UpnpDevice_Handle device_handle,
+	/*! [in] Device udn. */
+	char *UDN,
+	/*! [in] Service ID. */
+	char *servId,
+	/*! [in] Property set of the state table. */
+	const char *propertySet,
+	/*! [in] Length of the property set. */
+	size_t length,
+	/*! [in] subscription ID. */
+	const Upnp_SID sid);
+#endif /* INCLUDE_DEVICE_APIS */
+
 /*!
  * \brief Sends an error message to the control point in the case of incorrect
  * 	GENA requests.
@@ -39,8 +39,21 @@
  */
 
 
+#include "httpparser.h"
 #include "sock.h"
 
+/*! Counters of the GENA connection pool. */
+typedef struct {
+	/*! Connections opened to control points. */
+	unsigned long connects;
+	/*! Notifications sent on a pooled connection. */
+	unsigned long reuses;
+	/*! Pooled connections found closed by the peer when taken. */
+	unsigned long stale;
+	/*! Idle connections closed by the pool. */
+	unsigned long evictions;
+} GenaConnPoolStats;
+
 /*!
  * \brief Handles a subscription request from a ctrl point. The socket is not
  * closed on return.
@@ -71,5 +84,162 @@ void gena_process_unsubscribe_request(
 	/*! [in] UNSUBSCRIBE request from the control point. */
 	http_message_t *request);
 
+/*!
+ * \brief Gets a connection to the host and port of a delivery URL, from the
+ * pool when an idle one is available, otherwise by connecting.
+ *
+ * The connections are non-blocking. A new connection may still be in
+ * progress: it is established when the socket becomes writable, and SO_ERROR
+ * tells whether it failed.
+ *
+ * \return UPNP_E_SUCCESS, UPNP_E_OUTOF_SOCKET or UPNP_E_SOCKET_CONNECT.
+ */
+int genaConnPoolGet(
+	/*! [in] Delivery URL of the subscription. */
+	uri_type *destination_url,
+	/*! [out] Fixed delivery URL, for the NOTIFY start line. */
+	uri_type *url,
+	/*! [out] The connection. */
+	SOCKINFO *info,
+	/*! [out] 1 if the connection was taken from the pool, 0 if new. */
+	int *reused);
+
+/*!
+ * \brief Hands back a connection obtained with genaConnPoolGet().
+ *
+ * A reusable connection is kept for GENA_CONN_POOL_IDLE_MS, evicting the
+ * oldest idle connection when the pool is full. Other connections are closed.
+ */
+void genaConnPoolPut(
+	/*! [in] The connection. */
+	SOCKINFO *info,
+	/*! [in] 1 if the exchange completed and the peer keeps the connection
+	 * open. */
+	int reusable);
+
+/*!
+ * \brief Initializes the mutex of the connection pool.
+ *
+ * \return UPNP_E_SUCCESS or UPNP_E_INIT_FAILED.
+ */
+int genaConnPoolInit(void);
+
+/*!
+ * \brief Destroys the mutex of the connection pool, after
+ * genaConnPoolShutdown().
+ */
+void genaConnPoolDestroy(void);
+
+/*!
+ * \brief Closes all the pooled connections and forgets the breakers.
+ */
+void genaConnPoolShutdown(void);
+
+/*!
+ * \brief Tells whether a notification may be sent to the host and port of a
+ * delivery URL, see GENA_BREAKER_THRESHOLD.
+ *
+ * Once the delay of an open breaker is elapsed, the first notification
+ * probes the host and the others wait for another delay.
+ *
+ * \return 0 if the notification may be sent, otherwise the time from
+ * 	sock_now_ms() before which no notification is sent to the host.
+ */
+long long genaBreakerCheck(
+	/*! [in] Delivery URL. */
+	uri_type *url,
+	/*! [in] Current time, from sock_now_ms(). */
+	long long now);
+
+/*!
+ * \brief Counts the result of a notification to the host and port of a
+ * delivery URL, opening its breaker after GENA_BREAKER_THRESHOLD consecutive
+ * failures and closing it on success.
+ *
+ * \return The time from sock_now_ms() before which no notification is sent
+ * 	to the host, 0 if the breaker of the host is closed.
+ */
+long long genaBreakerCount(
+	/*! [in] Delivery URL. */
+	uri_type *url,
+	/*! [in] 1 if the control point accepted the notification. */
+	int delivered,
+	/*! [in] Current time, from sock_now_ms(). */
+	long long now);
+
+/*!
+ * \brief Copies the counters of the GENA connection pool.
+ */
+void genaGetConnPoolStats(
+	/*! [out] The counters. */
+	GenaConnPoolStats *stats);
+
+/*!
+ * \brief Called by the delivery engine when a NOTIFY is delivered or failed.
+ */
+typedef void (*GenaDeliveryDone)(
+	/*! [in] Argument given to genaDeliveryStart(). */
+	void *cookie,
+	/*! [in] UPNP_E_SUCCESS if a response was received, otherwise the error
+	 * of the last delivery URL tried. */
+	int result,
+	/*! [in] HTTP status code of the response, 0 if none. */
+	int statusCode);
+
+/*!
+ * \brief Queues a NOTIFY to the delivery engine, starting the engine on a
+ * thread of the send thread pool if it is not running.
+ *
+ * The delivery URLs are tried in order until one answers. The callback is
+ * called from the engine thread, without any lock held.
+ *
+ * \return UPNP_E_SUCCESS, UPNP_E_OUTOF_MEMORY, UPNP_E_FINISH while the engine
+ * 	shuts down, or an error of reactor_create().
+ */
+int genaDeliveryStart(
+	/*! [in] Delivery URLs of the subscription, copied. */
+	URL_list *urls,
+	/*! [in,out] Headers of the request, after the HOST header and up to the
+	 * empty line; the buffer is taken and the membuffer left empty. */
+	membuffer *headers,
+	/*! [in] The evented XML, which must remain valid until the callback. */
+	const char *propertySet,
+	/*! [in] Completion callback. */
+	GenaDeliveryDone done,
+	/*! [in] Argument of the callback. */
+	void *cookie);
+
+/*!
+ * \brief Initializes the mutex and the condition of the delivery engine.
+ *
+ * \return UPNP_E_SUCCESS or UPNP_E_INIT_FAILED.
+ */
+int genaDeliveryInit(void);
+
+/*!
+ * \brief Destroys the mutex and the condition of the delivery engine,
+ * after genaDeliveryShutdown().
+ */
+void genaDeliveryDestroy(void);
+
+/*!
+ * \brief Stops the delivery engine, reporting UPNP_E_CANCELED for the
+ * deliveries in progress.
+ */
+void genaDeliveryShutdown(void);
+
+/*!
+ * \brief Initializes the locks serializing the updates of the state
+ * variables of the services, see GENA_STATE_VAR_LOCKS.
+ *
+ * \return UPNP_E_SUCCESS or UPNP_E_INIT_FAILED.
+ */
+int genaInitStateVarLocks(void);
+
+/*!
+ * \brief Destroys the locks initialized by genaInitStateVarLocks().
+ */
+void genaDestroyStateVarLocks(void);
+
 #endif /* GENA_DEVICE_H */
 
@@ -38,7 +38,6 @@
  */
 #include <stdarg.h>
 #include <assert.h>
-#include "LinkedList.h"
 #include "membuffer.h"
 #include "uri.h"
 #include "upnputil.h"
@@ -143,6 +142,11 @@ typedef enum {
 #define HDR_IF_RANGE            34
 #define HDR_RANGE            35
 #define HDR_TE                36
+#define HDR_CONNECTION            37
+
+/*! Number of slots of the header index of http_message_t, one per header
+ * id above. */
+#define HDR_INDEX_SIZE            (HDR_CONNECTION + 1)
 
 /*! status of parsing */
 typedef enum {
@@ -196,8 +200,15 @@ typedef struct {
 	int major_version;
 	/* http minor version. */
 	int minor_version;
-	/*! . */
-	LinkedList headers;
+	/*! headers, in the order they were received. */
+	http_header_t *headers;
+	/*! number of entries in headers. */
+	size_t num_headers;
+	/*! allocated entries of headers. */
+	size_t max_headers;
+	/*! for each known header id, 1 + its position in headers; 0 if the
+	 * header is absent. */
+	int header_index[HDR_INDEX_SIZE];
 	/*! message body(entity). */
 	memptr entity;
 	/* private fields. */
@@ -265,8 +276,9 @@ void httpmsg_destroy(INOUT http_message_t *msg);
 *		IN http_message_t* msg ;	HTTP Message Object
 *		IN const char* header_name ; Header name to be compared with	
 *
-*	Description :	Compares the header name with the header names stored 
-*		in	the linked list of messages
+*	Description :	Finds a header by name. Known names are looked up in
+*		the header index, other names are compared with the
+*		unknown headers of the message
 *
 *	Return : http_header_t* - Pointer to a header on success;
 *			 NULL on failure
@@ -283,7 +295,8 @@ http_header_t *httpmsg_find_hdr_str(IN http_message_t *msg,
 *		IN int header_name_id ;	 Header Name ID to be compared with
 *		OUT memptr* value ;		 Buffer to get the ouput to.
 *
-*	Description :	Finds header from a list, with the given 'name_id'.
+*	Description :	Finds the header with the given 'name_id' through the
+*		header index of the message.
 *
 *	Return : http_header_t*  - Pointer to a header on success;
 *		 NULL on failure
@@ -395,6 +408,23 @@ parse_status_t parser_parse_entity(INOUT http_parser_t *parser);
 ************************************************************************/
 parse_status_t parser_get_entity_read_method(INOUT http_parser_t *parser);
 
+/************************************************************************
+* Function: parser_keep_alive
+*
+* Parameters:
+*	IN http_parser_t* parser ; HTTP Parser object
+*
+* Description: Tells whether the connection may be used for another
+*	message once the parsed one is complete. The message must be
+*	completely parsed, its body absent or delimited by a Content-Length,
+*	no further data must have been read from the socket, and its version
+*	and Connection header must ask for a persistent connection.
+*
+* Returns:
+*	 1 if the connection is persistent, 0 otherwise
+************************************************************************/
+int parser_keep_alive(IN http_parser_t *parser);
+
 /************************************************************************
 * Function: parser_append												
 *																		
@@ -117,7 +117,7 @@ SOCKET http_Connect(
  *	Get the data on the socket and take actions based on the read data
  *	to modify the parser objects buffer. If an error is reported while
  *	parsing the data, the error code is passed in the http_errr_code
- *	parameter
+ *	parameter. The reads honour the deadline set with sock_set_deadline().
  *
  * Returns:
  *	 UPNP_E_BAD_HTTPMSG
@@ -136,6 +136,9 @@ int http_RecvMessage(IN SOCKINFO *info, OUT http_parser_t *parser,
  * \li \c 'b': arg1 = "const char *" mem_buffer; arg2 = "size_t" buffer length.
  * \li \c 'I': arg = "struct SendInstruction *"
  *
+ * Consecutive 'b' buffers are written together with sock_writev().
+ * The writes honour the deadline set with sock_set_deadline().
+ *
  * E.g.:
  \verbatim
  	char *buf = "POST /xyz.cgi http/1.1\r\n\r\n";
@@ -160,6 +163,33 @@ int http_SendMessage(
 	/* [in] Variable parameter list. */
 	...);
 
+/*! Counters of the messages written by http_SendMessage(). */
+typedef struct {
+	/*! Number of messages sent. */
+	unsigned long messages;
+	/*! Number of system calls made to write them. */
+	unsigned long syscalls;
+} HttpSendStats;
+
+/*!
+ * \brief Initializes the counters of the messages sent.
+ *
+ * \return 0 on success, nonzero on failure.
+ */
+int http_InitSendStats(void);
+
+/*!
+ * \brief Releases the resources of the counters of the messages sent.
+ */
+void http_DestroySendStats(void);
+
+/*!
+ * \brief Returns the counters of the messages sent so far.
+ */
+void http_GetSendStats(
+	/*! [out] Counters. */
+	HttpSendStats *stats);
+
 /************************************************************************
  * Function: http_RequestAndResponse
  *
@@ -455,6 +485,8 @@ int http_SendStatusResponse(
  *
 \verbatim
 Format types:
+	'A':	arg = SOCKINFO *info		-- appends the CONNECTION header of a miniserver response: close unless
+						   info->keep_alive is set, Keep-Alive for a kept alive HTTP/1.0 client.
 	'B':	arg = int status_code		-- appends content-length, content-type and HTML body for given code.
 	'b':	arg1 = const char *buf;
 		arg2 = size_t buf_length memory ptr
@@ -60,7 +60,8 @@ typedef struct {
 	size_t length;
 	/*! total allocated memory (read-only). */
 	size_t capacity;
-	/*! used to increase size; MUST be > 0; (read/write). */
+	/*! minimum increase of the capacity, which otherwise doubles when
+	 * the buffer is full; MUST be > 0; (read/write). */
 	size_t size_inc;
 	/*! default value of size_inc. */
 #define MEMBUF_DEF_SIZE_INC (size_t)5
@@ -131,6 +132,20 @@ int membuffer_set_size(
 	/*! [in] new size to which the buffer will be modified. */
 	size_t new_length);
 
+/*!
+ * \brief Makes room for at least 'capacity' bytes (plus the terminating null)
+ * without changing the content, so that a buffer whose final size is known
+ * is filled without reallocations.
+ * \return
+ * \li UPNP_E_SUCCESS - On Success
+ * \li UPNP_E_OUTOF_MEMORY - On failure to allocate memory.
+ */
+int membuffer_reserve(
+	/*! [in,out] buffer whose capacity is to be increased. */
+	membuffer *m,
+	/*! [in] number of bytes the buffer must be able to hold. */
+	size_t capacity);
+
 /*!
  * \brief Wrapper to membuffer_initialize().
  *
@@ -84,6 +84,28 @@ typedef void (*MiniServerCallback)(
 extern "C" {
 #endif
 
+/*!
+ * \brief Initializes the mutex of the connections read by the miniserver.
+ * Called once by UpnpInit().
+ *
+ * \return UPNP_E_SUCCESS or UPNP_E_INIT_FAILED.
+ */
+#ifdef INTERNAL_WEB_SERVER
+int InitMiniServerLocks(void);
+#else /* INTERNAL_WEB_SERVER */
+static UPNP_INLINE int InitMiniServerLocks(void) { return UPNP_E_SUCCESS; }
+#endif /* INTERNAL_WEB_SERVER */
+
+/*!
+ * \brief Destroys the mutex of the connections, once the miniserver has
+ * stopped.
+ */
+#ifdef INTERNAL_WEB_SERVER
+void DestroyMiniServerLocks(void);
+#else /* INTERNAL_WEB_SERVER */
+static UPNP_INLINE void DestroyMiniServerLocks(void) {}
+#endif /* INTERNAL_WEB_SERVER */
+
 /*!
  * \brief Set HTTP Get Callback.
  */
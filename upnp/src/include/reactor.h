@@ -0,0 +1,157 @@
+#ifndef GENLIB_NET_REACTOR_H
+#define GENLIB_NET_REACTOR_H
+
+/*!
+ * \addtogroup Sock
+ *
+ * @{
+ *
+ * \file
+ *
+ * \brief Socket readiness notification used by the miniserver event loop.
+ *
+ * The reactor hides the system multiplexing facility behind a small
+ * interface. When the library is built with UPNP_ENABLE_EPOLL the epoll(7)
+ * backend is used, otherwise the portable select() backend is compiled in.
+ * Both backends are level triggered, so a socket that is not completely
+ * drained is reported again by the next call to reactor_wait().
+ */
+
+#include "sock.h"
+
+/*! The socket is readable (or a listening socket has a pending connection). */
+#define REACTOR_READ 0x1
+/*! The socket is writable. */
+#define REACTOR_WRITE 0x2
+/*! An error or hang up condition is pending on the socket (output only). */
+#define REACTOR_ERROR 0x4
+
+/*! Opaque reactor handle. */
+typedef struct reactor Reactor;
+
+/*! One ready socket as returned by reactor_wait(). */
+typedef struct {
+	/*! The ready socket. */
+	SOCKET sock;
+	/*! Combination of REACTOR_READ, REACTOR_WRITE and REACTOR_ERROR. */
+	int events;
+	/*! The user data given to reactor_add(). */
+	void *data;
+} ReactorEvent;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*!
+ * \brief Creates a reactor using the compiled in backend.
+ *
+ * \return
+ * 	\li \c UPNP_E_SUCCESS on success.
+ * 	\li \c UPNP_E_OUTOF_MEMORY if the reactor could not be allocated.
+ * 	\li \c UPNP_E_OUTOF_SOCKET if the backend descriptor could not be
+ * 		created.
+ */
+int reactor_create(
+	/*! [out] The new reactor. */
+	Reactor **out);
+
+/*!
+ * \brief Releases the reactor and all its registrations.
+ *
+ * The registered sockets are not closed.
+ */
+void reactor_destroy(
+	/*! [in] Reactor to destroy, may be NULL. */
+	Reactor *r);
+
+/*!
+ * \brief Registers a socket for readiness notification.
+ *
+ * May be called from any thread, a concurrent reactor_wait() watches the
+ * socket without waiting for its timeout.
+ *
+ * \return
+ * 	\li \c UPNP_E_SUCCESS on success.
+ * 	\li \c UPNP_E_INVALID_PARAM if the socket is invalid or already
+ * 		registered.
+ * 	\li \c UPNP_E_OUTOF_MEMORY if the registration could not be allocated.
+ * 	\li \c UPNP_E_OUTOF_SOCKET if the backend cannot watch the socket
+ * 		(e.g. beyond FD_SETSIZE for the select() backend).
+ */
+int reactor_add(
+	/*! [in] Reactor. */
+	Reactor *r,
+	/*! [in] Socket to watch. */
+	SOCKET sock,
+	/*! [in] REACTOR_READ and/or REACTOR_WRITE. */
+	int events,
+	/*! [in] User data returned with each event for this socket. */
+	void *data);
+
+/*!
+ * \brief Changes the set of events watched for a registered socket.
+ *
+ * \return UPNP_E_SUCCESS on success, UPNP_E_INVALID_PARAM if the socket is
+ * 	not registered, UPNP_E_SOCKET_ERROR on a backend failure.
+ */
+int reactor_mod(
+	/*! [in] Reactor. */
+	Reactor *r,
+	/*! [in] Registered socket. */
+	SOCKET sock,
+	/*! [in] REACTOR_READ and/or REACTOR_WRITE. */
+	int events);
+
+/*!
+ * \brief Removes a socket from the reactor. The socket is not closed.
+ *
+ * Must be called before the socket is closed, and from the thread running
+ * reactor_wait() since pending events may still refer to the registration.
+ *
+ * \return UPNP_E_SUCCESS on success, UPNP_E_INVALID_PARAM if the socket is
+ * 	not registered.
+ */
+int reactor_del(
+	/*! [in] Reactor. */
+	Reactor *r,
+	/*! [in] Registered socket. */
+	SOCKET sock);
+
+/*!
+ * \brief Makes the pending reactor_wait() return, or the next one when no
+ * thread is waiting. May be called from any thread.
+ */
+void reactor_wakeup(
+	/*! [in] Reactor. */
+	Reactor *r);
+
+/*!
+ * \brief Waits until at least one registered socket is ready.
+ *
+ * \return The number of entries stored in \b events, 0 on timeout, when
+ * 	the registrations changed during the wait or after reactor_wakeup(),
+ * 	SOCKET_ERROR on failure, with errno set (EINTR included).
+ */
+int reactor_wait(
+	/*! [in] Reactor. */
+	Reactor *r,
+	/*! [out] Array receiving the ready sockets. */
+	ReactorEvent *events,
+	/*! [in] Capacity of \b events. */
+	int maxEvents,
+	/*! [in] Timeout in milliseconds, negative to wait forever. */
+	int timeoutMs);
+
+/*!
+ * \brief Name of the compiled in backend, for diagnostics.
+ */
+const char *reactor_backend(void);
+
+#ifdef __cplusplus
+}	/* #extern "C" */
+#endif
+
+/* @} Sock */
+
+#endif /* GENLIB_NET_REACTOR_H */
@@ -61,16 +61,47 @@ typedef struct SUBSCRIPTION {
 	time_t expireTime;
 	int active;
 	URL_list DeliveryURLs;
-	/* List of queued events for this subscription. Only one event job
-	   at a time goes into the thread pool. The first element in the
-	   list is a copy of the active job. Others are activated on job
-	   completion. */
+	/* List of queued events for this subscription. Only one event
+	   at a time goes to the delivery engine. The first element in the
+	   list is the event being delivered, or waiting for the delivery to
+	   resume. Others are started on delivery completion. */
 	LinkedList outgoing;
 	struct SUBSCRIPTION *next;
+	/*! Previous subscription in the list of the service. */
+	struct SUBSCRIPTION *prev;
+	/*! Next subscription in the same bucket of the SID hash table. */
+	struct SUBSCRIPTION *hashNext;
+	/*! Position + 1 in the expiry heap of the service, 0 if the
+	 * subscription does not expire. */
+	size_t expiryIndex;
+	/*! Delivery counters, in milliseconds for the latencies. */
+	unsigned long delivered;
+	unsigned long failed;
+	long long latencySum;
+	long long lastLatency;
+	long long maxLatency;
+	/*! Time from sock_now_ms() when the event at the head of outgoing was
+	 * handed to the delivery engine, 0 while it is not being delivered. */
+	long long deliveryStart;
+	/*! Failed notifications since the last successful one. */
+	int consecutiveFailures;
+	/*! Time from sock_now_ms() before which no event is sent, 0 while
+	 * events are sent (see genaBreakerCheck()). */
+	long long retryAt;
+	/*! Set while a timer job is scheduled to retry the delivery. */
+	int retryScheduled;
 } subscription;
 
 extern void freeSubscriptionQueuedEvents(subscription *sub);
 
+struct STATE_VAR_STORE;
+
+extern void freeStateVarStore(struct STATE_VAR_STORE *store);
+
+struct EVENT_MODERATION;
+
+extern void freeEventModeration(struct EVENT_MODERATION *moderation);
+
 typedef struct SERVICE_INFO {
 	DOMString serviceType;
 	DOMString serviceId;
@@ -81,6 +112,26 @@ typedef struct SERVICE_INFO {
 	int active;
 	int TotalSubscriptions;
 	subscription *subscriptionList;
+	/*! Subscriptions by SID, subscriptionHashSize buckets (a power of 2). */
+	subscription **subscriptionHash;
+	size_t subscriptionHashSize;
+	/*! Subscriptions that expire, in a binary heap on expireTime. */
+	subscription **expiryHeap;
+	size_t expiryHeapCount;
+	size_t expiryHeapSize;
+	/*! Evented state variables kept by the library, NULL if the
+	 * application sends the initial events itself. */
+	struct STATE_VAR_STORE *stateVars;
+	/*! Moderated evented state variables, NULL if none. */
+	struct EVENT_MODERATION *moderation;
+	/*! Path and query of controlURL and eventURL, the keys of the
+	 * indexes of the service table. */
+	char *controlPath;
+	char *eventPath;
+	/*! Next services in the buckets of the indexes of the service table. */
+	struct SERVICE_INFO *controlPathNext;
+	struct SERVICE_INFO *eventPathNext;
+	struct SERVICE_INFO *serviceIdNext;
 	struct SERVICE_INFO *next;
 } service_info;
 
@@ -88,6 +139,12 @@ typedef struct SERVICE_TABLE {
 	DOMString URLBase;
 	service_info *serviceList;
 	service_info *endServiceList;
+	/*! Services by control path, event path and (UDN, serviceId),
+	 * indexSize buckets each (a power of 2), 0 if not indexed. */
+	service_info **controlPathIndex;
+	service_info **eventPathIndex;
+	service_info **serviceIdIndex;
+	size_t indexSize;
 } service_table;
 
 /* Functions for Subscriptions */
@@ -103,6 +160,45 @@ int copy_subscription(
 	/*! [in] Destination subscription. */
 	subscription *out);
 
+/*!
+ * \brief Adds a subscription to a service, indexed by its SID and, if it has
+ * one, its expiration time.
+ *
+ * \return UPNP_E_SUCCESS or UPNP_E_OUTOF_MEMORY.
+ */
+int AddSubscription(
+	/*! [in] Service object. */
+	service_info *service,
+	/*! [in] New subscription, taken on success. */
+	subscription *sub);
+
+/*!
+ * \brief Changes the expiration time of a subscription of a service.
+ *
+ * \return UPNP_E_SUCCESS or UPNP_E_OUTOF_MEMORY.
+ */
+int SetSubscriptionExpireTime(
+	/*! [in] Service object. */
+	service_info *service,
+	/*! [in] Subscription of the service. */
+	subscription *sub,
+	/*! [in] New expiration time, 0 if the subscription does not expire. */
+	time_t expireTime);
+
+/*!
+ * \brief Removes the expired subscriptions of a service.
+ *
+ * Lookups skip the expired subscriptions, this frees them.
+ *
+ * \return The earliest expiration time of the remaining subscriptions, 0 if
+ * none expires.
+ */
+time_t ExpireSubscriptions(
+	/*! [in] Service object. */
+	service_info *service,
+	/*! [in] Current time. */
+	time_t current_time);
+
 /*
  * \brief Remove the subscription represented by the const Upnp_SID sid parameter
  * from the service table and update the service table.
@@ -159,6 +255,17 @@ void freeSubscriptionList(
 	/*! [in] Head of the subscription list. */
 	subscription *head);
 
+/*!
+ * \brief Hashes the key of a service in the service table.
+ *
+ * \return The FNV-1a hash of the UDN and service id.
+ */
+size_t ServiceIdHash(
+	/*! [in] Service id. */
+	const char *serviceId,
+	/*! [in] UDN of the device of the service. */
+	const char *UDN);
+
 /*!
  * \brief Traverses through the service table and returns a pointer to the
  * service node that matches a known service id and a known UDN.
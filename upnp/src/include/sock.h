@@ -68,8 +68,29 @@ typedef struct {
 	SOCKET socket;
 	/*! The following two fields are filled only in incoming requests. */
 	struct sockaddr_storage foreign_sockaddr;
+	/*! Set by the miniserver when the connection stays open after the
+	 * response to the current request. Cleared by a callback whose
+	 * response cannot be delimited without closing the connection. */
+	int keep_alive;
+	/*! Number of system calls made to write on the socket. */
+	unsigned long write_syscalls;
+	/*! Time from sock_now_ms() after which reads and writes on the socket
+	 * time out, whatever their timeout in seconds, 0 for none. Set with
+	 * sock_set_deadline(). */
+	long long deadline;
 } SOCKINFO;
 
+/*! Maximum number of buffers written by one sock_writev() call. */
+#define SOCK_MAX_BUFFERS 16
+
+/*! One buffer of a gathered write. */
+typedef struct {
+	/*! Data to send. */
+	const char *buf;
+	/*! Size of the data. */
+	size_t length;
+} SockBuffer;
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -90,6 +111,37 @@ static UPNP_INLINE int sock_close(
 	return ret;
 }
 
+/*!
+ * \brief Returns the time of a monotonic clock, in milliseconds.
+ */
+long long sock_now_ms(void);
+
+/*!
+ * \brief Sets a deadline for all the following reads and writes on the socket
+ * in sockinfo, including those made by http_SendMessage() and
+ * http_RecvMessage().
+ *
+ * The deadline applies in addition to the timeout in seconds given to each
+ * call, the earliest one wins. It allows budgets below one second.
+ */
+void sock_set_deadline(
+	/*! [in] Socket Information Object. */
+	SOCKINFO *info,
+	/*! [in] Time left from now in milliseconds, negative to remove the
+	 * deadline. */
+	int timeoutMs);
+
+/*!
+ * \brief Checks, without waiting, that an idle connection can be used again:
+ * nothing is pending on it, neither data nor the close or an error from the
+ * peer.
+ *
+ * \return 1 if the connection is idle, 0 otherwise.
+ */
+int sock_is_idle(
+	/*! [in] Socket Information Object. */
+	SOCKINFO *info);
+
 /*!
  * \brief Assign the passed in socket descriptor to socket descriptor in the
  * SOCKINFO structure.
@@ -175,6 +227,53 @@ int sock_write(
 	/*! [in,out] timeout value. */
 	int *timeoutSecs);
 
+/*!
+ * \brief Writes several buffers on the socket in sockinfo with as few
+ * system calls as possible (one unless the socket buffer fills up).
+ *
+ * \return Integer:
+ * \li \c numBytes - On Success, no of bytes sent.
+ * \li \c UPNP_E_TIMEDOUT - Timeout.
+ * \li \c UPNP_E_SOCKET_ERROR - Error on socket calls.
+ */
+int sock_writev(
+	/*! [in] Socket Information Object. */
+	SOCKINFO *info,
+	/*! [in] Buffers to send, in order. */
+	const SockBuffer *buffers,
+	/*! [in] Number of buffers, at most SOCK_MAX_BUFFERS. */
+	int count,
+	/*! [in,out] timeout value. */
+	int *timeoutSecs);
+
+#ifdef UPNP_ENABLE_SENDFILE
+/*!
+ * \brief Sends part of a file on the socket in sockinfo with sendfile(),
+ * without copying the data through a user space buffer.
+ *
+ * SIGPIPE is blocked for the calling thread while sending.
+ *
+ * \return Integer:
+ * \li \c UPNP_E_SUCCESS - \b count bytes were sent, or the end of the file
+ * 	was reached (\b offset tells how far).
+ * \li \c UPNP_E_TIMEDOUT - Timeout.
+ * \li \c UPNP_E_SOCKET_ERROR - Error on socket calls.
+ * \li \c UPNP_E_FILE_READ_ERROR - The file cannot be sent with sendfile(),
+ * 	nothing was sent.
+ */
+int sock_sendfile(
+	/*! [in] Socket Information Object. */
+	SOCKINFO *info,
+	/*! [in] File descriptor to send data from. */
+	int fd,
+	/*! [in,out] File offset of the data, advanced by the bytes sent. */
+	off_t *offset,
+	/*! [in] Number of bytes to send. */
+	size_t count,
+	/*! [in,out] timeout value. */
+	int *timeoutSecs);
+#endif /* UPNP_ENABLE_SENDFILE */
+
 /*!
  * \brief Make socket blocking.
  * 
@@ -43,6 +43,8 @@
 
 #include "httpparser.h"
 #include "httpreadwrite.h"
+#include "ithread.h"
+#include "ixml.h"
 #include "miniserver.h"
 #include "UpnpInet.h"
 
@@ -150,6 +152,76 @@ typedef struct {
 	struct sockaddr_storage dest_addr;
 } ssdp_thread_data;
 
+/*! Message types of the packets sent by a device. */
+#define MSGTYPE_SHUTDOWN	0
+#define MSGTYPE_ADVERTISEMENT	1
+#define MSGTYPE_REPLY		2
+
+/*! Kinds of the notification types announced by a device. */
+typedef enum SsdpTargetKind {
+	/*! upnp:rootdevice, only for the root device. */
+	SSDP_TARGET_ROOT,
+	/*! uuid:device-UUID. */
+	SSDP_TARGET_UDN,
+	/*! Device type. */
+	SSDP_TARGET_DEVICE,
+	/*! Service type. */
+	SSDP_TARGET_SERVICE
+} SsdpTargetKind;
+
+/*! A notification type announced by a device, taken once from the
+ * description document. */
+typedef struct SsdpTarget {
+	/*! Kind of the notification type. */
+	SsdpTargetKind kind;
+	/*! UDN of the device. */
+	char *udn;
+	/*! NT, or ST of the search replies. */
+	char *nt;
+	/*! USN. */
+	char *usn;
+} SsdpTarget;
+
+/*! Packets of one message type for all the targets of a root device. */
+typedef struct SsdpPacketSet {
+	/*! 0 until the packets are built. */
+	int valid;
+	/*! CACHE-CONTROL max-age the packets were built with. */
+	int duration;
+	/*! PowerState the packets were built with. */
+	int powerState;
+	/*! SleepPeriod the packets were built with. */
+	int sleepPeriod;
+	/*! RegistrationState the packets were built with. */
+	int registrationState;
+	/*! One packet per target. */
+	char **packets;
+	/*! Offset of the DATE header in each packet, replies only. */
+	size_t *dateOffsets;
+	/*! Length of the DATE header line. */
+	size_t dateLength;
+} SsdpPacketSet;
+
+/*! Precompiled SSDP packets of a root device. */
+typedef struct SsdpPacketCache {
+	/*! Protects the packet sets, which are built on first use and
+	 * refreshed when the device changes its advertisement parameters,
+	 * and the generation. */
+	ithread_mutex_t mutex;
+	/*! Device handle. */
+	UpnpDevice_Handle handle;
+	/*! Changed when the shutdown messages are sent, to drop the copies
+	 * of the advertisements still scheduled. */
+	unsigned long generation;
+	/*! Targets, in the order of the description document: for each
+	 * device, its notification types followed by its services. */
+	SsdpTarget *targets;
+	/*! Number of targets. */
+	size_t count;
+	/*! Packet sets, indexed by the MSGTYPE_* values. */
+	SsdpPacketSet sets[3];
+} SsdpPacketCache;
+
 /* globals */
 
 #ifdef INCLUDE_CLIENT_APIS
@@ -166,6 +238,45 @@ typedef int (*ParserFun)(char *, SsdpEvent *);
  * @{
  */
 
+/*!
+ * \brief Initializes the mutexes of the SSDP listener: the one of the
+ * counters of the received datagrams and the one of the copy of the
+ * handles.
+ *
+ * \return UPNP_E_SUCCESS or UPNP_E_INIT_FAILED.
+ */
+int SsdpInitServerLocks(void);
+
+/*!
+ * \brief Destroys the mutexes of the SSDP listener.
+ */
+void SsdpDestroyServerLocks(void);
+
+/*!
+ * \brief Copies what the SSDP listener needs of the registered handles, so
+ * that the miniserver thread reads it without taking HandleLock.
+ *
+ * \note Called with HandleLock held, after a handle is registered or
+ * unregistered, a device changes its advertisement age or a search starts
+ * or ends. The packet cache of an unregistered device is freed after the
+ * call.
+ */
+void SsdpUpdateHandleSnapshot(void);
+
+/*!
+ * \brief Gives the device registered for an address family, from the copy
+ * of the handles.
+ *
+ * \return TRUE if a device is registered for the family, FALSE otherwise.
+ */
+int SsdpGetSnapshotDevice(
+	/* [in] Address family. */
+	int family,
+	/* [out] Device handle. */
+	UpnpDevice_Handle *handle,
+	/* [out] Advertisement age of the device. */
+	int *maxAge);
+
 /*!
  * \brief Sends SSDP advertisements, replies and shutdown messages.
  *
@@ -225,6 +336,27 @@ int ssdp_request_type(
 	/* [out] The event structure partially filled by this function. */
 	SsdpEvent *Evt);
 
+/*! Counters of the datagrams read from the SSDP sockets. */
+typedef struct {
+	/*! Number of datagrams dropped by the prefilter, before parsing. */
+	unsigned long filtered;
+	/*! Number of datagrams parsed and handled. */
+	unsigned long dispatched;
+} SsdpRecvStats;
+
+/*!
+ * \brief Returns the counters of the datagrams read so far.
+ */
+void SsdpGetRecvStats(
+	/* [out] Counters. */
+	SsdpRecvStats *stats);
+
+/*!
+ * \brief Frees the buffers of the datagrams read from the SSDP sockets,
+ * once the miniserver stopped reading them.
+ */
+void SsdpFreeRecvRing(void);
+
 /*!
  * \brief This function reads the data from the ssdp socket.
  */
@@ -509,6 +641,81 @@ int DeviceShutdown(
 	/* [in] RegistrationState as defined by UPnP Low Power. */
 	int RegistrationState);
 
+#ifdef INCLUDE_DEVICE_APIS
+/*!
+ * \brief Walks the device list of a description document once and collects
+ * the notification types of all the devices and services, so that the
+ * advertisements and the search replies do not traverse the DOM.
+ *
+ * \return The packet cache, NULL if out of memory.
+ */
+SsdpPacketCache *SsdpCreatePacketCache(
+	/* [in] Device handle. */
+	UpnpDevice_Handle Hnd,
+	/* [in] Devices of the description document. */
+	IXML_NodeList *DeviceList);
+
+/*!
+ * \brief Frees a packet cache and its packets.
+ */
+void SsdpFreePacketCache(
+	/* [in] Packet cache, can be NULL. */
+	SsdpPacketCache *Cache);
+
+/*!
+ * \brief Sends the precompiled packets of the selected targets, building
+ * them first if the advertisement parameters changed. Search replies get a
+ * fresh DATE header. The first copy is sent before returning, the others
+ * are sent by the timer thread every SSDP_PAUSE milliseconds.
+ *
+ * \return UPNP_E_SUCCESS if successful else appropriate error.
+ */
+int SsdpSendCachedPackets(
+	/* [in] Packet cache. */
+	SsdpPacketCache *Cache,
+	/* [in] MSGTYPE_SHUTDOWN, MSGTYPE_ADVERTISEMENT or MSGTYPE_REPLY. */
+	int MsgType,
+	/* [in] Destination of the replies, NULL for the multicast channel. */
+	struct sockaddr *DestAddr,
+	/* [in] Location of Device description document. */
+	char *Location,
+	/* [in] Life time of this device. */
+	int Duration,
+	/* [in] Device address family. */
+	int AddressFamily,
+	/* [in] PowerState as defined by UPnP Low Power. */
+	int PowerState,
+	/* [in] SleepPeriod as defined by UPnP Low Power. */
+	int SleepPeriod,
+	/* [in] RegistrationState as defined by UPnP Low Power. */
+	int RegistrationState,
+	/* [in] Indexes of the targets. */
+	const size_t *Targets,
+	/* [in] Number of targets. */
+	size_t NumTargets,
+	/* [in] Number of copies to send. */
+	int Copies);
+
+/*!
+ * \brief Initializes the mutex of the send sockets.
+ *
+ * \return UPNP_E_SUCCESS or UPNP_E_INIT_FAILED.
+ */
+int SsdpInitSendLocks(void);
+
+/*!
+ * \brief Destroys the mutex of the send sockets, after
+ * SsdpCloseSendSockets().
+ */
+void SsdpDestroySendLocks(void);
+
+/*!
+ * \brief Closes the sockets that send the advertisements and the search
+ * replies. They are opened again on the next send.
+ */
+void SsdpCloseSendSockets(void);
+#endif /* INCLUDE_DEVICE_APIS */
+
 /* @} SSDP Device Functions */
 
 /* @} SSDPlib SSDP Library */
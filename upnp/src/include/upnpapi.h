@@ -98,12 +98,24 @@ struct Handle_Info {
 	IXML_NodeList *DeviceList;
 	/*! List of services in the description document. */
 	IXML_NodeList *ServiceList;
+	/*! SSDP targets and precompiled packets of the devices and services
+	 * of the description document. */
+	struct SsdpPacketCache *SsdpPackets;
 	/*! Table holding subscriptions and URL information. */
 	service_table ServiceTable;
 	/*! . */
 	int MaxSubscriptions;
 	/*! . */
 	int MaxSubscriptionTimeOut;
+	/*! Merge the queued events of a subscription instead of dropping them
+	 * when the queue is full. */
+	int CoalesceEvents;
+	/*! Time of the next sweep of the expired subscriptions, 0 if none is
+	 * scheduled. */
+	time_t SubscriptionSweepAt;
+	/*! Time from sock_now_ms() of the next event of the held values of
+	 * the moderated state variables, 0 if none is scheduled. */
+	long long ModerationFlushAt;
 	/*! Address family: AF_INET or AF_INET6. */
 	int DeviceAf;
 #endif
@@ -138,12 +138,13 @@ static void send_error_response(
 	/* make headers */
 	membuffer_init(&headers);
 	if (http_MakeMessage(&headers, major, minor,
-	                     "RNsDsSXcc" "sssss",
+	                     "RNsDsSXcAc" "sssss",
 	                     500,
 	                     content_length,
 	                     ContentTypeHeader,
 	                     "EXT:\r\n",
 	                     X_USER_AGENT,
+	                     info,
 	                     start_body, err_code_str, mid_body, err_msg,
 	                     end_body) != 0) {
 		membuffer_destroy(&headers);
@@ -189,12 +190,13 @@ static UPNP_INLINE void send_var_query_response(
 	/* make headers */
 	membuffer_init(&response);
 	if (http_MakeMessage(&response, major, minor,
-	                     "RNsDsSXcc" "sss",
+	                     "RNsDsSXcAc" "sss",
 	                     HTTP_OK,
 	                     content_length,
 	                     ContentTypeHeader,
 	                     "EXT:\r\n",
 	                     X_USER_AGENT,
+	                     info,
 	                     start_body, var_value, end_body) != 0) {
 		membuffer_destroy(&response);
 		/* out of mem */
@@ -243,11 +245,11 @@ static UPNP_INLINE void send_action_response(
 		strlen(end_body));
 	/* make headers */
 	if (http_MakeMessage(&headers, major, minor,
-	                     "RNsDsSXcc",
+	                     "RNsDsSXcAc",
 	                     HTTP_OK,    /* status code */
 	                     content_length,
 	                     ContentTypeHeader,
-	                     "EXT:\r\n", X_USER_AGENT) != 0) {
+	                     "EXT:\r\n", X_USER_AGENT, info) != 0) {
 		goto error_handler;
 	}
 	/* send whole msg */
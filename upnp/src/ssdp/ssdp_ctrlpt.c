@@ -475,6 +475,7 @@ static void searchExpired(
 			item->searchTarget = NULL;
 			free(item);
 			ListDelNode(&ctrlpt_info->SsdpSearchList, node, 0);
+			SsdpUpdateHandleSnapshot();
 			break;
 		}
 		node = ListNext(&ctrlpt_info->SsdpSearchList, node);
@@ -573,6 +574,7 @@ int SearchByTarget(int Mx, char *St, void *Cookie) {
 	                    REL_SEC, &job, SHORT_TERM, id);
 	newArg->timeoutEventId = *id;
 	ListAddTail(&ctrlpt_info->SsdpSearchList, newArg);
+	SsdpUpdateHandleSnapshot();
 	HandleUnlock();
 	/* End of lock */
 
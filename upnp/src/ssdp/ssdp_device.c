@@ -38,6 +38,8 @@
  * \file
  */
 
+#define _GNU_SOURCE    /* For sendmmsg() in sys/socket.h */
+
 #include "../include/config.h"
 
 #ifdef INCLUDE_DEVICE_APIS
@@ -51,14 +53,26 @@
 #include "../include/upnpapi.h"
 
 #include <assert.h>
+#include <limits.h>
 
 #ifdef WIN32
 	#define snprintf _snprintf
 #endif
 
-#define MSGTYPE_SHUTDOWN    0
-#define MSGTYPE_ADVERTISEMENT    1
-#define MSGTYPE_REPLY        2
+/*! Number of packets given to one sendmmsg() call. */
+#define SSDP_SEND_BATCH 32
+
+/*! Protects the creation of the send sockets and gSsdpGeneration. */
+static ithread_mutex_t gSsdpSendMutex;
+/*! Last generation given to a packet cache. */
+static unsigned long gSsdpGeneration;
+/*! Socket sending the IPv4 advertisements and replies, created on first
+ * use and kept until UpnpFinish(). */
+static SOCKET gSsdpSendSock4 = INVALID_SOCKET;
+#ifdef UPNP_ENABLE_IPV6
+/*! Socket sending the IPv6 advertisements and replies. */
+static SOCKET gSsdpSendSock6 = INVALID_SOCKET;
+#endif /* UPNP_ENABLE_IPV6 */
 
 void *advertiseAndReplyThread(void *data) {
 	SsdpSearchReply *arg = (SsdpSearchReply *) data;
@@ -76,8 +90,7 @@ void *advertiseAndReplyThread(void *data) {
 #ifdef INCLUDE_DEVICE_APIS
 void ssdp_handle_device_request(http_message_t *hmsg, struct sockaddr_storage *dest_addr) {
 #define MX_FUDGE_FACTOR 10
-	int handle;
-	struct Handle_Info *dev_info = NULL;
+	UpnpDevice_Handle handle;
 	memptr hdr_value;
 	int mx;
 	char save_char;
@@ -111,17 +124,11 @@ void ssdp_handle_device_request(http_message_t *hmsg, struct sockaddr_storage *d
 		/* bad ST header. */
 		return;
 
-	HandleLock();
-	/* device info. */
-	switch (GetDeviceHandleInfo((int) dest_addr->ss_family,
-	                            &handle, &dev_info)) {
-		case HND_DEVICE: break;
-		default: HandleUnlock();
-			/* no info found. */
-			return;
-	}
-	maxAge = dev_info->MaxAge;
-	HandleUnlock();
+	/* device info, without HandleLock on the miniserver thread. */
+	if (!SsdpGetSnapshotDevice((int) dest_addr->ss_family, &handle,
+	                           &maxAge))
+		/* no info found. */
+		return;
 
 	UpnpPrintf(UPNP_PACKET, API, __FILE__, __LINE__,
 	           "MAX-AGE     =  %d\n", maxAge);
@@ -151,12 +158,101 @@ void ssdp_handle_device_request(http_message_t *hmsg, struct sockaddr_storage *d
 		mx -= MAXVAL(1, mx / MX_FUDGE_FACTOR);
 	if (mx < 1)
 		mx = 1;
-	replyTime = rand() % mx;
-	TimerThreadSchedule(&gTimerThread, replyTime, REL_SEC, &job,
-	                    SHORT_TERM, NULL);
+	/* Spread the replies over the window in milliseconds. */
+	if (mx > INT_MAX / 1000)
+		mx = INT_MAX / 1000;
+	replyTime = rand() % (mx * 1000);
+	TimerThreadScheduleMs(&gTimerThread, replyTime, &job, SHORT_TERM,
+	                      NULL);
 }
 #endif
 
+/*!
+ * \brief Returns the send socket of an address family, creating it and
+ * setting its multicast interface on first use.
+ *
+ * Datagrams are sent whole, so the socket is shared by all the threads
+ * without further locking.
+ *
+ * \return The socket, INVALID_SOCKET on error.
+ */
+static SOCKET GetSendSocket(
+	/*! [in] Address family. */
+	int family) {
+	char errorBuffer[ERROR_BUFFER_LEN];
+	SOCKET *sock;
+	SOCKET ret;
+	unsigned long replyAddr = inet_addr(gIF_IPV4);
+	/* a/c to UPNP Spec */
+	int ttl = 4;
+#ifdef UPNP_ENABLE_IPV6
+	int hops = 1;
+#endif /* UPNP_ENABLE_IPV6 */
+
+	switch (family) {
+		case AF_INET: sock = &gSsdpSendSock4;
+			break;
+#ifdef UPNP_ENABLE_IPV6
+		case AF_INET6: sock = &gSsdpSendSock6;
+			break;
+#endif /* UPNP_ENABLE_IPV6 */
+		default: return INVALID_SOCKET;
+	}
+	ithread_mutex_lock(&gSsdpSendMutex);
+	if (*sock == INVALID_SOCKET) {
+		*sock = socket(family, SOCK_DGRAM, 0);
+		if (*sock == INVALID_SOCKET) {
+			strerror_r(errno, errorBuffer, ERROR_BUFFER_LEN);
+			UpnpPrintf(UPNP_INFO, SSDP, __FILE__, __LINE__,
+			           "SSDP_LIB: New Request Handler:"
+				           "Error in socket(): %s\n", errorBuffer);
+		} else if (family == AF_INET) {
+			setsockopt(*sock, IPPROTO_IP, IP_MULTICAST_IF,
+			           (char *) &replyAddr, sizeof(replyAddr));
+			setsockopt(*sock, IPPROTO_IP, IP_MULTICAST_TTL,
+			           (char *) &ttl, sizeof(int));
+		}
+#ifdef UPNP_ENABLE_IPV6
+		else {
+			setsockopt(*sock, IPPROTO_IPV6, IPV6_MULTICAST_IF,
+			           (char *) &gIF_INDEX, sizeof(gIF_INDEX));
+			setsockopt(*sock, IPPROTO_IPV6, IPV6_MULTICAST_HOPS,
+			           (char *) &hops, sizeof(hops));
+		}
+#endif /* UPNP_ENABLE_IPV6 */
+	}
+	ret = *sock;
+	ithread_mutex_unlock(&gSsdpSendMutex);
+
+	return ret;
+}
+
+int SsdpInitSendLocks(void) {
+	if (ithread_mutex_init(&gSsdpSendMutex, NULL) != 0)
+		return UPNP_E_INIT_FAILED;
+
+	return UPNP_E_SUCCESS;
+}
+
+void SsdpDestroySendLocks(void) {
+	ithread_mutex_destroy(&gSsdpSendMutex);
+}
+
+void SsdpCloseSendSockets(void) {
+	ithread_mutex_lock(&gSsdpSendMutex);
+	if (gSsdpSendSock4 != INVALID_SOCKET) {
+		UpnpCloseSocket(gSsdpSendSock4);
+		gSsdpSendSock4 = INVALID_SOCKET;
+	}
+#ifdef UPNP_ENABLE_IPV6
+	if (gSsdpSendSock6 != INVALID_SOCKET) {
+		UpnpCloseSocket(gSsdpSendSock6);
+		gSsdpSendSock6 = INVALID_SOCKET;
+	}
+#endif /* UPNP_ENABLE_IPV6 */
+	ithread_mutex_unlock(&gSsdpSendMutex);
+}
+
 /*!
  * \brief Works as a request handler which passes the HTTP request string
  * to multicast channel.
@@ -174,58 +270,73 @@ static int NewRequestHandler(
 	SOCKET ReplySock;
 	socklen_t socklen = sizeof(struct sockaddr_storage);
 	int Index;
-	unsigned long replyAddr = inet_addr(gIF_IPV4);
-	/* a/c to UPNP Spec */
-	int ttl = 4;
-#ifdef INET_IPV6
-	int hops = 1;
-#endif
 	char buf_ntop[INET6_ADDRSTRLEN];
-	int ret = UPNP_E_SUCCESS;
-
-	ReplySock = socket((int) DestAddr->sa_family, SOCK_DGRAM, 0);
-	if (ReplySock == INVALID_SOCKET) {
-		strerror_r(errno, errorBuffer, ERROR_BUFFER_LEN);
-		UpnpPrintf(UPNP_INFO, SSDP, __FILE__, __LINE__,
-		           "SSDP_LIB: New Request Handler:"
-			           "Error in socket(): %s\n", errorBuffer);
-
-		return UPNP_E_OUTOF_SOCKET;
-	}
 
 	switch (DestAddr->sa_family) {
 		case AF_INET:
 			inet_ntop(AF_INET, &((struct sockaddr_in *) DestAddr)->sin_addr,
 			          buf_ntop, sizeof(buf_ntop));
-			setsockopt(ReplySock, IPPROTO_IP, IP_MULTICAST_IF,
-			           (char *) &replyAddr, sizeof(replyAddr));
-			setsockopt(ReplySock, IPPROTO_IP, IP_MULTICAST_TTL,
-			           (char *) &ttl, sizeof(int));
 			socklen = sizeof(struct sockaddr_in);
 			break;
-#ifdef INET_IPV6
+#ifdef UPNP_ENABLE_IPV6
 		case AF_INET6:
 			inet_ntop(AF_INET6,
 				  &((struct sockaddr_in6 *)DestAddr)->sin6_addr,
 				  buf_ntop, sizeof(buf_ntop));
-			setsockopt(ReplySock, IPPROTO_IPV6, IPV6_MULTICAST_IF,
-				   (char *)&gIF_INDEX, sizeof(gIF_INDEX));
-			setsockopt(ReplySock, IPPROTO_IPV6, IPV6_MULTICAST_HOPS,
-				   (char *)&hops, sizeof(hops));
+			socklen = sizeof(struct sockaddr_in6);
 			break;
-#endif
+#endif /* UPNP_ENABLE_IPV6 */
 		default:
 			UpnpPrintf(UPNP_CRITICAL, SSDP, __FILE__, __LINE__,
 			           "Invalid destination address specified.");
-			ret = UPNP_E_NETWORK_ERROR;
-			goto end_NewRequestHandler;
+			return UPNP_E_NETWORK_ERROR;
 	}
+	ReplySock = GetSendSocket((int) DestAddr->sa_family);
+	if (ReplySock == INVALID_SOCKET)
+		return UPNP_E_OUTOF_SOCKET;
 
 	for (Index = 0; Index < NumPacket; Index++) {
-		ssize_t rc;
 		UpnpPrintf(UPNP_INFO, SSDP, __FILE__, __LINE__,
 		           ">>> SSDP SEND to %s >>>\n%s\n",
 		           buf_ntop, *(RqPacket + Index));
+	}
+#ifdef UPNP_ENABLE_SENDMMSG
+	/* one system call for each batch of packets */
+	for (Index = 0; Index < NumPacket;) {
+		struct mmsghdr msgs[SSDP_SEND_BATCH];
+		struct iovec iov[SSDP_SEND_BATCH];
+		int count = NumPacket - Index;
+		int i;
+		int rc;
+
+		if (count > SSDP_SEND_BATCH)
+			count = SSDP_SEND_BATCH;
+		memset(msgs, 0, sizeof(msgs));
+		for (i = 0; i < count; i++) {
+			iov[i].iov_base = RqPacket[Index + i];
+			iov[i].iov_len = strlen(RqPacket[Index + i]);
+			msgs[i].msg_hdr.msg_name = DestAddr;
+			msgs[i].msg_hdr.msg_namelen = socklen;
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+		rc = sendmmsg(ReplySock, msgs, (unsigned int) count, 0);
+		if (rc == -1 && errno == EINTR)
+			continue;
+		if (rc <= 0) {
+			strerror_r(errno, errorBuffer, ERROR_BUFFER_LEN);
+			UpnpPrintf(UPNP_INFO, SSDP, __FILE__, __LINE__,
+			           "SSDP_LIB: New Request Handler:"
+				           "Error in sendmmsg(): %s\n", errorBuffer);
+			return UPNP_E_SOCKET_WRITE;
+		}
+		/* a short count means the next packet failed, retry from it */
+		Index += rc;
+	}
+#else /* UPNP_ENABLE_SENDMMSG */
+	for (Index = 0; Index < NumPacket; Index++) {
+		ssize_t rc;
+
 		rc = sendto(ReplySock, *(RqPacket + Index),
 		            strlen(*(RqPacket + Index)), 0, DestAddr, socklen);
 		if (rc == -1) {
@@ -233,15 +344,159 @@ static int NewRequestHandler(
 			UpnpPrintf(UPNP_INFO, SSDP, __FILE__, __LINE__,
 			           "SSDP_LIB: New Request Handler:"
 				           "Error in socket(): %s\n", errorBuffer);
-			ret = UPNP_E_SOCKET_WRITE;
-			goto end_NewRequestHandler;
+			return UPNP_E_SOCKET_WRITE;
 		}
 	}
+#endif /* UPNP_ENABLE_SENDMMSG */
+
+	return UPNP_E_SUCCESS;
+}
 
-	end_NewRequestHandler:
-	UpnpCloseSocket(ReplySock);
+/*! Copies of a batch of packets, sent again by the timer thread. */
+typedef struct {
+	/*! Device that sent the packets. */
+	UpnpDevice_Handle handle;
+	/*! Generation of the packet cache of the device when the packets were
+	 * sent. The copies are dropped once it changes. */
+	unsigned long generation;
+	/*! Destination. */
+	struct sockaddr_storage dest;
+	/*! Number of copies still to send. */
+	int copies;
+	/*! Number of packets. */
+	int count;
+	/*! Packets. */
+	char **packets;
+} SsdpResend;
 
-	return ret;
+/*!
+ * \brief Frees the copies of a batch of packets.
+ */
+static void FreeResend(
+	/*! [in] Copies. */
+	SsdpResend *resend) {
+	int i;
+
+	for (i = 0; i < resend->count; i++)
+		free(resend->packets[i]);
+	free(resend->packets);
+	free(resend);
+}
+
+static int ScheduleResend(SsdpResend *resend);
+
+/*!
+ * \brief Timer job sending a copy of a batch of packets, and scheduling the
+ * next copy if any. The copies are dropped once the device sent its
+ * shutdown messages or was unregistered.
+ *
+ * \return always return NULL
+ */
+static void *ResendThread(
+	/*! [in] Copies. */
+	void *data) {
+	SsdpResend *resend = (SsdpResend *) data;
+	struct Handle_Info *info = NULL;
+	SsdpPacketCache *cache;
+	int current = 0;
+
+	HandleReadLock();
+	if (GetHandleInfo(resend->handle, &info) == HND_DEVICE &&
+	    (cache = info->SsdpPackets) != NULL) {
+		/* the shutdown messages are sent with the cache locked, so
+		 * that no copy follows them */
+		ithread_mutex_lock(&cache->mutex);
+		current = cache->generation == resend->generation;
+		if (current)
+			NewRequestHandler((struct sockaddr *) &resend->dest,
+			                  resend->count, resend->packets);
+		ithread_mutex_unlock(&cache->mutex);
+	}
+	HandleUnlock();
+	if (!current || --resend->copies <= 0 ||
+	    ScheduleResend(resend) != UPNP_E_SUCCESS)
+		FreeResend(resend);
+
+	return NULL;
+}
+
+/*!
+ * \brief Schedules the next copy of a batch of packets SSDP_PAUSE
+ * milliseconds later.
+ *
+ * \return UPNP_E_SUCCESS if successful else appropriate error.
+ */
+static int ScheduleResend(
+	/*! [in] Copies. */
+	SsdpResend *resend) {
+	ThreadPoolJob job;
+
+	memset(&job, 0, sizeof(job));
+	TPJobInit(&job, (start_routine) ResendThread, resend);
+	TPJobSetFreeFunction(&job, (free_routine) FreeResend);
+	if (TimerThreadScheduleMs(&gTimerThread, (long) SSDP_PAUSE, &job,
+	                          SHORT_TERM, NULL) != 0)
+		return UPNP_E_OUTOF_MEMORY;
+
+	return UPNP_E_SUCCESS;
+}
+
+/*!
+ * \brief Sends a batch of packets now, and schedules its other copies on
+ * the timer thread instead of sleeping between them.
+ *
+ * \return UPNP_E_SUCCESS if successful else appropriate error.
+ *
+ * \note Called with the mutex of the packet cache held.
+ */
+static int SendCopies(
+	/*! [in] Packet cache the packets come from. */
+	SsdpPacketCache *Cache,
+	/*! [in] Destination. */
+	struct sockaddr *DestAddr,
+	/*! [in] Number of packets. */
+	int NumPacket,
+	/*! [in] Packets. */
+	char **RqPacket,
+	/*! [in] Number of copies to send. */
+	int Copies) {
+	SsdpResend *resend;
+	int ret_code;
+	int i;
+
+	ret_code = NewRequestHandler(DestAddr, NumPacket, RqPacket);
+	if (Copies <= 1)
+		return ret_code;
+	resend = (SsdpResend *) malloc(sizeof(SsdpResend));
+	if (resend == NULL)
+		return UPNP_E_OUTOF_MEMORY;
+	resend->handle = Cache->handle;
+	resend->generation = Cache->generation;
+	memset(&resend->dest, 0, sizeof(resend->dest));
+	memcpy(&resend->dest, DestAddr,
+	       DestAddr->sa_family == AF_INET6 ?
+	       sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in));
+	resend->copies = Copies - 1;
+	resend->count = 0;
+	resend->packets = (char **) malloc((size_t) NumPacket * sizeof(char *));
+	if (resend->packets == NULL) {
+		free(resend);
+		return UPNP_E_OUTOF_MEMORY;
+	}
+	for (i = 0; i < NumPacket; i++) {
+		resend->packets[i] = strdup(RqPacket[i]);
+		if (resend->packets[i] == NULL) {
+			FreeResend(resend);
+			return UPNP_E_OUTOF_MEMORY;
+		}
+		resend->count++;
+	}
+	if (ScheduleResend(resend) != UPNP_E_SUCCESS) {
+		FreeResend(resend);
+		return UPNP_E_OUTOF_MEMORY;
+	}
+
+	return ret_code;
 }
 
 /*!
@@ -882,6 +1137,377 @@ int DeviceShutdown(char *DevType, int RootDev, char *Udn,
 
 	return ret_code;
 }
+
+/*!
+ * \brief Returns the text of the first element with the given tag name in
+ * the subtree of an element.
+ *
+ * \return The text, NULL if not found.
+ */
+static const DOMString FirstElementText(
+	/*! [in] Element. */
+	IXML_Element *element,
+	/*! [in] Tag name. */
+	const char *tagName) {
+	IXML_NodeList *nodeList;
+	IXML_Node *textNode = NULL;
+	const DOMString ret = NULL;
+
+	nodeList = ixmlElement_getElementsByTagName(element, tagName);
+	if (!nodeList)
+		return NULL;
+	if (ixmlNodeList_item(nodeList, 0lu))
+		textNode = ixmlNode_getFirstChild(
+			ixmlNodeList_item(nodeList, 0lu));
+	if (textNode)
+		ret = ixmlNode_getNodeValue(textNode);
+	ixmlNodeList_free(nodeList);
+
+	return ret;
+}
+
+/*!
+ * \brief Appends a target to a packet cache.
+ *
+ * \return UPNP_E_SUCCESS if successful else UPNP_E_OUTOF_MEMORY.
+ */
+static int AddTarget(
+	/*! [in] Packet cache. */
+	SsdpPacketCache *cache,
+	/*! [in] Size of the targets array. */
+	size_t *size,
+	/*! [in] Kind of the target. */
+	SsdpTargetKind kind,
+	/*! [in] UDN of the device. */
+	const char *udn,
+	/*! [in] Device or service type, NULL for the other kinds. */
+	const char *type) {
+	SsdpTarget *target;
+	const char *nt;
+	char usn[LINE_SIZE];
+	int rc;
+
+	switch (kind) {
+		case SSDP_TARGET_ROOT: nt = "upnp:rootdevice";
+			rc = snprintf(usn, sizeof(usn), "%s::%s", udn, nt);
+			break;
+		case SSDP_TARGET_UDN: nt = udn;
+			rc = snprintf(usn, sizeof(usn), "%s", udn);
+			break;
+		default: nt = type;
+			rc = snprintf(usn, sizeof(usn), "%s::%s", udn, type);
+			break;
+	}
+	if (rc < 0 || (unsigned int) rc >= sizeof(usn)) {
+		UpnpPrintf(UPNP_CRITICAL, SSDP, __FILE__, __LINE__,
+		           "USN too long for %s\n", nt);
+		return UPNP_E_SUCCESS;
+	}
+	if (cache->count == *size) {
+		size_t newSize = *size ? *size * 2 : (size_t) 8;
+		SsdpTarget *targets = (SsdpTarget *) realloc(cache->targets,
+			newSize * sizeof(SsdpTarget));
+
+		if (targets == NULL)
+			return UPNP_E_OUTOF_MEMORY;
+		cache->targets = targets;
+		*size = newSize;
+	}
+	target = &cache->targets[cache->count];
+	target->kind = kind;
+	target->udn = strdup(udn);
+	target->nt = strdup(nt);
+	target->usn = strdup(usn);
+	if (!target->udn || !target->nt || !target->usn) {
+		free(target->udn);
+		free(target->nt);
+		free(target->usn);
+		return UPNP_E_OUTOF_MEMORY;
+	}
+	cache->count++;
+
+	return UPNP_E_SUCCESS;
+}
+
+/*!
+ * \brief Gives a new generation to a packet cache.
+ *
+ * \return The generation, never given before.
+ */
+static unsigned long NextGeneration(void) {
+	unsigned long generation;
+
+	ithread_mutex_lock(&gSsdpSendMutex);
+	generation = ++gSsdpGeneration;
+	ithread_mutex_unlock(&gSsdpSendMutex);
+
+	return generation;
+}
+
+SsdpPacketCache *SsdpCreatePacketCache(UpnpDevice_Handle Hnd,
+                                       IXML_NodeList *DeviceList) {
+	static const char SERVICELIST_STR[] = "serviceList";
+	SsdpPacketCache *cache;
+	size_t size = 0;
+	unsigned long i;
+	unsigned long j;
+	IXML_Node *devNode;
+	IXML_Node *node;
+	IXML_NodeList *serviceList;
+	const DOMString devType;
+	const DOMString udn;
+	const DOMString servType;
+	int ret = UPNP_E_SUCCESS;
+
+	cache = (SsdpPacketCache *) malloc(sizeof(SsdpPacketCache));
+	if (cache == NULL)
+		return NULL;
+	memset(cache, 0, sizeof(SsdpPacketCache));
+	ithread_mutex_init(&cache->mutex, NULL);
+	cache->handle = Hnd;
+	cache->generation = NextGeneration();
+	for (i = 0lu; ret == UPNP_E_SUCCESS &&
+		(devNode = ixmlNodeList_item(DeviceList, i)) != NULL; i++) {
+		devType = FirstElementText((IXML_Element *) devNode,
+		                           "deviceType");
+		if (!devType)
+			continue;
+		udn = FirstElementText((IXML_Element *) devNode, "UDN");
+		if (!udn) {
+			UpnpPrintf(UPNP_CRITICAL, SSDP, __FILE__, __LINE__,
+			           "UDN not found!\n");
+			continue;
+		}
+		if (i == 0lu)
+			ret = AddTarget(cache, &size, SSDP_TARGET_ROOT, udn,
+			                NULL);
+		if (ret == UPNP_E_SUCCESS)
+			ret = AddTarget(cache, &size, SSDP_TARGET_UDN, udn,
+			                NULL);
+		if (ret == UPNP_E_SUCCESS)
+			ret = AddTarget(cache, &size, SSDP_TARGET_DEVICE, udn,
+			                devType);
+		/* Each device's serviceList is directly traversed as a child
+		 * of its parent device, so that the services use the UDN of
+		 * the parent device. */
+		for (node = ixmlNode_getFirstChild(devNode); node;
+		     node = ixmlNode_getNextSibling(node)) {
+			if (!strncmp(ixmlNode_getNodeName(node),
+			             SERVICELIST_STR, sizeof SERVICELIST_STR))
+				break;
+		}
+		if (!node)
+			continue;
+		serviceList = ixmlElement_getElementsByTagName(
+			(IXML_Element *) node, "service");
+		if (!serviceList)
+			continue;
+		for (j = 0lu; ret == UPNP_E_SUCCESS &&
+			(node = ixmlNodeList_item(serviceList, j)) != NULL;
+		     j++) {
+			servType = FirstElementText((IXML_Element *) node,
+			                            "serviceType");
+			if (!servType) {
+				UpnpPrintf(UPNP_CRITICAL, SSDP, __FILE__,
+				           __LINE__,
+				           "ServiceType not found \n");
+				continue;
+			}
+			ret = AddTarget(cache, &size, SSDP_TARGET_SERVICE,
+			                udn, servType);
+		}
+		ixmlNodeList_free(serviceList);
+	}
+	if (ret != UPNP_E_SUCCESS) {
+		SsdpFreePacketCache(cache);
+		return NULL;
+	}
+	UpnpPrintf(UPNP_INFO, SSDP, __FILE__, __LINE__,
+	           "SSDP packet cache holds %lu targets\n",
+	           (unsigned long) cache->count);
+
+	return cache;
+}
+
+/*!
+ * \brief Frees the packets of a packet set.
+ */
+static void FreePacketSet(
+	/*! [in] Packet set. */
+	SsdpPacketSet *set,
+	/*! [in] Number of packets. */
+	size_t count) {
+	size_t i;
+
+	if (set->packets) {
+		for (i = 0; i < count; i++)
+			free(set->packets[i]);
+	}
+	free(set->packets);
+	free(set->dateOffsets);
+	memset(set, 0, sizeof(SsdpPacketSet));
+}
+
+void SsdpFreePacketCache(SsdpPacketCache *Cache) {
+	size_t i;
+
+	if (Cache == NULL)
+		return;
+	for (i = 0; i < sizeof Cache->sets / sizeof Cache->sets[0]; i++)
+		FreePacketSet(&Cache->sets[i], Cache->count);
+	ithread_mutex_destroy(&Cache->mutex);
+	for (i = 0; i < Cache->count; i++) {
+		free(Cache->targets[i].udn);
+		free(Cache->targets[i].nt);
+		free(Cache->targets[i].usn);
+	}
+	free(Cache->targets);
+	free(Cache);
+}
+
+/*!
+ * \brief Builds the packets of a message type for all the targets of a
+ * packet cache.
+ *
+ * \return UPNP_E_SUCCESS if successful else appropriate error.
+ */
+static int BuildPacketSet(
+	/*! [in] Packet cache. */
+	SsdpPacketCache *cache,
+	/*! [in] Message type. */
+	int msgType,
+	/*! [in] Location URL. */
+	char *location,
+	/*! [in] Service duration in sec. */
+	int duration,
+	/*! [in] Device address family. */
+	int addressFamily,
+	/*! [in] PowerState as defined by UPnP Low Power. */
+	int powerState,
+	/*! [in] SleepPeriod as defined by UPnP Low Power. */
+	int sleepPeriod,
+	/*! [in] RegistrationState as defined by UPnP Low Power. */
+	int registrationState) {
+	SsdpPacketSet *set = &cache->sets[msgType];
+	size_t i;
+	char *date;
+	char *end;
+
+	FreePacketSet(set, cache->count);
+	set->packets = (char **) calloc(cache->count, sizeof(char *));
+	if (msgType == MSGTYPE_REPLY)
+		set->dateOffsets = (size_t *) calloc(cache->count,
+		                                     sizeof(size_t));
+	if (set->packets == NULL ||
+		(msgType == MSGTYPE_REPLY && set->dateOffsets == NULL))
+		goto error_handler;
+	for (i = 0; i < cache->count; i++) {
+		CreateServicePacket(msgType, cache->targets[i].nt,
+		                    cache->targets[i].usn, location, duration,
+		                    &set->packets[i], addressFamily,
+		                    powerState, sleepPeriod,
+		                    registrationState);
+		if (set->packets[i] == NULL)
+			goto error_handler;
+		if (msgType != MSGTYPE_REPLY)
+			continue;
+		/* locate the DATE header, refreshed at each reply */
+		date = strstr(set->packets[i], "\r\nDATE: ");
+		end = date ? strstr(date + 2, "\r\n") : NULL;
+		if (end == NULL)
+			goto error_handler;
+		date += 2;
+		set->dateOffsets[i] = (size_t) (date - set->packets[i]);
+		set->dateLength = (size_t) (end + 2 - date);
+	}
+	set->duration = duration;
+	set->powerState = powerState;
+	set->sleepPeriod = sleepPeriod;
+	set->registrationState = registrationState;
+	set->valid = 1;
+
+	return UPNP_E_SUCCESS;
+
+	error_handler:
+	FreePacketSet(set, cache->count);
+
+	return UPNP_E_OUTOF_MEMORY;
+}
+
+int SsdpSendCachedPackets(SsdpPacketCache *Cache, int MsgType,
+                          struct sockaddr *DestAddr, char *Location,
+                          int Duration, int AddressFamily, int PowerState,
+                          int SleepPeriod, int RegistrationState,
+                          const size_t *Targets, size_t NumTargets,
+                          int Copies) {
+	struct sockaddr_storage __ss;
+	struct sockaddr_in *DestAddr4 = (struct sockaddr_in *) &__ss;
+	struct sockaddr_in6 *DestAddr6 = (struct sockaddr_in6 *) &__ss;
+	SsdpPacketSet *set = &Cache->sets[MsgType];
+	char **msgs = NULL;
+	membuffer date;
+	size_t i;
+	int ret_code = UPNP_E_SUCCESS;
+
+	if (NumTargets == 0)
+		return UPNP_E_SUCCESS;
+	membuffer_init(&date);
+	if (DestAddr == NULL) {
+		memset(&__ss, 0, sizeof(__ss));
+		switch (AddressFamily) {
+			case AF_INET: DestAddr4->sin_family = (sa_family_t) AF_INET;
+				inet_pton(AF_INET, SSDP_IP, &DestAddr4->sin_addr);
+				DestAddr4->sin_port = htons(SSDP_PORT);
+				break;
+			case AF_INET6: DestAddr6->sin6_family = (sa_family_t) AF_INET6;
+				inet_pton(AF_INET6,
+				          (isUrlV6UlaGua(Location)) ? SSDP_IPV6_SITELOCAL :
+				          SSDP_IPV6_LINKLOCAL, &DestAddr6->sin6_addr);
+				DestAddr6->sin6_port = htons(SSDP_PORT);
+				DestAddr6->sin6_scope_id = gIF_INDEX;
+				break;
+			default:
+				UpnpPrintf(UPNP_CRITICAL, SSDP, __FILE__, __LINE__,
+				           "Invalid device address family.\n");
+		}
+		DestAddr = (struct sockaddr *) &__ss;
+	}
+	msgs = (char **) malloc(NumTargets * sizeof(char *));
+	if (msgs == NULL ||
+		(MsgType == MSGTYPE_REPLY && http_MakeMessage(&date, 1, 1, "D"))) {
+		ret_code = UPNP_E_OUTOF_MEMORY;
+		goto error_handler;
+	}
+	ithread_mutex_lock(&Cache->mutex);
+	if (MsgType == MSGTYPE_SHUTDOWN)
+		/* drop the pending copies of the advertisements */
+		Cache->generation = NextGeneration();
+	if (!set->valid || set->duration != Duration ||
+		set->powerState != PowerState ||
+		set->sleepPeriod != SleepPeriod ||
+		set->registrationState != RegistrationState ||
+		(MsgType == MSGTYPE_REPLY && set->dateLength != date.length))
+		ret_code = BuildPacketSet(Cache, MsgType, Location, Duration,
+		                          AddressFamily, PowerState,
+		                          SleepPeriod, RegistrationState);
+	if (ret_code == UPNP_E_SUCCESS) {
+		for (i = 0; i < NumTargets; i++) {
+			msgs[i] = set->packets[Targets[i]];
+			if (MsgType == MSGTYPE_REPLY)
+				memcpy(msgs[i] + set->dateOffsets[Targets[i]],
+				       date.buf, date.length);
+		}
+		ret_code = SendCopies(Cache, DestAddr, (int) NumTargets, msgs,
+		                      Copies);
+	}
+	ithread_mutex_unlock(&Cache->mutex);
+
+	error_handler:
+	membuffer_destroy(&date);
+	free(msgs);
+
+	return ret_code;
+}
 #endif /* EXCLUDE_SSDP */
 #endif /* INCLUDE_DEVICE_APIS */
 
@@ -38,6 +38,8 @@
  * \file
  */
 
+#define _GNU_SOURCE    /* For recvmmsg() in sys/socket.h */
+
 #if !defined(_MSC_VER)
 	#include <sys/param.h>
 #else
@@ -57,6 +59,9 @@
 
 #define MAX_TIME_TOREAD  45
 
+/*! Number of datagrams read by one recvmmsg() call. */
+#define SSDP_RECV_BATCH 16
+
 #ifdef INCLUDE_CLIENT_APIS
 SOCKET gSsdpReqSocket4 = INVALID_SOCKET;
 	#ifdef UPNP_ENABLE_IPV6
@@ -82,33 +87,144 @@ struct SSDPSockArray {
 };
 
 #ifdef INCLUDE_DEVICE_APIS
-static const char SERVICELIST_STR[] = "serviceList";
+/*!
+ * \brief Compares the type of a search with a device or service type.
+ *
+ * \return 0 if the types do not match, 1 if they match with the same version,
+ * -1 if the search asks for a lower version than the one of the device.
+ */
+static int MatchSearchType(
+	/*! [in] Type searched by the control point. */
+	char *searchType,
+	/*! [in] Device or service type. */
+	const char *type) {
+	int searchVersion;
+	int version;
+
+	if (strncasecmp(searchType, type, strlen(searchType) - (size_t) 2))
+		return 0;
+	searchVersion = atoi(strrchr(searchType, ':') + 1);
+	version = atoi(&type[strlen(type) - (size_t) 1]);
+	if (searchVersion < version)
+		return -1;
+	if (searchVersion == version)
+		return 1;
+
+	return 0;
+}
+
+/*!
+ * \brief Replies to a search by device or service type. The cached reply is
+ * used when the search type is the announced one, otherwise a reply with
+ * the searched type is built.
+ *
+ * \return 1 if the cached reply of the target must be sent, 0 otherwise.
+ */
+static int ReplyByType(
+	/*! [in] Device information. */
+	struct Handle_Info *SInfo,
+	/*! [in] Destination address. */
+	struct sockaddr *DestAddr,
+	/*! [in] Type searched by the control point. */
+	char *searchType,
+	/*! [in] Target. */
+	SsdpTarget *target,
+	/*! [in] Advertisement age. */
+	int Exp) {
+	switch (MatchSearchType(searchType, target->nt)) {
+		case -1:
+			/* the requested version is lower than the device version
+			 * must reply with the lower version number and the lower
+			 * description URL */
+			UpnpPrintf(UPNP_INFO, API, __FILE__, __LINE__,
+			           "Type=%s and search type=%s MATCH\n",
+			           target->nt, searchType);
+			SendReply(DestAddr, searchType, 0, target->udn,
+			          SInfo->LowerDescURL, Exp, 1,
+			          SInfo->PowerState, SInfo->SleepPeriod,
+			          SInfo->RegistrationState);
+			return 0;
+		case 1:
+			UpnpPrintf(UPNP_INFO, API, __FILE__, __LINE__,
+			           "Type=%s and search type=%s MATCH\n",
+			           target->nt, searchType);
+			if (!strcmp(searchType, target->nt))
+				return 1;
+			SendReply(DestAddr, searchType, 0, target->udn,
+			          SInfo->DescURL, Exp, 1,
+			          SInfo->PowerState, SInfo->SleepPeriod,
+			          SInfo->RegistrationState);
+			return 0;
+		default:
+			return 0;
+	}
+}
+
+/*!
+ * \brief Tells whether a search would select at least one target of a
+ * device, using the same rules as AdvertiseAndReply().
+ *
+ * \return TRUE if a target matches, FALSE otherwise.
+ */
+static int HostsSearchTarget(
+	/*! [in] Targets of the device. */
+	SsdpPacketCache *cache,
+	/*! [in] Search request. */
+	SsdpEvent *event) {
+	size_t i;
+	SsdpTarget *target;
+
+	for (i = 0; i < cache->count; i++) {
+		target = &cache->targets[i];
+		switch (event->RequestType) {
+			case SSDP_ALL:
+				return TRUE;
+			case SSDP_ROOTDEVICE:
+				if (target->kind == SSDP_TARGET_ROOT)
+					return TRUE;
+				break;
+			case SSDP_DEVICEUDN:
+				if (strlen(event->UDN) != (size_t) 0) {
+					if (target->kind == SSDP_TARGET_UDN &&
+						!strcasecmp(event->UDN, target->udn))
+						return TRUE;
+					break;
+				}
+				/* fall through */
+			case SSDP_DEVICETYPE:
+				if (target->kind == SSDP_TARGET_DEVICE &&
+					MatchSearchType(event->DeviceType,
+					                target->nt) != 0)
+					return TRUE;
+				break;
+			case SSDP_SERVICE:
+				if (target->kind == SSDP_TARGET_SERVICE &&
+					MatchSearchType(event->ServiceType,
+					                target->nt) != 0)
+					return TRUE;
+				break;
+			default: break;
+		}
+	}
+
+	return FALSE;
+}
 
 int AdvertiseAndReply(int AdFlag, UpnpDevice_Handle Hnd,
                       enum SsdpSearchType SearchType,
                       struct sockaddr *DestAddr, char *DeviceType,
                       char *DeviceUDN, char *ServiceType, int Exp) {
 	int retVal = UPNP_E_SUCCESS;
-	long unsigned int i;
-	long unsigned int j;
+	size_t i;
 	int defaultExp = DEFAULT_MAXAGE;
 	struct Handle_Info *SInfo = NULL;
-	char UDNstr[100];
-	char devType[100];
-	char servType[100];
-	IXML_NodeList *nodeList = NULL;
-	IXML_NodeList *tmpNodeList = NULL;
-	IXML_Node *tmpNode = NULL;
-	IXML_Node *tmpNode2 = NULL;
-	IXML_Node *textNode = NULL;
-	const DOMString tmpStr;
-	const DOMString dbgStr;
+	SsdpPacketCache *cache;
+	SsdpTarget *target;
+	size_t *targets = NULL;
+	size_t numTargets = 0;
+	int msgType;
 	int NumCopy = 0;
 
-	memset(UDNstr, 0, sizeof(UDNstr));
-	memset(devType, 0, sizeof(devType));
-	memset(servType, 0, sizeof(servType));
-
 	UpnpPrintf(UPNP_ALL, API, __FILE__, __LINE__,
 	           "Inside AdvertiseAndReply with AdFlag = %d\n", AdFlag);
 
@@ -118,317 +234,84 @@ int AdvertiseAndReply(int AdFlag, UpnpDevice_Handle Hnd,
 		retVal = UPNP_E_INVALID_HANDLE;
 		goto end_function;
 	}
+	cache = SInfo->SsdpPackets;
+	if (cache == NULL) {
+		retVal = UPNP_E_OUTOF_MEMORY;
+		goto end_function;
+	}
 	defaultExp = SInfo->MaxAge;
-	/* parse the device list and send advertisements/replies */
-	while (NumCopy == 0 || (AdFlag && NumCopy < NUM_SSDP_COPY)) {
-		if (NumCopy != 0)
-			imillisleep(SSDP_PAUSE);
-		NumCopy++;
-		for (i = 0lu;; i++) {
-			UpnpPrintf(UPNP_ALL, API, __FILE__, __LINE__,
-			           "Entering new device list with i = %lu\n",
-			           i);
-			tmpNode = ixmlNodeList_item(SInfo->DeviceList, i);
-			if (!tmpNode) {
-				UpnpPrintf(UPNP_ALL, API, __FILE__, __LINE__,
-				           "Exiting new device list with i = %lu\n",
-				           i);
+	if (cache->count == (size_t) 0)
+		goto end_function;
+	targets = (size_t *) malloc(cache->count * sizeof(size_t));
+	if (targets == NULL) {
+		retVal = UPNP_E_OUTOF_MEMORY;
+		goto end_function;
+	}
+	/* select the packets to send, the DOM is not traversed here: the
+	 * targets were collected at registration */
+	for (i = 0; i < cache->count; i++) {
+		target = &cache->targets[i];
+		if (AdFlag || SearchType == SSDP_ALL) {
+			targets[numTargets++] = i;
+			continue;
+		}
+		switch (SearchType) {
+			case SSDP_ROOTDEVICE:
+				if (target->kind == SSDP_TARGET_ROOT)
+					targets[numTargets++] = i;
 				break;
-			}
-			dbgStr = ixmlNode_getNodeName(tmpNode);
-			UpnpPrintf(UPNP_INFO, API, __FILE__, __LINE__,
-			           "Extracting device type once for %s\n",
-			           dbgStr);
-			ixmlNodeList_free(nodeList);
-			nodeList = ixmlElement_getElementsByTagName((IXML_Element *) tmpNode, "deviceType");
-			if (!nodeList)
-				continue;
-			UpnpPrintf(UPNP_ALL, API, __FILE__, __LINE__,
-			           "Extracting UDN for %s\n", dbgStr);
-			UpnpPrintf(UPNP_ALL, API, __FILE__, __LINE__,
-			           "Extracting device type\n");
-			tmpNode2 = ixmlNodeList_item(nodeList, 0lu);
-			if (!tmpNode2)
-				continue;
-			textNode = ixmlNode_getFirstChild(tmpNode2);
-			if (!textNode)
-				continue;
-			UpnpPrintf(UPNP_ALL, API, __FILE__, __LINE__,
-			           "Extracting device type \n");
-			tmpStr = ixmlNode_getNodeValue(textNode);
-			if (!tmpStr)
-				continue;
-			strncpy(devType, tmpStr, sizeof(devType) - 1);
-			UpnpPrintf(UPNP_ALL, API, __FILE__, __LINE__,
-			           "Extracting device type = %s\n", devType);
-			if (!tmpNode) {
-				UpnpPrintf(UPNP_ALL, API, __FILE__, __LINE__,
-				           "TempNode is NULL\n");
-			}
-			dbgStr = ixmlNode_getNodeName(tmpNode);
-			UpnpPrintf(UPNP_ALL, API, __FILE__, __LINE__,
-			           "Extracting UDN for %s\n", dbgStr);
-			ixmlNodeList_free(nodeList);
-			nodeList = ixmlElement_getElementsByTagName((IXML_Element *) tmpNode, "UDN");
-			if (!nodeList) {
-				UpnpPrintf(UPNP_CRITICAL, API, __FILE__,
-				           __LINE__, "UDN not found!\n");
-				continue;
-			}
-			tmpNode2 = ixmlNodeList_item(nodeList, 0lu);
-			if (!tmpNode2) {
-				UpnpPrintf(UPNP_CRITICAL, API, __FILE__,
-				           __LINE__, "UDN not found!\n");
-				continue;
-			}
-			textNode = ixmlNode_getFirstChild(tmpNode2);
-			if (!textNode) {
-				UpnpPrintf(UPNP_CRITICAL, API, __FILE__,
-				           __LINE__, "UDN not found!\n");
-				continue;
-			}
-			tmpStr = ixmlNode_getNodeValue(textNode);
-			if (!tmpStr) {
-				UpnpPrintf(UPNP_CRITICAL, API, __FILE__,
-				           __LINE__, "UDN not found!\n");
-				continue;
-			}
-			strncpy(UDNstr, tmpStr, sizeof(UDNstr) - 1);
-			UpnpPrintf(UPNP_INFO, API, __FILE__, __LINE__,
-			           "Sending UDNStr = %s \n", UDNstr);
-			if (AdFlag) {
-				/* send the device advertisement */
-				if (AdFlag == 1) {
-					DeviceAdvertisement(devType, i == 0lu,
-					                    UDNstr,
-					                    SInfo->DescURL, Exp,
-					                    SInfo->DeviceAf,
-					                    SInfo->PowerState,
-					                    SInfo->SleepPeriod,
-					                    SInfo->RegistrationState);
-				} else {
-					/* AdFlag == -1 */
-					DeviceShutdown(devType, i == 0lu, UDNstr,
-					               SInfo->DescURL,
-					               Exp, SInfo->DeviceAf,
-					               SInfo->PowerState,
-					               SInfo->SleepPeriod,
-					               SInfo->RegistrationState);
-				}
-			} else {
-				switch (SearchType) {
-					case SSDP_ALL:
-						DeviceReply(DestAddr, devType, i == 0lu,
-						            UDNstr, SInfo->DescURL,
-						            defaultExp, SInfo->PowerState,
-						            SInfo->SleepPeriod,
-						            SInfo->RegistrationState);
-						break;
-					case SSDP_ROOTDEVICE:
-						if (i == 0lu) {
-							SendReply(DestAddr, devType, 1,
-							          UDNstr,
-							          SInfo->DescURL,
-							          defaultExp, 0,
-							          SInfo->PowerState,
-							          SInfo->SleepPeriod,
-							          SInfo->RegistrationState);
-						}
-						break;
-					case SSDP_DEVICEUDN: {
-						if (DeviceUDN && strlen(DeviceUDN) != (size_t) 0) {
-							if (strcasecmp(DeviceUDN, UDNstr)) {
-								UpnpPrintf(UPNP_INFO, API, __FILE__, __LINE__,
-								           "DeviceUDN=%s and search UDN=%s DID NOT match\n",
-								           UDNstr, DeviceUDN);
-								break;
-							} else {
-								UpnpPrintf(UPNP_INFO, API, __FILE__, __LINE__,
-								           "DeviceUDN=%s and search UDN=%s MATCH\n",
-								           UDNstr, DeviceUDN);
-								SendReply(DestAddr, devType, 0, UDNstr, SInfo->DescURL, defaultExp, 0,
-								          SInfo->PowerState,
-								          SInfo->SleepPeriod,
-								          SInfo->RegistrationState);
-								break;
-							}
-						}
+			case SSDP_DEVICEUDN:
+				if (DeviceUDN && strlen(DeviceUDN) != (size_t) 0) {
+					if (target->kind == SSDP_TARGET_UDN &&
+						!strcasecmp(DeviceUDN, target->udn)) {
+						UpnpPrintf(UPNP_INFO, API, __FILE__, __LINE__,
+						           "DeviceUDN=%s and search UDN=%s MATCH\n",
+						           target->udn, DeviceUDN);
+						targets[numTargets++] = i;
 					}
-					case SSDP_DEVICETYPE: {
-						if (!strncasecmp(DeviceType, devType, strlen(DeviceType) - (size_t) 2)) {
-							if (atoi(strrchr(DeviceType, ':') + 1)
-								< atoi(&devType[strlen(devType) - (size_t) 1])) {
-								/* the requested version is lower than the device version
-								 * must reply with the lower version number and the lower
-								 * description URL */
-								UpnpPrintf(UPNP_INFO, API, __FILE__, __LINE__,
-								           "DeviceType=%s and search devType=%s MATCH\n",
-								           devType, DeviceType);
-								SendReply(DestAddr, DeviceType, 0, UDNstr, SInfo->LowerDescURL,
-								          defaultExp, 1,
-								          SInfo->PowerState,
-								          SInfo->SleepPeriod,
-								          SInfo->RegistrationState);
-							} else if (atoi(strrchr(DeviceType, ':') + 1)
-								== atoi(&devType[strlen(devType) - (size_t) 1])) {
-								UpnpPrintf(UPNP_INFO, API, __FILE__, __LINE__,
-								           "DeviceType=%s and search devType=%s MATCH\n",
-								           devType, DeviceType);
-								SendReply(DestAddr, DeviceType, 0, UDNstr, SInfo->DescURL,
-								          defaultExp, 1,
-								          SInfo->PowerState,
-								          SInfo->SleepPeriod,
-								          SInfo->RegistrationState);
-							} else {
-								UpnpPrintf(UPNP_INFO, API, __FILE__, __LINE__,
-								           "DeviceType=%s and search devType=%s DID NOT MATCH\n",
-								           devType, DeviceType);
-							}
-						} else {
-							UpnpPrintf(UPNP_INFO, API, __FILE__, __LINE__,
-							           "DeviceType=%s and search devType=%s DID NOT MATCH\n",
-							           devType, DeviceType);
-						}
-						break;
-					}
-					default: break;
-				}
-			}
-			/* send service advertisements for services corresponding
-			 * to the same device */
-			UpnpPrintf(UPNP_INFO, API, __FILE__, __LINE__,
-			           "Sending service Advertisement\n");
-			/* Correct service traversal such that each device's serviceList
-			 * is directly traversed as a child of its parent device. This
-			 * ensures that the service's alive message uses the UDN of
-			 * the parent device. */
-			tmpNode = ixmlNode_getFirstChild(tmpNode);
-			while (tmpNode) {
-				dbgStr = ixmlNode_getNodeName(tmpNode);
-				if (!strncmp
-					(dbgStr, SERVICELIST_STR,
-					 sizeof SERVICELIST_STR)) {
 					break;
 				}
-				tmpNode = ixmlNode_getNextSibling(tmpNode);
-			}
-			ixmlNodeList_free(nodeList);
-			if (!tmpNode) {
-				nodeList = NULL;
-				continue;
-			}
-			nodeList = ixmlElement_getElementsByTagName((IXML_Element *) tmpNode, "service");
-			if (!nodeList) {
-				UpnpPrintf(UPNP_INFO, API, __FILE__, __LINE__,
-				           "Service not found 3\n");
-				continue;
-			}
-			for (j = 0lu;; j++) {
-				tmpNode = ixmlNodeList_item(nodeList, j);
-				if (!tmpNode) {
-					break;
-				}
-				ixmlNodeList_free(tmpNodeList);
-				tmpNodeList = ixmlElement_getElementsByTagName((IXML_Element *) tmpNode, "serviceType");
-				if (!tmpNodeList) {
-					UpnpPrintf(UPNP_CRITICAL, API, __FILE__,
-					           __LINE__,
-					           "ServiceType not found \n");
-					continue;
-				}
-				tmpNode2 = ixmlNodeList_item(tmpNodeList, 0lu);
-				if (!tmpNode2)
-					continue;
-				textNode = ixmlNode_getFirstChild(tmpNode2);
-				if (!textNode)
-					continue;
-				/* servType is of format Servicetype:ServiceVersion */
-				tmpStr = ixmlNode_getNodeValue(textNode);
-				if (!tmpStr)
-					continue;
-				strncpy(servType, tmpStr, sizeof(servType) - 1);
-				UpnpPrintf(UPNP_INFO, API, __FILE__, __LINE__,
-				           "ServiceType = %s\n", servType);
-				if (AdFlag) {
-					if (AdFlag == 1) {
-						ServiceAdvertisement(UDNstr,
-						                     servType, SInfo->DescURL,
-						                     Exp, SInfo->DeviceAf,
-						                     SInfo->PowerState,
-						                     SInfo->SleepPeriod,
-						                     SInfo->RegistrationState);
-					} else {
-						/* AdFlag == -1 */
-						ServiceShutdown(UDNstr,
-						                servType, SInfo->DescURL,
-						                Exp, SInfo->DeviceAf,
-						                SInfo->PowerState,
-						                SInfo->SleepPeriod,
-						                SInfo->RegistrationState);
-					}
-				} else {
-					switch (SearchType) {
-						case SSDP_ALL:
-							ServiceReply(DestAddr, servType,
-							             UDNstr,
-							             SInfo->DescURL,
-							             defaultExp,
-							             SInfo->PowerState,
-							             SInfo->SleepPeriod,
-							             SInfo->RegistrationState);
-							break;
-						case SSDP_SERVICE:
-							if (ServiceType) {
-								if (!strncasecmp(ServiceType, servType, strlen(ServiceType) - (size_t) 2)) {
-									if (atoi(strrchr(ServiceType, ':') + 1) <
-										atoi(&servType[strlen(servType) - (size_t) 1])) {
-										/* the requested version is lower than the service version
-										 * must reply with the lower version number and the lower
-										 * description URL */
-										UpnpPrintf(UPNP_INFO, API, __FILE__, __LINE__,
-										           "ServiceType=%s and search servType=%s MATCH\n",
-										           ServiceType, servType);
-										SendReply(DestAddr, ServiceType, 0, UDNstr, SInfo->LowerDescURL,
-										          defaultExp, 1,
-										          SInfo->PowerState,
-										          SInfo->SleepPeriod,
-										          SInfo->RegistrationState);
-									} else if (atoi(strrchr(ServiceType, ':') + 1) ==
-										atoi(&servType[strlen(servType) - (size_t) 1])) {
-										UpnpPrintf(UPNP_INFO, API, __FILE__, __LINE__,
-										           "ServiceType=%s and search servType=%s MATCH\n",
-										           ServiceType, servType);
-										SendReply(DestAddr, ServiceType, 0, UDNstr, SInfo->DescURL,
-										          defaultExp, 1,
-										          SInfo->PowerState,
-										          SInfo->SleepPeriod,
-										          SInfo->RegistrationState);
-									} else {
-										UpnpPrintf(UPNP_INFO, API, __FILE__, __LINE__,
-										           "ServiceType=%s and search servType=%s DID NOT MATCH\n",
-										           ServiceType, servType);
-									}
-								} else {
-									UpnpPrintf(UPNP_INFO, API, __FILE__, __LINE__,
-									           "ServiceType=%s and search servType=%s DID NOT MATCH\n",
-									           ServiceType, servType);
-								}
-							}
-							break;
-						default: break;
-					}
-				}
-			}
-			ixmlNodeList_free(tmpNodeList);
-			tmpNodeList = NULL;
-			ixmlNodeList_free(nodeList);
-			nodeList = NULL;
+				/* fall through */
+			case SSDP_DEVICETYPE:
+				if (target->kind == SSDP_TARGET_DEVICE &&
+					ReplyByType(SInfo, DestAddr, DeviceType,
+					            target, defaultExp))
+					targets[numTargets++] = i;
+				break;
+			case SSDP_SERVICE:
+				if (ServiceType &&
+					target->kind == SSDP_TARGET_SERVICE &&
+					ReplyByType(SInfo, DestAddr, ServiceType,
+					            target, defaultExp))
+					targets[numTargets++] = i;
+				break;
+			default: break;
 		}
 	}
+	if (AdFlag == 1)
+		msgType = MSGTYPE_ADVERTISEMENT;
+	else if (AdFlag == -1)
+		msgType = MSGTYPE_SHUTDOWN;
+	else
+		msgType = MSGTYPE_REPLY;
+	/* The copies of the advertisements are paced by the timer thread. The
+	 * shutdown messages are sent before returning: the handle, and maybe
+	 * the SDK, go away right after them. */
+	while (NumCopy == 0 || (AdFlag == -1 && NumCopy < NUM_SSDP_COPY)) {
+		if (NumCopy != 0)
+			imillisleep(SSDP_PAUSE);
+		NumCopy++;
+		SsdpSendCachedPackets(cache, msgType, AdFlag ? NULL : DestAddr,
+		                      SInfo->DescURL, AdFlag ? Exp : defaultExp,
+		                      SInfo->DeviceAf, SInfo->PowerState,
+		                      SInfo->SleepPeriod,
+		                      SInfo->RegistrationState,
+		                      targets, numTargets,
+		                      AdFlag == 1 ? NUM_SSDP_COPY : 1);
+	}
 
 	end_function:
-	ixmlNodeList_free(tmpNodeList);
-	ixmlNodeList_free(nodeList);
+	free(targets);
 	UpnpPrintf(UPNP_ALL, API, __FILE__, __LINE__,
 	           "Exiting AdvertiseAndReply.\n");
 	HandleUnlock();
@@ -547,6 +430,7 @@ int ssdp_request_type(char *cmd, SsdpEvent *Evt) {
 	return 0;
 }
 
+#ifdef INCLUDE_CLIENT_APIS
 /*!
  * \brief Frees the ssdp request.
  */
@@ -563,6 +447,7 @@ static void free_ssdp_event_handler_data(
 		free(data);
 	}
 }
+#endif /* INCLUDE_CLIENT_APIS */
 
 /*!
  * \brief Does some quick checking of the ssdp msg.
@@ -607,20 +492,15 @@ static UPNP_INLINE int valid_ssdp_msg(
 }
 
 /*!
- * \brief Parses the message and dispatches it to a handler which handles the
- * ssdp request msg.
+ * \brief Parses a SSDP message and does some quick checking of it.
  *
  * \return 0 if successful, -1 if error.
  */
-static UPNP_INLINE int start_event_handler(
-	/*! [in] ssdp_thread_data structure. This structure contains SSDP
-	 * request message. */
-	void *Data) {
-	http_parser_t *parser = NULL;
+static int parse_ssdp_msg(
+	/*! [in] Parser holding the SSDP message. */
+	http_parser_t *parser) {
 	parse_status_t status;
-	ssdp_thread_data *data = (ssdp_thread_data *) Data;
 
-	parser = &data->parser;
 	status = parser_parse(parser);
 	if (status == (parse_status_t) PARSE_FAILURE) {
 		if (parser->msg.method != (http_method_t) HTTPMETHOD_NOTIFY ||
@@ -628,29 +508,46 @@ static UPNP_INLINE int start_event_handler(
 			UpnpPrintf(UPNP_INFO, SSDP, __FILE__, __LINE__,
 			           "SSDP recvd bad msg code = %d\n", status);
 			/* ignore bad msg, or not enuf mem */
-			goto error_handler;
+			return -1;
 		}
 		/* valid notify msg */
 	} else if (status != (parse_status_t) PARSE_SUCCESS) {
 		UpnpPrintf(UPNP_INFO, SSDP, __FILE__, __LINE__,
 		           "SSDP recvd bad msg code = %d\n", status);
 
-		goto error_handler;
+		return -1;
 	}
 	/* check msg */
 	if (valid_ssdp_msg(&parser->msg) != TRUE) {
-		goto error_handler;
+		return -1;
 	}
-	/* done; thread will free 'data' */
+
 	return 0;
+}
 
-	error_handler:
-	free_ssdp_event_handler_data(data);
-	return -1;
+#ifdef INCLUDE_CLIENT_APIS
+/*!
+ * \brief Parses the message of a job.
+ *
+ * \return 0 if successful, -1 if error.
+ */
+static UPNP_INLINE int start_event_handler(
+	/*! [in] ssdp_thread_data structure. This structure contains SSDP
+	 * request message. */
+	void *Data) {
+	ssdp_thread_data *data = (ssdp_thread_data *) Data;
+
+	if (parse_ssdp_msg(&data->parser) != 0) {
+		free_ssdp_event_handler_data(data);
+		return -1;
+	}
+	/* done; thread will free 'data' */
+	return 0;
 }
 
 /*!
- * \brief This function is a thread that handles SSDP requests.
+ * \brief This function is a thread that passes a SSDP message to the
+ * control point callback.
  */
 static void ssdp_event_handler_thread(
 	/*! [] ssdp_thread_data structure. This structure contains SSDP
@@ -661,101 +558,525 @@ static void ssdp_event_handler_thread(
 
 	if (start_event_handler(the_data) != 0)
 		return;
-	/* send msg to device or ctrlpt */
-	if (hmsg->method == (http_method_t) HTTPMETHOD_NOTIFY ||
-		hmsg->request_method == (http_method_t) HTTPMETHOD_MSEARCH) {
-#ifdef INCLUDE_CLIENT_APIS
-		ssdp_handle_ctrlpt_msg(hmsg,
-		                       &data->dest_addr,
-		                       FALSE, NULL);
-#endif /* INCLUDE_CLIENT_APIS */
-	} else {
-		ssdp_handle_device_request(hmsg,
-		                           &data->dest_addr);
-	}
+	ssdp_handle_ctrlpt_msg(hmsg, &data->dest_addr, FALSE, NULL);
 
 	/* free data */
 	free_ssdp_event_handler_data(data);
 }
+#endif /* INCLUDE_CLIENT_APIS */
 
-void readFromSSDPSocket(SOCKET socket) {
-	char *requestBuf = NULL;
-	char staticBuf[BUFSIZE];
-	struct sockaddr_storage __ss;
+/*! Datagrams read by the last recvmmsg() call. Only the miniserver thread
+ * reads the SSDP sockets, so the ring is reused without locking. The
+ * buffers are lent to the parser, which may resize them. */
+static membuffer gSsdpRecvRing[SSDP_RECV_BATCH];
+/*! Senders of the datagrams of the ring. */
+static struct sockaddr_storage gSsdpRecvAddr[SSDP_RECV_BATCH];
+
+/*!
+ * \brief Makes a slot of the ring large enough for a datagram, before its
+ * first use or after the parser shrank it.
+ *
+ * \return The buffer of the slot, NULL if out of memory.
+ */
+static char *get_ring_slot(
+	/*! [in] Index of the slot. */
+	int i) {
+	membuffer *m = &gSsdpRecvRing[i];
+
+	if (m->buf == NULL)
+		membuffer_init(m);
+	m->length = (size_t) 0;
+	if (membuffer_set_size(m, BUFSIZE - (size_t) 1) != 0)
+		return NULL;
+
+	return m->buf;
+}
+
+void SsdpFreeRecvRing(void) {
+	int i;
+
+	for (i = 0; i < SSDP_RECV_BATCH; i++)
+		membuffer_destroy(&gSsdpRecvRing[i]);
+}
+
+/*!
+ * \brief Initializes a parser for a message read from a SSDP socket.
+ */
+static void init_ssdp_parser(
+	/*! [in] SSDP socket. */
+	SOCKET socket,
+	/*! [out] Parser. */
+	http_parser_t *parser) {
+#ifdef INCLUDE_CLIENT_APIS
+	if (socket == gSsdpReqSocket4
+		#ifdef UPNP_ENABLE_IPV6
+		|| socket == gSsdpReqSocket6
+		#endif /* UPNP_ENABLE_IPV6 */
+		)
+		parser_response_init(parser, HTTPMETHOD_MSEARCH);
+	else
+		parser_request_init(parser);
+#else /* INCLUDE_CLIENT_APIS */
+	parser_request_init(parser);
+#endif /* INCLUDE_CLIENT_APIS */
+}
+
+#ifdef INCLUDE_CLIENT_APIS
+/*!
+ * \brief Queues a job passing a message to the control point callback.
+ * The job has its own copy of the datagram, as the ring is reused by the
+ * next read.
+ */
+static void queue_ctrlpt_msg(
+	/*! [in] SSDP socket. */
+	SOCKET socket,
+	/*! [in] Datagram. */
+	const char *buf,
+	/*! [in] Length of the datagram. */
+	size_t length,
+	/*! [in] Sender. */
+	struct sockaddr_storage *addr) {
 	ThreadPoolJob job;
-	ssdp_thread_data *data = NULL;
-	socklen_t socklen = sizeof(__ss);
-	ssize_t byteReceived = 0;
-	char ntop_buf[INET6_ADDRSTRLEN];
+	ssdp_thread_data *data;
 
 	memset(&job, 0, sizeof(job));
-
-	requestBuf = staticBuf;
-	/* in case memory can't be allocated, still drain the socket using a
-	 * static buffer. */
 	data = malloc(sizeof(ssdp_thread_data));
-	if (data) {
-		/* initialize parser */
+	if (data == NULL)
+		return;
+	init_ssdp_parser(socket, &data->parser);
+	if (membuffer_assign(&data->parser.msg.msg, buf, length) != 0) {
+		free_ssdp_event_handler_data(data);
+		return;
+	}
+	memcpy(&data->dest_addr, addr, sizeof(data->dest_addr));
+	TPJobInit(&job, (start_routine) ssdp_event_handler_thread, data);
+	TPJobSetFreeFunction(&job, free_ssdp_event_handler_data);
+	TPJobSetPriority(&job, MED_PRIORITY);
+	if (ThreadPoolAdd(&gRecvThreadPool, &job, NULL) != 0)
+		free_ssdp_event_handler_data(data);
+}
+#endif /* INCLUDE_CLIENT_APIS */
+
+/*! Protects gSsdpRecvStats. */
+static ithread_mutex_t gSsdpRecvStatsMutex;
+
+/*! Counters of the datagrams read by readFromSSDPSocket(). */
+static SsdpRecvStats gSsdpRecvStats;
+
+void SsdpGetRecvStats(SsdpRecvStats *stats) {
+	ithread_mutex_lock(&gSsdpRecvStatsMutex);
+	*stats = gSsdpRecvStats;
+	ithread_mutex_unlock(&gSsdpRecvStatsMutex);
+}
+
+/*! What the SSDP listener needs of a registered device. */
+typedef struct {
+	/*! Handle of the device, -1 if none is registered. */
+	UpnpDevice_Handle handle;
+	/*! Advertisement age of the device. */
+	int maxAge;
+	/*! Targets of the device, NULL if not built. The cache is freed only
+	 * after the device is removed from the snapshot. */
+	SsdpPacketCache *packets;
+} SsdpDeviceSnapshot;
+
+/*! What the SSDP listener needs of the registered handles, copied by
+ * SsdpUpdateHandleSnapshot() so that the miniserver thread never waits for
+ * HandleLock, which a registration holds while it downloads a description
+ * served by the same thread. */
+typedef struct {
+	/*! TRUE while a control point is registered. */
+	int ctrlpt;
+	/*! Number of searches in progress. */
+	long searches;
+	/*! Devices by address family, IPv4 then IPv6. */
+	SsdpDeviceSnapshot devices[2];
+} SsdpHandleSnapshot;
+
+/*! Protects gSsdpHandleSnapshot. Never held while taking another lock. */
+static ithread_mutex_t gSsdpHandleSnapshotMutex;
+
+/*! Copy of the registered handles. */
+static SsdpHandleSnapshot gSsdpHandleSnapshot = {
+	FALSE, 0L, {{-1, 0, NULL}, {-1, 0, NULL}}};
+
+int SsdpInitServerLocks(void) {
+	if (ithread_mutex_init(&gSsdpRecvStatsMutex, NULL) != 0)
+		return UPNP_E_INIT_FAILED;
+	if (ithread_mutex_init(&gSsdpHandleSnapshotMutex, NULL) != 0) {
+		ithread_mutex_destroy(&gSsdpRecvStatsMutex);
+		return UPNP_E_INIT_FAILED;
+	}
+
+	return UPNP_E_SUCCESS;
+}
+
+void SsdpDestroyServerLocks(void) {
+	ithread_mutex_destroy(&gSsdpHandleSnapshotMutex);
+	ithread_mutex_destroy(&gSsdpRecvStatsMutex);
+}
+
+void SsdpUpdateHandleSnapshot(void) {
+#ifdef INCLUDE_DEVICE_APIS
+	static const int families[2] = {AF_INET, AF_INET6};
+#endif /* INCLUDE_DEVICE_APIS */
+	SsdpHandleSnapshot snapshot;
+	struct Handle_Info *info = NULL;
+	int handle;
+	int i;
+
+	memset(&snapshot, 0, sizeof(snapshot));
 #ifdef INCLUDE_CLIENT_APIS
-		if (socket == gSsdpReqSocket4
-			#ifdef UPNP_ENABLE_IPV6
-			|| socket == gSsdpReqSocket6
-			#endif /* UPNP_ENABLE_IPV6 */
-			)
-			parser_response_init(&data->parser, HTTPMETHOD_MSEARCH);
-		else
-			parser_request_init(&data->parser);
-#else /* INCLUDE_CLIENT_APIS */
-		parser_request_init(&data->parser);
+	if (GetClientHandleInfo(&handle, &info) == HND_CLIENT) {
+		snapshot.ctrlpt = TRUE;
+		snapshot.searches = ListSize(&info->SsdpSearchList);
+	}
 #endif /* INCLUDE_CLIENT_APIS */
-		/* set size of parser buffer */
-		if (membuffer_set_size(&data->parser.msg.msg, BUFSIZE) == 0)
-			/* use this as the buffer for recv */
-			requestBuf = data->parser.msg.msg.buf;
-		else {
-			free(data);
-			data = NULL;
+	for (i = 0; i < 2; i++) {
+		snapshot.devices[i].handle = -1;
+#ifdef INCLUDE_DEVICE_APIS
+		if (GetDeviceHandleInfo(families[i], &handle, &info) ==
+		    HND_DEVICE) {
+			snapshot.devices[i].handle = handle;
+			snapshot.devices[i].maxAge = info->MaxAge;
+			snapshot.devices[i].packets = info->SsdpPackets;
 		}
+#endif /* INCLUDE_DEVICE_APIS */
 	}
-	byteReceived = recvfrom(socket, requestBuf, BUFSIZE - (size_t) 1, 0,
-	                        (struct sockaddr *) &__ss, &socklen);
-	if (byteReceived > 0) {
-		requestBuf[byteReceived] = '\0';
-		switch (__ss.ss_family) {
-			case AF_INET: inet_ntop(AF_INET, &((struct sockaddr_in *) &__ss)->sin_addr, ntop_buf, sizeof(ntop_buf));
-				break;
+	ithread_mutex_lock(&gSsdpHandleSnapshotMutex);
+	gSsdpHandleSnapshot = snapshot;
+	ithread_mutex_unlock(&gSsdpHandleSnapshotMutex);
+}
+
+int SsdpGetSnapshotDevice(int family, UpnpDevice_Handle *handle,
+                          int *maxAge) {
+	SsdpDeviceSnapshot *device;
+
+	switch (family) {
+		case AF_INET: device = &gSsdpHandleSnapshot.devices[0];
+			break;
+		case AF_INET6: device = &gSsdpHandleSnapshot.devices[1];
+			break;
+		default: return FALSE;
+	}
+	ithread_mutex_lock(&gSsdpHandleSnapshotMutex);
+	*handle = device->handle;
+	*maxAge = device->maxAge;
+	ithread_mutex_unlock(&gSsdpHandleSnapshotMutex);
+
+	return *handle != -1;
+}
+
+/*!
+ * \brief Finds the NT, ST and MAN headers of a raw SSDP message. The values
+ * are trimmed, the headers not found have a NULL buffer.
+ */
+static void scan_ssdp_headers(
+	/*! [in] Message, null-terminated. */
+	char *buf,
+	/*! [out] NT header. */
+	memptr *nt,
+	/*! [out] ST header. */
+	memptr *st,
+	/*! [out] MAN header. */
+	memptr *man) {
+	char *line;
+	char *end;
+	char *colon;
+	char *value;
+	size_t len;
+	size_t nameLen;
+	memptr *hdr;
+
+	nt->buf = st->buf = man->buf = NULL;
+	nt->length = st->length = man->length = (size_t) 0;
+	/* skip the start line */
+	line = strchr(buf, '\n');
+	while (line != NULL) {
+		line++;
+		end = strchr(line, '\n');
+		len = end != NULL ? (size_t) (end - line) : strlen(line);
+		if (len > (size_t) 0 && line[len - (size_t) 1] == '\r')
+			len--;
+		if (len == (size_t) 0)
+			/* end of the headers */
+			break;
+		colon = memchr(line, ':', len);
+		if (colon != NULL) {
+			nameLen = (size_t) (colon - line);
+			hdr = NULL;
+			if (nameLen == (size_t) 2 && !strncasecmp(line, "NT", nameLen))
+				hdr = nt;
+			else if (nameLen == (size_t) 2 &&
+			         !strncasecmp(line, "ST", nameLen))
+				hdr = st;
+			else if (nameLen == (size_t) 3 &&
+			         !strncasecmp(line, "MAN", nameLen))
+				hdr = man;
+			if (hdr != NULL) {
+				value = colon + 1;
+				len -= nameLen + (size_t) 1;
+				while (len > (size_t) 0 && (*value == ' ' || *value == '\t')) {
+					value++;
+					len--;
+				}
+				while (len > (size_t) 0 && (value[len - (size_t) 1] == ' ' ||
+				                            value[len - (size_t) 1] == '\t'))
+					len--;
+				hdr->buf = value;
+				hdr->length = len;
+			}
+		}
+		line = end;
+	}
+}
+
+/*!
+ * \brief Tells whether the control point wants the messages.
+ *
+ * \return TRUE if a control point is registered and, for search replies,
+ * has a search in progress.
+ */
+static int ctrlpt_wants_msg(
+	/*! [in] TRUE for a search reply, FALSE for an advertisement. */
+	int isReply) {
+#ifdef INCLUDE_CLIENT_APIS
+	int ret;
+
+	ithread_mutex_lock(&gSsdpHandleSnapshotMutex);
+	ret = gSsdpHandleSnapshot.ctrlpt &&
+	      (!isReply || gSsdpHandleSnapshot.searches > 0L);
+	ithread_mutex_unlock(&gSsdpHandleSnapshotMutex);
+
+	return ret;
+#else /* INCLUDE_CLIENT_APIS */
+	return FALSE;
+	isReply = isReply;
+#endif /* INCLUDE_CLIENT_APIS */
+}
+
+/*!
+ * \brief Tells whether a device registered for an address family answers
+ * a search target.
+ *
+ * \return TRUE if the device has a matching target.
+ */
+static int device_wants_msg(
+	/*! [in] Address family of the control point. */
+	int family,
+	/*! [in] ST header. */
+	memptr *st) {
+#ifdef INCLUDE_DEVICE_APIS
+	SsdpDeviceSnapshot *device;
+	SsdpEvent event;
+	char save_char;
+	int ret;
+
+	save_char = st->buf[st->length];
+	st->buf[st->length] = '\0';
+	ret = ssdp_request_type(st->buf, &event);
+	st->buf[st->length] = save_char;
+	if (ret == -1)
+		return FALSE;
+	switch (family) {
+		case AF_INET: device = &gSsdpHandleSnapshot.devices[0];
+			break;
+		case AF_INET6: device = &gSsdpHandleSnapshot.devices[1];
+			break;
+		default: return FALSE;
+	}
+	ithread_mutex_lock(&gSsdpHandleSnapshotMutex);
+	if (device->handle == -1)
+		ret = FALSE;
+	else if (device->packets == NULL)
+		/* let AdvertiseAndReply() report it */
+		ret = TRUE;
+	else
+		ret = HostsSearchTarget(device->packets, &event);
+	ithread_mutex_unlock(&gSsdpHandleSnapshotMutex);
+
+	return ret;
+#else /* INCLUDE_DEVICE_APIS */
+	return FALSE;
+	family = family;
+	st = st;
+#endif /* INCLUDE_DEVICE_APIS */
+}
+
+/*!
+ * \brief Reads the start line and the NT, ST and MAN headers of a datagram
+ * to drop, before any allocation, the messages that nobody here would
+ * handle: advertisements without a control point, search replies without
+ * a search in progress and searches for targets that are not hosted.
+ *
+ * \return TRUE if the datagram must be parsed and handled, FALSE to drop it.
+ */
+static int prefilter_ssdp_msg(
+	/*! [in] Datagram, null-terminated. */
+	char *buf,
+	/*! [in] Sender. */
+	struct sockaddr_storage *addr) {
+	memptr nt;
+	memptr st;
+	memptr man;
+
+	scan_ssdp_headers(buf, &nt, &st, &man);
+	if (!strncmp(buf, "NOTIFY ", strlen("NOTIFY ")))
+		return nt.buf != NULL && ctrlpt_wants_msg(FALSE);
+	if (!strncmp(buf, "HTTP/", strlen("HTTP/")))
+		return st.buf != NULL && ctrlpt_wants_msg(TRUE);
+	if (!strncmp(buf, "M-SEARCH ", strlen("M-SEARCH ")))
+		return man.buf != NULL &&
+		       memptr_cmp(&man, "\"ssdp:discover\"") == 0 &&
+		       st.buf != NULL &&
+		       device_wants_msg((int) addr->ss_family, &st);
+
+	return FALSE;
+}
+
+/*!
+ * \brief Parses a datagram of the ring in place and handles it. The search
+ * requests are handled right away, as they only schedule the replies. A
+ * job is queued only for the messages passed to the control point
+ * callback. The datagrams refused by prefilter_ssdp_msg() are not parsed.
+ *
+ * The parser owns the buffer of the slot while it parses, as decoding a
+ * chunked body resizes it, and gives it back to the ring afterwards.
+ *
+ * \return TRUE if the datagram was dispatched, FALSE if it was filtered or
+ * could not be parsed.
+ */
+static int handle_ssdp_datagram(
+	/*! [in] SSDP socket. */
+	SOCKET socket,
+	/*! [in,out] Slot of the ring holding the datagram, null-terminated. */
+	membuffer *slot,
+	/*! [in] Sender. */
+	struct sockaddr_storage *addr) {
+	http_parser_t parser;
+	http_message_t *hmsg = &parser.msg;
+	char *buf = slot->buf;
+	char ntop_buf[INET6_ADDRSTRLEN];
+	int ret = FALSE;
+
+	switch (addr->ss_family) {
+		case AF_INET: inet_ntop(AF_INET, &((struct sockaddr_in *) addr)->sin_addr, ntop_buf, sizeof(ntop_buf));
+			break;
 #ifdef UPNP_ENABLE_IPV6
-			case AF_INET6:
-				inet_ntop(AF_INET6,
-					  &((struct sockaddr_in6 *)&__ss)->sin6_addr,
-					  ntop_buf, sizeof(ntop_buf));
-				break;
+		case AF_INET6:
+			inet_ntop(AF_INET6,
+				  &((struct sockaddr_in6 *)addr)->sin6_addr,
+				  ntop_buf, sizeof(ntop_buf));
+			break;
 #endif /* UPNP_ENABLE_IPV6 */
-			default: memset(ntop_buf, 0, sizeof(ntop_buf));
-				strncpy(ntop_buf, "<Invalid address family>",
-				        sizeof(ntop_buf) - 1);
-		}
-		UpnpPrintf(UPNP_INFO, SSDP, __FILE__, __LINE__,
-		           "Start of received response ----------------------------------------------------\n"
-			           "%s\n"
-			           "End of received response ------------------------------------------------------\n"
-			           "From host %s\n", requestBuf, ntop_buf);
-		/* add thread pool job to handle request */
-		if (data != NULL) {
-			data->parser.msg.msg.length += (size_t) byteReceived;
-			/* null-terminate */
-			data->parser.msg.msg.buf[byteReceived] = 0;
-			memcpy(&data->dest_addr, &__ss, sizeof(__ss));
-			TPJobInit(&job, (start_routine)
-				ssdp_event_handler_thread, data);
-			TPJobSetFreeFunction(&job,
-			                     free_ssdp_event_handler_data);
-			TPJobSetPriority(&job, MED_PRIORITY);
-			if (ThreadPoolAdd(&gRecvThreadPool, &job, NULL) != 0)
-				free_ssdp_event_handler_data(data);
-		}
-	} else
-		free_ssdp_event_handler_data(data);
+		default: memset(ntop_buf, 0, sizeof(ntop_buf));
+			strncpy(ntop_buf, "<Invalid address family>",
+			        sizeof(ntop_buf) - 1);
+	}
+	UpnpPrintf(UPNP_INFO, SSDP, __FILE__, __LINE__,
+	           "Start of received response ----------------------------------------------------\n"
+		           "%s\n"
+		           "End of received response ------------------------------------------------------\n"
+		           "From host %s\n", buf, ntop_buf);
+	if (!prefilter_ssdp_msg(buf, addr))
+		return FALSE;
+	init_ssdp_parser(socket, &parser);
+	hmsg->msg = *slot;
+	if (parse_ssdp_msg(&parser) != 0)
+		goto exit_function;
+	if (hmsg->method == (http_method_t) HTTPMETHOD_NOTIFY ||
+		hmsg->request_method == (http_method_t) HTTPMETHOD_MSEARCH) {
+#ifdef INCLUDE_CLIENT_APIS
+		queue_ctrlpt_msg(socket, hmsg->msg.buf, hmsg->msg.length,
+		                 addr);
+#endif /* INCLUDE_CLIENT_APIS */
+	} else {
+		ssdp_handle_device_request(hmsg, addr);
+	}
+	ret = TRUE;
+
+	exit_function:
+	/* the buffer goes back to the ring */
+	*slot = hmsg->msg;
+	membuffer_init(&hmsg->msg);
+	httpmsg_destroy(hmsg);
+
+	return ret;
+}
+
+void readFromSSDPSocket(SOCKET socket) {
+#ifdef UPNP_ENABLE_RECVMMSG
+	struct mmsghdr msgs[SSDP_RECV_BATCH];
+	struct iovec iov[SSDP_RECV_BATCH];
+	int count;
+	int i;
+	unsigned long dispatched = 0UL;
+	unsigned long filtered = 0UL;
+	char drop;
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < SSDP_RECV_BATCH; i++) {
+		iov[i].iov_base = get_ring_slot(i);
+		if (iov[i].iov_base == NULL)
+			break;
+		iov[i].iov_len = BUFSIZE - (size_t) 1;
+		msgs[i].msg_hdr.msg_name = &gSsdpRecvAddr[i];
+		msgs[i].msg_hdr.msg_namelen = sizeof(gSsdpRecvAddr[i]);
+		msgs[i].msg_hdr.msg_iov = &iov[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+	if (i == 0) {
+		/* out of memory, the datagram is read into a byte and dropped */
+		recv(socket, &drop, sizeof(drop), 0);
+		return;
+	}
+	/* the socket is readable: read what is queued, without waiting */
+	count = recvmmsg(socket, msgs, (unsigned int) i, MSG_DONTWAIT, NULL);
+	for (i = 0; i < count; i++) {
+		if (msgs[i].msg_len == 0)
+			continue;
+		gSsdpRecvRing[i].length = (size_t) msgs[i].msg_len;
+		gSsdpRecvRing[i].buf[msgs[i].msg_len] = '\0';
+		if (handle_ssdp_datagram(socket, &gSsdpRecvRing[i],
+		                         &gSsdpRecvAddr[i]))
+			dispatched++;
+		else
+			filtered++;
+	}
+	if (count > 0) {
+		ithread_mutex_lock(&gSsdpRecvStatsMutex);
+		gSsdpRecvStats.dispatched += dispatched;
+		gSsdpRecvStats.filtered += filtered;
+		ithread_mutex_unlock(&gSsdpRecvStatsMutex);
+	}
+#else /* UPNP_ENABLE_RECVMMSG */
+	socklen_t socklen = sizeof(gSsdpRecvAddr[0]);
+	ssize_t byteReceived;
+	int dispatched;
+	char *buf = get_ring_slot(0);
+	char drop;
+
+	if (buf == NULL) {
+		/* out of memory, the datagram is read into a byte and dropped */
+		recv(socket, &drop, sizeof(drop), 0);
+		return;
+	}
+	byteReceived = recvfrom(socket, buf, BUFSIZE - (size_t) 1,
+	                        0, (struct sockaddr *) &gSsdpRecvAddr[0],
+	                        &socklen);
+	if (byteReceived > 0) {
+		gSsdpRecvRing[0].length = (size_t) byteReceived;
+		buf[byteReceived] = '\0';
+		dispatched = handle_ssdp_datagram(socket, &gSsdpRecvRing[0],
+		                                  &gSsdpRecvAddr[0]);
+		ithread_mutex_lock(&gSsdpRecvStatsMutex);
+		if (dispatched)
+			gSsdpRecvStats.dispatched++;
+		else
+			gSsdpRecvStats.filtered++;
+		ithread_mutex_unlock(&gSsdpRecvStatsMutex);
+	}
+#endif /* UPNP_ENABLE_RECVMMSG */
 }
 
 /*!
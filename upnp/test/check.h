@@ -0,0 +1,23 @@
+#ifndef UPNP_TEST_CHECK_H
+#define UPNP_TEST_CHECK_H
+
+#include <stdio.h>
+
+/*!
+ * \brief Prints the condition if it does not hold, at the given line of the
+ * test file.
+ *
+ * \return 0 if the condition holds, 1 otherwise.
+ */
+#define CHECK_AT(cond, line) check((cond), #cond, __FILE__, (line))
+#define CHECK(cond) CHECK_AT(cond, __LINE__)
+
+static inline int
+check(int ok, const char *cond, const char *file, int line) {
+	if (ok)
+		return 0;
+	printf("%s:%d:  %s\n", file, line, cond);
+	return 1;
+}
+
+#endif /* UPNP_TEST_CHECK_H */
@@ -0,0 +1,172 @@
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "upnp.h"
+#include "ixml.h"
+#include "check.h"
+
+#define HEADER "<e:propertyset xmlns:e=\"urn:schemas-upnp-org:event-1-0\">\n"
+#define FOOTER "</e:propertyset>\n\n"
+
+/* The writer holds exactly the expected document. */
+static int
+same(const UpnpPropertySetWriter *p, const char *expect, int line) {
+	const char *s = UpnpPropertySetWriter_get_String(p);
+
+	if (strcmp(s, expect) == 0 &&
+	    UpnpPropertySetWriter_get_Length(p) == strlen(expect))
+		return 0;
+	printf("%s:%d:  '%s' (%lu) != '%s'\n", __FILE__, line, s,
+	       (unsigned long) UpnpPropertySetWriter_get_Length(p), expect);
+	return 1;
+}
+
+/* The value of a variable, read back from the parsed property set. */
+static char *
+parsed_value(const UpnpPropertySetWriter *p, const char *name) {
+	IXML_Document *doc = NULL;
+	IXML_NodeList *nodes;
+	IXML_Node *text;
+	char *value = NULL;
+
+	if (ixmlParseBufferEx(UpnpPropertySetWriter_get_String(p), &doc) !=
+	    IXML_SUCCESS)
+		return NULL;
+	nodes = ixmlDocument_getElementsByTagName(doc, name);
+	if (nodes != NULL) {
+		text = ixmlNode_getFirstChild(ixmlNodeList_item(nodes, 0));
+		value = strdup(text ? ixmlNode_getNodeValue(text) : "");
+		ixmlNodeList_free(nodes);
+	}
+	ixmlDocument_free(doc);
+	return value;
+}
+
+static int
+test_output(void) {
+	UpnpPropertySetWriter *p = UpnpPropertySetWriter_new();
+	int ret = 0;
+
+	ret |= same(p, HEADER FOOTER, __LINE__);
+	ret |= CHECK(UpnpPropertySetWriter_add(p, "Volume", "42") ==
+	             UPNP_E_SUCCESS);
+	ret |= CHECK(UpnpPropertySetWriter_add(p, "Empty", "") ==
+	             UPNP_E_SUCCESS);
+	ret |= same(p, HEADER
+	            "<e:property>\n<Volume>42</Volume>\n</e:property>\n"
+	            "<e:property>\n<Empty></Empty>\n</e:property>\n"
+	            FOOTER, __LINE__);
+
+	/* the buffer is reused after clearing */
+	UpnpPropertySetWriter_clear(p);
+	ret |= same(p, HEADER FOOTER, __LINE__);
+	ret |= CHECK(UpnpPropertySetWriter_add(p, "Mute", "1") ==
+	             UPNP_E_SUCCESS);
+	ret |= same(p, HEADER
+	            "<e:property>\n<Mute>1</Mute>\n</e:property>\n"
+	            FOOTER, __LINE__);
+
+	/* invalid parameters leave the property set as it was */
+	ret |= CHECK(UpnpPropertySetWriter_add(p, NULL, "1") ==
+	             UPNP_E_INVALID_PARAM);
+	ret |= CHECK(UpnpPropertySetWriter_add(p, "Mute", NULL) ==
+	             UPNP_E_INVALID_PARAM);
+	ret |= CHECK(UpnpPropertySetWriter_add(NULL, "Mute", "1") ==
+	             UPNP_E_INVALID_PARAM);
+	ret |= same(p, HEADER
+	            "<e:property>\n<Mute>1</Mute>\n</e:property>\n"
+	            FOOTER, __LINE__);
+	UpnpPropertySetWriter_delete(p);
+	UpnpPropertySetWriter_delete(NULL);
+	return ret;
+}
+
+static const struct {
+	const char *value;
+	const char *escaped;
+} ESCAPES[] = {
+	{"<", "&lt;"},
+	{">", "&gt;"},
+	{"&", "&amp;"},
+	{"\"", "&quot;"},
+	{"'", "&apos;"},
+	{"a<b>&c", "a&lt;b&gt;&amp;c"},
+	{"&amp;", "&amp;amp;"},
+	{"<Event xmlns=\"urn:schemas-upnp-org:metadata-1-0/AVT/\">"
+	 "<InstanceID val='0'/></Event>",
+	 "&lt;Event xmlns=&quot;urn:schemas-upnp-org:metadata-1-0/AVT/&quot;&gt;"
+	 "&lt;InstanceID val=&apos;0&apos;/&gt;&lt;/Event&gt;"},
+	{"plain text, no entity", "plain text, no entity"},
+};
+#define ARRAY_SIZE(a) (sizeof (a) / sizeof *(a))
+
+/* The special characters of the values are escaped, and parsing the
+ * property set gives the values back. */
+static int
+test_escape(void) {
+	UpnpPropertySetWriter *p = UpnpPropertySetWriter_new();
+	char expect[1024];
+	char *value;
+	size_t i;
+	int ret = 0;
+
+	for (i = 0; i < ARRAY_SIZE(ESCAPES); i++) {
+		UpnpPropertySetWriter_clear(p);
+		ret |= CHECK(UpnpPropertySetWriter_add(p, "LastChange",
+		                                       ESCAPES[i].value) ==
+		             UPNP_E_SUCCESS);
+		snprintf(expect, sizeof(expect), HEADER
+		         "<e:property>\n<LastChange>%s</LastChange>\n</e:property>\n"
+		         FOOTER, ESCAPES[i].escaped);
+		ret |= same(p, expect, __LINE__);
+		value = parsed_value(p, "LastChange");
+		ret |= CHECK(value != NULL && !strcmp(value, ESCAPES[i].value));
+		free(value);
+	}
+	UpnpPropertySetWriter_delete(p);
+	return ret;
+}
+
+/* Many variables and long values grow the buffer. */
+static int
+test_growth(void) {
+	UpnpPropertySetWriter *p = UpnpPropertySetWriter_new();
+	static char value[8192];
+	char name[32];
+	char *parsed;
+	size_t length;
+	int i, ret = 0;
+
+	memset(value, '&', sizeof(value) - 1);
+	for (i = 0; i < 200; i++) {
+		snprintf(name, sizeof(name), "Var%d", i);
+		length = UpnpPropertySetWriter_get_Length(p);
+		ret |= CHECK(UpnpPropertySetWriter_add(p, name, i % 2 ? value : "x") ==
+		             UPNP_E_SUCCESS);
+		ret |= CHECK(UpnpPropertySetWriter_get_Length(p) ==
+		             length + 2 * strlen(name) +
+		             strlen("<e:property>\n<></>\n</e:property>\n") +
+		             (i % 2 ? 5 * strlen(value) : 1));
+	}
+	ret |= CHECK(UpnpPropertySetWriter_get_Length(p) ==
+	             strlen(UpnpPropertySetWriter_get_String(p)));
+	parsed = parsed_value(p, "Var199");
+	ret |= CHECK(parsed != NULL && !strcmp(parsed, value));
+	free(parsed);
+	UpnpPropertySetWriter_delete(p);
+	return ret;
+}
+
+int
+main(int argc, char *argv[]) {
+	int ret = 0;
+
+	ret += test_output();
+	ret += test_escape();
+	ret += test_growth();
+
+	exit(ret ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+// gcc -o propertyset-writer-test -g test_propertyset_writer.c -I include -L prebuild/Linux -lupnp -lixml -lthreadutil -lpthread
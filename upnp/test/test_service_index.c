@@ -0,0 +1,212 @@
+
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "upnp.h"
+#include "ixml.h"
+#include "service_table.h"
+#include "check.h"
+
+#define DEVICES 40
+#define SERVICES 2
+#define URL_BASE "http://127.0.0.1:49152"
+
+static char doc[64 * 1024];
+
+static void
+append(const char *fmt, ...) {
+	size_t length = strlen(doc);
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(doc + length, sizeof(doc) - length, fmt, ap);
+	va_end(ap);
+}
+
+/* Formats a string, the last four stay valid. */
+static const char *
+str(const char *fmt, ...) {
+	static char bufs[4][256];
+	static int next;
+	char *buf = bufs[next++ % 4];
+	va_list ap;
+
+	va_start(ap, fmt);
+	vsnprintf(buf, sizeof(bufs[0]), fmt, ap);
+	va_end(ap);
+	return buf;
+}
+
+/*
+ * A root device with DEVICES embedded devices of SERVICES services each,
+ * whose serviceIds repeat across the devices. The last device has one more
+ * service, S9, without event URL and with the control URL of the first
+ * service of the document.
+ */
+static IXML_Document *
+description(const char *prefix) {
+	IXML_Document *xml = NULL;
+	int d, s;
+
+	doc[0] = '\0';
+	append("<?xml version=\"1.0\"?>\n"
+	       "<root xmlns=\"urn:schemas-upnp-org:device-1-0\">"
+	       "<URLBase>" URL_BASE "/</URLBase>"
+	       "<device><UDN>uuid:%s-root</UDN><deviceList>", prefix);
+	for (d = 0; d < DEVICES; d++) {
+		append("<device><UDN>uuid:%s-%d</UDN><serviceList>", prefix, d);
+		for (s = 0; s < SERVICES; s++)
+			append("<service>"
+			       "<serviceType>urn:schemas-upnp-org:service:T%d:1</serviceType>"
+			       "<serviceId>urn:upnp-org:serviceId:S%d</serviceId>"
+			       "<SCPDURL>/%s/scpd%d.xml</SCPDURL>"
+			       "<controlURL>/%s/dev%d/ctl%d</controlURL>"
+			       "<eventSubURL>/%s/dev%d/evt%d?sub=1</eventSubURL>"
+			       "</service>",
+			       s, s, prefix, s, prefix, d, s, prefix, d, s);
+		if (d == DEVICES - 1)
+			append("<service>"
+			       "<serviceType>urn:schemas-upnp-org:service:T9:1</serviceType>"
+			       "<serviceId>urn:upnp-org:serviceId:S9</serviceId>"
+			       "<SCPDURL>/%s/scpd9.xml</SCPDURL>"
+			       "<controlURL>/%s/dev0/ctl0</controlURL>"
+			       "</service>",
+			       prefix, prefix);
+		append("</serviceList></device>");
+	}
+	append("</deviceList></device></root>\n");
+	if (ixmlParseBufferEx(doc, &xml) != IXML_SUCCESS) {
+		printf("%s:%d:  cannot parse the description\n", __FILE__, __LINE__);
+		exit(EXIT_FAILURE);
+	}
+	return xml;
+}
+
+static int
+is_service(const service_info *service, const char *prefix, int d, int s) {
+	return service != NULL &&
+	       !strcmp(service->UDN, str("uuid:%s-%d", prefix, d)) &&
+	       !strcmp(service->serviceId, str("urn:upnp-org:serviceId:S%d", s));
+}
+
+/* Every service is found by its control path, its event path and its
+ * (UDN, serviceId), with or without the indexes. */
+static int
+lookups(service_table *table, const char *prefix) {
+	size_t indexSize = table->indexSize;
+	int d, s, pass, ret = 0;
+
+	for (pass = 0; pass < 2; pass++) {
+		/* the second pass walks the service list */
+		if (pass == 1)
+			table->indexSize = 0;
+		for (d = 0; d < DEVICES; d++) {
+			for (s = 0; s < SERVICES; s++) {
+				ret |= CHECK(is_service(FindServiceControlURLPath(table,
+				             str("/%s/dev%d/ctl%d", prefix, d, s)), prefix, d, s));
+				ret |= CHECK(is_service(FindServiceControlURLPath(table,
+				             str(URL_BASE "/%s/dev%d/ctl%d", prefix, d, s)), prefix, d, s));
+				ret |= CHECK(is_service(FindServiceEventURLPath(table,
+				             (char *) str("/%s/dev%d/evt%d?sub=1", prefix, d, s)), prefix, d, s));
+				ret |= CHECK(is_service(FindServiceId(table,
+				             str("urn:upnp-org:serviceId:S%d", s),
+				             str("uuid:%s-%d", prefix, d)), prefix, d, s));
+			}
+		}
+		/* the query is part of the key */
+		ret |= CHECK(FindServiceEventURLPath(table,
+		             (char *) str("/%s/dev0/evt0", prefix)) == NULL);
+		ret |= CHECK(FindServiceControlURLPath(table,
+		             str("/%s/dev%d/ctl0", prefix, DEVICES)) == NULL);
+		ret |= CHECK(FindServiceId(table, "urn:upnp-org:serviceId:S0",
+		             str("uuid:%s-%d", prefix, DEVICES)) == NULL);
+		/* the first service of the list wins when paths are shared */
+		ret |= CHECK(is_service(FindServiceControlURLPath(table,
+		             str("/%s/dev0/ctl0", prefix)), prefix, 0, 0));
+		ret |= CHECK(is_service(FindServiceId(table,
+		             "urn:upnp-org:serviceId:S9",
+		             str("uuid:%s-%d", prefix, DEVICES - 1)),
+		             prefix, DEVICES - 1, 9));
+	}
+	table->indexSize = indexSize;
+	return ret;
+}
+
+static int
+test_get(void) {
+	service_table table;
+	IXML_Document *xml = description("a");
+	service_info *service;
+	int count = 0;
+	int ret = 0;
+
+	memset(&table, 0, sizeof(table));
+	ret |= CHECK(getServiceTable((IXML_Node *) xml, &table, NULL) == 1);
+	for (service = table.serviceList; service; service = service->next)
+		count++;
+	ret |= CHECK(count == DEVICES * SERVICES + 1);
+	ret |= CHECK(table.indexSize >= 2 * (size_t) count);
+	ret |= CHECK((table.indexSize & (table.indexSize - 1)) == 0);
+	ret |= lookups(&table, "a");
+	service = FindServiceId(&table, "urn:upnp-org:serviceId:S9",
+	                        str("uuid:a-%d", DEVICES - 1));
+	ret |= CHECK(service != NULL && service->eventPath == NULL);
+	ret |= CHECK(service != NULL &&
+	             service->controlPath != NULL &&
+	             !strcmp(service->controlPath, "/a/dev0/ctl0"));
+	freeServiceTable(&table);
+	ixmlDocument_free(xml);
+	return ret;
+}
+
+/* The services of a second root device are indexed with the first ones. */
+static int
+test_add(void) {
+	service_table table;
+	IXML_Document *xml1 = description("a");
+	IXML_Document *xml2 = description("b");
+	size_t indexSize;
+	int ret = 0;
+
+	memset(&table, 0, sizeof(table));
+	ret |= CHECK(getServiceTable((IXML_Node *) xml1, &table, NULL) == 1);
+	indexSize = table.indexSize;
+	ret |= CHECK(addServiceTable((IXML_Node *) xml2, &table, NULL) == 1);
+	ret |= CHECK(table.indexSize > indexSize);
+	ret |= lookups(&table, "a");
+	ret |= lookups(&table, "b");
+	freeServiceTable(&table);
+	ixmlDocument_free(xml1);
+	ixmlDocument_free(xml2);
+	return ret;
+}
+
+/* Lookups in an empty table. */
+static int
+test_empty(void) {
+	service_table table;
+	int ret = 0;
+
+	memset(&table, 0, sizeof(table));
+	ret |= CHECK(FindServiceControlURLPath(&table, "/a/dev0/ctl0") == NULL);
+	ret |= CHECK(FindServiceEventURLPath(&table, "/a/dev0/evt0") == NULL);
+	ret |= CHECK(FindServiceId(&table, "urn:upnp-org:serviceId:S0",
+	                           "uuid:a-0") == NULL);
+	ret |= CHECK(FindServiceId(NULL, "urn:upnp-org:serviceId:S0",
+	                           "uuid:a-0") == NULL);
+	return ret;
+}
+
+int
+main(int argc, char *argv[]) {
+	int ret = 0;
+
+	ret += test_get();
+	ret += test_add();
+	ret += test_empty();
+
+	exit(ret ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+// gcc -o service-index-test -g test_service_index.c -I include -I upnp/src/include -L prebuild/Linux -lupnp -lixml -lthreadutil -lpthread
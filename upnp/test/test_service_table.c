@@ -0,0 +1,256 @@
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "upnp.h"
+#include "service_table.h"
+#include "check.h"
+
+/* Far enough in the future for GetSubscriptionSID() not to skip them. */
+static time_t base;
+
+static subscription *
+new_sub(int i, time_t expireTime) {
+	subscription *sub = (subscription *) calloc(1, sizeof(subscription));
+
+	if (sub == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	snprintf(sub->sid, sizeof(Upnp_SID), "uuid:test-%d", i);
+	sub->expireTime = expireTime;
+	sub->active = 1;
+	ListInit(&sub->outgoing, 0, 0);
+	return sub;
+}
+
+static const char *
+sid_of(int i) {
+	static Upnp_SID sid;
+
+	snprintf(sid, sizeof(Upnp_SID), "uuid:test-%d", i);
+	return sid;
+}
+
+/* Checks the list, the hash table and the expiry heap against each other. */
+static int
+consistent(service_info *service, int line) {
+	subscription *sub;
+	subscription *found;
+	size_t i;
+	int listed = 0;
+	int hashed = 0;
+	size_t expiring = 0;
+	int ret = 0;
+
+	for (sub = service->subscriptionList; sub; sub = sub->next) {
+		ret |= CHECK_AT(sub->next == NULL || sub->next->prev == sub, line);
+		if (sub->expireTime != 0)
+			expiring++;
+		for (i = 0; i < service->subscriptionHashSize; i++)
+			for (found = service->subscriptionHash[i]; found;
+			     found = found->hashNext)
+				if (found == sub)
+					hashed++;
+		listed++;
+	}
+	ret |= CHECK_AT(listed == service->TotalSubscriptions, line);
+	ret |= CHECK_AT(hashed == listed, line);
+	ret |= CHECK_AT(expiring == service->expiryHeapCount, line);
+	for (i = 0; i < service->expiryHeapCount; i++) {
+		sub = service->expiryHeap[i];
+		ret |= CHECK_AT(sub->expiryIndex == i + 1, line);
+		ret |= CHECK_AT(i == 0 || service->expiryHeap[(i - 1) / 2]->expireTime <=
+		                          sub->expireTime, line);
+	}
+	return ret;
+}
+
+static void
+clear(service_info *service) {
+	freeSubscriptionList(service->subscriptionList);
+	free(service->subscriptionHash);
+	free(service->expiryHeap);
+	memset(service, 0, sizeof(*service));
+}
+
+/* The heap gives back the expiration times in order. */
+static int
+test_heap_order(void) {
+	service_info service;
+	time_t next;
+	time_t prev = 0;
+	int i, ret = 0;
+
+	memset(&service, 0, sizeof(service));
+	for (i = 0; i < 100; i++) {
+		ret |= CHECK(AddSubscription(&service,
+		                             new_sub(i, base + (i * 37) % 100 + 1)) ==
+		             UPNP_E_SUCCESS);
+		ret |= consistent(&service, __LINE__);
+	}
+	ret |= CHECK(service.expiryHeap[0]->expireTime == base + 1);
+	for (i = 1; i <= 100; i++) {
+		next = ExpireSubscriptions(&service, base + i + 1);
+		ret |= CHECK(service.TotalSubscriptions == 100 - i);
+		ret |= CHECK(next == (i < 100 ? base + i + 1 : 0));
+		ret |= CHECK(next == 0 || next > prev);
+		ret |= consistent(&service, __LINE__);
+		prev = next;
+	}
+	clear(&service);
+	return ret;
+}
+
+/* Removing or rescheduling an entry in the middle keeps the heap ordered. */
+static int
+test_heap_middle(void) {
+	service_info service;
+	subscription *sub;
+	int i, ret = 0;
+
+	memset(&service, 0, sizeof(service));
+	for (i = 0; i < 31; i++)
+		AddSubscription(&service, new_sub(i, base + 10 * (i + 1)));
+	ret |= consistent(&service, __LINE__);
+
+	sub = service.expiryHeap[service.expiryHeapCount / 2];
+	RemoveSubscriptionSID(sub->sid, &service);
+	ret |= CHECK(service.TotalSubscriptions == 30);
+	ret |= CHECK(service.expiryHeapCount == 30);
+	ret |= consistent(&service, __LINE__);
+
+	sub = service.expiryHeap[service.expiryHeapCount / 2];
+	ret |= CHECK(SetSubscriptionExpireTime(&service, sub, base + 1) ==
+	             UPNP_E_SUCCESS);
+	ret |= CHECK(service.expiryHeap[0] == sub);
+	ret |= consistent(&service, __LINE__);
+	ret |= CHECK(SetSubscriptionExpireTime(&service, sub, base + 1000) ==
+	             UPNP_E_SUCCESS);
+	ret |= consistent(&service, __LINE__);
+	ret |= CHECK(SetSubscriptionExpireTime(&service, sub, 0) ==
+	             UPNP_E_SUCCESS);
+	ret |= CHECK(sub->expiryIndex == 0);
+	ret |= CHECK(service.expiryHeapCount == 29);
+	ret |= consistent(&service, __LINE__);
+
+	/* the subscription that does not expire survives the sweep */
+	ret |= CHECK(ExpireSubscriptions(&service, base + 10000) == 0);
+	ret |= CHECK(service.TotalSubscriptions == 1);
+	ret |= CHECK(service.subscriptionList == sub);
+	ret |= consistent(&service, __LINE__);
+	clear(&service);
+	return ret;
+}
+
+/* SIDs sharing a bucket are found and removed independently. */
+static int
+test_hash_collision(void) {
+	service_info service;
+	subscription *first;
+	subscription *second;
+	Upnp_SID sid;
+	size_t i;
+	int ret = 0;
+
+	memset(&service, 0, sizeof(service));
+	for (i = 0; i < 64; i++)
+		AddSubscription(&service, new_sub((int) i, 0));
+	ret |= consistent(&service, __LINE__);
+	for (i = 0; i < service.subscriptionHashSize; i++)
+		if (service.subscriptionHash[i] &&
+		    service.subscriptionHash[i]->hashNext)
+			break;
+	if (i == service.subscriptionHashSize) {
+		printf("%s:%d:  no colliding SIDs\n", __FILE__, __LINE__);
+		clear(&service);
+		return 1;
+	}
+	first = service.subscriptionHash[i];
+	second = first->hashNext;
+	ret |= CHECK(GetSubscriptionSID(first->sid, &service) == first);
+	ret |= CHECK(GetSubscriptionSID(second->sid, &service) == second);
+
+	/* the head of the chain */
+	strcpy(sid, first->sid);
+	RemoveSubscriptionSID(sid, &service);
+	ret |= CHECK(GetSubscriptionSID(sid, &service) == NULL);
+	ret |= CHECK(GetSubscriptionSID(second->sid, &service) == second);
+	ret |= consistent(&service, __LINE__);
+
+	/* back at the head, then the one behind it */
+	first = new_sub(0, 0);
+	strcpy(first->sid, sid);
+	AddSubscription(&service, first);
+	ret |= CHECK(service.subscriptionHash[i] == first);
+	strcpy(sid, second->sid);
+	RemoveSubscriptionSID(sid, &service);
+	ret |= CHECK(GetSubscriptionSID(sid, &service) == NULL);
+	ret |= CHECK(GetSubscriptionSID(first->sid, &service) == first);
+	ret |= consistent(&service, __LINE__);
+
+	/* unknown SIDs */
+	RemoveSubscriptionSID(sid, &service);
+	ret |= CHECK(service.TotalSubscriptions == 63);
+	ret |= CHECK(GetSubscriptionSID(sid_of(-1), &service) == NULL);
+	clear(&service);
+	return ret;
+}
+
+/* The sweep unlinks the expired subscriptions from the list and the hash
+ * table, whatever their place, and leaves the others reachable. */
+static int
+test_sweep_remove(void) {
+	service_info service;
+	int i, ret = 0;
+
+	memset(&service, 0, sizeof(service));
+	for (i = 0; i < 40; i++)
+		AddSubscription(&service,
+		                new_sub(i, i % 4 == 3 ? 0 : base + 1 + i % 3));
+	ret |= consistent(&service, __LINE__);
+
+	/* removed between two sweeps */
+	RemoveSubscriptionSID((char *) sid_of(0), &service);
+	RemoveSubscriptionSID((char *) sid_of(3), &service);
+	ret |= consistent(&service, __LINE__);
+
+	ret |= CHECK(ExpireSubscriptions(&service, base + 2) == base + 2);
+	ret |= consistent(&service, __LINE__);
+	for (i = 0; i < 40; i++) {
+		subscription *found = GetSubscriptionSID(sid_of(i), &service);
+
+		if (i == 0 || i == 3 || (i % 4 != 3 && i % 3 == 0))
+			ret |= CHECK(found == NULL);
+		else
+			ret |= CHECK(found != NULL);
+	}
+	/* the one expiring next is removed before the sweep reaches it */
+	RemoveSubscriptionSID((char *) sid_of(1), &service);
+	ret |= consistent(&service, __LINE__);
+	ret |= CHECK(ExpireSubscriptions(&service, base + 10) == 0);
+	ret |= CHECK(service.TotalSubscriptions == 9);
+	ret |= CHECK(service.expiryHeapCount == 0);
+	ret |= consistent(&service, __LINE__);
+	for (i = 0; i < 40; i++)
+		ret |= CHECK((GetSubscriptionSID(sid_of(i), &service) != NULL) ==
+		             (i % 4 == 3 && i != 3));
+	clear(&service);
+	return ret;
+}
+
+int
+main(int argc, char *argv[]) {
+	int ret = 0;
+
+	base = time(NULL) + 3600;
+	ret += test_heap_order();
+	ret += test_heap_middle();
+	ret += test_hash_collision();
+	ret += test_sweep_remove();
+
+	exit(ret ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+// gcc -o service-table-test -g test_service_table.c -I include -I upnp/src/include -I ixml/inc -I threadutil/inc -L prebuild/Linux -lupnp -lixml -lthreadutil -lpthread
@@ -0,0 +1,121 @@
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include "upnp.h"
+#include "ssdplib.h"
+
+struct test {
+	const char *msg;
+	int dispatched;
+	int line;
+};
+#define TEST(msg, dispatched) {msg, dispatched, __LINE__}
+
+static SOCKET sock = INVALID_SOCKET;
+static struct sockaddr_in addr;
+
+/* Sends the datagram to the socket and reads it as the miniserver would. */
+static int
+result(const struct test *test) {
+	SsdpRecvStats before;
+	SsdpRecvStats after;
+	int ret = 0;
+
+	SsdpGetRecvStats(&before);
+	if (sendto(sock, test->msg, strlen(test->msg), 0,
+	           (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		perror("sendto");
+		return 1;
+	}
+	readFromSSDPSocket(sock);
+	SsdpGetRecvStats(&after);
+	if (after.dispatched - before.dispatched != (unsigned long) test->dispatched ||
+	    after.filtered - before.filtered != (unsigned long) !test->dispatched) {
+		printf("%s:%d:  dispatched %lu, filtered %lu\n",
+		       __FILE__,
+		       test->line,
+		       after.dispatched - before.dispatched,
+		       after.filtered - before.filtered);
+		ret = 1;
+	}
+	return ret;
+}
+
+#define NOTIFY_HEADERS \
+	"NOTIFY * HTTP/1.1\r\n" \
+	"HOST: 239.255.255.250:1900\r\n" \
+	"CACHE-CONTROL: max-age=1800\r\n" \
+	"LOCATION: http://127.0.0.1:49152/description.xml\r\n" \
+	"NT: upnp:rootdevice\r\n" \
+	"NTS: ssdp:alive\r\n" \
+	"SERVER: Linux/1.0 UPnP/1.0 test/1.0\r\n" \
+	"USN: uuid:test::upnp:rootdevice\r\n"
+
+static char LARGE[2400];
+
+static const struct test DATAGRAMS[] = {
+	TEST(NOTIFY_HEADERS "\r\n", 1),
+	/* decoding the chunked body shrinks the buffer of the slot */
+	TEST(NOTIFY_HEADERS "Transfer-Encoding: chunked\r\n\r\n"
+	     "5\r\nhello\r\n0\r\n\r\n", 1),
+	TEST(NOTIFY_HEADERS "Transfer-Encoding: chunked\r\n\r\n"
+	     "zz\r\nhello\r\n", 0),
+	/* which is large enough for the next datagrams */
+	TEST(LARGE, 1),
+	TEST(NOTIFY_HEADERS "\r\n", 1),
+	/* no search in progress, no device */
+	TEST("HTTP/1.1 200 OK\r\nST: upnp:rootdevice\r\n\r\n", 0),
+	TEST("M-SEARCH * HTTP/1.1\r\nMAN: \"ssdp:discover\"\r\n"
+	     "ST: ssdp:all\r\nMX: 1\r\n\r\n", 0),
+	TEST("garbage", 0),
+};
+#define ARRAY_SIZE(a) (sizeof (a) / sizeof *(a))
+
+static int
+callback(Upnp_EventType EventType, void *Event, void *Cookie) {
+	return 0;
+}
+
+int
+main(int argc, char *argv[]) {
+	UpnpClient_Handle handle;
+	socklen_t len = sizeof(addr);
+	size_t length;
+	int i, ret = 0;
+
+	if (UpnpInit("127.0.0.1", 0) != UPNP_E_SUCCESS ||
+	    UpnpRegisterClient(callback, NULL, &handle) != UPNP_E_SUCCESS) {
+		printf("%s:%d:  cannot start a control point\n", __FILE__, __LINE__);
+		exit(EXIT_FAILURE);
+	}
+	sock = socket(AF_INET, SOCK_DGRAM, 0);
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (sock == INVALID_SOCKET ||
+	    bind(sock, (struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+	    getsockname(sock, (struct sockaddr *) &addr, &len) != 0) {
+		perror("socket");
+		exit(EXIT_FAILURE);
+	}
+	/* a NOTIFY whose padding header fills most of a datagram */
+	strcpy(LARGE, NOTIFY_HEADERS "X-PADDING: ");
+	length = strlen(LARGE);
+	memset(LARGE + length, 'x', sizeof(LARGE) - length - 5);
+	strcpy(LARGE + sizeof(LARGE) - 5, "\r\n\r\n");
+
+	for (i = 0; i < ARRAY_SIZE(DATAGRAMS); i++)
+		ret += result(&DATAGRAMS[i]);
+
+	close(sock);
+	UpnpUnRegisterClient(handle);
+	UpnpFinish();
+	exit(ret ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+// gcc -o ssdp-recv-test -g test_ssdp_recv.c -I include -I upnp/src/include -L prebuild/Linux -lupnp -lixml -lthreadutil -lpthread